@@ -0,0 +1,89 @@
+#!/usr/bin/env ruby
+
+# Compare two ways of getting an event to everyone in a room: publishing it to
+# each player's exchange, and publishing it once to the 'areas' topic exchange
+# that every player's queue is bound to (MUES::AreaExchange).
+#
+#   ruby -Ilib experiments/area-fanout-bench.rb [players] [events]
+#
+# Needs a broker with the /players vhost and the engine's user set up (see
+# docs/amqp_interface.textile). Nothing consumes the players' queues; only the
+# engine's side of the fan-out is measured: the number of publishes and the
+# time they take.
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'benchmark'
+require 'bunny'
+
+require 'mues'
+require 'mues/wireformat'
+require 'mues/areaexchange'
+
+PLAYERS = Integer( ARGV[0] || 200 )
+EVENTS  = Integer( ARGV[1] || 500 )
+AREA    = 'bench'
+
+Player = Struct.new( :name, :exchange, :queue )
+
+
+bus = Bunny.new(
+	:vhost => MUES::Constants::DEFAULT_PLAYERS_VHOST,
+	:user  => MUES::Constants::DEFAULT_MQ_USER,
+	:pass  => MUES::Constants::DEFAULT_MQ_PASS
+  )
+bus.start
+
+# Set up a room full of players the way clients do: an exchange and a queue
+# bound to it for each one
+players = (0 ... PLAYERS).collect do |i|
+	name = "bench:player#{i}"
+	exchange = bus.exchange( name, :type => :topic, :auto_delete => true )
+	queue = bus.queue( name, :auto_delete => true )
+	queue.bind( exchange, :key => '#' )
+	Player.new( name, exchange, queue )
+end
+
+areas = MUES::AreaExchange.new( bus )
+areas.start
+players.each {|player| areas.move(player, AREA) }
+
+body = "Bob says: Is anybody else hearing that strange humming noise?"
+frame = MUES::WireFormat.encode( :output, 1, body )
+
+puts "%d events to a room of %d players" % [ EVENTS, PLAYERS ]
+Benchmark.bm( 18 ) do |bench|
+	bench.report( "per-player:" ) do
+		EVENTS.times do
+			players.each {|player| player.exchange.publish(frame, :key => 'output') }
+		end
+	end
+	puts "%20s %d publishes" % [ '', EVENTS * PLAYERS ]
+
+	bench.report( "area topic:" ) do
+		EVENTS.times do
+			areas.exchange.publish( frame, :key => MUES::AreaExchange.routing_key(AREA) )
+		end
+	end
+	puts "%20s %d publishes" % [ '', EVENTS ]
+
+	bench.report( "area, coalesced:" ) do
+		EVENTS.times {|i| areas.broadcast(AREA, :output, body) }
+		areas.flush
+	end
+	puts "%20s (one publish per %d bytes of output)" % [ '', MUES::Constants::DEFAULT_OUTPUT_BUFFER_SIZE ]
+end
+
+players.each do |player|
+	areas.leave( player )
+	player.queue.delete
+	player.exchange.delete
+end
+bus.stop
+
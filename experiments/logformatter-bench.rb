@@ -0,0 +1,95 @@
+#!/usr/bin/env ruby
+
+# Compare the cost of a debug-level log call through MUES::Loggable and
+# MUES::LogFormatter with the implementation they replaced, which built an
+# Array and called strftime and String#% for every line, and dispatched through
+# method_missing. The current formatter's #call is the one from the C
+# extension if it's been built in ext/; set MUES_PURE_RUBY to measure the Ruby
+# one instead.
+#
+#   ruby experiments/logformatter-bench.rb [lines]
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+	extdir = basedir + 'ext'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+	$LOAD_PATH.unshift( extdir.to_s ) unless ENV['MUES_PURE_RUBY']
+}
+
+require 'benchmark'
+require 'logger'
+require 'mues'
+
+LINES = Integer( ARGV[0] || 200_000 )
+
+
+# The formatter as it was
+class LegacyLogFormatter < MUES::LogFormatter
+	def call( severity, time, progname, msg )
+		args = [
+			time.strftime( '%Y-%m-%d %H:%M:%S' ),
+			time.usec,
+			Process.pid,
+			Thread.current == Thread.main ? 'main' : Thread.object_id,
+			severity,
+			progname,
+			msg
+		]
+
+		if @logger.level == Logger::DEBUG
+			return self.debug_format % args
+		else
+			return self.format % args
+		end
+	end
+end
+
+# The logging proxy as it was
+class LegacyClassNameProxy
+	def initialize( klass ); @classname = klass.name; end
+	def method_missing( sym, msg=nil, &block )
+		return super unless MUES::Loggable::LEVEL.key?( sym )
+		MUES.logger.add( MUES::Loggable::LEVEL[sym], msg, @classname, &block )
+	end
+end
+
+class Emitter
+	include MUES::Loggable
+	def legacy_log; @legacy_log ||= LegacyClassNameProxy.new( self.class ); end
+	public :log
+end
+
+
+devnull = File.open( File::NULL, 'w' )
+logger = Logger.new( devnull )
+logger.level = Logger::DEBUG
+MUES.logger = logger
+emitter = Emitter.new
+
+native = MUES::LogFormatter.instance_method( :call ).source_location.nil?
+puts "%d debug-level lines, %s #call" % [ LINES, native ? 'native' : 'Ruby' ]
+Benchmark.bm( 22 ) do |bench|
+	logger.formatter = LegacyLogFormatter.new( logger )
+	bench.report( "legacy formatter:" ) do
+		LINES.times {|i| emitter.legacy_log.debug("Handled command %d" % [i]) }
+	end
+
+	logger.formatter = MUES::LogFormatter.new( logger )
+	bench.report( "cached formatter:" ) do
+		LINES.times {|i| emitter.log.debug("Handled command %d" % [i]) }
+	end
+
+	formatter = LegacyLogFormatter.new( logger )
+	now = Time.now
+	bench.report( "legacy #call only:" ) do
+		LINES.times { formatter.call('DEBUG', now, 'Emitter', 'Handled command') }
+	end
+
+	formatter = MUES::LogFormatter.new( logger )
+	bench.report( "cached #call only:" ) do
+		LINES.times { formatter.call('DEBUG', now, 'Emitter', 'Handled command') }
+	end
+end
@@ -0,0 +1,71 @@
+#!/usr/bin/env ruby
+
+# Measure what recording into MUES::Metrics costs per call, from one thread and
+# from several at once, next to a MUES::Histogram with its lock and a bare
+# Integer increment for scale.
+#
+#   ruby -Ilib experiments/metrics-bench.rb [calls] [threads]
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'benchmark'
+require 'mues'
+require 'mues/metrics'
+
+CALLS   = Integer( ARGV[0] || 1_000_000 )
+THREADS = Integer( ARGV[1] || 4 )
+
+counter   = MUES::Metrics.counter( :bench_counter )
+histogram = MUES::Metrics.histogram( :bench_histogram )
+locked    = MUES::Histogram.new
+
+
+### Run the block CALLS times, split across +threads+ threads.
+def spread( threads, &block )
+	per_thread = CALLS / threads
+	( 1..threads ).collect {
+		Thread.new { per_thread.times(&block) }
+	}.each {|thr| thr.join }
+end
+
+
+puts "%d calls" % [ CALLS ]
+results = {}
+Benchmark.bm( 30 ) do |bench|
+	results[ :integer ] = bench.report( "Integer +=:" ) do
+		count = 0
+		CALLS.times { count += 1 }
+	end
+
+	results[ :counter ] = bench.report( "Metrics counter:" ) do
+		CALLS.times { counter.increment }
+	end
+
+	results[ :locked ] = bench.report( "Histogram with its lock:" ) do
+		CALLS.times {|i| locked.record(i & 0xffff) }
+	end
+
+	results[ :histogram ] = bench.report( "Metrics histogram:" ) do
+		CALLS.times {|i| histogram.record(i & 0xffff) }
+	end
+
+	results[ :threaded_counter ] = bench.report( "Metrics counter, %d threads:" % [THREADS] ) do
+		spread( THREADS ) { counter.increment }
+	end
+
+	results[ :threaded_histogram ] = bench.report( "Metrics histogram, %d threads:" % [THREADS] ) do
+		spread( THREADS ) {|i| histogram.record(i & 0xffff) }
+	end
+end
+
+puts
+results.each do |name, tms|
+	puts "%-20s %0.3fus per call" % [ name, tms.real * 1_000_000 / CALLS ]
+end
+puts "counter total: %d" % [ counter.value ]
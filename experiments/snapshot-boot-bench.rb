@@ -0,0 +1,52 @@
+#!/usr/bin/env ruby
+
+# Measure how long it takes to open a MUES::ObjectLog whose records are all in
+# a snapshot, and to read the first few records back, for worlds of different
+# sizes. With the snapshot's key table, neither should grow much with the
+# number of records.
+#
+#   ruby -Ilib experiments/snapshot-boot-bench.rb [records...]
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'benchmark'
+require 'tmpdir'
+require 'fileutils'
+require 'mues/objectlog'
+
+SIZES   = ARGV.empty? ? [ 10_000, 100_000, 500_000 ] : ARGV.collect {|arg| Integer(arg) }
+BATCH   = 1_000
+READS   = 100
+PAYLOAD = 'x' * 200
+
+srand( 1 )
+puts "%10s %12s %12s %12s" % [ 'records', 'open (ms)', 'read (us)', 'snapshot (s)' ]
+
+SIZES.each do |size|
+	dir = File.join( Dir.tmpdir, "mues-snapshot-bench-#{Process.pid}-#{size}" )
+	begin
+		log = MUES::ObjectLog.new( dir )
+		(0 ... size).step( BATCH ) do |start|
+			log.append_batch( (start ... [start + BATCH, size].min).collect {|i| [Marshal.dump(i), PAYLOAD] } )
+		end
+		snapshot_time = Benchmark.realtime { log.write_snapshot(log.roll) }
+		log.close
+
+		log = nil
+		open_time = Benchmark.realtime { log = MUES::ObjectLog.new(dir) }
+		keys = Array.new( READS ) { Marshal.dump(rand(size)) }
+		read_time = Benchmark.realtime { keys.each {|key| log.read(key) or raise "missing record" } }
+		log.close
+
+		puts "%10d %12.2f %12.1f %12.2f" %
+			[ size, open_time * 1000, read_time * 1_000_000 / READS, snapshot_time ]
+	ensure
+		FileUtils.rm_rf( dir )
+	end
+end
@@ -0,0 +1,71 @@
+#!/usr/bin/env ruby
+
+# Benchmark proximity queries against MUES::SpatialIndex and against a linear
+# scan of every object's position (which is what interest management would have
+# to do without an index), and the cost of moving objects around in the index.
+#
+#   ruby -Ilib experiments/spatialindex-bench.rb [objects] [queries]
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'benchmark'
+require 'mues/spatialindex'
+
+OBJECTS   = Integer( ARGV[0] || 100_000 )
+QUERIES   = Integer( ARGV[1] || 1_000 )
+WORLD     = 2_000.0  # The world is a WORLD x WORLD x WORLD/10 slab
+RADIUS    = 16.0     # How far a query reaches
+CELL_SIZE = 16.0
+
+srand( 1 )
+def random_point
+	return [ rand * WORLD, rand * WORLD, rand * WORLD / 10 ]
+end
+
+positions = {}
+OBJECTS.times {|i| positions[ i ] = random_point() }
+queries = Array.new( QUERIES ) { random_point() }
+index = MUES::SpatialIndex.new( CELL_SIZE )
+
+puts "%d objects, %d queries of radius %0.1f" % [ OBJECTS, QUERIES, RADIUS ]
+Benchmark.bm( 14 ) do |bench|
+	bench.report( "insert:" ) do
+		positions.each {|obj, (x, y, z)| index.insert(obj, x, y, z) }
+	end
+
+	found = 0
+	bench.report( "index query:" ) do
+		queries.each {|x, y, z| found += index.within(x, y, z, RADIUS).length }
+	end
+
+	scanned = 0
+	limit = RADIUS * RADIUS
+	scan_queries = queries[ 0, QUERIES / 10 ]
+	bench.report( "scan query:" ) do
+		scan_queries.each do |x, y, z|
+			positions.each do |obj, (ox, oy, oz)|
+				dx, dy, dz = ox - x, oy - y, oz - z
+				scanned += 1 if dx * dx + dy * dy + dz * dz <= limit
+			end
+		end
+	end
+	puts "%16s (%d scan queries only; multiply by %d to compare)" %
+		[ '', scan_queries.length, QUERIES / scan_queries.length ]
+
+	bench.report( "small moves:" ) do
+		positions.each {|obj, (x, y, z)| index.move(obj, x + 1.0, y - 1.0, z) }
+	end
+
+	bench.report( "teleports:" ) do
+		positions.each_key {|obj| index.move(obj, *random_point()) }
+	end
+
+	puts "%16s %0.1f objects found per query" % [ '', found.to_f / QUERIES ]
+end
+
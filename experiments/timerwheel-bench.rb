@@ -0,0 +1,111 @@
+#!/usr/bin/env ruby
+
+# Benchmark MUES::TimerWheel against the other ways we've scheduled delayed
+# events: a Thread per timer that sleeps until it's due (what the attic
+# experiments do), and a binary heap of expiry times that's popped every tick.
+#
+#   ruby -Ilib experiments/timerwheel-bench.rb [timers] [threads]
+#
+# The Thread-per-timer case is run with far fewer timers, since a few thousand
+# Threads is already about as many as the VM will comfortably hold.
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'benchmark'
+require 'mues/timerwheel'
+
+TIMERS  = Integer( ARGV[0] || 1_000_000 )
+THREADS = Integer( ARGV[1] || 2_000 )
+SPAN    = 3_000    # Timers expire within this many ticks
+TICK    = 0.001    # Length of a tick (for the Thread case), in seconds
+
+
+### A minimal binary min-heap of [ expiry, callback ] pairs.
+class TimerHeap
+	def initialize; @heap = []; end
+	def size; @heap.size; end
+
+	def push( expires, callback )
+		@heap << [ expires, callback ]
+		i = @heap.size - 1
+		while i > 0 && @heap[ (i - 1) / 2 ][0] > @heap[ i ][0]
+			parent = (i - 1) / 2
+			@heap[ parent ], @heap[ i ] = @heap[ i ], @heap[ parent ]
+			i = parent
+		end
+	end
+
+	def peek; @heap.first; end
+
+	def pop
+		top = @heap.first
+		last = @heap.pop
+		unless @heap.empty?
+			@heap[0] = last
+			i = 0
+			loop do
+				l, r, min = 2 * i + 1, 2 * i + 2, i
+				min = l if l < @heap.size && @heap[ l ][0] < @heap[ min ][0]
+				min = r if r < @heap.size && @heap[ r ][0] < @heap[ min ][0]
+				break if min == i
+				@heap[ min ], @heap[ i ] = @heap[ i ], @heap[ min ]
+				i = min
+			end
+		end
+		return top
+	end
+end
+
+
+srand( 2424 )
+delays = Array.new( TIMERS ) { 1 + rand(SPAN) }
+fired = 0
+callback = lambda {|*| fired += 1 }
+
+puts "Scheduling and expiring %d timers over %d ticks" % [ TIMERS, SPAN ]
+Benchmark.bm( 24 ) do |bench|
+
+	wheel = MUES::TimerWheel.new
+	bench.report( "timer wheel: schedule" ) do
+		delays.each {|delay| wheel.schedule(delay, &callback) }
+	end
+	bench.report( "timer wheel: cancel 10%" ) do
+		timers = Array.new( TIMERS / 10 ) { wheel.schedule(1 + rand(SPAN), &callback) }
+		timers.each {|timer| timer.cancel }
+	end
+	bench.report( "timer wheel: expire" ) do
+		SPAN.times { wheel.advance }
+	end
+	raise "wheel fired %d of %d timers" % [ fired, TIMERS ] unless fired == TIMERS
+
+	fired = 0
+	heap = TimerHeap.new
+	bench.report( "binary heap: schedule" ) do
+		delays.each {|delay| heap.push(delay, callback) }
+	end
+	bench.report( "binary heap: expire" ) do
+		1.upto( SPAN ) do |tick|
+			heap.pop[1].call while heap.size.nonzero? && heap.peek[0] <= tick
+		end
+	end
+	raise "heap fired %d of %d timers" % [ fired, TIMERS ] unless fired == TIMERS
+
+	fired = 0
+	mutex = Mutex.new
+	threads = nil
+	bench.report( "#{THREADS} threads: schedule" ) do
+		threads = delays.first( THREADS ).collect do |delay|
+			Thread.new { sleep(delay * TICK); mutex.synchronize { fired += 1 } }
+		end
+	end
+	bench.report( "#{THREADS} threads: expire" ) do
+		threads.each {|thr| thr.join }
+	end
+	raise "threads fired %d of %d timers" % [ fired, THREADS ] unless fired == THREADS
+end
@@ -0,0 +1,53 @@
+#!/usr/bin/env ruby
+
+# Compare packing and unpacking a structured frame body with the pure-Ruby
+# codec in MUES::WireFormat and with MUES::WireFormat::Native from the C
+# extension. Build the extension first:
+#
+#   (cd ext && ruby extconf.rb && make)
+#   ruby -Ilib -Iext experiments/wireformat-bench.rb [calls]
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname( __FILE__ ).dirname.parent
+	libdir = basedir + 'lib'
+	extdir = basedir + 'ext'
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+	$LOAD_PATH.unshift( extdir.to_s ) unless $LOAD_PATH.include?( extdir.to_s )
+}
+
+require 'benchmark'
+require 'mues'
+require 'mues/wireformat'
+
+abort "The extension isn't built; see the top of #{__FILE__}" unless
+	defined?( MUES::WireFormat::Native )
+
+CALLS = Integer( ARGV[0] || 100_000 )
+
+body = {
+	:actor   => 'ged',
+	:damage  => -12,
+	:crit    => true,
+	:misses  => nil,
+	:ratio   => 0.25,
+	:targets => [ 1, 300, 2 ** 40, 'orc' ],
+}
+packed = MUES::WireFormat.pack_value( body )
+
+puts "%d calls, %d-byte body" % [ CALLS, packed.length ]
+Benchmark.bm( 16 ) do |bench|
+	bench.report( "Ruby pack:" ) do
+		CALLS.times { MUES::WireFormat.pack_value_at(body, MUES::WireFormat.binary(''), 0) }
+	end
+	bench.report( "Native pack:" ) do
+		CALLS.times { MUES::WireFormat::Native.pack_value(body, MUES::WireFormat.binary('')) }
+	end
+	bench.report( "Ruby unpack:" ) do
+		CALLS.times { MUES::WireFormat.unpack_value_at(packed, 0) }
+	end
+	bench.report( "Native unpack:" ) do
+		CALLS.times { MUES::WireFormat::Native.unpack_value(packed) }
+	end
+end
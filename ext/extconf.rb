@@ -0,0 +1,13 @@
+#!/usr/bin/env ruby
+
+# Build the native parts of MUES. Everything in the extension has a pure-Ruby
+# fallback, so MUES still runs (more slowly) if it can't be built.
+
+require 'mkmf'
+
+dir_config( 'mues_ext' )
+
+have_header( 'ruby/encoding.h' )
+have_header( 'stdint.h' ) or abort "The MUES extension needs stdint.h"
+
+create_makefile( 'mues_ext' )
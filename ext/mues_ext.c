@@ -0,0 +1,703 @@
+/*
+ * mues_ext.c - Native parts of the Multi-User Environment Server
+ *
+ * MUES::WireFormat::Native packs and unpacks the tagged values carried in
+ * wire-format frame bodies (see lib/mues/wireformat.rb). It's a
+ * byte-for-byte drop-in for the pure-Ruby codec, which MUES::WireFormat falls
+ * back to when the extension hasn't been built, and raises the same errors.
+ *
+ * MUES::LogFormatter#call is replaced with one that puts lines in the default
+ * formats together without going back into Ruby (see lib/mues/utils.rb), and
+ * produces the same lines as the Ruby version.
+ *
+ * Please see the file LICENSE for licensing details.
+ */
+
+#include "ruby.h"
+#ifdef HAVE_RUBY_ENCODING_H
+#  include "ruby/encoding.h"
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef RFLOAT_VALUE
+#  define RFLOAT_VALUE(v) (RFLOAT(v)->value)
+#endif
+#ifndef RSTRING_PTR
+#  define RSTRING_PTR(str) (RSTRING(str)->ptr)
+#  define RSTRING_LEN(str) (RSTRING(str)->len)
+#endif
+#ifndef RARRAY_LEN
+#  define RARRAY_LEN(ary) (RARRAY(ary)->len)
+#endif
+
+
+/* The value tags; these must match the TAG_* constants in MUES::WireFormat */
+#define MUES_TAG_NIL    0
+#define MUES_TAG_TRUE   1
+#define MUES_TAG_FALSE  2
+#define MUES_TAG_INT    3
+#define MUES_TAG_FLOAT  4
+#define MUES_TAG_STRING 5
+#define MUES_TAG_SYMBOL 6
+#define MUES_TAG_ARRAY  7
+#define MUES_TAG_HASH   8
+
+
+static VALUE mues_mWireFormat;
+static VALUE mues_eFormatError = Qnil;
+static int mues_max_depth;
+
+static VALUE mues_default_format, mues_default_debug_format, mues_timestamp_format,
+	mues_severity_labels, mues_main_name;
+static long mues_pid;
+
+static ID id_or, id_lshift, id_rshift, id_and, id_plus, id_minus, id_uminus, id_lt,
+	id_to_s, id_pack_varint, id_level, id_iv_format, id_iv_debug_format, id_strftime,
+	id_object_id, id_usec, id_cached_parts, id_percent, id_iv_logger, id_iv_timestamp, id_iv_tag_key;
+
+
+/* The state of a value being unpacked */
+typedef struct {
+	const unsigned char *data;
+	long length;
+	long offset;
+} mues_reader;
+
+/* The state of a Hash being packed */
+typedef struct {
+	VALUE buffer;
+	int depth;
+} mues_hash_packer;
+
+
+static void mues_pack( VALUE value, VALUE buffer, int depth );
+static VALUE mues_unpack( mues_reader *reader, int depth );
+
+
+
+/*
+ * Look up the MUES::WireFormat constants the codec needs, the first time
+ * they're needed. The extension can be loaded before lib/mues/wireformat.rb
+ * has defined them.
+ */
+static void
+mues_wireformat_constants( void )
+{
+	if ( !NIL_P(mues_eFormatError) ) return;
+
+	mues_max_depth = NUM2INT( rb_const_get(mues_mWireFormat, rb_intern("MAX_DEPTH")) );
+	mues_eFormatError = rb_const_get( mues_mWireFormat, rb_intern("FormatError") );
+}
+
+
+
+/* --------------------------------------------------------------
+ * Packing
+ * -------------------------------------------------------------- */
+
+/*
+ * Append the given non-negative +value+ to +buffer+ as a base-128 varint.
+ */
+static void
+mues_write_varint( VALUE buffer, uint64_t value )
+{
+	char bytes[ 10 ];
+	int count = 0;
+
+	while ( value > 0x7f ) {
+		bytes[ count++ ] = (char)( (value & 0x7f) | 0x80 );
+		value >>= 7;
+	}
+	bytes[ count++ ] = (char)value;
+
+	rb_str_buf_cat( buffer, bytes, count );
+}
+
+
+/*
+ * Append the given +tag+ byte to +buffer+.
+ */
+static void
+mues_write_tag( VALUE buffer, int tag )
+{
+	char byte = (char)tag;
+	rb_str_buf_cat( buffer, &byte, 1 );
+}
+
+
+/*
+ * Append the bytes of +str+ to +buffer+, preceded by their length.
+ */
+static void
+mues_write_bytes( VALUE buffer, VALUE str )
+{
+	mues_write_varint( buffer, (uint64_t)RSTRING_LEN(str) );
+	rb_str_buf_cat( buffer, RSTRING_PTR(str), RSTRING_LEN(str) );
+}
+
+
+/*
+ * Raise an ArgumentError if an Array or Hash at +depth+ would be nested
+ * deeper than MUES::WireFormat::MAX_DEPTH.
+ */
+static void
+mues_check_pack_depth( int depth )
+{
+	if ( depth >= mues_max_depth )
+		rb_raise( rb_eArgError, "values nested more than %d deep", mues_max_depth );
+}
+
+
+/*
+ * rb_hash_foreach() callback: append one key/value pair.
+ */
+static int
+mues_pack_pair( VALUE key, VALUE val, VALUE arg )
+{
+	mues_hash_packer *packer = (mues_hash_packer *)arg;
+
+	mues_pack( key, packer->buffer, packer->depth + 1 );
+	mues_pack( val, packer->buffer, packer->depth + 1 );
+
+	return ST_CONTINUE;
+}
+
+
+/*
+ * Append +value+, which is nested +depth+ Arrays or Hashes deep, to +buffer+.
+ */
+static void
+mues_pack( VALUE value, VALUE buffer, int depth )
+{
+	switch ( TYPE(value) ) {
+	  case T_NIL:
+		mues_write_tag( buffer, MUES_TAG_NIL );
+		break;
+
+	  case T_TRUE:
+		mues_write_tag( buffer, MUES_TAG_TRUE );
+		break;
+
+	  case T_FALSE:
+		mues_write_tag( buffer, MUES_TAG_FALSE );
+		break;
+
+	  case T_FIXNUM: {
+		long num = FIX2LONG( value );
+		uint64_t zigzag = num < 0 ?
+			( (uint64_t)(-(num + 1)) << 1 ) | 1 :
+			(uint64_t)num << 1;
+
+		mues_write_tag( buffer, MUES_TAG_INT );
+		mues_write_varint( buffer, zigzag );
+		break;
+	  }
+
+	  case T_BIGNUM: {
+		VALUE zigzag;
+
+		if ( RTEST(rb_funcall(value, id_lt, 1, INT2FIX(0))) )
+			zigzag = rb_funcall( rb_funcall(rb_funcall(value, id_uminus, 0), id_lshift, 1, INT2FIX(1)),
+			                     id_minus, 1, INT2FIX(1) );
+		else
+			zigzag = rb_funcall( value, id_lshift, 1, INT2FIX(1) );
+
+		mues_write_tag( buffer, MUES_TAG_INT );
+		rb_str_buf_append( buffer, rb_funcall(mues_mWireFormat, id_pack_varint, 1, zigzag) );
+		break;
+	  }
+
+	  case T_FLOAT: {
+		double num = RFLOAT_VALUE( value );
+		uint64_t bits;
+		char bytes[ 8 ];
+		int i;
+
+		memcpy( &bits, &num, sizeof(bits) );
+		for ( i = 7; i >= 0; i-- ) {
+			bytes[ i ] = (char)( bits & 0xff );
+			bits >>= 8;
+		}
+
+		mues_write_tag( buffer, MUES_TAG_FLOAT );
+		rb_str_buf_cat( buffer, bytes, 8 );
+		break;
+	  }
+
+	  case T_SYMBOL:
+		mues_write_tag( buffer, MUES_TAG_SYMBOL );
+		mues_write_bytes( buffer, rb_funcall(value, id_to_s, 0) );
+		break;
+
+	  case T_STRING:
+		mues_write_tag( buffer, MUES_TAG_STRING );
+		mues_write_bytes( buffer, value );
+		break;
+
+	  case T_ARRAY: {
+		long i;
+
+		mues_check_pack_depth( depth );
+		mues_write_tag( buffer, MUES_TAG_ARRAY );
+		mues_write_varint( buffer, (uint64_t)RARRAY_LEN(value) );
+		for ( i = 0; i < RARRAY_LEN(value); i++ )
+			mues_pack( rb_ary_entry(value, i), buffer, depth + 1 );
+		break;
+	  }
+
+	  case T_HASH: {
+		mues_hash_packer packer;
+
+		mues_check_pack_depth( depth );
+		packer.buffer = buffer;
+		packer.depth  = depth;
+
+		mues_write_tag( buffer, MUES_TAG_HASH );
+		mues_write_varint( buffer, NUM2ULL(rb_funcall(value, rb_intern("size"), 0)) );
+		rb_hash_foreach( value, mues_pack_pair, (VALUE)&packer );
+		break;
+	  }
+
+	  default:
+		rb_raise( rb_eArgError, "can't encode a %s", rb_obj_classname(value) );
+	}
+}
+
+
+/*
+ * call-seq:
+ *    MUES::WireFormat::Native.pack_value( value, buffer )   -> buffer
+ *
+ * Append +value+ to the binary String +buffer+ in the tagged binary format,
+ * and return the buffer.
+ */
+static VALUE
+mues_native_pack_value( VALUE module, VALUE value, VALUE buffer )
+{
+	mues_wireformat_constants();
+	StringValue( buffer );
+	rb_str_modify( buffer );
+	mues_pack( value, buffer, 0 );
+	return buffer;
+}
+
+
+
+/* --------------------------------------------------------------
+ * Unpacking
+ * -------------------------------------------------------------- */
+
+/*
+ * Read the varint at the reader's offset. Returns 1 and sets +result+ if it
+ * fits in 63 bits; otherwise returns 0 and sets +big+ to it as an Integer.
+ */
+static int
+mues_read_varint( mues_reader *reader, uint64_t *result, VALUE *big )
+{
+	uint64_t value = 0;
+	VALUE bigvalue = Qnil;
+	int shift = 0;
+	unsigned char byte;
+
+	do {
+		if ( reader->offset >= reader->length )
+			rb_raise( mues_eFormatError, "truncated varint" );
+		byte = reader->data[ reader->offset++ ];
+
+		if ( NIL_P(bigvalue) && shift <= 56 ) {
+			value |= (uint64_t)( byte & 0x7f ) << shift;
+		} else {
+			if ( NIL_P(bigvalue) ) bigvalue = ULL2NUM( value );
+			bigvalue = rb_funcall( bigvalue, id_or, 1,
+				rb_funcall(INT2FIX(byte & 0x7f), id_lshift, 1, INT2FIX(shift)) );
+		}
+		shift += 7;
+	} while ( byte & 0x80 );
+
+	if ( NIL_P(bigvalue) ) {
+		*result = value;
+		return 1;
+	}
+
+	*big = bigvalue;
+	return 0;
+}
+
+
+/*
+ * Read a varint count of values of at least +size+ bytes each, raising a
+ * FormatError if they can't fit in what's left of the data.
+ */
+static long
+mues_read_count( mues_reader *reader, int size )
+{
+	uint64_t count = 0;
+	VALUE big = Qnil;
+	long left;
+
+	if ( !mues_read_varint(reader, &count, &big) ) {
+		VALUE desc = rb_funcall( big, id_to_s, 0 );
+		rb_raise( mues_eFormatError, "count %s exceeds the %ld bytes left",
+		          StringValueCStr(desc), reader->length - reader->offset );
+	}
+
+	left = reader->length - reader->offset;
+	if ( count > (uint64_t)(left / size) )
+		rb_raise( mues_eFormatError, "count %llu exceeds the %ld bytes left",
+		          (unsigned long long)count, left );
+
+	return (long)count;
+}
+
+
+/*
+ * Raise a FormatError if an Array or Hash at +depth+ would be nested deeper
+ * than MUES::WireFormat::MAX_DEPTH.
+ */
+static void
+mues_check_unpack_depth( int depth )
+{
+	if ( depth >= mues_max_depth )
+		rb_raise( mues_eFormatError, "values nested more than %d deep", mues_max_depth );
+}
+
+
+/*
+ * Read the value at the reader's offset, which is nested +depth+ Arrays or
+ * Hashes deep.
+ */
+static VALUE
+mues_unpack( mues_reader *reader, int depth )
+{
+	int tag;
+
+	if ( reader->offset >= reader->length )
+		rb_raise( mues_eFormatError, "truncated value" );
+	tag = reader->data[ reader->offset++ ];
+
+	switch ( tag ) {
+	  case MUES_TAG_NIL:
+		return Qnil;
+
+	  case MUES_TAG_TRUE:
+		return Qtrue;
+
+	  case MUES_TAG_FALSE:
+		return Qfalse;
+
+	  case MUES_TAG_INT: {
+		uint64_t zigzag = 0;
+		VALUE big = Qnil;
+
+		if ( !mues_read_varint(reader, &zigzag, &big) ) {
+			if ( rb_funcall(big, id_and, 1, INT2FIX(1)) == INT2FIX(0) )
+				return rb_funcall( big, id_rshift, 1, INT2FIX(1) );
+			return rb_funcall( rb_funcall(rb_funcall(big, id_plus, 1, INT2FIX(1)),
+			                              id_rshift, 1, INT2FIX(1)),
+			                   id_uminus, 0 );
+		}
+
+		if ( (zigzag & 1) == 0 )
+			return ULL2NUM( zigzag >> 1 );
+		return LL2NUM( -(long long)(zigzag >> 1) - 1 );
+	  }
+
+	  case MUES_TAG_FLOAT: {
+		uint64_t bits = 0;
+		double num;
+		int i;
+
+		if ( reader->length - reader->offset < 8 )
+			rb_raise( mues_eFormatError, "truncated float" );
+		for ( i = 0; i < 8; i++ )
+			bits = ( bits << 8 ) | reader->data[ reader->offset++ ];
+		memcpy( &num, &bits, sizeof(num) );
+
+		return rb_float_new( num );
+	  }
+
+	  case MUES_TAG_STRING:
+	  case MUES_TAG_SYMBOL: {
+		uint64_t length = 0;
+		VALUE big = Qnil, str;
+
+		if ( !mues_read_varint(reader, &length, &big) ||
+		     length > (uint64_t)(reader->length - reader->offset) )
+			rb_raise( mues_eFormatError, "truncated string" );
+
+		str = rb_str_new( (const char *)reader->data + reader->offset, (long)length );
+		reader->offset += (long)length;
+#ifdef HAVE_RUBY_ENCODING_H
+		rb_enc_associate( str, rb_utf8_encoding() );
+#endif
+
+		return tag == MUES_TAG_SYMBOL ? rb_str_intern( str ) : str;
+	  }
+
+	  case MUES_TAG_ARRAY: {
+		long count, i;
+		VALUE array;
+
+		mues_check_unpack_depth( depth );
+		count = mues_read_count( reader, 1 );
+		array = rb_ary_new2( count );
+		for ( i = 0; i < count; i++ )
+			rb_ary_push( array, mues_unpack(reader, depth + 1) );
+
+		return array;
+	  }
+
+	  case MUES_TAG_HASH: {
+		long count, i;
+		VALUE hash, key;
+
+		mues_check_unpack_depth( depth );
+		count = mues_read_count( reader, 2 );
+		hash = rb_hash_new();
+		for ( i = 0; i < count; i++ ) {
+			key = mues_unpack( reader, depth + 1 );
+			rb_hash_aset( hash, key, mues_unpack(reader, depth + 1) );
+		}
+
+		return hash;
+	  }
+
+	  default:
+		rb_raise( mues_eFormatError, "unknown value tag %d", tag );
+	}
+
+	return Qnil; /* not reached */
+}
+
+
+/*
+ * call-seq:
+ *    MUES::WireFormat::Native.unpack_value( data )   -> object
+ *
+ * Decode a value in the tagged binary format from the String +data+, which
+ * must hold exactly one value.
+ */
+static VALUE
+mues_native_unpack_value( VALUE module, VALUE data )
+{
+	mues_reader reader;
+	VALUE value;
+
+	mues_wireformat_constants();
+	StringValue( data );
+	reader.data   = (const unsigned char *)RSTRING_PTR( data );
+	reader.length = RSTRING_LEN( data );
+	reader.offset = 0;
+
+	value = mues_unpack( &reader, 0 );
+	if ( reader.offset != reader.length )
+		rb_raise( mues_eFormatError, "trailing bytes after value" );
+
+	RB_GC_GUARD( data );
+	return value;
+}
+
+
+
+/* --------------------------------------------------------------
+ * Log formatting
+ * -------------------------------------------------------------- */
+
+/*
+ * Return the second-resolution timestamp of the time +seconds+ (+time+ as a
+ * Time), formatting it only if the second has changed since it was last
+ * needed.
+ */
+static VALUE
+mues_log_timestamp( VALUE formatter, VALUE time, long seconds )
+{
+	VALUE cached = rb_ivar_get( formatter, id_iv_timestamp );
+	VALUE second = LONG2NUM( seconds ), timestamp;
+
+	if ( TYPE(cached) == T_ARRAY && RARRAY_LEN(cached) == 2 &&
+	     rb_equal(rb_ary_entry(cached, 0), second) )
+		return rb_ary_entry( cached, 1 );
+
+	timestamp = rb_funcall( time, id_strftime, 1, mues_timestamp_format );
+	rb_ivar_set( formatter, id_iv_timestamp, rb_assoc_new(second, timestamp) );
+
+	return timestamp;
+}
+
+
+/*
+ * pthread_atfork() child handler: forget the pid of the parent.
+ */
+static void
+mues_forget_pid( void )
+{
+	mues_pid = 0;
+}
+
+
+/*
+ * Return the "pid/name" tag of the current thread, making it if the thread
+ * doesn't have one yet or was made in another process.
+ */
+static VALUE
+mues_log_tag( VALUE formatter )
+{
+	VALUE thread = rb_thread_current();
+	ID key = SYM2ID( rb_ivar_get(formatter, id_iv_tag_key) );
+	VALUE cached = rb_thread_local_aref( thread, key );
+	VALUE pid, name, tag;
+
+	if ( !mues_pid ) mues_pid = (long)getpid();
+	pid = LONG2NUM( mues_pid );
+
+	if ( TYPE(cached) == T_ARRAY && RARRAY_LEN(cached) == 3 &&
+	     rb_equal(rb_ary_entry(cached, 2), pid) )
+		return rb_ary_entry( cached, 1 );
+
+	if ( thread == rb_thread_main() )
+		name = mues_main_name;
+	else
+		name = rb_funcall( rb_funcall(thread, id_object_id, 0), id_to_s, 0 );
+	tag = rb_funcall( pid, id_to_s, 0 );
+	rb_str_buf_cat( tag, "/", 1 );
+	rb_str_buf_append( tag, name );
+
+	rb_thread_local_aset( thread, key, rb_ary_new3(3, name, tag, pid) );
+	return tag;
+}
+
+
+/*
+ * call-seq:
+ *    formatter.call( severity, time, progname, msg )   -> string
+ *
+ * Format a log line; see MUES::LogFormatter#call.
+ */
+static VALUE
+mues_logformatter_call( VALUE self, VALUE severity, VALUE time, VALUE progname, VALUE msg )
+{
+	VALUE logger = rb_ivar_get( self, id_iv_logger );
+	VALUE format, line;
+	int debug;
+	struct timeval tv;
+	char usec[ 16 ];
+
+	debug = NUM2INT( rb_funcall(logger, id_level, 0) ) == 0;
+	format = rb_ivar_get( self, debug ? id_iv_debug_format : id_iv_format );
+
+	if ( !rb_equal(format, mues_default_format) && !rb_equal(format, mues_default_debug_format) ) {
+		VALUE parts = rb_funcall( self, id_cached_parts, 1, time );
+		VALUE args = rb_ary_new3( 7, rb_ary_entry(parts, 0), rb_funcall(time, id_usec, 0),
+			rb_ary_entry(parts, 1), rb_ary_entry(parts, 2), severity, progname, msg );
+		return rb_funcall( format, id_percent, 1, args );
+	}
+
+	tv = rb_time_timeval( time );
+	snprintf( usec, sizeof(usec), "%06ld", (long)tv.tv_usec );
+
+	line = rb_str_buf_new( 128 );
+#ifdef HAVE_RUBY_ENCODING_H
+	rb_enc_associate( line, rb_utf8_encoding() );
+#endif
+	rb_str_buf_cat( line, "[", 1 );
+	rb_str_buf_append( line, mues_log_timestamp(self, time, (long)tv.tv_sec) );
+	rb_str_buf_cat( line, ".", 1 );
+	rb_str_buf_cat2( line, usec );
+	rb_str_buf_cat( line, " ", 1 );
+	rb_str_buf_append( line, mues_log_tag(self) );
+	rb_str_buf_cat( line, "] ", 2 );
+	rb_str_buf_append( line, rb_obj_as_string(rb_hash_aref(mues_severity_labels, severity)) );
+
+	if ( rb_equal(format, mues_default_debug_format) ) {
+		rb_str_buf_cat( line, " {", 2 );
+		rb_str_buf_append( line, rb_obj_as_string(progname) );
+		rb_str_buf_cat( line, "}", 1 );
+	}
+
+	rb_str_buf_cat( line, " -- ", 4 );
+	rb_str_buf_append( line, rb_obj_as_string(msg) );
+	rb_str_buf_cat( line, "\n", 1 );
+
+	return line;
+}
+
+
+/*
+ * Replace MUES::LogFormatter#call with the native version, if the formatter
+ * has been defined.
+ */
+static void
+mues_init_logformatter( VALUE mues_mMUES )
+{
+	VALUE klass;
+
+	if ( !rb_const_defined(mues_mMUES, rb_intern("LogFormatter")) ) return;
+	klass = rb_const_get( mues_mMUES, rb_intern("LogFormatter") );
+
+	mues_default_format       = rb_const_get( klass, rb_intern("DEFAULT_FORMAT") );
+	mues_default_debug_format = rb_const_get( klass, rb_intern("DEFAULT_DEBUG_FORMAT") );
+	mues_timestamp_format     = rb_const_get( klass, rb_intern("TIMESTAMP_FORMAT") );
+	mues_severity_labels      = rb_const_get( klass, rb_intern("SEVERITY_LABELS") );
+	mues_main_name            = rb_obj_freeze( rb_str_new2("main") );
+	rb_global_variable( &mues_default_format );
+	rb_global_variable( &mues_default_debug_format );
+	rb_global_variable( &mues_timestamp_format );
+	rb_global_variable( &mues_severity_labels );
+	rb_global_variable( &mues_main_name );
+
+	id_level           = rb_intern( "level" );
+	id_strftime        = rb_intern( "strftime" );
+	id_object_id       = rb_intern( "object_id" );
+	id_usec            = rb_intern( "usec" );
+	id_cached_parts    = rb_intern( "cached_parts" );
+	id_percent         = rb_intern( "%" );
+	id_iv_logger       = rb_intern( "@logger" );
+	id_iv_format       = rb_intern( "@format" );
+	id_iv_debug_format = rb_intern( "@debug_format" );
+	id_iv_timestamp    = rb_intern( "@timestamp" );
+	id_iv_tag_key      = rb_intern( "@tag_key" );
+
+	pthread_atfork( NULL, NULL, mues_forget_pid );
+
+	rb_remove_method( klass, "call" );
+	rb_define_method( klass, "call", mues_logformatter_call, 4 );
+}
+
+
+
+/* --------------------------------------------------------------
+ * Initialization
+ * -------------------------------------------------------------- */
+
+void
+Init_mues_ext( void )
+{
+	VALUE mues_mMUES = rb_define_module( "MUES" );
+	VALUE mues_mNative;
+
+	mues_mWireFormat = rb_define_module_under( mues_mMUES, "WireFormat" );
+	rb_global_variable( &mues_mWireFormat );
+	rb_global_variable( &mues_eFormatError );
+
+	id_or          = rb_intern( "|" );
+	id_lshift      = rb_intern( "<<" );
+	id_rshift      = rb_intern( ">>" );
+	id_and         = rb_intern( "&" );
+	id_plus        = rb_intern( "+" );
+	id_minus       = rb_intern( "-" );
+	id_uminus      = rb_intern( "-@" );
+	id_lt          = rb_intern( "<" );
+	id_to_s        = rb_intern( "to_s" );
+	id_pack_varint = rb_intern( "pack_varint" );
+
+	mues_mNative = rb_define_module_under( mues_mWireFormat, "Native" );
+	rb_define_module_function( mues_mNative, "pack_value", mues_native_pack_value, 2 );
+	rb_define_module_function( mues_mNative, "unpack_value", mues_native_unpack_value, 1 );
+
+	mues_init_logformatter( mues_mMUES );
+}
+
@@ -41,6 +41,7 @@ module MUES
 	require 'mues/mixins'
 	require 'mues/utils'
 	require 'mues/constants'
+	require 'mues/objectinspector'
 
 	include MUES::Constants,
 	        MUES::VersionFunctions
@@ -93,6 +94,7 @@ module MUES
 	end
 
 
+	require 'mues/event'
 	require 'mues/engine'
 	require 'mues/player'
 
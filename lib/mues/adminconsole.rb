@@ -0,0 +1,445 @@
+#!/usr/bin/env ruby
+
+require 'socket'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/objectinspector'
+require 'mues/metrics'
+
+
+# An administrative console for a running MUES::Engine, served over a local
+# UNIX socket.
+#
+# The console doesn't have a thread of its own: the engine's runloop selects
+# on the console's sockets along with its self-pipe, and hands the ones that
+# are ready to #handle_readable and #handle_writable, which never block.
+# Commands run in the runloop, so looking at the world doesn't pause the
+# environment's thread.
+#
+# Each line a client sends is a command:
+#
+#   stats                         the engine's counters and timings
+#   metrics                       the values of the engine's MUES::Metrics
+#   players                       the names of the connected players
+#   inspect <target> [path] [opts] describe a player (or 'engine' or
+#                                 'environment'), optionally following a
+#                                 path of ivars, keys and indexes (see
+#                                 MUES::ObjectInspector); opts are depth=,
+#                                 page=, size= and format=(html|json)
+#   levels                        the per-class log levels
+#   level <category> <level>      set the log level for a class or namespace
+#                                 ('default' to go back to the global level)
+#   threads                       a dump of every thread and its backtrace
+#   quit                          close the connection
+#
+# == Synopsis
+#
+#   console = MUES::AdminConsole.new( engine, :admin_socket => 'mues-admin.sock' )
+#   console.start
+#
+#   ready, writable = IO.select( console.readers, console.writers )
+#   ready.each {|io| console.handle_readable(io) }
+#   writable.each {|io| console.handle_writable(io) }
+#
+class MUES::AdminConsole
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# The most bytes read from a client at once
+	READ_SIZE = 4096
+
+	# The longest command line that's accepted
+	MAX_LINE_LENGTH = 4096
+
+	# The most output that can be waiting for a client before the console stops
+	# reading its commands
+	MAX_PENDING_OUTPUT = 1024 * 1024
+
+	# The greeting sent to new clients
+	BANNER = "MUES admin console (%s). Type 'help' for a list of commands.\n"
+
+	# The help text
+	HELP = <<-END_HELP
+	stats                          the engine's counters and timings
+	metrics                        the engine's metrics
+	players                        the names of the connected players
+	inspect <target> [path] [opts] describe a player, 'engine' or 'environment'
+	                               (opts: depth=N page=N size=N format=html|json)
+	levels                         the per-class log levels
+	level <category> <level>       set the log level for a class or namespace
+	                               ('default' goes back to the global level)
+	threads                        a dump of every thread
+	quit                           close the connection
+	END_HELP
+
+
+	#
+	# A client connected to the console.
+	#
+	class Connection
+
+		### Create a connection for the given +socket+.
+		def initialize( socket )
+			@socket  = socket
+			@input   = ''
+			@output  = ''
+			@closing = false
+		end
+
+
+		######
+		public
+		######
+
+		# The client's socket
+		attr_reader :socket
+
+		# The output that hasn't been written to the client yet
+		attr_reader :output
+
+		# Whether the connection is to be closed once its output is written
+		attr_accessor :closing
+
+
+		### Queue +data+ to be written to the client. Returns the length of
+		### +data+, so the connection can be written to like an IO.
+		def write( data )
+			@output << data
+			return data.length
+		end
+
+
+		### Append +data+ to the output, returning the connection.
+		def <<( data )
+			@output << data.to_s
+			return self
+		end
+
+
+		### Read what the client has sent and return the complete lines in it.
+		### Raises EOFError if the client has closed its end.
+		def read_lines
+			@input << @socket.read_nonblock( READ_SIZE )
+			lines = []
+			while newline = @input.index( "\n" )
+				lines << @input.slice!( 0, newline + 1 ).chomp
+			end
+
+			if @input.length > MAX_LINE_LENGTH
+				@input = ''
+				lines << nil
+			end
+
+			return lines
+		rescue Errno::EAGAIN, Errno::EINTR
+			return []
+		end
+
+
+		### Write as much of the pending output as the socket will take.
+		def flush
+			return if @output.empty?
+			written = @socket.write_nonblock( @output )
+			@output.slice!( 0, written )
+		rescue Errno::EAGAIN, Errno::EINTR
+			# Try again when it's writable
+		end
+
+
+		### Returns +true+ if the client is waiting for output.
+		def pending_output?
+			return !@output.empty?
+		end
+
+
+		### Close the connection's socket.
+		def close
+			@socket.close unless @socket.closed?
+		end
+
+	end # class Connection
+
+
+	### Create a new console for the given +engine+. The +config+ may contain an
+	### :admin_socket key, the path of the socket to listen on.
+	def initialize( engine, config={} )
+		@engine      = engine
+		@path        = config[:admin_socket] || DEFAULT_ADMIN_SOCKET
+		@server      = nil
+		@connections = {}
+	end
+
+
+	######
+	public
+	######
+
+	# The engine the console is attached to
+	attr_reader :engine
+
+	# The path of the socket the console listens on
+	attr_reader :path
+
+
+	### Start listening on the console's socket. Raises an error if another
+	### process is already listening on it.
+	def start
+		if File.socket?( @path )
+			begin
+				UNIXSocket.new( @path ).close
+				raise "Something is already listening on %s" % [ @path ]
+			rescue Errno::ECONNREFUSED, Errno::ENOENT
+				File.unlink( @path )
+			end
+		end
+
+		# Bind with a umask that leaves the socket usable only by its owner, so
+		# there's no window before the chmod when anyone else can connect
+		old_umask = File.umask( 0177 )
+		begin
+			@server = UNIXServer.new( @path )
+		ensure
+			File.umask( old_umask )
+		end
+		File.chmod( 0600, @path )
+		self.log.info "Admin console listening on %s" % [ @path ]
+
+		return @server
+	end
+
+
+	### Returns +true+ if the console is listening for clients.
+	def running?
+		return @server && !@server.closed?
+	end
+
+
+	### Close the console's socket and disconnect all of its clients.
+	def shutdown
+		@connections.each_value {|conn| conn.close }
+		@connections.clear
+
+		if @server
+			@server.close unless @server.closed?
+			File.unlink( @path ) if File.socket?( @path )
+			@server = nil
+		end
+	end
+
+
+	### Return the number of connected clients.
+	def client_count
+		return @connections.length
+	end
+
+
+	### Return the sockets that should be selected for reading: the listening
+	### socket, and those of the clients that aren't behind on their output.
+	def readers
+		return [] unless self.running?
+		readers = [ @server ]
+		@connections.each do |socket, conn|
+			readers << socket unless conn.closing || conn.output.length > MAX_PENDING_OUTPUT
+		end
+
+		return readers
+	end
+
+
+	### Return the sockets of the clients that have output waiting.
+	def writers
+		return @connections.values.find_all {|conn| conn.pending_output? }.
+			collect {|conn| conn.socket }
+	end
+
+
+	### Returns +true+ if the given +io+ is one of the console's sockets.
+	def owns?( io )
+		return io == @server || @connections.key?( io )
+	end
+
+
+	### Handle the given +io+ being readable: accept a new client if it's the
+	### listening socket, or run the commands a client has sent.
+	def handle_readable( io )
+		if io == @server
+			self.accept_client
+		elsif conn = @connections[ io ]
+			self.read_commands( conn )
+		end
+	end
+
+
+	### Handle the given client +io+ being writable.
+	def handle_writable( io )
+		conn = @connections[ io ] or return
+		conn.flush
+		self.disconnect( conn ) if conn.closing && !conn.pending_output?
+	rescue IOError, SystemCallError
+		self.disconnect( conn )
+	end
+
+
+	### Run the given command +line+, writing its output to +out+.
+	def run_command( line, out )
+		command, *args = line.strip.split( /\s+/ )
+		return if command.nil?
+
+		case command
+		when 'help'    then out << HELP.gsub( /^\t/, '' )
+		when 'stats'   then self.write_stats( @engine.stats, out )
+		when 'metrics' then self.write_stats( MUES::Metrics.snapshot, out )
+		when 'players' then @engine.players.keys.sort.each {|name| out << name << "\n" }
+		when 'inspect' then self.inspect_command( args, out )
+		when 'levels'  then self.levels_command( out )
+		when 'level'   then self.level_command( args, out )
+		when 'threads' then self.threads_command( out )
+		when 'quit'    then out << "Bye.\n"
+		else
+			out << "Unknown command %p; try 'help'.\n" % [ command ]
+		end
+	rescue => err
+		out << "%s: %s\n" % [ err.class.name, err.message ]
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Accept a connection from a new client.
+	def accept_client
+		socket = @server.accept_nonblock
+		conn = Connection.new( socket )
+		@connections[ socket ] = conn
+		conn << BANNER % [ MUES.version_string ]
+		self.log.info "Admin console client connected."
+	rescue Errno::EAGAIN, Errno::EINTR, Errno::ECONNABORTED, Errno::EPROTO
+		# The client went away before it could be accepted
+	end
+
+
+	### Read and run the commands the client on +conn+ has sent.
+	def read_commands( conn )
+		conn.read_lines.each do |line|
+			if line.nil?
+				conn << "Command too long.\n"
+			elsif line.strip == 'quit'
+				self.run_command( line, conn )
+				conn.closing = true
+				break
+			else
+				self.run_command( line, conn )
+			end
+		end
+	rescue EOFError, IOError, SystemCallError
+		self.disconnect( conn )
+	end
+
+
+	### Close the connection to the client on +conn+.
+	def disconnect( conn )
+		@connections.delete( conn.socket )
+		conn.close
+		self.log.info "Admin console client disconnected."
+	end
+
+
+	### Write the given Hash of +stats+ to +out+, one per line, indenting nested
+	### Hashes.
+	def write_stats( stats, out, indent='' )
+		stats.keys.sort_by {|key| key.to_s }.each do |key|
+			value = stats[ key ]
+			if value.is_a?( Hash )
+				out << "%s%s:\n" % [ indent, key ]
+				self.write_stats( value, out, indent + '  ' )
+			else
+				out << "%s%s: %p\n" % [ indent, key, value ]
+			end
+		end
+	end
+
+
+	### Describe the object named by the first of the +args+ with a
+	### MUES::ObjectInspector.
+	def inspect_command( args, out )
+		options = { :format => :html }
+		path = []
+		args.each do |arg|
+			if arg =~ /\A(depth|page|size|format)=(\S+)\z/
+				case $1
+				when 'depth'  then options[:max_depth] = $2
+				when 'page'   then options[:page] = $2
+				when 'size'   then options[:page_size] = $2
+				when 'format' then options[:format] = $2
+				end
+			else
+				path << arg
+			end
+		end
+
+		target = path.shift or return out << "Usage: inspect <target> [path] [opts]\n"
+		object = case target
+			when 'engine'      then @engine
+			when 'environment' then @engine.environment
+			else @engine.players[ target ] or return out << "No player named %p.\n" % [ target ]
+			end
+
+		object = MUES::ObjectInspector.resolve( object, path )
+		inspector = MUES::ObjectInspector.new( out, options )
+		inspector.render( object )
+		out << "\n(%d values described%s)\n" %
+			[ inspector.count, inspector.truncated? ? '; truncated' : '' ]
+	end
+
+
+	### List the per-class log levels.
+	def levels_command( out )
+		levels = MUES::Loggable.levels
+		out << "No per-class levels are set.\n" if levels.empty?
+		labels = MUES::Loggable::LEVEL.invert
+		levels.keys.sort.each do |category|
+			out << "%s: %s\n" % [ category, labels[levels[category]] ]
+		end
+	end
+
+
+	### Set the log level for the category in +args+, or go back to the global
+	### level if it's 'default'.
+	def level_command( args, out )
+		category, level = args
+		return out << "Usage: level <category> <level|default>\n" unless level
+
+		if level == 'default'
+			MUES::Loggable.set_level( category, nil )
+			out << "%s now logs at the global level.\n" % [ category ]
+		else
+			MUES::Loggable.set_level( category, level )
+			out << "%s now logs at %s.\n" % [ category, level ]
+		end
+	end
+
+
+	### Write a dump of every thread and where it is to +out+.
+	def threads_command( out )
+		names = {
+			Thread.main         => 'main',
+			@engine.env_thread  => 'environment',
+			@engine.connect_thread => 'connections',
+		}
+
+		Thread.list.each do |thread|
+			out << "%p %s%s\n" % [
+				thread,
+				names[ thread ] ? "(#{names[thread]}) " : '',
+				thread.status || 'dead',
+			]
+			next unless thread.respond_to?( :backtrace ) && backtrace = thread.backtrace
+			backtrace.each {|frame| out << "    " << frame << "\n" }
+		end
+	end
+
+end # class MUES::AdminConsole
+
@@ -0,0 +1,187 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/outputbuffer'
+
+
+# Broadcasts events to everyone in an area with a single publish to a topic
+# exchange, instead of a publish to each player's exchange.
+#
+# When a player enters an area, the queue their client reads from is bound to
+# the 'areas' exchange with the area's routing key ("area.<area name>"), and
+# rebound when they move, so the broker does the fan-out: "say" in a room of 200
+# players is one message from the engine instead of 200. Area names may be
+# dotted to form a hierarchy ("castle.keep"); the routing keys are too, so a
+# queue bound to "area.castle.#" hears the whole castle.
+#
+# Like player output, broadcasts are coalesced into one message per area per
+# tick with a MUES::OutputBuffer; #flush publishes them, and drops the buffers
+# of areas nobody is in any more.
+#
+# == Synopsis
+#
+#   areas = MUES::AreaExchange.new( playersbus )
+#   areas.start
+#
+#   areas.move( player, 'tavern' )
+#   areas.broadcast( 'tavern', :output, "Bob says: hello." )
+#
+#   # ...at the end of the tick
+#   areas.flush
+#
+class MUES::AreaExchange
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# The name of the topic exchange area events are published to
+	EXCHANGE_NAME = 'areas'
+
+	# The prefix of areas' routing keys
+	ROUTING_KEY_PREFIX = 'area'
+
+
+	### Create a new AreaExchange on the given +bus+ (a Bunny client connected to
+	### the players vhost), with area output buffers of +buffer_size+ bytes.
+	def initialize( bus, buffer_size=DEFAULT_OUTPUT_BUFFER_SIZE )
+		@bus         = bus
+		@buffer_size = buffer_size
+		@exchange    = nil
+
+		@locations   = {}
+		@occupancy   = Hash.new( 0 )
+		@buffers     = {}
+		@queues      = {}
+		@mutex       = Mutex.new
+	end
+
+
+	######
+	public
+	######
+
+	# The Bunny::Exchange area events are published to
+	attr_reader :exchange
+
+
+	### Return the routing key for the specified +area+.
+	def self::routing_key( area )
+		return "#{ROUTING_KEY_PREFIX}.#{area}"
+	end
+
+
+	### Declare the area exchange.
+	def start
+		self.log.debug "Declaring the %p topic exchange" % [ EXCHANGE_NAME ]
+		@exchange = @bus.exchange( EXCHANGE_NAME, :type => :topic, :auto_delete => true )
+	end
+
+
+	### Return the name of the area the specified +player+ is in, or +nil+ if
+	### they aren't in one.
+	def area_of( player )
+		return @mutex.synchronize { @locations[player.name] }
+	end
+
+
+	### Return the names of the players in the specified +area+.
+	def players_in( area )
+		return @mutex.synchronize {
+			@locations.keys.select {|name| @locations[name] == area }
+		}
+	end
+
+
+	### Move the specified +player+ into the given +area+, rebinding their
+	### client's queue. The new binding is made before the old one is removed
+	### so the player doesn't miss anything in between.
+	def move( player, area )
+		old_area = self.area_of( player )
+		return if old_area == area
+
+		queue = self.client_queue( player )
+		queue.bind( self.exchange, :key => self.class.routing_key(area) )
+		queue.unbind( self.exchange, :key => self.class.routing_key(old_area) ) if old_area
+
+		@mutex.synchronize do
+			@locations[ player.name ] = area
+			@occupancy[ area ] += 1
+			self.vacate( old_area ) if old_area
+		end
+	end
+	alias_method :enter, :move
+
+
+	### Remove the specified +player+ from whatever area they're in, and forget
+	### their client's queue.
+	def leave( player )
+		area, queue = @mutex.synchronize do
+			location = @locations.delete( player.name ) or return
+			self.vacate( location )
+			[ location, @queues.delete(player.name) ]
+		end
+
+		queue ||= @bus.queue( player.name, :passive => true )
+		queue.unbind( self.exchange, :key => self.class.routing_key(area) )
+	end
+
+
+	### Broadcast an event of the given message +type+ and +body+ to everyone in
+	### the specified +area+. It will be published when the area buffers are
+	### next flushed.
+	def broadcast( area, type, body )
+		self.buffer_for( area ).append( type, body )
+	end
+
+
+	### Publish the buffered events for every area, then drop the buffers of
+	### areas nobody is in. Returns the number of events published.
+	def flush
+		buffers = @mutex.synchronize { @buffers.values }
+		count = buffers.inject( 0 ) {|sum, buffer| sum + buffer.flush }
+
+		@mutex.synchronize do
+			@buffers.delete_if {|area, buffer| buffer.empty? && !@occupancy.key?(area) }
+		end
+
+		return count
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the (existing) queue that the specified +player+'s client reads
+	### events from, declaring it passively the first time it's needed.
+	def client_queue( player )
+		queue = @mutex.synchronize { @queues[player.name] } and return queue
+		queue = @bus.queue( player.name, :passive => true )
+		@mutex.synchronize { @queues[player.name] ||= queue }
+
+		return queue
+	end
+
+
+	### Note that a player has left the specified +area+. Must be called while
+	### holding the mutex.
+	def vacate( area )
+		@occupancy[ area ] -= 1
+		@occupancy.delete( area ) if @occupancy[ area ] <= 0
+	end
+
+
+	### Return the output buffer for the specified +area+, creating it if
+	### necessary.
+	def buffer_for( area )
+		@mutex.synchronize do
+			@buffers[ area ] ||= MUES::OutputBuffer.new( self.exchange, @buffer_size,
+				self.class.routing_key(area) )
+		end
+	end
+
+end # class MUES::AreaExchange
+
@@ -0,0 +1,244 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+
+
+# A log device for Logger that hands each message to a writer thread instead of
+# writing it in the thread that logged it, so that the tick loop and the
+# players' threads never wait on a slow terminal or pipe.
+#
+# Messages go into a fixed-size ring buffer; the writer thread takes everything
+# that's in it at once and writes it to the underlying IO with a single write.
+# When the buffer is full, the device either drops the new message (the :drop
+# overflow policy) or makes the logging thread wait for room (:block). Dropped
+# messages are counted, and a note saying how many were lost is written in
+# their place once there's room again.
+#
+# Closing the device writes whatever is still buffered and stops the writer
+# thread, but leaves the IO open; anything logged after that, or after the
+# writer thread has died, is written directly.
+#
+# == Synopsis
+#
+#   device = MUES::AsyncLogDevice.new( $stderr, :log_overflow_policy => :drop )
+#   MUES.logger = Logger.new( device )
+#   ...
+#   device.stats    # => { :written => 1138, :dropped => 0, ... }
+#   device.close
+#
+class MUES::AsyncLogDevice
+	include MUES::Constants
+
+	# The valid overflow policies
+	OVERFLOW_POLICIES = [ :drop, :block ]
+
+	# The note that's written in place of messages that were dropped
+	DROPPED_NOTE = "-- %d log messages dropped --\n"
+
+
+	### Create a new AsyncLogDevice that writes to the given +io+. The +config+
+	### may contain the :log_buffer_size and :log_overflow_policy keys.
+	def initialize( io, config={} )
+		@io       = io
+		@capacity = Integer( config[:log_buffer_size] || DEFAULT_LOG_BUFFER_SIZE )
+		@policy   = ( config[:log_overflow_policy] || DEFAULT_LOG_OVERFLOW_POLICY ).to_sym
+
+		raise ArgumentError, "invalid overflow policy %p" % [ @policy ] unless
+			OVERFLOW_POLICIES.include?( @policy )
+		raise ArgumentError, "buffer size must be positive" unless @capacity > 0
+
+		@ring      = Array.new( @capacity )
+		@head      = 0
+		@count     = 0
+		@writing   = false
+		@unnoted   = 0
+
+		@mutex     = Mutex.new
+		@not_empty = ConditionVariable.new
+		@not_full  = ConditionVariable.new
+		@drained   = ConditionVariable.new
+		@counters  = Hash.new( 0 )
+
+		@running   = true
+		@stopped   = false
+		@thread    = Thread.new { self.write_behind }
+	end
+
+
+	######
+	public
+	######
+
+	# The IO the messages are written to
+	attr_reader :io
+
+	# The number of messages the buffer holds
+	attr_reader :capacity
+
+	# What happens to messages when the buffer is full (:drop or :block)
+	attr_reader :policy
+
+	# The writer thread
+	attr_reader :thread
+
+
+	### Returns +true+ if the writer thread is running.
+	def running?
+		@mutex.synchronize { return @running && self.writer_alive? }
+	end
+
+
+	### Buffer the given +message+ for the writer thread. If the buffer is full,
+	### the message is dropped or the caller waits, depending on the overflow
+	### policy. Returns the length of the message.
+	def write( message )
+		# Formatters that sample messages return an empty String for the ones
+		# they skip
+		return 0 if message.empty?
+
+		@mutex.synchronize do
+			while @count >= @capacity && @running && self.writer_alive?
+				if @policy == :drop
+					@counters[ :dropped ] += 1
+					@unnoted += 1
+					return 0
+				end
+				@counters[ :blocked ] += 1
+				@not_full.wait( @mutex )
+			end
+
+			unless @running && self.writer_alive?
+				@io.write( message )
+				return message.length
+			end
+
+			@ring[ (@head + @count) % @capacity ] = message
+			@count += 1
+			@counters[ :enqueued ] += 1
+			@not_empty.signal
+		end
+
+		return message.length
+	end
+
+
+	### Wait until everything that's been buffered so far has been written.
+	def flush
+		@mutex.synchronize do
+			@drained.wait( @mutex ) while ( @count > 0 || @writing ) && self.writer_alive?
+		end
+		return self
+	end
+
+
+	### Write everything that's buffered and stop the writer thread. The IO is
+	### left open.
+	def close
+		@mutex.synchronize do
+			@running = false
+			@not_empty.signal
+			@not_full.broadcast
+		end
+		@thread.join unless @thread == Thread.current
+	end
+
+
+	### Return a Hash of the device's counters: how many messages are buffered,
+	### and how many have been buffered, written, dropped, and had to wait for
+	### room, and how many batches were written and how many writes failed.
+	def stats
+		@mutex.synchronize do
+			return {
+				:buffered => @count,
+				:capacity => @capacity,
+				:enqueued => @counters[ :enqueued ],
+				:written  => @counters[ :written ],
+				:dropped  => @counters[ :dropped ],
+				:blocked  => @counters[ :blocked ],
+				:batches  => @counters[ :batches ],
+				:errors   => @counters[ :errors ],
+			}
+		end
+	end
+
+
+	#########
+	protected
+	#########
+
+	### The writer thread's loop: take everything out of the buffer and write it,
+	### until the device is closed and the buffer is empty.
+	def write_behind
+		self.write_batches
+	ensure
+		# Wake anyone waiting for room or for a flush, whether the loop finished or
+		# the thread is dying
+		@mutex.synchronize do
+			@stopped = true
+			@not_full.broadcast
+			@drained.broadcast
+		end
+	end
+
+
+	### Write each batch taken out of the buffer until there are no more.
+	def write_batches
+		while taken = self.take_batch
+			batch, dropped = taken
+
+			begin
+				output = batch.join
+				output = ( DROPPED_NOTE % [dropped] ) + output if dropped > 0
+				@io.write( output )
+				@io.flush if @io.respond_to?( :flush )
+			rescue
+				# There's nowhere left to complain to, so just count it
+				@mutex.synchronize { @counters[:errors] += 1 }
+			end
+
+			@mutex.synchronize do
+				@writing = false
+				@counters[ :written ] += batch.length
+				@counters[ :batches ] += 1
+				@drained.broadcast
+			end
+		end
+	end
+
+
+	### Returns +true+ if the writer thread is still taking messages. Must be
+	### called with the mutex held.
+	def writer_alive?
+		return !@stopped && @thread.alive?
+	end
+
+
+	### Wait for messages and take all of them out of the buffer. Returns them and
+	### the number of messages that were dropped since the last batch, or +nil+
+	### if the device has been closed and there's nothing left to write.
+	def take_batch
+		@mutex.synchronize do
+			@not_empty.wait( @mutex ) while @count.zero? && @running
+			return nil if @count.zero? && @unnoted.zero?
+
+			batch = Array.new( @count ) do |i|
+				index = ( @head + i ) % @capacity
+				message, @ring[ index ] = @ring[ index ], nil
+				message
+			end
+			@head = ( @head + @count ) % @capacity
+			@count = 0
+			@writing = true
+			@not_full.broadcast
+
+			dropped, @unnoted = @unnoted, 0
+			return batch, dropped
+		end
+	end
+
+end # class MUES::AsyncLogDevice
+
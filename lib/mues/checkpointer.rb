@@ -0,0 +1,218 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/histogram'
+
+
+# Takes consistent checkpoints of the world in a MUES::ObjectStore, so that the
+# Engine can come back up from the latest one after a restart.
+#
+# A checkpoint is taken in two phases. The first runs in the tick loop, so the
+# world is between ticks and can't change underneath it: the environment's own
+# state is stored, every dirty object is written to the store's log, and the
+# log is rolled over to a new segment. Since the write-behind thread keeps the
+# number of dirty objects small, the pause this causes depends on how much has
+# changed since the last flush rather than on the size of the world. The
+# segment that was just closed marks the checkpoint.
+#
+# The second phase runs in the checkpointer's own thread: the previous snapshot
+# and the live records in every segment up to the checkpoint are compacted
+# into a new, versioned snapshot file (see MUES::ObjectLog#write_snapshot), and
+# the files it replaces are deleted. If another checkpoint is taken while a
+# snapshot is being written, the next snapshot just covers both.
+#
+# When the store is next opened, its log loads the newest snapshot and replays
+# only the segments written after it, and #restore hands the environment back
+# the state it had at the checkpoint.
+#
+# The time each checkpoint paused the tick loop for, and the time each
+# compaction took, are kept in MUES::Histograms (in microseconds).
+#
+# == Synopsis
+#
+#   checkpointer = MUES::Checkpointer.new( store, :checkpoint_keep => 2 )
+#   checkpointer.start
+#   checkpointer.restore( environment )
+#
+#   environment.schedule_every( 300 ) { checkpointer.checkpoint(environment) }
+#
+class MUES::Checkpointer
+	include MUES::Constants,
+	        MUES::Loggable,
+	        MUES::TimeUtilities
+
+	# The id the environment's own state is kept under in the object store
+	ENVIRONMENT_STATE_ID = :__environment__
+
+
+	### Create a new Checkpointer for the specified +store+. The +config+ may
+	### contain a :checkpoint_keep key, the number of snapshots to keep around.
+	def initialize( store, config={} )
+		@store   = store
+		@keep    = Integer( config[:checkpoint_keep] || DEFAULT_CHECKPOINT_KEEP )
+
+		@pending = nil
+		@running = false
+		@thread  = nil
+		@mutex   = Mutex.new
+		@pending_cond = ConditionVariable.new
+
+		@pause_histogram      = MUES::Histogram.new
+		@compaction_histogram = MUES::Histogram.new
+		@stats   = Hash.new( 0 )
+	end
+
+
+	######
+	public
+	######
+
+	# The MUES::ObjectStore being checkpointed
+	attr_reader :store
+
+	# The number of snapshots that are kept
+	attr_reader :keep
+
+	# A MUES::Histogram of how long each checkpoint paused the tick loop for, in
+	# microseconds
+	attr_reader :pause_histogram
+
+	# A MUES::Histogram of how long each snapshot took to write, in microseconds
+	attr_reader :compaction_histogram
+
+
+	### Start the thread that writes snapshots, adding it to the specified
+	### +threadgroup+ if one is given. Until it's started, snapshots are written
+	### by #checkpoint itself.
+	def start( threadgroup=nil )
+		@running = true
+		@thread = Thread.new { self.compact_in_background }
+		threadgroup.add( @thread ) if threadgroup
+		return @thread
+	end
+
+
+	### Returns +true+ if the snapshot thread is running.
+	def running?
+		return @running
+	end
+
+
+	### Stop the snapshot thread after it's written any pending snapshot.
+	def shutdown
+		@mutex.synchronize do
+			@running = false
+			@pending_cond.signal
+		end
+		@thread.join if @thread && @thread != Thread.current
+		@thread = nil
+	end
+
+
+	### Take a checkpoint of the world, including the state of the specified
+	### +environment+ if one is given. Must be called from the tick loop (or
+	### while the world is otherwise quiescent). Returns the number of the
+	### checkpoint.
+	def checkpoint( environment=nil )
+		started = monotonic_time()
+
+		@store.store( environment.checkpoint_state, ENVIRONMENT_STATE_ID ) if environment
+		@store.sync
+		upto = @store.object_log.roll
+
+		pause = monotonic_time() - started
+		@pause_histogram.record( pause * 1_000_000 )
+		self.log.info "Checkpoint %d paused the world for %0.3fs" % [ upto, pause ]
+
+		@mutex.synchronize do
+			@pending = upto
+			@stats[ :checkpoints ] += 1
+			@stats[ :last_pause ] = pause
+			@pending_cond.signal
+		end
+
+		self.compact unless @running
+		return upto
+	end
+
+
+	### Restore the state the specified +environment+ had at the latest
+	### checkpoint. Returns +false+ if there hasn't been one.
+	def restore( environment )
+		state = @store.retrieve( ENVIRONMENT_STATE_ID ) or return false
+		environment.restore_state( state )
+		self.log.info "Restored the environment from snapshot %p" % [ @store.object_log.snapshot ]
+		return true
+	end
+
+
+	### Write a snapshot of the latest checkpoint if there's one that hasn't been
+	### written yet. Returns the number of records in the snapshot, or +nil+ if
+	### there was nothing to do.
+	def compact
+		upto = @mutex.synchronize do
+			pending, @pending = @pending, nil
+			pending
+		end
+		return nil unless upto
+
+		started = monotonic_time()
+		records = @store.object_log.write_snapshot( upto, @keep )
+		duration = monotonic_time() - started
+		@compaction_histogram.record( duration * 1_000_000 )
+
+		@mutex.synchronize do
+			@stats[ :snapshots ] += 1
+			@stats[ :snapshot_records ] = records
+			@stats[ :last_compaction ] = duration
+		end
+
+		return records
+	end
+
+
+	### Return a Hash of the checkpointer's counters and timings.
+	def stats
+		stats = @mutex.synchronize { @stats.dup }
+		return {
+			:checkpoints      => stats[ :checkpoints ],
+			:snapshots        => stats[ :snapshots ],
+			:snapshot         => @store.object_log.snapshot,
+			:snapshot_records => stats[ :snapshot_records ],
+			:last_pause       => stats[ :last_pause ],
+			:last_compaction  => stats[ :last_compaction ],
+			:pause            => @pause_histogram.to_h,
+			:compaction       => @compaction_histogram.to_h,
+		}
+	end
+
+
+	#########
+	protected
+	#########
+
+	### The snapshot thread's loop: write a snapshot whenever there's a new
+	### checkpoint, until the checkpointer is shut down.
+	def compact_in_background
+		loop do
+			@mutex.synchronize do
+				@pending_cond.wait( @mutex ) while @running && @pending.nil?
+			end
+
+			begin
+				self.compact
+			rescue => err
+				self.log.error "Writing a snapshot failed: %s: %s" % [ err.class.name, err.message ]
+				self.log.debug { err.backtrace.join($/) }
+			end
+
+			break unless @running
+		end
+	end
+
+end # class MUES::Checkpointer
+
@@ -0,0 +1,500 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+require 'bunny'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+
+
+# An engine-level event reactor that multiplexes the command events of all
+# connected players over a small, fixed pool of consumer threads.
+#
+# Each consumer owns one shared command queue on the players bus. When a player
+# connects, its exchange is bound to exactly one of those queues (chosen by
+# hashing the player's name), so all of a player's commands are delivered in
+# order by the same consumer, and the number of threads stays constant no
+# matter how many players are connected.
+#
+# If the reactor is given a MUES::EventQueue, consumers hand each command to
+# it in the :player lane instead of running it themselves, and hold off while
+# it's congested. Each player's commands are kept in a mailbox that only one
+# of the queue's workers drains at a time, so they still run one at a time and
+# in the order they arrived.
+#
+# Consumers set a QoS prefetch window (:command_prefetch) on their channel and
+# acknowledge deliveries in batches, sending a single multiple-ack once
+# :command_ack_batch deliveries have accumulated or :command_ack_interval
+# seconds have passed since the last ack, whichever comes first. A timer thread
+# in each consumer sends the acks for a partial batch once the interval is up
+# even if no more deliveries arrive, and the prefetch window has to be at least
+# as large as a batch, so a consumer can't stall waiting for deliveries the
+# broker won't send until it acks.
+class MUES::CommandReactor
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# The name of the shared command queues; the consumer's index is appended.
+	QUEUE_NAME_PREFIX = 'engine_commands'
+
+	# The options the shared command queues are declared with, by the consumers
+	# and by the players that bind to them. They aren't auto-delete: the broker
+	# would delete a queue (and every player's binding to it) as soon as a
+	# crashed consumer's subscription was cancelled, before its replacement
+	# subscribed.
+	QUEUE_OPTIONS = { :auto_delete => false }
+
+
+	### Create a new reactor that will connect its consumers to the players bus
+	### using the specified +config+ (a Hash containing at least :players_vhost,
+	### :mq_user, and :mq_pass). The size of the consumer pool is taken from the
+	### :command_consumers key of the config. If an +event_queue+ is given, the
+	### consumers stop taking deliveries whenever it signals backpressure.
+	### Raises an ArgumentError if the :command_prefetch window is smaller than
+	### the :command_ack_batch size.
+	def initialize( config={}, event_queue=nil )
+		@config      = config
+		@event_queue = event_queue
+		@size      = Integer( config[:command_consumers] || DEFAULT_COMMAND_CONSUMERS )
+
+		prefetch = Integer( config[:command_prefetch] || DEFAULT_COMMAND_PREFETCH )
+		batch    = Integer( config[:command_ack_batch] || DEFAULT_COMMAND_ACK_BATCH )
+		raise ArgumentError, "command prefetch (%d) is smaller than the ack batch (%d)" % [ prefetch, batch ] if
+			prefetch.nonzero? && prefetch < batch
+
+		@consumers   = []
+		@players     = {}
+		@mailboxes   = {}
+		@mutex       = Mutex.new
+		@threadgroup = nil
+		@on_exit     = nil
+	end
+
+
+	######
+	public
+	######
+
+	# The number of consumer threads in the pool
+	attr_reader :size
+
+	# The Array of MUES::CommandReactor::Consumer objects in the pool
+	attr_reader :consumers
+
+	# The MUES::EventQueue whose backpressure the consumers respect
+	attr_reader :event_queue
+
+
+	### Start the pool of consumers, adding their threads to the specified
+	### +threadgroup+ if one is given. If a block is given, it will be called with
+	### each consumer's thread when the thread exits.
+	def start( threadgroup=nil, &on_exit )
+		self.log.debug "Starting %d command consumers." % [ self.size ]
+		@threadgroup = threadgroup
+		@on_exit     = on_exit
+		@consumers = (0 ... self.size).collect do |index|
+			self.start_consumer( index )
+		end
+	end
+
+
+	### If the given +thread+ belongs to one of the pool's consumers, replace
+	### that consumer with a new one on the same queue and return it. Returns
+	### +nil+ if the thread isn't a consumer's.
+	def restart_consumer( thread )
+		index = @consumers.index {|consumer| consumer.thread == thread } or return nil
+		old = @consumers[ index ]
+
+		begin
+			old.stop
+		rescue => err
+			self.log.debug "Cleaning up after consumer %d failed: %s: %s" %
+				[ index, err.class.name, err.message ]
+		end
+
+		return @consumers[ index ] = self.start_consumer( index )
+	end
+
+
+	### Stop all of the consumers and wait for their threads to finish.
+	def stop
+		self.log.info "Stopping %d command consumers." % [ @consumers.length ]
+		@consumers.each {|consumer| consumer.stop }
+		@consumers.clear
+	end
+
+
+	### Create and start the consumer at the given +index+ and return it.
+	def start_consumer( index )
+		consumer = Consumer.new( self, index, self.queue_name(index), @config )
+		thr = consumer.start( &@on_exit )
+		@threadgroup.add( thr ) if @threadgroup
+		return consumer
+	end
+
+
+	### Return the name of the shared queue that is drained by the consumer at
+	### the given +index+.
+	def queue_name( index )
+		return "%s.%d" % [ QUEUE_NAME_PREFIX, index ]
+	end
+
+
+	### Return the index of the consumer that will handle commands for the player
+	### with the specified +name+.
+	def slot_for( name )
+		# String#hash isn't stable across processes, so use a simple checksum that is
+		return name.to_s.sum( 32 ) % self.size
+	end
+
+
+	### Return the name of the shared command queue the player with the given
+	### +name+ should bind its exchange to.
+	def queue_name_for( name )
+		return self.queue_name( self.slot_for(name) )
+	end
+
+
+	### Add the specified +player+ to the set of players whose commands are
+	### dispatched by the reactor.
+	def register( player )
+		self.log.debug "Registering %s with consumer %d" % [ player.name, self.slot_for(player.name) ]
+		@mutex.synchronize { @players[ player.name ] = player }
+	end
+
+
+	### Remove the specified +player+ from the reactor.
+	def unregister( player )
+		@mutex.synchronize { @players.delete( player.name ) }
+	end
+
+
+	### Return the player registered under the given +name+, if any.
+	def []( name )
+		return @mutex.synchronize { @players[name] }
+	end
+
+
+	### Return a Hash of the acknowledgement counters summed across all of the
+	### consumers in the pool (see MUES::CommandReactor::AckBatcher#stats).
+	def stats
+		totals = Hash.new( 0 )
+		self.consumers.each do |consumer|
+			consumer.acks.stats.each {|key, val| totals[key] += val }
+		end
+		return totals
+	end
+
+
+	### Block the calling consumer while the event queue is congested. Since the
+	### consumer's unacknowledged deliveries then fill up its prefetch window, the
+	### broker stops delivering to it until the queue drains.
+	def wait_for_capacity
+		self.event_queue.wait_while_congested if self.event_queue
+	end
+
+
+	### Hand the specified command +event+ to the event queue to be dispatched
+	### by one of its workers, or dispatch it right away if the reactor doesn't
+	### have an event queue (or it's been shut down).
+	def submit( event )
+		return self.dispatch( event ) unless self.event_queue
+
+		name = event[:delivery_details][:exchange]
+		idle = @mutex.synchronize do
+			mailbox = ( @mailboxes[name] ||= [] )
+			mailbox << event
+			mailbox.length == 1
+		end
+		return unless idle
+
+		self.drain_mailbox( name ) unless
+			self.event_queue.enqueue( lambda { self.drain_mailbox(name) }, :player )
+	end
+
+
+	### Dispatch the commands waiting in the mailbox of the player with the
+	### given +name+, in order, until it's empty.
+	def drain_mailbox( name )
+		event = @mutex.synchronize { @mailboxes[name].first }
+
+		while event
+			self.dispatch( event )
+			event = @mutex.synchronize do
+				mailbox = @mailboxes[ name ]
+				mailbox.shift
+				@mailboxes.delete( name ) if mailbox.empty?
+				mailbox.first
+			end
+		end
+	end
+
+
+	### Dispatch the specified command +event+ to the player whose exchange it was
+	### published to.
+	def dispatch( event )
+		name = event[:delivery_details][:exchange]
+
+		if player = self[ name ]
+			player.handle_command_event( event )
+		else
+			self.log.warn "Discarding command event for unregistered player %p" % [ name ]
+		end
+	rescue => err
+		self.log.error "Command event for %p failed: %s: %s" % [ name, err.class.name, err.message ]
+		self.log.debug {
+			err.backtrace.collect {|frame| "  #{frame}" }.join( $/ )
+		}
+	end
+
+
+	#
+	# Accumulates delivery tags and decides when to send a multiple-ack for
+	# them. The actual acknowledgement is done by the block passed to the
+	# constructor, which is called with the highest delivery tag to ack. The
+	# batcher is synchronized so a timer thread can flush it while deliveries
+	# are still arriving.
+	#
+	class AckBatcher
+		include MUES::TimeUtilities
+
+		### Create a new AckBatcher that will call +block+ to acknowledge every
+		### +batch_size+ deliveries or every +interval+ seconds.
+		def initialize( batch_size, interval, &block )
+			@batch_size = Integer( batch_size )
+			@interval   = Float( interval )
+			@ack_block  = block
+			@mutex      = Mutex.new
+
+			@pending    = 0
+			@last_tag   = nil
+			@last_ack   = monotonic_time()
+
+			@deliveries = 0
+			@acks       = 0
+			@acked      = 0
+		end
+
+
+		######
+		public
+		######
+
+		# The maximum number of deliveries to accumulate before acknowledging
+		attr_reader :batch_size
+
+		# The maximum number of seconds to wait between acknowledgements
+		attr_reader :interval
+
+		# The number of deliveries that have been received but not yet acknowledged
+		attr_reader :pending
+
+		# The total number of deliveries received
+		attr_reader :deliveries
+
+		# The number of (multiple-)acks sent to the broker
+		attr_reader :acks
+
+		# The number of deliveries that have been acknowledged
+		attr_reader :acked
+
+
+		### Note the delivery of the message with the given +tag+, acknowledging it
+		### (and any pending deliveries before it) if the batch is full or the ack
+		### interval has elapsed.
+		def delivered( tag )
+			@mutex.synchronize do
+				@deliveries += 1
+				@pending    += 1
+				@last_tag    = tag
+
+				self.flush_unlocked if @pending >= @batch_size || self.due?
+			end
+		end
+
+
+		### Acknowledge any pending deliveries.
+		def flush
+			@mutex.synchronize { self.flush_unlocked }
+		end
+
+
+		### Acknowledge any pending deliveries if the ack interval has passed
+		### since the last ack. Called periodically by the consumer's timer so
+		### a partial batch doesn't wait for the next delivery.
+		def flush_if_due
+			@mutex.synchronize { self.flush_unlocked if self.due? }
+		end
+
+
+		### Return the batcher's counters as a Hash.
+		def stats
+			@mutex.synchronize do
+				return {
+					:deliveries => @deliveries,
+					:acks       => @acks,
+					:acked      => @acked,
+					:pending    => @pending,
+				}
+			end
+		end
+
+
+		#########
+		protected
+		#########
+
+		### Returns +true+ if the ack interval has passed since the last ack.
+		def due?
+			return monotonic_time() - @last_ack >= @interval
+		end
+
+
+		### Acknowledge any pending deliveries. Must be called with the mutex
+		### held.
+		def flush_unlocked
+			return if @pending.zero?
+
+			@ack_block.call( @last_tag )
+			@acks    += 1
+			@acked   += @pending
+			@pending  = 0
+			@last_ack = monotonic_time()
+		end
+
+	end # class AckBatcher
+
+
+	#
+	# A single consumer in the pool; owns its own connection to the players bus so
+	# that its blocking subscription doesn't contend with the other consumers.
+	#
+	class Consumer
+		include MUES::Constants,
+		        MUES::Loggable
+
+		### Create a new Consumer for the given +reactor+ that will drain the
+		### queue called +queue_name+.
+		def initialize( reactor, index, queue_name, config )
+			@reactor    = reactor
+			@index      = index
+			@queue_name = queue_name
+			@config     = config
+
+			@client     = nil
+			@queue      = nil
+			@thread     = nil
+			@timer      = nil
+
+			batch, interval = config.values_at( :command_ack_batch, :command_ack_interval )
+			@acks = AckBatcher.new( batch || DEFAULT_COMMAND_ACK_BATCH,
+			                        interval || DEFAULT_COMMAND_ACK_INTERVAL ) do |tag|
+				@queue.ack( :delivery_tag => tag, :multiple => true )
+			end
+		end
+
+
+		######
+		public
+		######
+
+		# The consumer's index in the pool
+		attr_reader :index
+
+		# The name of the queue the consumer drains
+		attr_reader :queue_name
+
+		# The consumer's thread
+		attr_reader :thread
+
+		# The MUES::CommandReactor::AckBatcher that acknowledges the consumer's
+		# deliveries
+		attr_reader :acks
+
+
+		### Return the consumer tag used for the consumer's subscription.
+		def consumer_tag
+			return "engine-%d" % [ self.index ]
+		end
+
+
+		### Connect to the players bus and start consuming in a new thread, which is
+		### returned. If a block is given, it is called with the thread when it exits.
+		def start( &on_exit )
+			@thread = Thread.new do
+				begin
+					self.connect
+					self.start_ack_timer
+					@queue.subscribe(
+						:header       => true,
+						:consumer_tag => self.consumer_tag,
+						:no_ack       => false
+					  ) do |event|
+						@reactor.wait_for_capacity
+						@reactor.submit( event )
+						@acks.delivered( event[:delivery_details][:delivery_tag] )
+					end
+				rescue => err
+					self.log.error "Consumer %d crashed: %s: %s" % [ self.index, err.class.name, err.message ]
+				ensure
+					@timer.kill if @timer
+					on_exit.call( Thread.current ) if on_exit
+				end
+			end
+
+			return @thread
+		end
+
+
+		### Cancel the subscription, disconnect from the bus, and wait for the
+		### consumer's thread to exit.
+		def stop
+			if @queue
+				@queue.unsubscribe( :consumer_tag => self.consumer_tag )
+				@acks.flush
+			end
+			@client.stop if @client
+			@thread.join if @thread && @thread != Thread.current
+		end
+
+
+		#########
+		protected
+		#########
+
+		### Start the thread that acknowledges a partial batch of deliveries once
+		### the ack interval is up, even if no more deliveries arrive.
+		def start_ack_timer
+			return if @acks.interval <= 0
+
+			@timer = Thread.new do
+				loop do
+					sleep @acks.interval
+					begin
+						@acks.flush_if_due
+					rescue => err
+						self.log.error "Consumer %d couldn't ack: %s: %s" %
+							[ self.index, err.class.name, err.message ]
+					end
+				end
+			end
+		end
+
+
+		### Open the consumer's connection and declare its queue.
+		def connect
+			vhost, user, password = @config.values_at( :players_vhost, :mq_user, :mq_pass )
+
+			self.log.debug "Consumer %d connecting to %s as %s" % [ self.index, vhost, user ]
+			@client = Bunny.new( :vhost => vhost, :user => user, :pass => password )
+			@client.start
+			@client.qos( :prefetch_count => @config[:command_prefetch] || DEFAULT_COMMAND_PREFETCH )
+
+			@queue = @client.queue( self.queue_name, QUEUE_OPTIONS )
+		end
+
+	end # class Consumer
+
+end # class MUES::CommandReactor
+
@@ -24,5 +24,111 @@ module MUES::Constants
 	# The name of the vhost that will be used for environment events.
 	DEFAULT_ENVIRONMENT_VHOST = '/env'
 
+	# The number of threads the engine uses to consume player command events
+	DEFAULT_COMMAND_CONSUMERS = 4
+
+	# The maximum number of unacknowledged command events the broker will deliver
+	# to each command consumer
+	DEFAULT_COMMAND_PREFETCH = 64
+
+	# Command events are acknowledged in batches of (at most) this many deliveries...
+	DEFAULT_COMMAND_ACK_BATCH = 16
+
+	# ...or after this many seconds, whichever comes first
+	DEFAULT_COMMAND_ACK_INTERVAL = 0.1
+
+	# The length of one simulation tick of the Environment, in seconds
+	DEFAULT_TICK_LENGTH = 0.1
+
+	# What the Environment does when it falls behind: either :catch_up (run the
+	# missed ticks back-to-back) or :skip (drop them)
+	DEFAULT_OVERRUN_POLICY = :catch_up
+
+	# The most ticks the Environment will run back-to-back to catch up before
+	# giving up and skipping the rest
+	DEFAULT_MAX_CATCHUP_TICKS = 5
+
+	# The maximum number of events that can be waiting in the engine's event queue
+	DEFAULT_EVENT_QUEUE_CAPACITY = 10_000
+
+	# The number of worker threads that handle events from the event queue
+	DEFAULT_EVENT_QUEUE_WORKERS = 4
+
+	# The fraction of its capacity at which the event queue signals backpressure...
+	DEFAULT_EVENT_QUEUE_HIGH_WATER = 0.8
+
+	# ...and the fraction it has to drain down to before releasing it again
+	DEFAULT_EVENT_QUEUE_LOW_WATER = 0.5
+
+	# The number of bytes of output a player's output buffer will hold before it's
+	# published early, without waiting for the end of the tick
+	DEFAULT_OUTPUT_BUFFER_SIZE = 16 * 1024
+
+	# The length of a side of one cell of the Environment's spatial index, which
+	# should be about the range of the most common proximity queries
+	DEFAULT_SPATIAL_CELL_SIZE = 16.0
+
+	# The distance within which nodes become interesting to a session...
+	DEFAULT_INTEREST_RADIUS = 32.0
+
+	# ...and how much further they have to go before they stop being interesting
+	DEFAULT_INTEREST_HYSTERESIS = 8.0
+
+	# The number of updates of a node that are sent to a session as deltas between
+	# full keyframes
+	DEFAULT_DELTA_KEYFRAME_INTERVAL = 100
+
+	# The number of unacknowledged updates of a node after which the session is
+	# sent keyframes until it catches up
+	DEFAULT_DELTA_MAX_UNACKED = 32
+
+	# The directory the object store keeps its log segments in
+	DEFAULT_OBJECTSTORE_DIR = 'objectstore'
+
+	# The size, in bytes, at which the object store starts a new log segment
+	DEFAULT_OBJECTSTORE_SEGMENT_SIZE = 64 * 1024 * 1024
+
+	# The longest a changed object waits before the object store writes it, in
+	# seconds...
+	DEFAULT_OBJECTSTORE_FLUSH_INTERVAL = 1.0
+
+	# ...unless this many changed objects are waiting
+	DEFAULT_OBJECTSTORE_BATCH_SIZE = 500
+
+	# The number of objects the object store keeps in memory before it starts
+	# evicting cold ones
+	DEFAULT_OBJECTSTORE_RESIDENT_LIMIT = 100_000
+
+	# The memory manager that chooses which objects to evict ('Null' never evicts
+	# anything; 'Clock' evicts approximately the least-recently-used)
+	DEFAULT_MEMORY_MANAGER = 'Null'
+
+	# The number of seconds between checkpoints of the world
+	DEFAULT_CHECKPOINT_INTERVAL = 300.0
+
+	# The number of world snapshots to keep
+	DEFAULT_CHECKPOINT_KEEP = 2
+
+	# Whether the Engine writes log messages from a background thread
+	DEFAULT_ASYNC_LOGGING = true
+
+	# The number of log messages that can be waiting to be written
+	DEFAULT_LOG_BUFFER_SIZE = 8192
+
+	# What happens to log messages when the buffer is full (:drop or :block)
+	DEFAULT_LOG_OVERFLOW_POLICY = :drop
+
+	# The format log messages are written in (:text, or :json or :binary for
+	# structured records)
+	DEFAULT_LOG_FORMAT = :text
+
+	# The path of the UNIX socket the admin console listens on (nil to not start
+	# the console)
+	DEFAULT_ADMIN_SOCKET = 'mues-admin.sock'
+
+	# The number of seconds between the snapshots of the engine's metrics that
+	# are published to the stats exchange
+	DEFAULT_METRICS_INTERVAL = 10.0
+
 end # module MUES::Constants
 
@@ -0,0 +1,222 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+
+
+# Encodes the state of nodes sent to each session as deltas against the last
+# state the session acknowledged, so that the steady-state cost of keeping a
+# client up to date is proportional to how much is changing rather than to how
+# much there is.
+#
+# A node's state is a Hash of fields. For each session and node, the encoder
+# remembers the states it has sent that haven't been acknowledged yet, and the
+# newest one that has (the baseline). Each update is encoded as the fields that
+# differ from the baseline, tagged with the sequence number of the baseline it
+# applies to; when the client acknowledges an update's sequence number, the
+# state in that update becomes the new baseline. Because every delta is against
+# an acknowledged state, a client that misses an update can still apply the
+# next one.
+#
+# A full keyframe is sent instead when there's no baseline yet, after every
+# :delta_keyframe_interval updates, and when too many updates have gone
+# unacknowledged (the client has probably fallen behind or gone away).
+#
+# Encoded updates are Hashes suitable for a MUES::WireFormat :node_diff frame:
+#
+#   { :node => id, :seq => 12, :key => true, :set => { all fields } }
+#   { :node => id, :seq => 13, :base => 12, :set => { changed }, :unset => [ removed ] }
+#
+# Clients turn them back into states with a MUES::DeltaEncoder::Decoder.
+#
+# == Synopsis
+#
+#   encoder = MUES::DeltaEncoder.new
+#   update = encoder.encode( session, node.id, node.state ) or return
+#   session.send_output( :node_diff, update )
+#
+#   # ...when the client acknowledges it
+#   encoder.ack( session, seq )
+#
+class MUES::DeltaEncoder
+	include MUES::Constants,
+	        MUES::Loggable
+
+	#
+	# The client's side of the encoding: keeps the states it's received for
+	# each node until it knows they won't be used as a baseline any more.
+	#
+	class Decoder
+
+		### Create a new, empty Decoder that will keep up to +history+ states of
+		### each node.
+		def initialize( history=MUES::Constants::DEFAULT_DELTA_MAX_UNACKED * 2 )
+			@history = history
+			@states  = {}
+		end
+
+
+		######
+		public
+		######
+
+		### Decode the given +update+ and return the node's new state. Returns
+		### +nil+ if the update is against a baseline the decoder doesn't have.
+		def decode( update )
+			node, seq, base = update.values_at( :node, :seq, :base )
+			history = ( @states[node] ||= {} )
+
+			if update[ :key ]
+				state = {}
+			else
+				baseline = history[ base ] or return nil
+				state = baseline.dup
+			end
+
+			state.update( update[:set] ) if update[ :set ]
+			( update[:unset] || [] ).each {|field| state.delete(field) }
+
+			# Baselines only ever move forward, so states older than this one won't
+			# be referred to again
+			history.delete_if {|old_seq, _| old_seq < base } if base
+			history[ seq ] = state
+			history.delete( history.keys.min ) while history.length > @history
+
+			return state
+		end
+
+
+		### Forget everything about the specified +node+.
+		def forget( node )
+			@states.delete( node )
+		end
+
+	end # class Decoder
+
+
+	# The per-session, per-node tracking state
+	NodeTrack = Struct.new( :baseline_seq, :baseline, :pending, :since_keyframe )
+
+
+	### Create a new DeltaEncoder with the given +config+, which may contain the
+	### :delta_keyframe_interval and :delta_max_unacked keys.
+	def initialize( config={} )
+		@keyframe_interval = Integer( config[:delta_keyframe_interval] || DEFAULT_DELTA_KEYFRAME_INTERVAL )
+		@max_unacked       = Integer( config[:delta_max_unacked] || DEFAULT_DELTA_MAX_UNACKED )
+
+		@sessions = {}   # session => { :seq => n, :nodes => { node => NodeTrack } }
+		@mutex    = Mutex.new
+		@stats    = Hash.new( 0 )
+	end
+
+
+	######
+	public
+	######
+
+	# The number of updates of a node between keyframes
+	attr_reader :keyframe_interval
+
+	# The number of unacknowledged updates of a node after which the encoder
+	# falls back to keyframes
+	attr_reader :max_unacked
+
+
+	### Encode the given +state+ of +node+ for the specified +session+, returning
+	### the update to send, or +nil+ if the session already has that state.
+	def encode( session, node, state )
+		@mutex.synchronize do
+			info = ( @sessions[session] ||= { :seq => 0, :nodes => {} } )
+			track = ( info[:nodes][node] ||= NodeTrack.new(nil, nil, [], 0) )
+			last_sent = track.pending.empty? ? track.baseline : track.pending.last[ 1 ]
+			return nil if last_sent == state
+
+			seq = ( info[:seq] += 1 )
+			state = state.dup
+			track.pending << [ seq, state ]
+
+			# Once too many updates are outstanding, only the newest ones can become
+			# the baseline, and the client gets keyframes until it acknowledges one
+			unacked = track.pending.length > @max_unacked
+			track.pending.shift while track.pending.length > @max_unacked + 1
+
+			if track.baseline.nil? || unacked || track.since_keyframe >= @keyframe_interval
+				track.since_keyframe = 0
+				@stats[ :keyframes ] += 1
+				return { :node => node, :seq => seq, :key => true, :set => state }
+			end
+
+			track.since_keyframe += 1
+			@stats[ :deltas ] += 1
+			update = { :node => node, :seq => seq, :base => track.baseline_seq }
+			set, unset = self.diff( track.baseline, state )
+			update[ :set ] = set unless set.empty?
+			update[ :unset ] = unset unless unset.empty?
+
+			return update
+		end
+	end
+
+
+	### Record the specified +session+'s acknowledgement of every update up to and
+	### including the one with sequence number +seq+, making the newest state of
+	### each node it acknowledges the node's new baseline.
+	def ack( session, seq )
+		@mutex.synchronize do
+			info = @sessions[ session ] or return
+			info[ :nodes ].each_value do |track|
+				acked = track.pending.select {|pseq, _| pseq <= seq }
+				next if acked.empty?
+
+				track.baseline_seq, track.baseline = acked.last
+				track.pending -= acked
+			end
+		end
+	end
+
+
+	### Forget the specified +session+'s baseline for +node+, e.g., because it's
+	### no longer interested in it. The next update will be a keyframe.
+	def forget( session, node )
+		@mutex.synchronize do
+			info = @sessions[ session ] or return
+			info[ :nodes ].delete( node )
+		end
+	end
+
+
+	### Forget everything about the specified +session+.
+	def remove_session( session )
+		@mutex.synchronize { @sessions.delete(session) }
+	end
+
+
+	### Return a copy of the encoder's counters: the number of keyframes and
+	### deltas it's encoded.
+	def stats
+		stats = @mutex.synchronize { @stats.dup }
+		return { :keyframes => stats[:keyframes], :deltas => stats[:deltas] }
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the fields of +state+ that differ from +baseline+ as a Hash, and the
+	### fields of +baseline+ that +state+ doesn't have as an Array.
+	def diff( baseline, state )
+		set = {}
+		state.each do |field, value|
+			set[ field ] = value unless baseline.key?( field ) && baseline[ field ] == value
+		end
+		unset = baseline.keys.reject {|field| state.key?(field) }
+
+		return set, unset
+	end
+
+end # class MUES::DeltaEncoder
+
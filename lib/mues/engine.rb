@@ -1,5 +1,6 @@
 #!/usr/bin/env ruby
 
+require 'thread'
 require 'bunny'
 require 'verse'
 require 'verse/mixins'
@@ -9,6 +10,16 @@ require 'mues'
 require 'mues/mixins'
 require 'mues/constants'
 require 'mues/environment'
+require 'mues/commandreactor'
+require 'mues/eventqueue'
+require 'mues/areaexchange'
+require 'mues/objectstore'
+require 'mues/checkpointer'
+require 'mues/asynclogdevice'
+require 'mues/structuredlogformatter'
+require 'mues/adminconsole'
+require 'mues/metrics'
+require 'mues/metricsexporter'
 
 
 # The main server object class.
@@ -20,11 +31,58 @@ class MUES::Engine
 	# The Engine's version-control revision
 	VCSREV = %q$Revision$
 
+	# The codes written to the runloop's self-pipe for each signal the engine
+	# handles
+	SIGNAL_CODES = {
+		'T' => 'TERM',
+		'I' => 'INT',
+		'H' => 'HUP',
+	}
+
+	# The code written to the self-pipe when there's an event in the supervisor
+	# queue
+	WAKEUP_EVENT = '.'
+
+	# The maximum number of wakeup codes to read from the self-pipe at once
+	WAKEUP_READ_SIZE = 512
+
+	# The number of players that have connected
+	CONNECTS = MUES::Metrics.counter( :connects, "player connections" )
+
+	# How long setting up each player's connection took
+	CONNECT_LATENCY = MUES::Metrics.histogram( :connect_latency, "microseconds to connect a player" )
+
 	# The default configuration
 	DEFAULT_CONFIG = {
-		:mq_user       => DEFAULT_MQ_USER,
-		:mq_pass       => DEFAULT_MQ_PASS,
-		:players_vhost => DEFAULT_PLAYERS_VHOST,
+		:mq_user              => DEFAULT_MQ_USER,
+		:mq_pass              => DEFAULT_MQ_PASS,
+		:players_vhost        => DEFAULT_PLAYERS_VHOST,
+		:env_vhost            => DEFAULT_ENVIRONMENT_VHOST,
+		:command_consumers    => DEFAULT_COMMAND_CONSUMERS,
+		:command_prefetch     => DEFAULT_COMMAND_PREFETCH,
+		:command_ack_batch    => DEFAULT_COMMAND_ACK_BATCH,
+		:command_ack_interval => DEFAULT_COMMAND_ACK_INTERVAL,
+		:tick_length          => DEFAULT_TICK_LENGTH,
+		:overrun_policy       => DEFAULT_OVERRUN_POLICY,
+		:max_catchup_ticks    => DEFAULT_MAX_CATCHUP_TICKS,
+		:event_queue_capacity   => DEFAULT_EVENT_QUEUE_CAPACITY,
+		:event_queue_workers    => DEFAULT_EVENT_QUEUE_WORKERS,
+		:event_queue_high_water => DEFAULT_EVENT_QUEUE_HIGH_WATER,
+		:event_queue_low_water  => DEFAULT_EVENT_QUEUE_LOW_WATER,
+		:output_buffer_size   => DEFAULT_OUTPUT_BUFFER_SIZE,
+		:objectstore_dir      => DEFAULT_OBJECTSTORE_DIR,
+		:objectstore_resident_limit => DEFAULT_OBJECTSTORE_RESIDENT_LIMIT,
+		:memory_manager       => DEFAULT_MEMORY_MANAGER,
+		:checkpoint_interval  => DEFAULT_CHECKPOINT_INTERVAL,
+		:checkpoint_keep      => DEFAULT_CHECKPOINT_KEEP,
+		:async_logging        => DEFAULT_ASYNC_LOGGING,
+		:log_buffer_size      => DEFAULT_LOG_BUFFER_SIZE,
+		:log_overflow_policy  => DEFAULT_LOG_OVERFLOW_POLICY,
+		:log_levels           => {},
+		:log_format           => DEFAULT_LOG_FORMAT,
+		:log_sampling         => {},
+		:admin_socket         => DEFAULT_ADMIN_SOCKET,
+		:metrics_interval     => DEFAULT_METRICS_INTERVAL,
 	}
 
 
@@ -49,16 +107,45 @@ class MUES::Engine
 		@connect_queue  = nil
 		@login_exch     = nil
 
+		# The in-process queue for events generated inside the engine, and the
+		# reactor that dispatches player command events (and holds off while the
+		# event queue is congested)
+		@event_queue    = MUES::EventQueue.new( @config )
+		@reactor        = MUES::CommandReactor.new( @config, @event_queue )
+
+		# The topic exchange that events are broadcast to areas through
+		@areas          = MUES::AreaExchange.new( @playersbus, @config[:output_buffer_size] )
+
 		# Threads and thread groups
 		@threadgroup    = ThreadGroup.new
 		@connect_thread = nil
 		@env_thread     = nil
 
-		# The environment object
+		# Supervision: events from other threads go into the queue, and the
+		# self-pipe wakes up the runloop to handle them
+		@supervisor_queue = Queue.new
+		@wakeup_reader, @wakeup_writer = IO.pipe
+		@stopping       = false
+
+		# The environment object, the store its objects are persisted in, and
+		# the checkpointer that snapshots the store
 		@environment    = nil
+		@object_store   = nil
+		@checkpointer   = nil
 
 		# The hash of connected players
 		@players        = {}
+
+		# The admin console, which is served from the runloop
+		@admin_console  = nil
+
+		# The publisher of the engine's metrics
+		@metrics_exporter = nil
+
+		# The background log device, and the logger it replaced
+		@log_device     = nil
+		@previous_logger = nil
+		@previous_formatter = nil
 	end
 
 
@@ -81,83 +168,281 @@ class MUES::Engine
 	# The MUES::Environment that is running the game world
 	attr_reader :environment
 
+	# The MUES::ObjectStore the Environment's objects are persisted in
+	attr_reader :object_store
+
+	# The MUES::Checkpointer that takes snapshots of the world
+	attr_reader :checkpointer
+
+	# The MUES::CommandReactor that dispatches command events to connected players
+	attr_reader :reactor
+
+	# The MUES::EventQueue that handles events generated inside the engine
+	attr_reader :event_queue
+
+	# The MUES::AreaExchange that broadcasts events to everyone in an area
+	attr_reader :areas
+
+	# The MUES::AsyncLogDevice log messages are written through while the
+	# engine is running, if :async_logging is set
+	attr_reader :log_device
+
+	# The connected MUES::Players, keyed by name
+	attr_reader :players
+
+	# The MUES::AdminConsole, if the engine has an :admin_socket
+	attr_reader :admin_console
+
+	# The MUES::MetricsExporter that publishes the engine's metrics
+	attr_reader :metrics_exporter
+
 
 	### Start the engine
 	def start
+		self.start_async_logging if @config[:async_logging]
+		self.start_structured_logging unless @config[:log_format].to_sym == :text
+		@config[:log_levels].each {|category, level| MUES::Loggable.set_level(category, level) }
 		self.log.debug "Starting the Engine..."
 		self.set_signal_handlers
 
+		self.register_metrics
+		self.event_queue.start( self.threadgroup ) do |thread|
+			self.notify_supervisor( :thread_exit, thread )
+		end
+		self.start_environment_bus
 		self.start_environment
 		self.start_connect_listener
+		self.reactor.start( self.threadgroup ) do |thread|
+			self.notify_supervisor( :thread_exit, thread )
+		end
+		self.start_admin_console if @config[:admin_socket]
 
 		self.enter_runloop
 	end
 
 
-	### Create the environment, and start its thread.
+	### Open the object store (which loads the latest snapshot of the world) and
+	### create the environment, and start its thread.
 	def start_environment
-		self.env_thread = Thread.new do
-			Thread.current.abort_on_exception = true
+		unless @object_store
+			@object_store = MUES::ObjectStore.new( @config )
+			@object_store.start( self.threadgroup )
+			@checkpointer = MUES::Checkpointer.new( @object_store, @config )
+			@checkpointer.start( self.threadgroup )
+		end
+
+		self.env_thread = self.start_supervised_thread do
 			self.log.debug "  creating the environment object and starting it..."
-			@environment = MUES::Environment.new
+			@environment = MUES::Environment.new( @config, @object_store )
+			@environment.add_tick_hook( self.method(:flush_player_output) )
+			@checkpointer.restore( @environment )
+			@environment.schedule_every( @config[:checkpoint_interval] ) do
+				@checkpointer.checkpoint( @environment )
+			end
 			@environment.start
 		end
-		self.threadgroup.add( self.env_thread )
+	end
+
+
+	### Connect to the environment vhost and start publishing the engine's
+	### metrics to it.
+	def start_environment_bus
+		self.log.debug "Starting the environment event bus..."
+		@envbus.start
+
+		@metrics_exporter = MUES::MetricsExporter.new( @envbus, @config )
+		@metrics_exporter.start( self.threadgroup )
+	end
+
+
+	### Stop publishing metrics and disconnect from the environment vhost.
+	def stop_environment_bus
+		self.log.info "Stopping the environment event bus."
+		@metrics_exporter.shutdown if @metrics_exporter
+		@metrics_exporter = nil
+		@envbus.stop
 	end
 
 
 	### Set up the player event bus and start the incoming-connection
 	### listener.
 	def start_connect_listener
-		self.connect_thread = Thread.new do
-			Thread.current.abort_on_exception = true
+		self.connect_thread = self.start_supervised_thread do
 			self.log.debug "  setting up the connection-handler"
-			self.start_player_bus( vhost, user, pass )
+			self.start_player_bus
 		end
-		self.threadgroup.add( self.connect_thread )
 	end
 
 
-	### Start the main server loop, which for now just waits for its 
-	### main threads to die off and then returns.
+	### Start the main server loop, which sleeps until there's something for the
+	### supervisor to do (a thread exited or a signal arrived) or an admin console
+	### client to serve, handles it, and returns once the engine is stopping and
+	### all of its threads have finished.
 	def enter_runloop
-		begin
-			self.log.debug "In runloop..."
-			self.threadgroup.list.each do |thread|
-				if !thread.alive?
-					self.log.info "  joining %p" % [ thread ]
-					thread.join
-					ThreadGroup::Default.add( thread )
-				else
-					self.log.debug "  %p is still alive; continuing" % [ thread ]
+		self.log.debug "In runloop..."
+
+		until @stopping && self.threadgroup.list.empty?
+			begin
+				readers, writers = [ @wakeup_reader ], []
+				if @admin_console
+					readers += @admin_console.readers
+					writers += @admin_console.writers
+				end
+
+				readable, writable = IO.select( readers, writers )
+				readable.each do |io|
+					if io == @wakeup_reader
+						self.handle_wakeup( @wakeup_reader.read_nonblock(WAKEUP_READ_SIZE) )
+					else
+						@admin_console.handle_readable( io )
+					end
 				end
+				writable.each {|io| @admin_console.handle_writable(io) }
+			rescue Errno::EAGAIN, Errno::EINTR
+				next
+			rescue IOError
+				# The admin console was shut down while its sockets were selected
+				next if @stopping
+				raise
+			rescue => err
+				self.log.error "Uncaught %s: %s\n  %s" % [
+					err.class.name,
+					err.message,
+					err.backtrace.join( "\n  " )
+				]
 			end
+		end
 
-			sleep 0.5
-		rescue => err
-			self.log.error "Uncaught %s: %s\n  %s" % [
-				err.class.name,
-				err.message,
-				err.backtrace.join( "\n  " )
-			]
-		end until self.threadgroup.list.empty?
+		self.log.info "All engine threads have exited."
+	end
+
+
+	### Start the admin console on the configured :admin_socket. The runloop
+	### serves it from then on.
+	def start_admin_console
+		@admin_console = MUES::AdminConsole.new( self, @config )
+		@admin_console.start
+	rescue => err
+		self.log.error "Couldn't start the admin console: %s: %s" % [ err.class.name, err.message ]
+		@admin_console = nil
+	end
+
+
+	### Return a Hash of the counters and timings of the engine and each of its
+	### parts.
+	def stats
+		stats = {
+			:players     => @players.length,
+			:threads     => self.threadgroup.list.length,
+			:event_queue => self.event_queue.stats,
+			:reactor     => self.reactor.stats,
+		}
+
+		stats[ :environment ] = @environment.stats.merge( :tick => @environment.tick ) if @environment
+		stats[ :object_store ] = @object_store.stats if @object_store
+		stats[ :checkpointer ] = @checkpointer.stats if @checkpointer
+		stats[ :log_device ] = @log_device.stats if @log_device
+		stats[ :admin_clients ] = @admin_console.client_count if @admin_console
+
+		return stats
+	end
+
+
+	### Queue a supervisor event of the given +type+ with the specified +args+ and
+	### wake up the runloop to handle it. This is safe to call from any thread.
+	def notify_supervisor( type, *args )
+		@supervisor_queue.push( [type, *args] )
+		self.wake_runloop( WAKEUP_EVENT )
 	end
 
 
 	### Stop the engine and disconnect all players.
 	def stop
+		@stopping = true
 		self.unset_signal_handlers
 		self.log.info "Stopping the Engine."
 
-		@environment.stop
+		# Wait for the tick loop to finish any checkpoint it's taking, and for the
+		# checkpointer to finish writing its snapshot, before closing the store
+		if @environment
+			@environment.stop
+			thread = self.env_thread
+			thread.join if thread && thread != Thread.current
+		end
+		@checkpointer.shutdown if @checkpointer
+		@object_store.close if @object_store
+
+		@players.values.each do |pl|
+			self.log.info "  disconnecting player %s" % [ pl.name ]
+			pl.disconnect
+		end
 
+		self.reactor.stop
+		self.event_queue.shutdown
 		self.stop_player_bus
 		self.stop_environment_bus
+		@admin_console.shutdown if @admin_console
+		self.stop_structured_logging
+		self.stop_async_logging
+	end
 
-		@players.each do |name, pl|
-			self.log.info "  disconnecting player %s" % [ name ]
-			pl.disconnect
+
+	### Switch the global logger over to one that writes to the same device from
+	### a background thread, keeping its level and formatter.
+	def start_async_logging
+		return if @log_device
+
+		# A logger without a device throws its messages away anyway
+		device = MUES.logger.instance_variable_get( :@logdev ) or return
+
+		@previous_logger = MUES.logger
+		@log_device = MUES::AsyncLogDevice.new( device, @config )
+
+		logger = Logger.new( @log_device )
+		logger.level = @previous_logger.level
+		formatter = @previous_logger.formatter
+
+		# Formatters that check their logger's level need to look at the new one
+		if formatter.respond_to?( :logger= )
+			formatter = formatter.dup
+			formatter.logger = logger
 		end
+		logger.formatter = formatter
+
+		MUES.logger = logger
+	end
+
+
+	### Write out any buffered log messages and go back to the logger that was in
+	### use before the engine started.
+	def stop_async_logging
+		return unless @log_device
+
+		MUES.logger = @previous_logger
+		@log_device.close
+		@log_device = @previous_logger = nil
+	end
+
+
+	### Switch the global logger's formatter over to a
+	### MUES::StructuredLogFormatter that writes records in the configured
+	### :log_format, sampled at the :log_sampling rates.
+	def start_structured_logging
+		return if @previous_formatter
+
+		@previous_formatter = MUES.logger.formatter
+		MUES.logger.formatter = MUES::StructuredLogFormatter.new( MUES.logger,
+			@config[:log_format], @config[:log_sampling] )
+	end
+
+
+	### Go back to the formatter that was in use before structured logging was
+	### started.
+	def stop_structured_logging
+		return unless @previous_formatter
+
+		MUES.logger.formatter = @previous_formatter
+		@previous_formatter = nil
 	end
 
 
@@ -166,31 +451,126 @@ class MUES::Engine
 	protected
 	#########
 
-	### Set up various signals to shut down/reload the engine.
-	def set_signal_handlers
-		stop_handler = lambda {|*args|
-			self.log.error "Stopping the engine: %p" % [ args ]
-			self.stop
-		}
+	### Register the gauges whose values are read from the engine.
+	def register_metrics
+		MUES::Metrics.gauge( :players_online, "connected players" ) { @players.length }
+		MUES::Metrics.gauge( :event_queue_depth, "queued events" ) { self.event_queue.depth }
+	end
 
-		Signal.trap( :TERM, &stop_handler )
-		Signal.trap( :INT, &stop_handler )
-		Signal.trap( :HUP, &stop_handler )
+
+	### Set up various signals to shut down/reload the engine. The handlers just
+	### write the signal's code to the self-pipe; the signal itself is handled by the
+	### runloop outside of the trap context.
+	def set_signal_handlers
+		SIGNAL_CODES.each do |code, signal|
+			Signal.trap( signal ) { self.wake_runloop(code) }
+		end
 	end
 
 
 	### Restore default signal handlers.
 	def unset_signal_handlers
-		Signal.trap( :TERM, Signal::SIG_DFL )
-		Signal.trap( :INT, Signal::SIG_DFL )
-		Signal.trap( :HUP, Signal::SIG_DFL )
+		SIGNAL_CODES.each_value do |signal|
+			Signal.trap( signal, 'SIG_DFL' )
+		end
+	end
+
+
+	### Write the given +code+ to the self-pipe to wake up the runloop.
+	def wake_runloop( code )
+		@wakeup_writer.write_nonblock( code )
+	rescue Errno::EAGAIN
+		# The pipe is full, so the runloop has plenty of wakeups pending already
+	end
+
+
+	### Handle the wakeup +codes+ read from the self-pipe.
+	def handle_wakeup( codes )
+		codes.each_byte do |byte|
+			code = byte.chr
+
+			if code == WAKEUP_EVENT
+				self.handle_supervisor_event( *@supervisor_queue.shift ) until
+					@supervisor_queue.empty?
+			elsif signal = SIGNAL_CODES[ code ]
+				self.handle_signal( signal )
+			else
+				self.log.warn "Unknown wakeup code %p" % [ code ]
+			end
+		end
+	end
+
+
+	### Handle a supervisor event of the given +type+.
+	def handle_supervisor_event( type, *args )
+		case type
+		when :thread_exit
+			self.handle_thread_exit( *args )
+		else
+			self.log.warn "Unhandled supervisor event %p: %p" % [ type, args ]
+		end
+	end
+
+
+	### Handle the delivery of the specified +signal+.
+	def handle_signal( signal )
+		self.log.error "Stopping the engine: SIG%s" % [ signal ]
+		self.stop unless @stopping
+	end
+
+
+	### Start a new thread in the engine's threadgroup that will run the given
+	### +block+ and notify the supervisor when it exits, whether normally or by
+	### raising an exception.
+	def start_supervised_thread( &block )
+		thread = Thread.new do
+			begin
+				block.call
+			rescue ::Exception => err
+				self.log.error "%p crashed: %s: %s\n  %s" % [
+					Thread.current,
+					err.class.name,
+					err.message,
+					err.backtrace.join( "\n  " )
+				]
+			ensure
+				self.notify_supervisor( :thread_exit, Thread.current )
+			end
+		end
+
+		self.threadgroup.add( thread )
+		return thread
+	end
+
+
+	### Reap the specified +thread+ after it exits, restarting it if it is one of
+	### the engine's main threads, a command consumer's, or an event queue
+	### worker, and the engine isn't shutting down.
+	def handle_thread_exit( thread )
+		self.log.info "  joining %p" % [ thread ]
+		thread.join rescue nil
+		ThreadGroup::Default.add( thread )
+		return if @stopping
+
+		if thread == self.env_thread
+			self.log.warn "Environment thread exited; restarting it."
+			self.start_environment
+		elsif thread == self.connect_thread
+			self.log.warn "Connection thread exited; restarting it."
+			self.start_connect_listener
+		elsif consumer = self.reactor.restart_consumer( thread )
+			self.log.warn "Command consumer %d exited; restarted it." % [ consumer.index ]
+		elsif self.event_queue.restart_worker( thread )
+			self.log.warn "Event queue worker exited; restarted it."
+		end
 	end
 
 
 	### Start the connections to AMQP for communication with players.
-	def start_player_bus( vhost, user, password )
+	def start_player_bus
 		self.log.debug "Starting the players event bus..."
 		@playersbus.start
+		self.areas.start
 
 		# Set up the exchange player clients will use for logging in
 		self.log.debug "  setting up the login exchange..."
@@ -225,14 +605,17 @@ class MUES::Engine
 
 
 	### Handle an incoming connection event: Read the username from the connect 
-	### event and set up a client thread for the corresponding exchange.
+	### event and hand the corresponding exchange off to the command reactor.
 	def handle_connect_event( event )
-		player = Player.new_from_connect_event( event )
-		player.connect_to_bus( @playersbus )
-		@players[ playername ] = player
-
-		thr = player.start
-		@player_threads.add( thr )
+		CONNECTS.increment
+		CONNECT_LATENCY.time do
+			player = MUES::Player.new_from_connect_event( event )
+			player.connect_to_bus( @playersbus, self.reactor, @config[:output_buffer_size] )
+			player.on_disconnect {|pl| self.remove_player(pl) }
+			@players[ player.name ] = player
+
+			player.start
+		end
 	rescue => err
 		self.log.error "Connection event failed: %s: %s" % [ err.class.name, err.message ]
 		self.log.debug {
@@ -240,5 +623,38 @@ class MUES::Engine
 		}
 	end
 
+
+	### Forget the specified +player+ after they've disconnected, take them out
+	### of whatever area they were in, and drop their session's state in the
+	### environment.
+	def remove_player( player )
+		@players.delete( player.name ) if @players[ player.name ].equal?( player )
+		self.areas.leave( player )
+		self.environment.remove_session( player ) if self.environment
+	rescue => err
+		self.log.error "Removing player %s failed: %s: %s" % [ player.name, err.class.name, err.message ]
+	end
+
+
+	### Environment tick hook: publish the output each connected player's client
+	### was sent during the tick as a single message, and the events broadcast to
+	### each area as another.
+	def flush_player_output( environment, tick )
+		begin
+			self.areas.flush
+		rescue => err
+			self.log.error "Flushing area output failed: %s: %s" % [ err.class.name, err.message ]
+		end
+
+		@players.values.each do |player|
+			begin
+				player.flush_output
+			rescue => err
+				self.log.error "Flushing output for %s failed: %s: %s" %
+					[ player.name, err.class.name, err.message ]
+			end
+		end
+	end
+
 end # class MUES::Engine
 
@@ -1,24 +1,89 @@
 #!/usr/bin/env ruby
 
+require 'thread'
 require 'verse'
 require 'verse/mixins'
 
 require 'mues'
 require 'mues/mixins'
 require 'mues/constants'
+require 'mues/timerwheel'
+require 'mues/spatialindex'
+require 'mues/interestmanager'
+require 'mues/deltaencoder'
+require 'mues/metrics'
 
 
 ### The shared environment container object -- manages all interaction between the
 ### Engine and the game environment.
+###
+### The environment is simulated in fixed-length ticks. Once started, it runs each
+### tick at a fixed interval measured against the monotonic clock: it advances its
+### MUES::TimerWheel (firing any delayed events that are due) and then calls
+### each of its tick hooks. If a tick runs long, the environment either runs the
+### missed ticks back-to-back to catch up (up to a limit) or skips them, depending
+### on its overrun policy.
+###
+### The positions of the nodes in the world are kept in a MUES::SpatialIndex so
+### that questions like "who can hear this?" only have to look at the nodes
+### nearby, and a MUES::InterestManager works out which sessions each node's
+### changes need to be sent to. Sessions' interests are brought up to date at
+### the start of every tick. Node state goes to each session as deltas against
+### what it last acknowledged, courtesy of a MUES::DeltaEncoder.
 class MUES::Environment
 	include MUES::Loggable,
 	        MUES::Constants,
+	        MUES::TimeUtilities,
 	        Verse::SessionObserver,
 	        Verse::NodeObserver
 
-	### Create a new Environment that will connect to the .
-	def initialize
-		
+	# The valid overrun policies
+	OVERRUN_POLICIES = [ :catch_up, :skip ]
+
+	# The number of ticks that have been run
+	TICKS = MUES::Metrics.counter( :ticks, "ticks run" )
+
+	# How long each tick took
+	TICK_DURATION = MUES::Metrics.histogram( :tick_duration, "microseconds per tick" )
+
+
+	### Create a new Environment with the given +config+, persisting its objects
+	### in the specified MUES::ObjectStore if one is given.
+	def initialize( config={}, store=nil )
+		@tick_length    = Float( config[:tick_length] || DEFAULT_TICK_LENGTH )
+		@overrun_policy = ( config[:overrun_policy] || DEFAULT_OVERRUN_POLICY ).to_sym
+		@max_catchup    = Integer( config[:max_catchup_ticks] || DEFAULT_MAX_CATCHUP_TICKS )
+
+		raise ArgumentError, "invalid overrun policy %p" % [ @overrun_policy ] unless
+			OVERRUN_POLICIES.include?( @overrun_policy )
+
+		@store          = store
+		@timers         = MUES::TimerWheel.new
+		@tick_hooks     = []
+
+		@spatial_index  = MUES::SpatialIndex.new( config[:spatial_cell_size] || DEFAULT_SPATIAL_CELL_SIZE )
+		@world_mutex    = Mutex.new
+		@interest       = MUES::InterestManager.new( self, config )
+		@delta_encoder  = MUES::DeltaEncoder.new( config )
+
+		# Sessions that lose interest in a node start over with a keyframe if they
+		# regain it
+		@interest.on_change do |session, node, interested|
+			@delta_encoder.forget( session, node ) unless interested
+		end
+
+		@running        = false
+		@thread         = nil
+		@tick           = 0
+
+		@stats          = {
+			:ticks         => 0,
+			:skipped_ticks => 0,
+			:overruns      => 0,
+			:last_duration => 0.0,
+			:max_duration  => 0.0,
+			:total_time    => 0.0,
+		}
 	end
 
 
@@ -26,20 +91,257 @@ class MUES::Environment
 	public
 	######
 
+	# The length of a tick, in seconds
+	attr_reader :tick_length
+
+	# The environment's overrun policy (:catch_up or :skip)
+	attr_reader :overrun_policy
+
+	# The MUES::TimerWheel that holds delayed events
+	attr_reader :timers
+
+	# The MUES::ObjectStore the environment's objects are persisted in, if any
+	attr_reader :store
+
+	# The number of the last tick that was run
+	attr_reader :tick
+
+	# The tick-timing counters
+	attr_reader :stats
+
+	# The MUES::SpatialIndex of the positions of the nodes in the world
+	attr_reader :spatial_index
+
+	# The MUES::InterestManager that tracks which sessions can perceive which nodes
+	attr_reader :interest
+
+	# The MUES::DeltaEncoder that encodes node state for each session
+	attr_reader :delta_encoder
+
+
+	### Returns +true+ if the environment's tick loop is running.
+	def running?
+		return @running
+	end
+
 
-	### Start the environment
+	### Start the environment, running its tick loop in the current thread until
+	### #stop is called.
 	def start
-		
+		self.log.info "Starting the environment (%0.3fs ticks, %s on overrun)" %
+			[ self.tick_length, self.overrun_policy ]
+
+		@thread  = Thread.current
+		@running = true
+		next_tick = monotonic_time() + self.tick_length
+
+		while @running
+			now = monotonic_time()
+
+			if now < next_tick
+				sleep( next_tick - now )
+				next
+			end
+
+			next_tick = self.run_due_ticks( next_tick )
+		end
+
+		self.log.info "Environment stopped after %d ticks." % [ self.tick ]
 	end
 
 
 	### Stop the environment.
 	def stop
+		@running = false
+		@thread.wakeup if @thread && @thread.alive? && @thread != Thread.current
 	end
 
 
+	### Register a +hook+ (or a block) that will be called with the environment and
+	### the tick number at the end of every tick.
+	def add_tick_hook( hook=nil, &block )
+		hook ||= block or raise ArgumentError, "no hook given"
+		@tick_hooks << hook
+		return hook
+	end
 
 
-end # MUES::Environment
+	### Unregister the specified tick +hook+.
+	def remove_tick_hook( hook )
+		@tick_hooks.delete( hook )
+	end
+
+
+	### Schedule the given +block+ to run +delay+ seconds from now, rounded up to
+	### the next tick. Returns a MUES::TimerWheel::Timer that can be used to cancel
+	### it.
+	def schedule( delay, &block )
+		return self.timers.schedule( delay / self.tick_length, &block )
+	end
+
+
+	### Schedule the given +block+ to run every +interval+ seconds (rounded up to
+	### a whole number of ticks) until the returned MUES::TimerWheel::Timer is
+	### cancelled.
+	def schedule_every( interval, &block )
+		return self.timers.schedule_every( interval / self.tick_length, &block )
+	end
+
+
+	### Start tracking the position of the specified +node+, which is at the
+	### given coordinates.
+	def track_node( node, x, y, z )
+		@world_mutex.synchronize { @spatial_index.insert(node, x, y, z) }
+	end
+
+
+	### Update the position of the specified +node+, which has moved to the
+	### given coordinates.
+	def move_node( node, x, y, z )
+		@world_mutex.synchronize { @spatial_index.move(node, x, y, z) }
+	end
+
+
+	### Stop tracking the position of the specified +node+.
+	def untrack_node( node )
+		@world_mutex.synchronize { @spatial_index.remove(node) }
+		self.interest.place_node( node, nil )
+	end
+
+
+	### Return the [ x, y, z ] position of the specified +node+, or +nil+ if it
+	### isn't being tracked.
+	def position_of( node )
+		@world_mutex.synchronize { @spatial_index.position_of(node) }
+	end
+
+
+	### Return the tracked nodes that are within +radius+ of the given point.
+	def nodes_near( x, y, z, radius )
+		@world_mutex.synchronize { @spatial_index.within(x, y, z, radius) }
+	end
+
+
+	### Add the specified +object+ to the environment's object store, if it has
+	### one.
+	def persist( object )
+		self.store.store( object ) if self.store
+	end
+
+
+	### Note that the specified persistent +object+ has changed, so the object
+	### store will write it out the next time it flushes.
+	def object_changed( object )
+		self.store.mark_dirty( object ) if self.store
+	end
+
+
+	### Encode the given +state+ of +node+ for each session that's interested in
+	### it, and yield the session and the encoded update (suitable for a
+	### :node_diff MUES::WireFormat frame) to the block. Sessions that already
+	### have that state are skipped. Returns the number of updates yielded.
+	def send_node_state( node, state )
+		sent = 0
+		self.interest.forward( node ) do |session|
+			update = self.delta_encoder.encode( session, node, state ) or next
+			yield( session, update )
+			sent += 1
+		end
+
+		return sent
+	end
+
+
+	### Record the specified +session+'s acknowledgement of the node updates up to
+	### and including the one with the sequence number +seq+.
+	def acknowledge_node_updates( session, seq )
+		self.delta_encoder.ack( session, seq )
+	end
+
+
+	### Stop tracking the specified +session+'s interests, and forget the node
+	### state it was last sent (e.g., because its player has left).
+	def remove_session( session )
+		self.interest.remove_session( session )
+		self.delta_encoder.remove_session( session )
+	end
+
+
+	### Return the environment's own state (as opposed to that of the objects in
+	### it) as a Hash, for a checkpoint.
+	def checkpoint_state
+		return { :tick => @tick }
+	end
+
+
+	### Restore the environment's own state from the given +state+, a Hash
+	### returned by #checkpoint_state.
+	def restore_state( state )
+		@tick = state[:tick] || 0
+	end
+
+
+	### Run one tick of the simulation.
+	def run_tick
+		started = monotonic_time()
+		@tick += 1
+
+		self.interest.update_all
+		self.timers.advance
+		@tick_hooks.each do |hook|
+			begin
+				hook.call( self, @tick )
+			rescue => err
+				self.log.error "Tick hook %p raised %s: %s" % [ hook, err.class.name, err.message ]
+			end
+		end
+
+		duration = monotonic_time() - started
+		@stats[ :ticks ]         += 1
+		@stats[ :last_duration ]  = duration
+		@stats[ :total_time ]    += duration
+		@stats[ :max_duration ]   = duration if duration > @stats[ :max_duration ]
+		@stats[ :overruns ]      += 1 if duration > self.tick_length
+		TICKS.increment
+		TICK_DURATION.record( duration * 1_000_000 )
 
+		return duration
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Run the tick that was due at +next_tick+ and, if the loop has fallen behind
+	### far enough that more ticks are already due, deal with them according to the
+	### overrun policy. Returns the time the following tick is due.
+	def run_due_ticks( next_tick )
+		self.run_tick
+		next_tick += self.tick_length
+
+		overdue = ( (monotonic_time() - next_tick) / self.tick_length ).floor + 1
+		return next_tick if overdue < 1
+
+		if self.overrun_policy == :catch_up
+			catchup = [ overdue, @max_catchup ].min
+			catchup.times do
+				break unless @running
+				self.run_tick
+				next_tick += self.tick_length
+			end
+			overdue -= catchup
+		end
+
+		# Drop any ticks that are still overdue to resynchronize with the clock
+		if overdue > 0
+			self.log.warn "Environment fell behind: skipping %d ticks" % [ overdue ]
+			@stats[ :skipped_ticks ] += overdue
+			next_tick += overdue * self.tick_length
+		end
+
+		return next_tick
+	end
+
+end # MUES::Environment
 
@@ -0,0 +1,211 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+
+
+# The base class for events that are propagated inside the engine.
+#
+# Handlers are registered with an event class, and receive events of that class
+# and all of its subclasses. An object handler is called through the most
+# specific +handle_<name>_event+ method it has for the event's class, falling
+# back through the event's superclasses to +handle_event+; a Proc (or anything
+# else that responds to #call but not to a handler method) is just called.
+#
+# The handlers for each concrete event class are resolved into a dispatch table
+# of callables when it's first needed, and the tables of a class and its
+# subclasses are thrown away whenever a handler is (un)registered, so
+# dispatching an event is just a walk over an Array.
+#
+# == Synopsis
+#
+#   class MUES::PlayerChatEvent < MUES::PlayerEvent; end
+#
+#   class ChatLogger
+#       def handle_player_chat_event( event )
+#           ...
+#       end
+#   end
+#
+#   MUES::PlayerEvent.register_handlers( ChatLogger.new )
+#   MUES::PlayerChatEvent.new.dispatch
+#
+class MUES::Event
+	include MUES::Loggable,
+	        MUES::TimeUtilities
+
+	# The priority lane (see MUES::EventQueue::PRIORITIES) events of this class
+	# are queued in
+	PRIORITY = :player
+
+	# Serializes changes to the handler registrations
+	@registry_mutex = Mutex.new
+
+	class << self
+		# The mutex that serializes handler registration for the whole hierarchy
+		attr_reader :registry_mutex
+	end
+
+
+	### Set up the class-level state of a new +subclass+.
+	def self::inherited( subclass )
+		super
+		subclass.instance_variable_set( :@handlers, [] )
+		subclass.instance_variable_set( :@subclasses, [] )
+		subclass.instance_variable_set( :@dispatch_table, nil )
+		self.subclasses << subclass
+	end
+
+	@handlers       = []
+	@subclasses     = []
+	@dispatch_table = nil
+
+
+	### Return the handlers that are registered directly with the receiving class.
+	def self::handlers
+		return @handlers
+	end
+
+
+	### Return the receiving class's direct subclasses.
+	def self::subclasses
+		return @subclasses
+	end
+
+
+	### Register the specified +handlers+ to receive events of the receiving class
+	### and its subclasses.
+	def self::register_handlers( *handlers )
+		MUES::Event.registry_mutex.synchronize do
+			handlers.flatten.each do |handler|
+				@handlers << handler unless @handlers.include?( handler )
+			end
+			self.invalidate_dispatch_tables
+		end
+	end
+
+
+	### Unregister the specified +handlers+ from the receiving class.
+	def self::unregister_handlers( *handlers )
+		MUES::Event.registry_mutex.synchronize do
+			handlers.flatten.each {|handler| @handlers.delete(handler) }
+			self.invalidate_dispatch_tables
+		end
+	end
+
+
+	### Return the name of the handler method for events of the receiving class
+	### (e.g., 'handle_player_chat_event' for MUES::PlayerChatEvent).
+	def self::handler_method_name
+		@handler_method_name ||= begin
+			name = self.name.to_s.sub( /.*::/, '' ).sub( /Event$/, '' )
+			name = name.gsub( /([a-z\d])([A-Z])/, '\1_\2' ).downcase
+			name.empty? ? 'handle_event' : "handle_#{name}_event"
+		end
+	end
+
+
+	### Return the Array of callables that events of the receiving class are
+	### dispatched to, building it if necessary.
+	def self::dispatch_table
+		return @dispatch_table || MUES::Event.registry_mutex.synchronize {
+			@dispatch_table ||= self.build_dispatch_table
+		}
+	end
+
+
+	### Build the dispatch table for the receiving class: the handlers registered
+	### with it and each of its event superclasses, each resolved to the most
+	### specific handler method it has for the receiving class.
+	def self::build_dispatch_table
+		event_classes = self.ancestors.select {|mod| mod <= MUES::Event }
+		method_names = event_classes.collect {|klass| klass.handler_method_name }
+		seen = {}
+		table = []
+
+		event_classes.each do |klass|
+			klass.handlers.each do |handler|
+				next if seen[ handler.object_id ]
+				seen[ handler.object_id ] = true
+
+				if name = method_names.find {|meth| handler.respond_to?(meth, true) }
+					table << handler.method( name )
+				elsif handler.respond_to?( :call )
+					table << handler
+				else
+					MUES.logger.warn "%p can't handle %s events; ignoring it" % [ handler, self.name ]
+				end
+			end
+		end
+
+		return table.freeze
+	end
+
+
+	### Throw away the dispatch tables of the receiving class and its subclasses.
+	def self::invalidate_dispatch_tables
+		@dispatch_table = nil
+		self.subclasses.each {|subclass| subclass.invalidate_dispatch_tables }
+	end
+
+
+
+	#################################################################
+	###	I N S T A N C E   M E T H O D S
+	#################################################################
+
+	### Create a new event.
+	def initialize
+		@created_at = monotonic_time()
+	end
+
+
+	######
+	public
+	######
+
+	# The monotonic time the event was created at
+	attr_reader :created_at
+
+
+	### Return the priority lane the event should be queued in.
+	def priority
+		return self.class.const_get( :PRIORITY )
+	end
+
+
+	### Dispatch the event to each of the handlers registered for its class.
+	### Handler exceptions are logged and don't stop the dispatch.
+	def dispatch
+		self.class.dispatch_table.each do |handler|
+			begin
+				handler.call( self )
+			rescue => err
+				self.log.error "%p failed to handle %p: %s: %s" %
+					[ handler, self, err.class.name, err.message ]
+			end
+		end
+	end
+
+end # class MUES::Event
+
+
+# Events that concern the engine itself (startup, shutdown, etc.)
+class MUES::SystemEvent < MUES::Event
+	PRIORITY = :system
+end # class MUES::SystemEvent
+
+
+# Events that originate in the game environment
+class MUES::EnvironmentEvent < MUES::Event
+	PRIORITY = :environment
+end # class MUES::EnvironmentEvent
+
+
+# Events that originate with a player
+class MUES::PlayerEvent < MUES::Event
+	PRIORITY = :player
+end # class MUES::PlayerEvent
+
@@ -0,0 +1,335 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/histogram'
+
+
+# An in-process, bounded event queue with priority lanes that is drained by a
+# fixed-size pool of worker threads.
+#
+# Events are enqueued into one of the PRIORITIES lanes; workers always take the
+# oldest event from the highest-priority lane that has one. The total number of
+# queued events is capped at the queue's capacity: once it's full, #enqueue
+# blocks (or returns +false+ if asked not to wait) until a worker makes room.
+# A queue that hasn't been started or has been shut down doesn't take events
+# at all, since nothing would ever handle them.
+#
+# To keep AMQP consumers from piling more work onto a congested queue, the
+# queue signals backpressure when its depth reaches the high-water mark and
+# releases it when it drains back down to the low-water mark. Consumers can
+# either register a listener with #on_backpressure or call
+# #wait_while_congested before pulling their next delivery.
+#
+# The queue keeps a histogram of its depth (sampled on every enqueue) and of
+# the time events spend waiting in it, in microseconds.
+#
+# == Synopsis
+#
+#   config = { :event_queue_capacity => 1000, :event_queue_workers => 4 }
+#   queue = MUES::EventQueue.new( config )
+#   queue.start
+#
+#   queue.enqueue( MUES::PlayerChatEvent.new )
+#   queue.enqueue( lambda { puts "Hi!" }, :system )
+#
+class MUES::EventQueue
+	include MUES::Constants,
+	        MUES::Loggable,
+	        MUES::TimeUtilities
+
+	# The priority lanes, highest first
+	PRIORITIES = [ :system, :environment, :player ]
+
+	# The handler that's used if none is given to the constructor: dispatches
+	# MUES::Events to their handlers, and calls anything else
+	DEFAULT_HANDLER = lambda {|event|
+		event.respond_to?( :dispatch ) ? event.dispatch : event.call
+	}
+
+
+	### Create a new EventQueue that will call the given +handler+ (or block)
+	### with each event, or use the DEFAULT_HANDLER if there isn't one. The +config+ may contain :event_queue_capacity,
+	### :event_queue_workers, :event_queue_high_water, and
+	### :event_queue_low_water keys (the water marks are fractions of the
+	### capacity).
+	def initialize( config={}, handler=nil, &block )
+		high_water, low_water =
+			config.values_at( :event_queue_high_water, :event_queue_low_water )
+
+		@capacity     = Integer( config[:event_queue_capacity] || DEFAULT_EVENT_QUEUE_CAPACITY )
+		@worker_count = Integer( config[:event_queue_workers] || DEFAULT_EVENT_QUEUE_WORKERS )
+		@high_water   = ( @capacity * (high_water || DEFAULT_EVENT_QUEUE_HIGH_WATER) ).ceil
+		@low_water    = ( @capacity * (low_water || DEFAULT_EVENT_QUEUE_LOW_WATER) ).floor
+		@handler      = handler || block || DEFAULT_HANDLER
+
+		@lanes      = PRIORITIES.collect { [] }
+		@depth      = 0
+		@mutex      = Mutex.new
+		@not_empty  = ConditionVariable.new
+		@not_full   = ConditionVariable.new
+		@relieved   = ConditionVariable.new
+
+		@congested  = false
+		@running    = false
+		@workers    = []
+		@threadgroup = nil
+		@on_exit    = nil
+		@backpressure_listeners = []
+
+		@depth_histogram   = MUES::Histogram.new
+		@latency_histogram = MUES::Histogram.new
+		@counters   = Hash.new( 0 )
+	end
+
+
+	######
+	public
+	######
+
+	# The maximum number of queued events
+	attr_reader :capacity
+
+	# The number of worker threads
+	attr_reader :worker_count
+
+	# The depth at which backpressure is signalled
+	attr_reader :high_water
+
+	# The depth at which backpressure is released
+	attr_reader :low_water
+
+	# The worker threads
+	attr_reader :workers
+
+	# A MUES::Histogram of the queue's depth, sampled on every enqueue
+	attr_reader :depth_histogram
+
+	# A MUES::Histogram of the time events spent in the queue, in microseconds
+	attr_reader :latency_histogram
+
+
+	### Start the worker pool, adding the workers to the given +threadgroup+ if
+	### one is given. If a block is given, it will be called with each worker's
+	### thread when the thread exits.
+	def start( threadgroup=nil, &on_exit )
+		@threadgroup = threadgroup
+		@on_exit     = on_exit
+		@mutex.synchronize { @running = true }
+		@workers = (0 ... self.worker_count).collect { self.start_worker }
+		self.log.debug "Started %d event queue workers." % [ @workers.length ]
+	end
+
+
+	### If the given +thread+ is one of the pool's workers and the queue is still
+	### running, replace it with a new worker and return the new worker's thread.
+	### Returns +nil+ otherwise.
+	def restart_worker( thread )
+		index = @workers.index( thread ) or return nil
+		return nil unless @running
+		return @workers[ index ] = self.start_worker
+	end
+
+
+	### Stop the workers after they've drained the queue, and wait for them to
+	### exit.
+	def shutdown
+		@mutex.synchronize do
+			@running = false
+			@not_empty.broadcast
+			@not_full.broadcast
+			@relieved.broadcast
+		end
+		@workers.each {|thr| thr.join unless thr == Thread.current }
+		@workers.clear
+	end
+
+
+	### Returns +true+ if the worker pool is running.
+	def running?
+		return @running
+	end
+
+
+	### Return the number of queued events.
+	def depth
+		return @depth
+	end
+	alias_method :size, :depth
+
+
+	### Returns +true+ if the queue has signalled backpressure and hasn't drained
+	### to the low-water mark since.
+	def congested?
+		return @congested
+	end
+
+
+	### Add the specified +event+ to the lane for the given +priority+, which
+	### defaults to the event's own #priority if it has one, or :player if not.
+	### If the queue is full, wait for room unless +wait+ is false, in which case
+	### the event is dropped and +false+ is returned. Also returns +false+
+	### without queueing the event if the queue isn't running.
+	def enqueue( event, priority=nil, wait=true )
+		priority ||= event.respond_to?( :priority ) ? event.priority : :player
+		lane = PRIORITIES.index( priority ) or
+			raise ArgumentError, "unknown priority %p" % [ priority ]
+		signal = nil
+
+		@mutex.synchronize do
+			return false unless @running
+
+			while @depth >= @capacity
+				unless wait && @running
+					@counters[ :dropped ] += 1
+					return false
+				end
+				@counters[ :blocked ] += 1
+				@not_full.wait( @mutex )
+			end
+
+			@lanes[ lane ] << [ event, monotonic_time() ]
+			@depth += 1
+			@counters[ priority ] += 1
+			@depth_histogram.record( @depth )
+
+			if !@congested && @depth >= @high_water
+				@congested = true
+				@counters[ :congested ] += 1
+				signal = true
+			end
+
+			@not_empty.signal
+		end
+
+		self.notify_backpressure_listeners( signal ) unless signal.nil?
+		return true
+	end
+	alias_method :<<, :enqueue
+
+
+	### Register a +listener+ (or a block) that will be called with +true+ when
+	### the queue signals backpressure, and with +false+ when it releases it.
+	def on_backpressure( listener=nil, &block )
+		listener ||= block or raise ArgumentError, "no listener given"
+		@backpressure_listeners << listener
+		return listener
+	end
+
+
+	### If the queue is congested, block until it drains down to its low-water
+	### mark (or is shut down).
+	def wait_while_congested
+		@mutex.synchronize do
+			@relieved.wait( @mutex ) while @congested && @running
+		end
+	end
+
+
+	### Return a Hash of the queue's counters: the number of events enqueued in
+	### each priority lane, how many times enqueueing had to wait for room, how
+	### many events were dropped because the queue was full, and how many times
+	### backpressure was signalled.
+	def stats
+		counters = @mutex.synchronize { @counters.dup }
+		stats = { :depth => @depth }
+		PRIORITIES.each {|priority| stats[priority] = counters[priority] }
+		[ :handled, :errors, :blocked, :dropped, :congested ].each do |key|
+			stats[ key ] = counters[ key ]
+		end
+
+		return stats
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Start a worker thread and return it.
+	def start_worker
+		thread = Thread.new do
+			begin
+				self.work
+			rescue ::Exception => err
+				self.log.error "Event queue worker crashed: %s: %s" % [ err.class.name, err.message ]
+			ensure
+				@on_exit.call( Thread.current ) if @on_exit
+			end
+		end
+
+		@threadgroup.add( thread ) if @threadgroup
+		return thread
+	end
+
+
+	### The worker loop: take events from the queue and handle them until the queue
+	### is shut down and empty.
+	def work
+		while pair = self.dequeue
+			event, enqueued_at = pair
+			@latency_histogram.record( (monotonic_time() - enqueued_at) * 1_000_000 )
+
+			begin
+				@handler.call( event )
+				@mutex.synchronize { @counters[:handled] += 1 }
+			rescue => err
+				@mutex.synchronize { @counters[:errors] += 1 }
+				self.log.error "Event %p raised %s: %s" % [ event, err.class.name, err.message ]
+				self.log.debug {
+					err.backtrace.collect {|frame| "  #{frame}" }.join( $/ )
+				}
+			end
+		end
+	end
+
+
+	### Remove and return the next [ event, enqueue time ] pair from the highest
+	### priority lane that isn't empty, waiting for one if the queue is empty.
+	### Returns +nil+ when the queue has been shut down and drained.
+	def dequeue
+		signal = nil
+		pair = nil
+
+		@mutex.synchronize do
+			while @depth.zero?
+				return nil unless @running
+				@not_empty.wait( @mutex )
+			end
+
+			pair = @lanes.find {|lane| !lane.empty? }.shift
+			@depth -= 1
+			@not_full.signal
+
+			if @congested && @depth <= @low_water
+				@congested = false
+				@relieved.broadcast
+				signal = false
+			end
+		end
+
+		self.notify_backpressure_listeners( signal ) unless signal.nil?
+		return pair
+	end
+
+
+	### Call each backpressure listener with the given +congested+ flag.
+	def notify_backpressure_listeners( congested )
+		self.log.info "Event queue %s backpressure at depth %d" %
+			[ congested ? "signalling" : "releasing", @depth ]
+
+		@backpressure_listeners.each do |listener|
+			begin
+				listener.call( congested )
+			rescue => err
+				self.log.error "Backpressure listener %p raised %s: %s" %
+					[ listener, err.class.name, err.message ]
+			end
+		end
+	end
+
+end # class MUES::EventQueue
+
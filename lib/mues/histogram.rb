@@ -0,0 +1,241 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+
+
+# A histogram of non-negative integer values (e.g., latencies in microseconds
+# or queue depths) with log-linear buckets: each power-of-two range is split
+# into SUB_BUCKETS equal sub-buckets, so every recorded value is counted with a
+# relative error of less than 1/SUB_BUCKETS regardless of its magnitude, and
+# the histogram's size stays fixed no matter how many values are recorded.
+#
+# == Synopsis
+#
+#   latency = MUES::Histogram.new
+#   latency.record( 1250 )
+#   latency.percentile( 99 )    # => 1279
+#   latency.to_h                # => { :count => 1, :min => 1250, ... }
+#
+# A histogram that only one thread ever records into can be created without
+# its lock, and merged into a shared one when its values are needed.
+#
+class MUES::Histogram
+
+	# The number of sub-buckets each power of two is divided into (must itself
+	# be a power of two)
+	SUB_BUCKETS = 16
+
+	# log2( SUB_BUCKETS )
+	SUB_BUCKET_BITS = 4
+
+	# The largest power of two that will be tracked; larger values are counted
+	# in the last bucket
+	MAX_MAGNITUDE = 40
+
+	# The total number of buckets; values too large to track are counted in the
+	# last one
+	BUCKETS = ( MAX_MAGNITUDE - SUB_BUCKET_BITS + 2 ) * SUB_BUCKETS
+
+	# The percentiles included in #to_h
+	SUMMARY_PERCENTILES = [ 50, 90, 99, 99.9 ]
+
+	# Stands in for the lock of a histogram that isn't synchronized, everywhere
+	# but #record
+	NO_LOCK = Object.new
+	def NO_LOCK.synchronize; yield; end
+
+
+	### Create a new, empty histogram. If +synchronized+ is false, recording
+	### into it from more than one thread isn't safe.
+	def initialize( synchronized=true )
+		@counts = Array.new( BUCKETS, 0 )
+		@synchronized = synchronized
+		@mutex  = synchronized ? Mutex.new : NO_LOCK
+		self.clear
+	end
+
+
+	######
+	public
+	######
+
+	# The number of values recorded
+	attr_reader :count
+
+	# The sum of the values recorded
+	attr_reader :sum
+
+	# The smallest value recorded
+	attr_reader :min
+
+	# The largest value recorded
+	attr_reader :max
+
+
+	### Record the given +value+ in the histogram. Negative values are counted as
+	### zero, and non-integers are truncated.
+	def record( value )
+		value = value.to_i
+		value = 0 if value < 0
+		index = self.class.bucket_index( value )
+
+		# Yielding through NO_LOCK costs more than the Mutex does, so an
+		# unsynchronized histogram records without going through either
+		unless @synchronized
+			@counts[ index ] += 1
+			@count += 1
+			@sum   += value
+			@min    = value if @min.nil? || value < @min
+			@max    = value if @max.nil? || value > @max
+			return value
+		end
+
+		@mutex.synchronize do
+			@counts[ index ] += 1
+			@count += 1
+			@sum   += value
+			@min    = value if @min.nil? || value < @min
+			@max    = value if @max.nil? || value > @max
+		end
+
+		return value
+	end
+	alias_method :<<, :record
+
+
+	### Forget all recorded values.
+	def clear
+		@mutex.synchronize do
+			@counts.fill( 0 )
+			@count = 0
+			@sum   = 0
+			@min   = nil
+			@max   = nil
+		end
+	end
+
+
+	### Return the mean of the recorded values, or +nil+ if nothing has been
+	### recorded.
+	def mean
+		return nil if @count.zero?
+		return @sum.to_f / @count
+	end
+
+
+	### Return the (upper bound of the bucket containing the) value below which
+	### the given +percent+ of the recorded values fall, or +nil+ if nothing has
+	### been recorded.
+	def percentile( percent )
+		counts, total, max = @mutex.synchronize { [@counts.dup, @count, @max] }
+		return nil if total.zero?
+
+		threshold = ( total * percent / 100.0 ).ceil
+		threshold = 1 if threshold < 1
+		seen = 0
+
+		counts.each_with_index do |count, index|
+			next if count.zero?
+			seen += count
+			if seen >= threshold
+				return max if index == BUCKETS - 1
+				upper = self.class.bucket_upper_bound( index )
+				return upper > max ? max : upper
+			end
+		end
+
+		return max
+	end
+
+
+	### Add the values recorded in the +other+ histogram to this one. Returns
+	### the receiver.
+	def merge( other )
+		counts, count, sum, min, max = other.state
+
+		@mutex.synchronize do
+			counts.each_with_index {|n, index| @counts[index] += n unless n.zero? }
+			@count += count
+			@sum   += sum
+			@min    = min if min && ( @min.nil? || min < @min )
+			@max    = max if max && ( @max.nil? || max > @max )
+		end
+
+		return self
+	end
+
+
+	### Return a summary of the histogram as a Hash.
+	def to_h
+		summary = {
+			:count => @count,
+			:min   => @min,
+			:max   => @max,
+			:mean  => self.mean,
+		}
+		SUMMARY_PERCENTILES.each do |pct|
+			summary[ ("p%s" % [pct.to_s.sub('.', '_')]).to_sym ] = self.percentile( pct )
+		end
+
+		return summary
+	end
+
+
+	### Return the index of the bucket the given +value+ falls into.
+	def self::bucket_index( value )
+		return value if value < SUB_BUCKETS
+
+		magnitude = self.magnitude_of( value ) - SUB_BUCKET_BITS
+		return BUCKETS - 1 if magnitude > MAX_MAGNITUDE - SUB_BUCKET_BITS
+
+		sub = ( value >> magnitude ) - SUB_BUCKETS
+		return ( magnitude + 1 ) * SUB_BUCKETS + sub
+	end
+
+
+	### Return the largest value that falls into the bucket at +index+.
+	def self::bucket_upper_bound( index )
+		return index if index < SUB_BUCKETS
+
+		magnitude = index / SUB_BUCKETS - 1
+		sub = index % SUB_BUCKETS
+		return ( (SUB_BUCKETS + sub + 1) << magnitude ) - 1
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return a copy of the bucket counts, and the count, sum, min and max of
+	### the recorded values.
+	def state
+		return @mutex.synchronize { [@counts.dup, @count, @sum, @min, @max] }
+	end
+
+
+	if 0.respond_to?( :bit_length )
+
+		### Return the position of the highest set bit of +value+ (i.e.,
+		### floor(log2)).
+		def self::magnitude_of( value )
+			return value.bit_length - 1
+		end
+
+	else
+
+		### Return the position of the highest set bit of +value+ (i.e.,
+		### floor(log2)).
+		def self::magnitude_of( value )
+			magnitude = 0
+			magnitude += 1 while ( value >> (magnitude + 1) ) > 0
+			return magnitude
+		end
+
+	end
+
+end # class MUES::Histogram
+
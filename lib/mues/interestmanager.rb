@@ -0,0 +1,365 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+
+
+# Keeps track of which sessions are interested in which nodes, so that node
+# changes only have to be forwarded to the sessions that can actually perceive
+# them instead of to every session.
+#
+# A session can be interested in a node for any of three reasons:
+#
+# [proximity]  the node is near the session's avatar
+# [room]       the node is in the same room as the session
+# [explicit]   the session subscribed to the node by hand
+#
+# Proximity interest uses hysteresis to keep nodes that hover around the edge of
+# a session's range from being subscribed and unsubscribed over and over: a node
+# becomes interesting when it comes within the interest radius of the avatar,
+# but stops being interesting only once it's more than the radius plus the
+# hysteresis margin away.
+#
+# Listeners registered with #on_change are told whenever a session gains or
+# loses interest in a node, so they can send it the node's full state or tell
+# it to forget about the node.
+#
+# == Synopsis
+#
+#   interest = MUES::InterestManager.new( environment )
+#   interest.add_session( session, avatar_node )
+#   interest.enter_room( session, 'tavern' )
+#
+#   # Once per tick
+#   interest.update_all
+#
+#   interest.forward( node ) {|session| session.send_node_update(node) }
+#
+class MUES::InterestManager
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# Reason bits for a session's interest in a node
+	PROXIMITY = 0x1
+	ROOM      = 0x2
+	EXPLICIT  = 0x4
+
+	# The members of a room that has none
+	NO_MEMBERS = {}.freeze
+
+
+	### Create a new InterestManager that looks up node positions in the
+	### specified +environment+ (anything that responds to #nodes_near and
+	### #position_of, like MUES::Environment). The +config+ may contain
+	### :interest_radius and :interest_hysteresis keys.
+	def initialize( environment, config={} )
+		@environment = environment
+		@radius      = Float( config[:interest_radius] || DEFAULT_INTEREST_RADIUS )
+		@hysteresis  = Float( config[:interest_hysteresis] || DEFAULT_INTEREST_HYSTERESIS )
+
+		@avatars       = {}   # session => avatar node
+		@interests     = {}   # session => { node => reason bits }
+		@audiences     = {}   # node => { session => true }
+		@session_rooms = {}   # session => room
+		@node_rooms    = {}   # node => room
+		@room_sessions = {}   # room => { session => true }
+		@room_nodes    = {}   # room => { node => true }
+
+		@listeners   = []
+		@mutex       = Mutex.new
+		@stats       = { :gained => 0, :lost => 0 }
+	end
+
+
+	######
+	public
+	######
+
+	# The distance within which nodes become interesting to a session
+	attr_reader :radius
+
+	# How far past the radius a node has to go before it stops being interesting
+	attr_reader :hysteresis
+
+
+	### Register a +listener+ (or a block) that will be called with the session,
+	### the node, and +true+ whenever a session becomes interested in a node, and
+	### +false+ when it stops being interested.
+	def on_change( listener=nil, &block )
+		listener ||= block or raise ArgumentError, "no listener given"
+		@listeners << listener
+		return listener
+	end
+
+
+	### Start tracking the interests of the specified +session+, whose avatar is
+	### the given +avatar+ node.
+	def add_session( session, avatar )
+		@mutex.synchronize do
+			@avatars[ session ] = avatar
+			@interests[ session ] ||= {}
+		end
+		self.update( session )
+	end
+
+
+	### Stop tracking the interests of the specified +session+.
+	def remove_session( session )
+		changes = []
+		@mutex.synchronize do
+			self.leave_room_unlocked( session, changes )
+			nodes = @interests.delete( session ) || {}
+			nodes.each_key do |node|
+				self.remove_from_audience( node, session )
+				changes << [ session, node, false ]
+			end
+			@avatars.delete( session )
+		end
+		self.notify_listeners( changes )
+	end
+
+
+	### Return the sessions that are interested in the specified +node+.
+	def interested_sessions( node )
+		@mutex.synchronize do
+			audience = @audiences[ node ] or return []
+			return audience.keys
+		end
+	end
+
+
+	### Return the nodes the specified +session+ is interested in.
+	def interests_of( session )
+		@mutex.synchronize do
+			nodes = @interests[ session ] or return []
+			return nodes.keys
+		end
+	end
+
+
+	### Returns +true+ if the specified +session+ is interested in the given
+	### +node+.
+	def interested?( session, node )
+		@mutex.synchronize do
+			nodes = @interests[ session ] or return false
+			return nodes.key?( node )
+		end
+	end
+
+
+	### Yield each session that's interested in the specified +node+ (e.g., to
+	### forward a change to it). Returns the number of sessions.
+	def forward( node )
+		sessions = self.interested_sessions( node )
+		sessions.each {|session| yield(session) }
+		return sessions.length
+	end
+
+
+	### Explicitly subscribe the specified +session+ to the given +node+,
+	### regardless of where it is.
+	def subscribe( session, node )
+		changes = []
+		@mutex.synchronize { self.add_reason(session, node, EXPLICIT, changes) }
+		self.notify_listeners( changes )
+	end
+
+
+	### Cancel the specified +session+'s explicit subscription to the given
+	### +node+.
+	def unsubscribe( session, node )
+		changes = []
+		@mutex.synchronize { self.remove_reason(session, node, EXPLICIT, changes) }
+		self.notify_listeners( changes )
+	end
+
+
+	### Move the specified +session+ into the given +room+, making it interested
+	### in all of the nodes in the room (and no longer in those of the room it
+	### was in before).
+	def enter_room( session, room )
+		changes = []
+		@mutex.synchronize do
+			self.leave_room_unlocked( session, changes )
+			@session_rooms[ session ] = room
+			( @room_sessions[room] ||= {} )[ session ] = true
+			@room_nodes.fetch( room, NO_MEMBERS ).each_key do |node|
+				self.add_reason( session, node, ROOM, changes )
+			end
+		end
+		self.notify_listeners( changes )
+	end
+
+
+	### Move the specified +session+ out of whatever room it's in.
+	def leave_room( session )
+		changes = []
+		@mutex.synchronize { self.leave_room_unlocked(session, changes) }
+		self.notify_listeners( changes )
+	end
+
+
+	### Place the specified +node+ in the given +room+ (or take it out of any room
+	### if +room+ is +nil+), updating the interest of the sessions in the room it
+	### left and the one it entered.
+	def place_node( node, room )
+		changes = []
+		@mutex.synchronize do
+			if old_room = @node_rooms.delete( node )
+				@room_nodes[ old_room ].delete( node )
+				@room_nodes.delete( old_room ) if @room_nodes[ old_room ].empty?
+				@room_sessions.fetch( old_room, NO_MEMBERS ).each_key do |session|
+					self.remove_reason( session, node, ROOM, changes )
+				end
+			end
+
+			if room
+				@node_rooms[ node ] = room
+				( @room_nodes[room] ||= {} )[ node ] = true
+				@room_sessions.fetch( room, NO_MEMBERS ).each_key do |session|
+					self.add_reason( session, node, ROOM, changes )
+				end
+			end
+		end
+		self.notify_listeners( changes )
+	end
+
+
+	### Recalculate the proximity interests of the specified +session+ from the
+	### current position of its avatar. Returns the number of nodes it gained and
+	### lost interest in.
+	def update( session )
+		avatar = @mutex.synchronize { @avatars[session] } or return 0
+		position = @environment.position_of( avatar ) or return 0
+		x, y, z = position
+
+		nearby = @environment.nodes_near( x, y, z, @radius )
+		changes = []
+
+		@mutex.synchronize do
+			nodes = @interests[ session ] or return 0
+
+			nearby.each do |node|
+				self.add_reason( session, node, PROXIMITY, changes )
+			end
+
+			# Only drop nodes that have moved out past the hysteresis margin
+			limit = ( @radius + @hysteresis ) ** 2
+			nodes.keys.each do |node|
+				next if ( nodes[node] & PROXIMITY ).zero?
+				pos = @environment.position_of( node )
+				if pos.nil? || self.distance_squared( position, pos ) > limit
+					self.remove_reason( session, node, PROXIMITY, changes )
+				end
+			end
+		end
+
+		self.notify_listeners( changes )
+		return changes.length
+	end
+
+
+	### Recalculate the proximity interests of every session.
+	def update_all
+		sessions = @mutex.synchronize { @avatars.keys }
+		return sessions.inject( 0 ) {|sum, session| sum + self.update(session) }
+	end
+
+
+	### Return a copy of the manager's counters: the number of times a session
+	### gained and lost interest in a node.
+	def stats
+		stats = @mutex.synchronize { @stats.dup }
+		stats[ :sessions ] = @avatars.length
+		return stats
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Add the +reason+ bit to the specified +session+'s interest in +node+,
+	### adding a change to +changes+ if the session wasn't interested before. Must
+	### be called with the mutex held.
+	def add_reason( session, node, reason, changes )
+		nodes = ( @interests[session] ||= {} )
+		if bits = nodes[ node ]
+			nodes[ node ] = bits | reason
+		else
+			nodes[ node ] = reason
+			( @audiences[node] ||= {} )[ session ] = true
+			@stats[ :gained ] += 1
+			changes << [ session, node, true ]
+		end
+	end
+
+
+	### Clear the +reason+ bit from the specified +session+'s interest in +node+,
+	### adding a change to +changes+ if that was the last reason for it. Must be
+	### called with the mutex held.
+	def remove_reason( session, node, reason, changes )
+		nodes = @interests[ session ] or return
+		bits = nodes[ node ] or return
+		bits &= ~reason
+
+		if bits.zero?
+			nodes.delete( node )
+			self.remove_from_audience( node, session )
+			@stats[ :lost ] += 1
+			changes << [ session, node, false ]
+		else
+			nodes[ node ] = bits
+		end
+	end
+
+
+	### Remove the specified +session+ from the audience of the given +node+.
+	def remove_from_audience( node, session )
+		audience = @audiences[ node ] or return
+		audience.delete( session )
+		@audiences.delete( node ) if audience.empty?
+	end
+
+
+	### Take the specified +session+ out of its room. Must be called with the
+	### mutex held.
+	def leave_room_unlocked( session, changes )
+		room = @session_rooms.delete( session ) or return
+		@room_sessions[ room ].delete( session )
+		@room_sessions.delete( room ) if @room_sessions[ room ].empty?
+
+		@room_nodes.fetch( room, NO_MEMBERS ).each_key do |node|
+			self.remove_reason( session, node, ROOM, changes )
+		end
+	end
+
+
+	### Return the square of the distance between the points +a+ and +b+.
+	def distance_squared( a, b )
+		dx = a[0] - b[0]
+		dy = a[1] - b[1]
+		dz = a[2] - b[2]
+		return dx * dx + dy * dy + dz * dz
+	end
+
+
+	### Tell the listeners about the given interest +changes+.
+	def notify_listeners( changes )
+		changes.each do |session, node, interested|
+			@listeners.each do |listener|
+				begin
+					listener.call( session, node, interested )
+				rescue => err
+					self.log.error "Interest listener %p raised %s: %s" %
+						[ listener, err.class.name, err.message ]
+				end
+			end
+		end
+	end
+
+end # class MUES::InterestManager
+
@@ -0,0 +1,215 @@
+#!/usr/bin/env ruby
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+
+
+# The strategy a MUES::ObjectStore uses to decide which of its resident objects
+# to evict when there are more of them than it's allowed to keep in memory.
+#
+# This base class is the 'Null' memory manager: it never chooses anything to
+# evict, so every object that's been stored or retrieved stays resident. The
+# 'Clock' manager (MUES::MemoryManager::Clock) approximates least-recently-used
+# eviction.
+#
+# Objects can be pinned (e.g., because they're in an area players are in) to
+# keep them resident regardless of the manager.
+#
+# == Synopsis
+#
+#   memmgr = MUES::MemoryManager.create( 'Clock' )
+#   memmgr.added( id )
+#   memmgr.touched( id )
+#   memmgr.victims( 10 ) {|id| !dirty?(id) }   # => [ ... ]
+#
+class MUES::MemoryManager
+	include MUES::Constants,
+	        MUES::Loggable
+
+
+	### Create a memory manager of the type with the given +name+ ('Null' or
+	### 'Clock').
+	def self::create( name=DEFAULT_MEMORY_MANAGER )
+		return self.new if name.to_s.downcase == 'null'
+		subclass = self.const_get( name.to_s.capitalize ) rescue nil
+		raise ArgumentError, "no such memory manager %p" % [ name ] unless
+			subclass.is_a?( Class ) && subclass < self
+		return subclass.new
+	end
+
+
+	### Create a new memory manager.
+	def initialize
+		@pinned = {}
+	end
+
+
+	######
+	public
+	######
+
+	### Note that the object with the specified +id+ has become resident.
+	def added( id )
+	end
+
+
+	### Note that the object with the specified +id+ has been referred to.
+	def touched( id )
+	end
+
+
+	### Note that the object with the specified +id+ is no longer resident.
+	def removed( id )
+	end
+
+
+	### Keep the object with the specified +id+ resident until it's unpinned.
+	### Pins nest.
+	def pin( id )
+		@pinned[ id ] = ( @pinned[id] || 0 ) + 1
+	end
+
+
+	### Undo one #pin of the object with the specified +id+.
+	def unpin( id )
+		count = @pinned[ id ] or return
+		if count > 1
+			@pinned[ id ] = count - 1
+		else
+			@pinned.delete( id )
+		end
+	end
+
+
+	### Returns +true+ if the object with the specified +id+ is pinned.
+	def pinned?( id )
+		return @pinned.key?( id )
+	end
+
+
+	### Return the ids of the pinned objects.
+	def pinned_ids
+		return @pinned.keys
+	end
+
+
+	### Choose up to +count+ objects to evict, skipping any that are pinned or
+	### for which the block (if given) returns false. The chosen objects are
+	### removed from the manager's bookkeeping.
+	def victims( count )
+		return []
+	end
+
+
+
+	# A memory manager that approximates LRU with the CLOCK algorithm: resident
+	# objects sit in a ring with a "referenced" bit that's set whenever they're
+	# touched. To find a victim, the hand sweeps around the ring, clearing the
+	# bits it finds set (giving those objects a second chance) and choosing the
+	# first object whose bit is already clear.
+	class Clock < MUES::MemoryManager
+
+		### Create a new Clock memory manager.
+		def initialize
+			super
+			@ring       = []
+			@slots      = {}
+			@referenced = {}
+			@hand       = 0
+			@holes      = 0
+			@swept      = 0
+		end
+
+
+		######
+		public
+		######
+
+		# The number of slots the hand has passed over
+		attr_reader :swept
+
+
+		### Add the object with the specified +id+ to the ring.
+		def added( id )
+			if @slots.key?( id )
+				@referenced[ id ] = true
+				return
+			end
+
+			@slots[ id ] = @ring.length
+			@ring << id
+			@referenced[ id ] = true
+		end
+
+
+		### Set the referenced bit of the object with the specified +id+.
+		def touched( id )
+			@referenced[ id ] = true if @slots.key?( id )
+		end
+
+
+		### Remove the object with the specified +id+ from the ring.
+		def removed( id )
+			slot = @slots.delete( id ) or return
+			@referenced.delete( id )
+			@ring[ slot ] = nil
+			@holes += 1
+			self.compact if @holes > 32 && @holes > @ring.length / 2
+		end
+
+
+		### Sweep the hand around the ring to choose up to +count+ objects to
+		### evict.
+		def victims( count )
+			chosen = []
+			return chosen if @slots.empty? || count < 1
+
+			# Two full turns is enough to clear every referenced bit and come back
+			# to the objects that had them
+			steps = @ring.length * 2
+
+			while chosen.length < count && steps > 0 && !@slots.empty?
+				steps -= 1
+				@swept += 1
+				@hand = 0 if @hand >= @ring.length
+				id = @ring[ @hand ]
+				@hand += 1
+
+				next if id.nil? || self.pinned?( id )
+				if @referenced[ id ]
+					@referenced[ id ] = false
+					next
+				end
+				next if block_given? && !yield( id )
+
+				chosen << id
+				self.removed( id )
+			end
+
+			return chosen
+		end
+
+
+		### Return the number of objects in the ring.
+		def size
+			return @slots.size
+		end
+
+
+		#########
+		protected
+		#########
+
+		### Squeeze the holes left by removed objects out of the ring.
+		def compact
+			@ring.compact!
+			@ring.each_with_index {|id, i| @slots[id] = i }
+			@hand = 0
+			@holes = 0
+		end
+
+	end # class Clock
+
+end # class MUES::MemoryManager
+
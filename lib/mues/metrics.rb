@@ -0,0 +1,345 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/histogram'
+
+
+# A registry of the engine's metrics: counters, gauges and histograms that the
+# Engine, Players, the Environment and the rest record into, and that
+# MUES::MetricsExporter publishes and the admin console shows.
+#
+# Recording a value doesn't take a lock: each thread counts into its own shard
+# of a counter or histogram (found through a thread variable, which all of a
+# thread's fibers share), and the shards are
+# only added up when the metric's value is asked for. Shards of threads that
+# have exited are folded into the total and dropped then too.
+#
+# Metrics are registered once by name, usually in a constant of the class
+# that records into them; registering a name again returns the same metric.
+#
+# == Synopsis
+#
+#   COMMANDS = MUES::Metrics.counter( :commands, "commands handled" )
+#   COMMAND_LATENCY = MUES::Metrics.histogram( :command_latency, "microseconds per command" )
+#   MUES::Metrics.gauge( :players_online ) { engine.players.length }
+#
+#   COMMANDS.increment
+#   COMMAND_LATENCY.time { player.handle_command_event(event) }
+#
+#   MUES::Metrics.snapshot  # => { :commands => 1138, :players_online => 12, ... }
+#
+module MUES::Metrics
+
+	#
+	# The things all metrics have in common: a name and description, and the
+	# shards that threads record into.
+	#
+	class Metric
+		include MUES::TimeUtilities
+
+		### Create a new metric with the given +name+ and +description+.
+		def initialize( name, description=nil )
+			@name        = name
+			@description = description
+			@key         = :"mues_metric_#{self.object_id}"
+			@mutex       = Mutex.new
+			@shards      = []
+			@retired     = self.new_shard
+		end
+
+
+		######
+		public
+		######
+
+		# The metric's name
+		attr_reader :name
+
+		# A description of what the metric measures
+		attr_reader :description
+
+
+		#########
+		protected
+		#########
+
+		### Create a shard for the current thread and return it.
+		def add_shard
+			shard = self.new_shard
+			@mutex.synchronize { @shards << [Thread.current, shard] }
+			Thread.current.thread_variable_set( @key, shard )
+			return shard
+		end
+
+
+		### Return the shards of the threads that are still running, after
+		### folding the others into the retired shard. Must be called with the
+		### mutex held.
+		def live_shards
+			@shards.delete_if do |thread, shard|
+				next false if thread.alive?
+				self.fold( shard, @retired )
+				true
+			end
+
+			return @shards.collect {|_, shard| shard }
+		end
+
+	end # class Metric
+
+
+	#
+	# A count of things that have happened.
+	#
+	class Counter < Metric
+
+		######
+		public
+		######
+
+		### Add +amount+ to the counter.
+		def increment( amount=1 )
+			( Thread.current.thread_variable_get(@key) || self.add_shard )[ 0 ] += amount
+		end
+
+
+		### Return the counter's total.
+		def value
+			@mutex.synchronize do
+				return self.live_shards.inject( @retired[0] ) {|sum, shard| sum + shard[0] }
+			end
+		end
+
+
+		### Set the counter back to zero.
+		def reset
+			@mutex.synchronize do
+				@shards.each {|_, shard| shard[0] = 0 }
+				@retired[ 0 ] = 0
+			end
+		end
+
+
+		#########
+		protected
+		#########
+
+		### Return a new, empty shard.
+		def new_shard
+			return [ 0 ]
+		end
+
+
+		### Add the count in +shard+ to +into+.
+		def fold( shard, into )
+			into[ 0 ] += shard[ 0 ]
+		end
+
+	end # class Counter
+
+
+	#
+	# A distribution of values, such as latencies in microseconds.
+	#
+	class Histogram < Metric
+
+		######
+		public
+		######
+
+		### Record the given +value+.
+		def record( value )
+			( Thread.current.thread_variable_get(@key) || self.add_shard ).record( value )
+		end
+		alias_method :<<, :record
+
+
+		### Call the block and record how long it took, in microseconds. Returns
+		### the block's value.
+		def time
+			started = monotonic_time()
+			return yield
+		ensure
+			self.record( (monotonic_time() - started) * 1_000_000 )
+		end
+
+
+		### Return a MUES::Histogram of all of the recorded values.
+		def histogram
+			@mutex.synchronize do
+				shards = self.live_shards
+				totals = MUES::Histogram.new.merge( @retired )
+				shards.each {|shard| totals.merge(shard) }
+				return totals
+			end
+		end
+
+
+		### Return a summary of the recorded values (see MUES::Histogram#to_h).
+		def value
+			return self.histogram.to_h
+		end
+
+
+		### Forget the recorded values.
+		def reset
+			@mutex.synchronize do
+				@shards.each {|_, shard| shard.clear }
+				@retired.clear
+			end
+		end
+
+
+		#########
+		protected
+		#########
+
+		### Return a new, empty shard. Only its own thread records into it, so it
+		### doesn't need a lock.
+		def new_shard
+			return MUES::Histogram.new( false )
+		end
+
+
+		### Add the values in +shard+ to +into+.
+		def fold( shard, into )
+			into.merge( shard )
+		end
+
+	end # class Histogram
+
+
+	#
+	# A value that goes up and down, either set directly or read from a block
+	# when it's needed.
+	#
+	class Gauge
+
+		### Create a new gauge with the given +name+ and +description+.
+		def initialize( name, description=nil )
+			@name        = name
+			@description = description
+			@value       = 0
+			@source      = nil
+		end
+
+
+		######
+		public
+		######
+
+		# The gauge's name
+		attr_reader :name
+
+		# A description of what the gauge measures
+		attr_reader :description
+
+		# The block the gauge's value is read from, if any
+		attr_accessor :source
+
+
+		### Set the gauge's value.
+		def set( value )
+			@value = value
+		end
+
+
+		### Return the gauge's value.
+		def value
+			return @source ? @source.call : @value
+		end
+
+
+		### Set the gauge back to zero.
+		def reset
+			@value = 0
+		end
+
+	end # class Gauge
+
+
+	@registry       = {}
+	@registry_mutex = Mutex.new
+
+
+	### Return the counter registered under +name+, registering it if it
+	### doesn't exist yet.
+	def self::counter( name, description=nil )
+		return self.register( name, Counter, description )
+	end
+
+
+	### Return the histogram registered under +name+, registering it if it
+	### doesn't exist yet.
+	def self::histogram( name, description=nil )
+		return self.register( name, Histogram, description )
+	end
+
+
+	### Return the gauge registered under +name+, registering it if it doesn't
+	### exist yet. If a block is given, the gauge's value is read from it from
+	### then on.
+	def self::gauge( name, description=nil, &block )
+		gauge = self.register( name, Gauge, description )
+		gauge.source = block if block
+		return gauge
+	end
+
+
+	### Return the metric registered under +name+, if there is one.
+	def self::[]( name )
+		return @registry_mutex.synchronize { @registry[name.to_sym] }
+	end
+
+
+	### Return a copy of the registry, keyed by name.
+	def self::metrics
+		return @registry_mutex.synchronize { @registry.dup }
+	end
+
+
+	### Return a Hash of the current value of every metric, keyed by name.
+	### Counters' values are their totals, gauges' are their values, and
+	### histograms' are summaries (see MUES::Histogram#to_h).
+	def self::snapshot
+		snapshot = {}
+		self.metrics.each do |name, metric|
+			begin
+				snapshot[ name ] = metric.value
+			rescue => err
+				MUES.logger.error "Reading metric %p failed: %s: %s" % [ name, err.class.name, err.message ]
+			end
+		end
+
+		return snapshot
+	end
+
+
+	### Set every metric back to zero.
+	def self::reset
+		self.metrics.each_value {|metric| metric.reset }
+	end
+
+
+	### Register a metric of the given +type+ under +name+, or return the one
+	### that's already registered. Raises an ArgumentError if the name is
+	### already taken by a different kind of metric.
+	def self::register( name, type, description )
+		name = name.to_sym
+
+		@registry_mutex.synchronize do
+			if metric = @registry[ name ]
+				raise ArgumentError, "metric %p is already a %s" % [ name, metric.class.name ] unless
+					metric.instance_of?( type )
+				return metric
+			end
+
+			return @registry[ name ] = type.new( name, description )
+		end
+	end
+
+end # module MUES::Metrics
+
@@ -0,0 +1,160 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/metrics'
+require 'mues/wireformat'
+
+
+# Publishes a snapshot of the engine's MUES::Metrics to the 'stats' topic
+# exchange on the environment vhost every so often, so that monitoring can
+# subscribe to it without talking to the engine directly.
+#
+# Each message is a Hash encoded with MUES::WireFormat.pack_value:
+#
+#   :time      the time of the snapshot (seconds since the epoch)
+#   :pid       the engine's process id
+#   :interval  the number of seconds since the previous snapshot
+#   :metrics   the snapshot (see MUES::Metrics.snapshot)
+#   :rates     each counter's increase per second since the previous snapshot
+#
+# == Synopsis
+#
+#   exporter = MUES::MetricsExporter.new( envbus, :metrics_interval => 10 )
+#   exporter.start
+#   ...
+#   exporter.shutdown
+#
+class MUES::MetricsExporter
+	include MUES::Constants,
+	        MUES::Loggable,
+	        MUES::TimeUtilities
+
+	# The name of the exchange metrics are published to
+	EXCHANGE_NAME = 'stats'
+
+	# The routing key metrics are published with
+	ROUTING_KEY = 'stats.engine'
+
+
+	### Create a new exporter that will publish to the given +bus+ (a Bunny
+	### client connected to the environment vhost). The +config+ may contain
+	### a :metrics_interval key, the number of seconds between snapshots.
+	def initialize( bus, config={} )
+		@bus      = bus
+		@interval = Float( config[:metrics_interval] || DEFAULT_METRICS_INTERVAL )
+		raise ArgumentError, "metrics interval must be positive" unless @interval > 0
+
+		@exchange = nil
+		@thread   = nil
+		@running  = false
+		@mutex    = Mutex.new
+		@stopped  = ConditionVariable.new
+
+		@last_time   = nil
+		@last_counts = {}
+	end
+
+
+	######
+	public
+	######
+
+	# The number of seconds between snapshots
+	attr_reader :interval
+
+	# The Bunny::Exchange metrics are published to
+	attr_reader :exchange
+
+
+	### Declare the stats exchange and start publishing to it, adding the
+	### publishing thread to +threadgroup+ if one is given.
+	def start( threadgroup=nil )
+		self.log.debug "Declaring the %p topic exchange" % [ EXCHANGE_NAME ]
+		@exchange = @bus.exchange( EXCHANGE_NAME, :type => :topic, :auto_delete => true )
+
+		@running = true
+		@thread = Thread.new { self.export_periodically }
+		threadgroup.add( @thread ) if threadgroup
+		return @thread
+	end
+
+
+	### Returns +true+ if the publishing thread is running.
+	def running?
+		return @running
+	end
+
+
+	### Stop publishing.
+	def shutdown
+		@mutex.synchronize do
+			@running = false
+			@stopped.signal
+		end
+		@thread.join if @thread && @thread != Thread.current
+		@thread = nil
+	end
+
+
+	### Take a snapshot of the metrics and publish it. Returns the message that
+	### was published.
+	def export
+		message = self.make_message
+		@exchange.publish( MUES::WireFormat.pack_value(message), :key => ROUTING_KEY )
+		return message
+	end
+
+
+	### Return the message for a new snapshot of the metrics.
+	def make_message
+		now = monotonic_time()
+		elapsed = @last_time ? now - @last_time : nil
+		@last_time = now
+
+		metrics = MUES::Metrics.snapshot
+		rates = {}
+		MUES::Metrics.metrics.each do |name, metric|
+			next unless metric.is_a?( MUES::Metrics::Counter ) && metrics.key?( name )
+			count = metrics[ name ]
+			rates[ name ] = ( count - @last_counts[name] ) / elapsed if
+				elapsed && elapsed > 0 && @last_counts.key?( name )
+			@last_counts[ name ] = count
+		end
+
+		return {
+			:time     => Time.now.to_i,
+			:pid      => Process.pid,
+			:interval => elapsed,
+			:metrics  => metrics,
+			:rates    => rates,
+		}
+	end
+
+
+	#########
+	protected
+	#########
+
+	### The publishing thread's loop: publish a snapshot every interval until
+	### the exporter is shut down.
+	def export_periodically
+		loop do
+			@mutex.synchronize do
+				@stopped.wait( @mutex, @interval ) if @running
+			end
+			break unless @running
+
+			begin
+				self.export
+			rescue => err
+				self.log.error "Publishing metrics failed: %s: %s" % [ err.class.name, err.message ]
+			end
+		end
+	end
+
+end # class MUES::MetricsExporter
+
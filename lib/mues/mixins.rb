@@ -1,6 +1,7 @@
 #!/usr/bin/env ruby
 
 require 'logger'
+require 'thread'
 
 # A collection of mixin modules used throughout MUES.
 module MUES
@@ -120,43 +121,81 @@ module MUES
 	end
 
 
-	### A collection of HTML utility functions
-	module HTMLUtilities
+	### A collection of utilities for measuring time.
+	module TimeUtilities
 
 		###############
 		module_function
 		###############
 
-		# The name of the Thread-local variable to keep the serialized-object
-		# cache in (i.e., Thread[ THREAD_DUMP_KEY ] = {}). The cache is keyed by
-		# object_id
-		THREAD_DUMP_KEY = :__to_html_cache__
+		if defined?( Process::CLOCK_MONOTONIC )
 
-		# The HTML fragment to wrap around Hash objects
-		HASH_HTML_CONTAINER = %{<div class="hash-members">%s</div>}
+			### Return the current value of the system's monotonic clock as a Float
+			### number of seconds. Unlike Time.now, it never jumps when the
+			### wall-clock is adjusted, so it's suitable for measuring intervals.
+			def monotonic_time
+				return Process.clock_gettime( Process::CLOCK_MONOTONIC )
+			end
 
-		# The HTML fragment to use for pairs of a Hash
-		HASH_PAIR_HTML = %{<div class="hash-pair %s">\n} +
-			%{<div class="key">%s</div>\n} +
-			%{<div class="value">%s</div>\n} +
-			%{</div>\n}
+		else
 
-		# The HTML fragment to wrap around Array objects
-		ARRAY_HTML_CONTAINER = %{<ol class="array-members"><li>%s</li></ol>}
+			### Fallback for Rubies without Process.clock_gettime: return the
+			### current wall-clock time as a Float number of seconds.
+			def monotonic_time
+				return Time.now.to_f
+			end
 
-		# The HTML fragment to wrap around immediate objects
-		IMMEDIATE_OBJECT_HTML_CONTAINER = %{<div class="immediate-object">%s</div>}
+		end
 
-		# The HTML fragment to wrap around objects other than Arrays and Hashes.
-		OBJECT_HTML_CONTAINER = %{<div id="object-%d" class="object %s">%s</div>}
+	end
 
-		# The HTML fragment to use for instance variables inside of object DIVs.
-		IVAR_HTML_FRAGMENT = %Q{
-		  <div class="%s">
-			<div class="name">%s</div>
-			<div class="value">%s</div>
-		  </div>
-		}
+
+	### A collection of functions for writing JSON by hand.
+	module JSONUtilities
+
+		# The escapes for characters that can't appear in a JSON string as-is
+		JSON_ESCAPES = Hash.new {|hash, char| hash[char] = "\\u%04x" % [char.unpack('C').first] }
+		JSON_ESCAPES.update( '"' => '\\"', '\\' => '\\\\', "\n" => '\\n', "\r" => '\\r', "\t" => '\\t' )
+
+
+		###############
+		module_function
+		###############
+
+		### Return the given +string+ as a quoted JSON string. Strings that aren't
+		### valid UTF-8 (such as binary data) have their invalid bytes replaced
+		### with U+FFFD first, so the result is always valid JSON.
+		def json_string( string )
+			string = utf8_string( string )
+			return '"' + string.gsub( /["\\\x00-\x1f]/ ) {|char| JSON_ESCAPES[char] } + '"'
+		end
+
+
+		### Return +string+ as valid UTF-8: as-is if it already is, reinterpreted
+		### if it's binary, or converted from its encoding otherwise, with any
+		### invalid bytes replaced.
+		def utf8_string( string )
+			return string unless string.respond_to?( :encoding )
+			return string if string.encoding == Encoding::UTF_8 && string.valid_encoding?
+
+			if string.encoding == Encoding::BINARY || string.encoding == Encoding::UTF_8
+				string = string.dup.force_encoding( Encoding::UTF_8 )
+			else
+				string = string.encode( Encoding::UTF_8, :invalid => :replace, :undef => :replace )
+			end
+
+			return string.valid_encoding? ? string : string.scrub
+		end
+
+	end
+
+
+	### A collection of HTML utility functions
+	module HTMLUtilities
+
+		###############
+		module_function
+		###############
 
 		### Escape special characters in the given +string+ for display in an
 		### HTML inspection interface. This escapes common invisible characters
@@ -174,108 +213,20 @@ module MUES
 		end
 
 
-		### Return an HTML fragment describing the specified +object+.
-		def make_html_for_object( object )
+		### Return an HTML fragment describing the specified +object+. See
+		### MUES::ObjectInspector for the limits on how much of it is described.
+		def make_html_for_object( object, options={} )
 			return object.html_inspect if 
 				object.respond_to?( :html_inspect ) && ! object.is_a?( HtmlInspectableObject )
-			object_html = []
-
-			case object
-			when Hash
-				object_html << "\n<!-- Hash -->\n"
-				if object.empty?
-					object_html << '{}'
-				else
-					object_html << HASH_HTML_CONTAINER % [
-						object.collect {|k,v|
-							pairclass = v.instance_variables.empty? ? 
-								"simple-hash-pair" :
-								"complex-hash-pair"
-							HASH_PAIR_HTML % [
-								pairclass,
-								make_html_for_object(k),
-								make_html_for_object(v),
-							  ]
-						}
-					]
-				end
-
-			when Array
-				object_html << "\n<!-- Array -->\n"
-				if object.empty?
-					object_html << '[]'
-				else
-					object_html << ARRAY_HTML_CONTAINER % [
-						object.collect {|o| make_html_for_object(o) }.join('</li><li>')
-					]
-				end
-
-			else
-				if object.instance_variables.empty?
-					return IMMEDIATE_OBJECT_HTML_CONTAINER % 
-						[ HTMLUtilities.escape_html(object.inspect) ]
-				else
-					object_html << make_object_html_wrapper( object )
-				end
-			end
-
-			return object_html.join("\n")
+			return MUES::ObjectInspector.render( object, options.merge(:format => :html) )
 		end
 
 
-		### Wrap up the various parts of a complex object in an HTML fragment. If the
-		### object has already been wrapped, returns a link to the previous rendering
-		### instead.
-		def make_object_html_wrapper( object )
-
-			# If the object has been rendered already, just return a link to the previous
-			# HTML fragment
-			Thread.current[ THREAD_DUMP_KEY ] ||= {}
-			if Thread.current[ THREAD_DUMP_KEY ].key?( object.object_id )
-				return %Q{<a href="#object-%d" class="cache-link" title="jump to previous details">%s</a>} % [
-					object.object_id,
-					%{&rarr; %s #%d} % [ object.class.name, object.object_id ]
-				]
-			else
-				Thread.current[ THREAD_DUMP_KEY ][ object.object_id ] = true
-			end
-
-			# Assemble the innards as an array of parts
-			parts = [
-				%{<div class="object-header">},
-				%{<span class="object-class">#{object.class.name}</span>},
-				%{<span class="object-id">##{object.object_id}</span>},
-				%{</div>},
-				%{<div class="object-body">},
-			]
-
-			object.instance_variables.sort.each do |ivar|
-				value = object.instance_variable_get( ivar )
-				html = make_html_for_object( value )
-				classes = %w[instance-variable]
-				if value.instance_variables.empty? && !value.respond_to?( :values_at )
-					classes << 'simple'
-				else
-					classes << 'complex'
-				end
-				parts << IVAR_HTML_FRAGMENT % [ classes.join(' '), ivar, html ]
-			end
-
-			parts << %{</div>}
-
-			# Make HTML class names out of the object's namespaces
-			namespaces = object.class.name.downcase.split(/::/)
-			classes = []
-			namespaces.each_index do |i|
-				classes << namespaces[0..i].join('-') + '-object'
-			end
-
-			# Glue the whole thing together and return it
-			return OBJECT_HTML_CONTAINER % [
-				object.object_id,
-				classes.join(" "),
-				parts.join("\n")
-			]
+		### Wrap up the various parts of a complex object in an HTML fragment.
+		### Objects it refers to more than once are only described the first
+		### time, and linked to after that.
+		def make_object_html_wrapper( object, options={} )
+			return MUES::ObjectInspector.render( object, options.merge(:format => :html) )
 		end
 
 	end # module HTMLUtilities
@@ -293,13 +244,10 @@ module MUES
 	module HtmlInspectableObject
 		include MUES::HTMLUtilities
 
-		### Return the receiver as an HTML fragment.
-		def html_inspect
-			if self.instance_variables.empty?
-				return make_html_for_object( self )
-			else
-				return make_object_html_wrapper( self )
-			end
+		### Return the receiver as an HTML fragment, described with the given
+		### MUES::ObjectInspector +options+.
+		def html_inspect( options={} )
+			return MUES::ObjectInspector.render( self, options.merge(:format => :html) )
 		end
 
 	end # HtmlInspectableObject
@@ -308,6 +256,15 @@ module MUES
 	# A mixin that adds a #log method to including classes that calls
 	# MUES::Logger with the class of the receiving object.
 	#
+	# Each class can be given its own level (or a whole namespace of them, e.g.,
+	# 'MUES' for all of MUES's classes) with MUES::Loggable.set_level, which
+	# overrides the global logger's level for messages from that class. The
+	# logging methods of a class with its own level are compiled for it: those
+	# below its level are no-ops, and the rest write directly, so a disabled
+	# call costs only the method call. To avoid building messages that won't be
+	# logged, pass the message in a block; it's only called if the message is
+	# going to be written.
+	#
 	# == Usage
 	# 
 	#	require "mues/mixins"
@@ -317,8 +274,11 @@ module MUES
 	#	  
 	#	  def some_method
 	#	    self.log.debug "A debugging message"
+	#	    self.log.debug { "An expensive message: %p" % [ self ] }
 	#	  end
 	#	end
+	#
+	#	MUES::Loggable.set_level( MyClass, :debug )
 	# 
 	### Add logging to a MUES class. Including classes get #log and #log_debug methods.
 	module Loggable
@@ -331,25 +291,156 @@ module MUES
 			:fatal => Logger::FATAL,
 		  }
 
+
 		### A logging proxy class that wraps calls to the logger into calls that include
 		### the name of the calling class.
 		class ClassNameProxy # :nodoc:
 
-			### Create a new proxy for the given +klass+.
-			def initialize( klass, force_debug=false )
+			### Create a new proxy for the given +klass+, with its methods compiled
+			### for the given per-class +level+ (+nil+ to follow the global logger).
+			def initialize( klass, force_debug=false, level=nil )
 				@classname   = klass.name
 				@force_debug = force_debug
+				self.compile( level )
 			end
 
-			### Delegate calls the global logger with the class name as the 'progname' 
-			### argument.
-			def method_missing( sym, msg=nil, &block )
-				return super unless LEVEL.key?( sym )
-				sym = :debug if @force_debug
-				MUES.logger.add( LEVEL[sym], msg, @classname, &block )
+
+			# The name of the class the proxy logs for
+			attr_reader :classname
+
+			# The per-class level the proxy's methods are compiled for, if any
+			attr_reader :level
+
+
+			### (Re)define the proxy's logging methods (and their predicates, e.g.,
+			### #debug?) for the given per-class +level+. Without one, they defer to
+			### the global logger's level; with one, they're either no-ops or log
+			### through the global logger with its level lowered to theirs.
+			def compile( level )
+				@level = level
+
+				LEVEL.each do |name, severity|
+					severity = Logger::DEBUG if @force_debug
+
+					if level.nil?
+						instance_eval %{
+							def #{name}( msg=nil, &block )
+								MUES.logger.add( #{severity}, msg, @classname, &block )
+							end
+							def #{name}?
+								return MUES.logger.level <= #{severity}
+							end
+						}, __FILE__, __LINE__ - 7
+					elsif severity < level
+						instance_eval %{
+							def #{name}( msg=nil )
+								return true
+							end
+							def #{name}?
+								return false
+							end
+						}, __FILE__, __LINE__ - 7
+					else
+						instance_eval %{
+							def #{name}( msg=nil, &block )
+								logger = MUES.logger
+								return logger.add( #{severity}, msg, @classname, &block ) if
+									logger.level <= #{severity}
+								logger.with_level( #{severity} ) do
+									return logger.add( #{severity}, msg, @classname, &block )
+								end
+							end
+							def #{name}?
+								return true
+							end
+						}, __FILE__, __LINE__ - 12
+					end
+				end
 			end
+
 		end # ClassNameProxy
 
+
+		# Per-class levels, keyed by class or namespace name, and the proxies that
+		# have been handed out, keyed by [ class name, force_debug ]
+		@levels         = {}
+		@proxies        = {}
+		@registry_mutex = Mutex.new
+
+
+		### Set the level of messages logged by the specified +category+ (a Class or
+		### Module, or the name of one) and the classes in its namespace to +level+
+		### (a Symbol like :debug, or a Logger level). Setting it to +nil+ goes back
+		### to following the level of the enclosing namespace or the global logger.
+		def self::set_level( category, level )
+			name = category.is_a?( Module ) ? category.name : category.to_s
+
+			unless level.nil? || level.is_a?( Integer )
+				level = LEVEL[ level.to_s.downcase.to_sym ] or
+					raise ArgumentError, "unknown log level %p" % [ level ]
+			end
+
+			@registry_mutex.synchronize do
+				if level.nil?
+					@levels.delete( name )
+				else
+					@levels[ name ] = level
+				end
+				@proxies.each_value {|proxy| proxy.compile(self.level_for_name(proxy.classname)) }
+			end
+
+			return level
+		end
+
+
+		### Return the level that's in effect for the specified +category+, or +nil+
+		### if it follows the global logger.
+		def self::level_for( category )
+			name = category.is_a?( Module ) ? category.name : category.to_s
+			return @registry_mutex.synchronize { self.level_for_name(name) }
+		end
+
+
+		### Return a copy of the per-class levels, keyed by class or namespace name.
+		def self::levels
+			return @registry_mutex.synchronize { @levels.dup }
+		end
+
+
+		### Clear all of the per-class levels.
+		def self::reset_levels
+			@registry_mutex.synchronize do
+				@levels.clear
+				@proxies.each_value {|proxy| proxy.compile(nil) }
+			end
+		end
+
+
+		### Return the shared logging proxy for the given +klass+.
+		def self::proxy_for( klass, force_debug=false )
+			name = klass.name
+			return ClassNameProxy.new( klass, force_debug ) if name.nil? || name.empty?
+
+			@registry_mutex.synchronize do
+				return @proxies[ [name, force_debug] ] ||=
+					ClassNameProxy.new( klass, force_debug, self.level_for_name(name) )
+			end
+		end
+
+
+		### Return the level set for the class or namespace +name+ or the nearest
+		### namespace that encloses it. Must be called with the registry mutex
+		### held.
+		def self::level_for_name( name )
+			while name
+				return @levels[ name ] if @levels.key?( name )
+				name = name.index( '::' ) ? name.sub( /::[^:]*\z/, '' ) : nil
+			end
+
+			return nil
+		end
+
+
 		#########
 		protected
 		#########
@@ -362,12 +453,12 @@ module MUES
 
 		### Return the proxied logger.
 		def log
-			@log_proxy ||= ClassNameProxy.new( self.class )
+			@log_proxy ||= MUES::Loggable.proxy_for( self.class )
 		end
 
 		### Return a proxied "debug" logger that ignores other level specification.
 		def log_debug
-			@log_debug_proxy ||= ClassNameProxy.new( self.class, true )
+			@log_debug_proxy ||= MUES::Loggable.proxy_for( self.class, true )
 		end
 
 	end # module Loggable
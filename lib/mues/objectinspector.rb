@@ -0,0 +1,434 @@
+#!/usr/bin/env ruby
+
+require 'stringio'
+
+require 'mues'
+require 'mues/mixins'
+
+
+# Writes a description of an object and the objects it refers to, as HTML or
+# JSON, to an IO a piece at a time, so that even an object graph the size of a
+# live world can be looked at without building the whole description in
+# memory or holding up the engine for long.
+#
+# How much is described is bounded:
+#
+# [:max_depth]
+#   how many levels of instance variables and collection members are followed;
+#   objects below that are described by their class and id (or size) only
+# [:page_size]
+#   how many members of each Hash or Array are described; the rest are counted
+# [:page]
+#   which page of the members of the inspected object itself (if it's a Hash or
+#   an Array) is described, so a large collection can be paged through
+# [:max_objects]
+#   the most values that are described in all; anything after that is elided
+# [:max_string]
+#   the most characters of a String that are shown
+#
+# Objects (including Hashes and Arrays) that are reached more than once are
+# described the first time and referred to after that, so structures that
+# contain themselves don't recurse without end. The objects that have been seen are only remembered
+# for the duration of one #render.
+#
+# To look at something deep inside a large structure, use ::resolve to follow
+# a path of instance variable names, Hash keys and Array indexes to it first.
+#
+# == Synopsis
+#
+#   inspector = MUES::ObjectInspector.new( socket, :format => :json, :max_depth => 2 )
+#   inspector.render( engine.environment )
+#
+#   players = MUES::ObjectInspector.resolve( engine, ['@players'] )
+#   MUES::ObjectInspector.new( socket, :page => 3 ).render( players )
+#
+class MUES::ObjectInspector
+	include MUES::HTMLUtilities,
+	        MUES::JSONUtilities
+
+	# The formats descriptions can be written in
+	FORMATS = [ :html, :json ]
+
+	# The default options
+	DEFAULT_OPTIONS = {
+		:format      => :html,
+		:max_depth   => 4,
+		:page_size   => 50,
+		:page        => 0,
+		:max_objects => 10_000,
+		:max_string  => 1024,
+	}
+
+	# The number of values described between giving other threads a chance to
+	# run
+	YIELD_INTERVAL = 500
+
+	# The HTML fragment written for an object that's already been described
+	HTML_REFERENCE = %{<a href="#object-%d" class="cache-link" title="jump to previous details">} +
+		%{&rarr; %s #%d</a>}
+
+	# The HTML fragment written for a collection below the :max_depth limit
+	HTML_COLLAPSED = %{<div class="elided">%s of %d members</div>\n}
+
+	# The HTML fragment written for objects without instance variables
+	HTML_IMMEDIATE = %{<div class="immediate-object">%s</div>}
+
+	# The HTML fragment written in place of the members of a collection that
+	# aren't described
+	HTML_MORE = %{<div class="more-members">members %d to %d of %d</div>\n}
+
+	# The HTML fragment written in place of anything past the :max_objects limit
+	HTML_ELIDED = %{<div class="elided">&hellip;</div>}
+
+
+	### Write a description of the given +object+ with the specified +options+ to
+	### a String and return it.
+	def self::render( object, options={} )
+		io = StringIO.new( '' )
+		self.new( io, options ).render( object )
+		return io.string
+	end
+
+
+	### Follow the given +path+ from +object+ and return the object at the end
+	### of it. Each step of the path is an instance variable name (starting with
+	### '@'), an Array index, or a Hash key (tried as given, as a String, as a
+	### Symbol and as an Integer). Raises an IndexError if a step can't be
+	### followed.
+	def self::resolve( object, path )
+		target = path.inject( object ) do |current, step|
+			name = step.to_s
+
+			if name[0, 1] == '@'
+				raise IndexError, "%s has no %s" % [ current.class.name, name ] unless
+					current.instance_variable_defined?( name )
+				current.instance_variable_get( name )
+			elsif current.is_a?( Array )
+				index = Integer( name ) rescue raise( IndexError, "%p isn't an index" % [step] )
+				raise IndexError, "no element %d" % [ index ] unless index < current.length
+				current[ index ]
+			elsif current.is_a?( Hash )
+				candidates = [ step, name, name.to_sym ]
+				candidates << Integer( name ) if name =~ /\A-?\d+\z/
+				key = candidates.find {|candidate| current.key?(candidate) } or
+					raise IndexError, "no key %p" % [ step ]
+				current[ key ]
+			else
+				raise IndexError, "can't follow %p into a %s" % [ step, current.class.name ]
+			end
+		end
+
+		return target
+	end
+
+
+	### Create an inspector that writes to the given +io+ with the specified
+	### +options+ (see DEFAULT_OPTIONS).
+	def initialize( io, options={} )
+		options = DEFAULT_OPTIONS.merge( options )
+
+		@io          = io
+		@format      = options[:format].to_sym
+		@max_depth   = Integer( options[:max_depth] )
+		@page_size   = Integer( options[:page_size] )
+		@page        = Integer( options[:page] )
+		@max_objects = Integer( options[:max_objects] )
+		@max_string  = Integer( options[:max_string] )
+
+		raise ArgumentError, "unknown inspection format %p" % [ @format ] unless
+			FORMATS.include?( @format )
+		raise ArgumentError, "page size must be positive" unless @page_size > 0
+
+		@visited   = nil
+		@count     = 0
+		@truncated = false
+	end
+
+
+	######
+	public
+	######
+
+	# The IO descriptions are written to
+	attr_reader :io
+
+	# The format descriptions are written in (:html or :json)
+	attr_reader :format
+
+	# The number of values described by the last #render
+	attr_reader :count
+
+
+	### Returns +true+ if the last #render stopped at the :max_objects limit.
+	def truncated?
+		return @truncated
+	end
+
+
+	### Write a description of the given +object+ to the inspector's IO. Returns
+	### the number of values that were described.
+	def render( object )
+		@visited   = {}
+		@count     = 0
+		@truncated = false
+
+		if @format == :html
+			self.write_html( object, 0 )
+		else
+			self.write_json( object, 0 )
+			@io.write( "\n" )
+		end
+
+		return @count
+	ensure
+		@visited = nil
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Count another value as described, returning +false+ if that goes over the
+	### :max_objects limit.
+	def count_value
+		if @count >= @max_objects
+			@truncated = true
+			return false
+		end
+
+		@count += 1
+		Thread.pass if ( @count % YIELD_INTERVAL ).zero?
+		return true
+	end
+
+
+	### Call the block with each member of +collection+ (an Array or a Hash) on
+	### the page that's described at the given +depth+. Returns the index of the
+	### first member on the page and the number of members described. The
+	### members are copied out before any of them are described, so the
+	### collection can be changed by other threads in the meantime.
+	def each_on_page( collection, depth )
+		first = depth.zero? ? @page * @page_size : 0
+
+		if collection.is_a?( Array )
+			members = collection[ first, @page_size ]
+		else
+			members = collection.first( first + @page_size )[ first, @page_size ]
+		end
+		members ||= []
+
+		members.each_with_index {|member, index| yield(member, index) }
+		return first, members.length
+	end
+
+
+	### Return the #inspect of +object+, shortening Strings longer than the
+	### :max_string limit.
+	def short_inspect( object )
+		return object.inspect unless object.is_a?( String ) && object.length > @max_string
+		return object[ 0, @max_string ].inspect + "... (%d characters)" % [ object.length ]
+	end
+
+
+	### Return the HTML/CSS class names for the namespaces of the given +object+'s
+	### class.
+	def namespace_classes( object )
+		namespaces = ( object.class.name || 'anonymous' ).downcase.split( /::/ )
+		return ( 0 ... namespaces.length ).collect do |i|
+			namespaces[ 0..i ].join( '-' ) + '-object'
+		end
+	end
+
+
+	### Returns +true+ if the given +object+ has instance variables that are
+	### worth describing.
+	def complex?( object )
+		return !object.instance_variables.empty? || object.is_a?( Hash ) || object.is_a?( Array )
+	end
+
+
+	#
+	# HTML
+	#
+
+	### Write the HTML description of +object+ at the given +depth+.
+	def write_html( object, depth )
+		return @io.write( HTML_ELIDED ) unless self.count_value
+
+		case object
+		when Hash
+			self.write_html_collection( object, depth, 'Hash', '{}',
+				%{<div id="object-%d" class="hash-members">}, %{</div>} ) do |(key, value), _|
+				@io.write( %{<div class="hash-pair %s">\n<div class="key">} %
+					[ self.complex?(value) ? 'complex-hash-pair' : 'simple-hash-pair' ] )
+				self.write_html( key, depth + 1 )
+				@io.write( %{</div>\n<div class="value">} )
+				self.write_html( value, depth + 1 )
+				@io.write( %{</div>\n</div>\n} )
+			end
+
+		when Array
+			self.write_html_collection( object, depth, 'Array', '[]',
+				%{<ol id="object-%d" class="array-members">}, %{</ol>} ) do |member, _|
+				@io.write( '<li>' )
+				self.write_html( member, depth + 1 )
+				@io.write( '</li>' )
+			end
+
+		else
+			if object.respond_to?( :html_inspect ) && !object.is_a?( MUES::HtmlInspectableObject )
+				@io.write( object.html_inspect )
+			elsif object.instance_variables.empty?
+				@io.write( HTML_IMMEDIATE % [escape_html(self.short_inspect( object ))] )
+			else
+				self.write_html_object( object, depth )
+			end
+		end
+	end
+
+
+	### Write the HTML description of the Hash or Array +collection+, calling the
+	### block for each member on the page. The +open+ tag is given the
+	### collection's id.
+	def write_html_collection( collection, depth, kind, empty, open, close, &block )
+		@io.write( "\n<!-- #{kind} -->\n" )
+		return @io.write( empty ) if collection.empty?
+
+		id = collection.object_id
+		return @io.write( HTML_REFERENCE % [id, kind, id] ) if @visited.key?( id )
+		@visited[ id ] = true
+		return @io.write( HTML_COLLAPSED % [kind, collection.length] ) if depth >= @max_depth
+
+		@io.write( open % [id] )
+		first, shown = self.each_on_page( collection, depth, &block )
+		@io.write( close )
+
+		@io.write( HTML_MORE % [first + 1, first + shown, collection.length] ) if
+			shown < collection.length
+	end
+
+
+	### Write the HTML description of an +object+ that has instance variables.
+	def write_html_object( object, depth )
+		id = object.object_id
+		return @io.write( HTML_REFERENCE % [id, object.class.name, id] ) if @visited.key?( id )
+		@visited[ id ] = true
+
+		@io.write( %{<div id="object-%d" class="object %s">\n} % [id, self.namespace_classes(object).join(' ')] )
+		@io.write( %{<div class="object-header">\n} +
+			%{<span class="object-class">#{object.class.name}</span>\n} +
+			%{<span class="object-id">##{id}</span>\n</div>\n} )
+		@io.write( %{<div class="object-body">\n} )
+
+		ivars = object.instance_variables.sort
+		if depth >= @max_depth
+			@io.write( %{<div class="elided">%d instance variables</div>\n} % [ivars.length] )
+		else
+			ivars.each do |ivar|
+				value = object.instance_variable_get( ivar )
+				@io.write( %{<div class="instance-variable %s">\n<div class="name">%s</div>\n} %
+					[ self.complex?(value) ? 'complex' : 'simple', ivar ] )
+				@io.write( %{<div class="value">} )
+				self.write_html( value, depth + 1 )
+				@io.write( %{</div>\n</div>\n} )
+			end
+		end
+
+		@io.write( %{</div>\n</div>} )
+	end
+
+
+	#
+	# JSON
+	#
+
+	### Write the JSON description of +object+ at the given +depth+.
+	def write_json( object, depth )
+		return @io.write( '{"elided":true}' ) unless self.count_value
+
+		case object
+		when nil, true, false, Integer
+			@io.write( object.nil? ? 'null' : object.to_s )
+		when Float
+			@io.write( object.finite? ? object.to_s : json_string(object.to_s) )
+		when String
+			text = object.length > @max_string ? object[ 0, @max_string ] : object
+			@io.write( json_string(text) )
+
+		when Hash
+			self.write_json_collection( object, depth, 'pairs' ) do |(key, value), _|
+				@io.write( '[' )
+				self.write_json( key, depth + 1 )
+				@io.write( ',' )
+				self.write_json( value, depth + 1 )
+				@io.write( ']' )
+			end
+
+		when Array
+			self.write_json_collection( object, depth, 'items' ) do |member, _|
+				self.write_json( member, depth + 1 )
+			end
+
+		else
+			if object.instance_variables.empty?
+				@io.write( '{"class":%s,"inspect":%s}' %
+					[json_string(object.class.name.to_s), json_string(self.short_inspect(object))] )
+			else
+				self.write_json_object( object, depth )
+			end
+		end
+	end
+
+
+	### Write the JSON description of the Hash or Array +collection+, with the
+	### members on the page under the given +key+, calling the block for each of
+	### them.
+	def write_json_collection( collection, depth, key )
+		id = collection.object_id
+		classname = json_string( collection.class.name )
+		unless collection.empty?
+			return @io.write( '{"class":%s,"id":%d,"ref":true}' % [classname, id] ) if
+				@visited.key?( id )
+			@visited[ id ] = true
+			return @io.write( '{"class":%s,"id":%d,"size":%d,"elided":true}' %
+				[classname, id, collection.length] ) if depth >= @max_depth
+		end
+
+		@io.write( '{"class":%s,' % [classname] )
+		@io.write( '"id":%d,' % [id] ) unless collection.empty?
+		@io.write( '"size":%d,"%s":[' % [collection.length, key] )
+		first, _shown = self.each_on_page( collection, depth ) do |member, index|
+			@io.write( ',' ) unless index.zero?
+			yield( member, index )
+		end
+		@io.write( '],"first":%d}' % [first] )
+	end
+
+
+	### Write the JSON description of an +object+ that has instance variables.
+	def write_json_object( object, depth )
+		id = object.object_id
+		classname = json_string( object.class.name.to_s )
+		return @io.write( '{"class":%s,"id":%d,"ref":true}' % [classname, id] ) if
+			@visited.key?( id )
+		@visited[ id ] = true
+
+		ivars = object.instance_variables.sort
+		if depth >= @max_depth
+			return @io.write( '{"class":%s,"id":%d,"ivars":%d,"elided":true}' %
+				[classname, id, ivars.length] )
+		end
+
+		@io.write( '{"class":%s,"id":%d,"ivars":{' % [classname, id] )
+		ivars.each_with_index do |ivar, i|
+			@io.write( ',' ) unless i.zero?
+			@io.write( json_string(ivar.to_s) + ':' )
+			self.write_json( object.instance_variable_get(ivar), depth + 1 )
+		end
+		@io.write( '}}' )
+	end
+
+
+end # class MUES::ObjectInspector
+
@@ -0,0 +1,553 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+require 'zlib'
+require 'fileutils'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/snapshotfile'
+
+
+# An append-only log of object records, split into numbered segment files in a
+# directory, that MUES::ObjectStore keeps the world in.
+#
+# Each record is a fixed header followed by the record's key and data:
+#
+#   offset  size  field
+#        0     4  magic ('MUOL')
+#        4     1  flags (FLAG_DELETED for a tombstone)
+#        5     2  key length
+#        7     4  data length
+#       11     4  CRC32 of the flags, key, and data
+#
+# Records are only ever appended, and a batch of them is fsynced before
+# #append_batch returns, so a crash can at worst leave a partly-written record
+# at the end of the newest segment. When the log is opened, the segments are
+# scanned to rebuild the index of where the newest record for each key is, and
+# a torn or corrupt record at the end of the last segment is truncated away.
+#
+# So that the log doesn't grow without bound (and opening it doesn't have to
+# scan its whole history), the live records in the segments up to a given one
+# can be compacted into a snapshot with #write_snapshot. A snapshot is a
+# MUES::SnapshotFile named after the last segment it covers; it's written to a
+# temporary file and renamed into place once it's been fsynced, so one that
+# has a trailer is complete.
+#
+# The segments a snapshot replaces are only deleted once no snapshot that's
+# being kept needs them, so that if the newest snapshot turns out to be
+# unreadable, the log can fall back to an older one and replay the segments
+# after it without losing anything. If the segments an older snapshot needs
+# are gone, opening the log fails rather than silently losing records.
+#
+# When the log is opened, it opens the newest complete snapshot -- which only
+# means reading its header and trailer -- and scans the segments after it. The
+# index in memory only holds the records in those segments (including
+# tombstones); anything else is looked up in the snapshot's key table the first
+# time it's needed, so the time it takes to open the log depends on how much
+# has been written since the last snapshot rather than on how many records
+# there are.
+#
+# == Synopsis
+#
+#   log = MUES::ObjectLog.new( 'world' )
+#   log.append_batch( [ ['door', Marshal.dump(door)], ['lamp', nil] ] )
+#   data = log.read( 'door' )
+#   log.close
+#
+class MUES::ObjectLog
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# The magic bytes at the start of each record
+	MAGIC = 'MUOL'
+
+	# The pack() format of a record header
+	HEADER_FORMAT = 'a4CnNN'
+
+	# The length of a record header, in bytes
+	HEADER_LENGTH = 15
+
+	# Record flag: the record is a tombstone for a deleted key
+	FLAG_DELETED = 0x01
+
+	# The sprintf() format of segment file names
+	SEGMENT_NAME_FORMAT = '%08d.seg'
+
+	# The glob that matches segment files
+	SEGMENT_GLOB = '[0-9]*.seg'
+
+	# The sprintf() format of snapshot file names
+	SNAPSHOT_NAME_FORMAT = '%08d.snap'
+
+	# The glob that matches snapshot files
+	SNAPSHOT_GLOB = '[0-9]*.snap'
+
+
+	# The location of a key's newest record: the path of the segment or snapshot
+	# it's in, its offset and length, and whether it's a tombstone
+	Location = Struct.new( :path, :offset, :length, :deleted )
+
+	# The error raised when a record fails its checksum
+	class CorruptRecord < StandardError; end
+
+
+	### Open (creating it if necessary) the log in the specified +directory+,
+	### rolling over to a new segment whenever the current one grows past
+	### +segment_size+ bytes.
+	def initialize( directory, segment_size=DEFAULT_OBJECTSTORE_SEGMENT_SIZE )
+		@directory    = directory.to_s
+		@segment_size = Integer( segment_size )
+
+		@index        = {}
+		@readers      = {}
+		@writer       = nil
+		@segment      = nil
+		@snapshot     = nil
+		@snapshot_file = nil
+		@mutex        = Mutex.new
+		@snapshot_mutex = Mutex.new
+
+		FileUtils.mkdir_p( @directory )
+		self.recover
+	end
+
+
+	######
+	public
+	######
+
+	# The directory the segment files are in
+	attr_reader :directory
+
+	# The size segments are rolled over at
+	attr_reader :segment_size
+
+	# The number of the segment records are being appended to
+	attr_reader :segment
+
+	# The number of the newest snapshot, or +nil+ if there isn't one
+	attr_reader :snapshot
+
+
+	### Return the keys of all of the live (not deleted) records. This has to
+	### read the whole key table of the snapshot, if there is one.
+	def keys
+		@mutex.synchronize do
+			keys = []
+			@index.each {|key, location| keys << key unless location.deleted }
+			@snapshot_file.each {|key, _, _| keys << key unless @index.key?(key) } if @snapshot_file
+			return keys
+		end
+	end
+
+
+	### Return the number of live records.
+	def size
+		return self.keys.length
+	end
+
+
+	### Returns +true+ if there's a live record for the specified +key+.
+	def include?( key )
+		key = self.class.binary( key )
+		return @mutex.synchronize { !self.locate(key).nil? }
+	end
+
+
+	### Return the numbers of the log's segment files, oldest first.
+	def segments
+		return Dir.glob( File.join(@directory, SEGMENT_GLOB) ).
+			collect {|path| File.basename(path).to_i }.sort
+	end
+
+
+	### Return the numbers of the log's snapshot files, oldest first.
+	def snapshots
+		return Dir.glob( File.join(@directory, SNAPSHOT_GLOB) ).
+			collect {|path| File.basename(path).to_i }.sort
+	end
+
+
+	### Append the given +records+, an Array of [ key, data ] pairs (where +data+
+	### is +nil+ to delete the key), to the log, and fsync it. Keys must be
+	### Strings.
+	def append_batch( records )
+		return 0 if records.empty?
+
+		@mutex.synchronize do
+			self.roll_segment if @writer.nil? || @writer.pos >= @segment_size
+
+			offset = @writer.pos
+			path = self.segment_path( @segment )
+			locations = []
+			buffer = ''
+			buffer.force_encoding( 'binary' ) if buffer.respond_to?( :force_encoding )
+
+			records.each do |key, data|
+				key = self.class.binary( key )
+				record = self.class.pack_record( key, data )
+				locations << [ key, Location.new(path, offset + buffer.length, record.length, data.nil?) ]
+				buffer << record
+			end
+
+			@writer.write( buffer )
+			@writer.flush
+			@writer.fsync
+
+			# Only publish the new locations once they're safely on disk
+			locations.each {|key, location| @index[key] = location }
+
+			return buffer.length
+		end
+	end
+
+
+	### Read the newest data stored under the specified +key+, or +nil+ if there
+	### isn't any.
+	def read( key )
+		key = self.class.binary( key )
+		@mutex.synchronize do
+			location = self.locate( key ) or return nil
+			record = self.read_at( location.path, location.offset, location.length )
+			_, data, _ = self.class.unpack_record( record )
+			return data
+		end
+	end
+
+
+	### Close the current segment and start appending to a new one. Returns the
+	### number of the segment that was closed, which can be passed to
+	### #write_snapshot.
+	def roll
+		@mutex.synchronize do
+			closed = @segment
+			self.roll_segment
+			return closed
+		end
+	end
+
+
+	### Compact the newest snapshot (if there is one) and the live records in the
+	### segments up to and including +upto+ into a new snapshot, then delete all
+	### but the newest +keep+ snapshots (all of them are kept if +keep+ is 0),
+	### and the segments that none of the remaining ones need. The segment
+	### that's being appended to can't be included. Returns the number of
+	### records in the snapshot.
+	def write_snapshot( upto, keep=1 )
+		upto = Integer( upto )
+		@snapshot_mutex.synchronize do
+			sources = {}
+			previous = overlay = nil
+
+			@mutex.synchronize do
+				raise ArgumentError, "can't snapshot segment %d while it's being written" % [ upto ] if
+					upto >= @segment
+				raise ArgumentError, "segment %d is already in snapshot %d" % [ upto, @snapshot ] if
+					@snapshot && upto <= @snapshot
+
+				self.segments.each do |segment|
+					sources[ self.segment_path(segment) ] = true if
+						segment <= upto && ( @snapshot.nil? || segment > @snapshot )
+				end
+				previous = @snapshot_file
+				overlay = @index.dup
+			end
+
+			# The newest record for each key as of the end of segment +upto+. Keys
+			# that have changed since then are in the overlay with locations in
+			# later segments, which will still be in the index afterwards.
+			entries = []
+			overlay.each do |key, location|
+				entries << [ key, location ] if sources[ location.path ] && !location.deleted
+			end
+			previous.each do |key, offset, length|
+				entries << [ key, Location.new(previous.path, offset, length) ] unless overlay.key?( key )
+			end if previous
+			entries = entries.sort_by {|_, location| [location.path, location.offset] }
+
+			path = self.snapshot_path( upto )
+			snapshot_file = self.copy_records( entries, path, upto )
+
+			# The snapshot now has everything that was in the compacted segments
+			@mutex.synchronize do
+				@index.delete_if {|key, location| sources[location.path] }
+				[ previous && previous.path, *sources.keys ].compact.each do |source|
+					io = @readers.delete( source ) or next
+					io.close unless io.closed?
+				end
+				previous.close if previous
+				@snapshot_file = snapshot_file
+				@snapshot = upto
+			end
+
+			self.prune( keep )
+
+			self.log.info "Wrote snapshot %d with %d records" % [ upto, entries.length ]
+			return entries.length
+		end
+	end
+
+
+	### Close the log's files.
+	def close
+		@mutex.synchronize do
+			@writer.close if @writer && !@writer.closed?
+			@writer = nil
+			@readers.each_value {|io| io.close unless io.closed? }
+			@readers.clear
+			@snapshot_file.close if @snapshot_file
+			@snapshot_file = nil
+		end
+	end
+
+
+	### Pack a record for the given +key+ and +data+ (+nil+ for a tombstone).
+	def self::pack_record( key, data )
+		key = self.binary( key )
+		flags = data.nil? ? FLAG_DELETED : 0
+		data = self.binary( data || '' )
+
+		crc = Zlib.crc32( flags.chr + key + data )
+		record = [ MAGIC, flags, key.length, data.length, crc ].pack( HEADER_FORMAT )
+		record.force_encoding( 'binary' ) if record.respond_to?( :force_encoding )
+
+		return record << key << data
+	end
+
+
+	### Unpack the given +record+ and return its key, data (+nil+ for a
+	### tombstone), and total length. Raises a CorruptRecord error if the record
+	### is incomplete or fails its checksum.
+	def self::unpack_record( record )
+		raise CorruptRecord, "truncated header" if record.length < HEADER_LENGTH
+		magic, flags, key_length, data_length, crc = record.unpack( HEADER_FORMAT )
+		raise CorruptRecord, "bad magic %p" % [ magic ] unless magic == MAGIC
+
+		length = HEADER_LENGTH + key_length + data_length
+		raise CorruptRecord, "truncated record" if record.length < length
+
+		key  = record[ HEADER_LENGTH, key_length ]
+		data = record[ HEADER_LENGTH + key_length, data_length ]
+		raise CorruptRecord, "checksum mismatch" unless
+			Zlib.crc32( flags.chr + key + data ) == crc
+
+		data = nil if ( flags & FLAG_DELETED ).nonzero?
+		return key, data, length
+	end
+
+
+	### Return the given +string+ (or the String form of the object) with its
+	### encoding set to binary, so that keys compare equal no matter where they
+	### came from.
+	def self::binary( string )
+		string = string.to_s
+		return string unless string.respond_to?( :force_encoding )
+		return string if string.encoding == Encoding::BINARY
+		return string.dup.force_encoding( Encoding::BINARY )
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Delete all but the newest +keep+ snapshots (unless +keep+ is 0), and
+	### the segments that are in every snapshot that's left.
+	def prune( keep )
+		snapshots = self.snapshots
+		if keep > 0
+			snapshots[ 0 ... -keep ].each {|number| File.delete(self.snapshot_path(number)) }
+			snapshots = snapshots.last( keep )
+		end
+
+		oldest = snapshots.first or return
+		self.segments.each do |segment|
+			File.delete( self.segment_path(segment) ) if segment <= oldest
+		end
+	end
+
+
+	### Rebuild the index from the newest snapshot and the segment files after
+	### it, truncating any torn record off the end of the last one.
+	def recover
+		Dir.glob( File.join(@directory, '*.tmp') ).each {|path| File.delete(path) }
+		self.load_snapshot
+
+		segments = self.segments
+		if @snapshot
+			# Segments that are already in the snapshot, and are only kept for
+			# the sake of older ones
+			segments = segments.reject {|segment| segment <= @snapshot }
+		end
+
+		# If the snapshot that was loaded is older than the newest one, the
+		# segments after it have to be all there, or records would be lost
+		expected = ( @snapshot || 0 ) + 1
+		first = segments.first || ( self.snapshots.last || 0 ) + 1
+		raise CorruptRecord, "segments %d to %d after snapshot %p are missing" %
+			[ expected, first - 1, @snapshot ] if first > expected
+
+		segments.each do |segment|
+			last = ( segment == segments.last )
+			path = self.segment_path( segment )
+			good = self.scan_file( path, 0, File.size(path) )
+
+			if good < File.size( path )
+				raise CorruptRecord, "corrupt record in segment %d at offset %d" % [ segment, good ] unless
+					last
+				self.log.warn "Truncating torn record at the end of segment %d (offset %d)" %
+					[ segment, good ]
+				File.truncate( path, good )
+			end
+		end
+
+		if segments.empty?
+			self.roll_segment
+		else
+			@segment = segments.last
+			@writer = File.open( self.segment_path(@segment), 'ab' )
+			@writer.seek( 0, IO::SEEK_END )
+		end
+	end
+
+
+	### Open the newest complete snapshot, if there is one.
+	def load_snapshot
+		self.snapshots.reverse.each do |number|
+			begin
+				@snapshot_file = MUES::SnapshotFile.new( self.snapshot_path(number), number )
+			rescue MUES::SnapshotFile::FormatError => err
+				self.log.error "Skipping snapshot %d: %s" % [ number, err.message ]
+				next
+			end
+
+			self.log.info "Opened snapshot %d (%d records)" % [ number, @snapshot_file.count ]
+			@snapshot = number
+			return number
+		end
+
+		return nil
+	end
+
+
+	### Scan the file at +path+ from +start+ up to (but not past) +stop+, adding
+	### the location of every record in it to the index. Returns the offset of
+	### the end of the last good record.
+	def scan_file( path, start, stop )
+		offset = start
+
+		File.open( path, 'rb' ) do |io|
+			io.seek( start )
+			while offset + HEADER_LENGTH <= stop && header = io.read( HEADER_LENGTH )
+				break if header.length < HEADER_LENGTH
+				magic, flags, key_length, data_length, crc = header.unpack( HEADER_FORMAT )
+				break unless magic == MAGIC
+
+				length = HEADER_LENGTH + key_length + data_length
+				break if offset + length > stop
+
+				key = io.read( key_length )
+				data = io.read( data_length )
+				break if key.nil? || key.length < key_length ||
+				         ( data_length > 0 && (data.nil? || data.length < data_length) )
+				break unless Zlib.crc32( flags.chr + key + (data || '') ) == crc
+
+				@index[ key ] = Location.new( path, offset, length, (flags & FLAG_DELETED).nonzero? )
+
+				offset += length
+			end
+		end
+
+		return offset
+	end
+
+
+	### Copy the records at the locations in +entries+ (an Array of [ key,
+	### location ] pairs) into a new snapshot of segment +upto+ at +path+, and
+	### return it as an open MUES::SnapshotFile.
+	def copy_records( entries, path, upto )
+		tmppath = path + '.tmp'
+		readers = {}
+		writer = MUES::SnapshotFile::Writer.new( tmppath, upto )
+
+		entries.each do |key, location|
+			reader = ( readers[location.path] ||= File.open(location.path, 'rb') )
+			reader.seek( location.offset )
+			record = reader.read( location.length )
+
+			# Make sure a corrupt record doesn't get carried forward
+			self.class.unpack_record( record )
+			writer.append( key, record )
+		end
+
+		writer.finish
+		File.rename( tmppath, path )
+		self.sync_directory
+
+		return MUES::SnapshotFile.new( path, upto )
+	rescue
+		writer.abort if writer
+		File.delete( tmppath ) if File.exist?( tmppath )
+		raise
+	ensure
+		readers.each_value {|reader| reader.close } if readers
+	end
+
+
+	### Return the Location of the newest live record for +key+, or +nil+ if
+	### there isn't one. Must be called with the mutex held.
+	def locate( key )
+		if location = @index[ key ]
+			return location.deleted ? nil : location
+		end
+
+		return nil unless @snapshot_file
+		offset, length = @snapshot_file.find( key )
+		return nil unless offset
+		return Location.new( @snapshot_file.path, offset, length )
+	end
+
+
+	### Fsync the log's directory so that renames in it are durable (where the
+	### platform allows it).
+	def sync_directory
+		File.open( @directory, 'r' ) {|dir| dir.fsync }
+	rescue SystemCallError, IOError
+		# Not every platform can fsync a directory
+	end
+
+
+	### Start a new segment file and make it the one records are appended to.
+	def roll_segment
+		@writer.close if @writer && !@writer.closed?
+		@segment = [ self.segments.last || 0, @snapshot || 0, @segment || 0 ].max + 1
+		self.log.info "Starting object log segment %d" % [ @segment ]
+		@writer = File.open( self.segment_path(@segment), 'ab' )
+		@writer.seek( 0, IO::SEEK_END )
+	end
+
+
+	### Read +length+ bytes at +offset+ of the file at +path+. Must be called with
+	### the mutex held.
+	def read_at( path, offset, length )
+		io = ( @readers[path] ||= File.open(path, 'rb') )
+		io.seek( offset )
+		return io.read( length )
+	end
+
+
+	### Return the path to the file of the specified +segment+.
+	def segment_path( segment )
+		return File.join( @directory, SEGMENT_NAME_FORMAT % [segment] )
+	end
+
+
+	### Return the path to the specified +snapshot+ file.
+	def snapshot_path( snapshot )
+		return File.join( @directory, SNAPSHOT_NAME_FORMAT % [snapshot] )
+	end
+
+end # class MUES::ObjectLog
+
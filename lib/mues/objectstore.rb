@@ -0,0 +1,595 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/objectlog'
+require 'mues/sortedindex'
+require 'mues/memorymanager'
+
+
+# A persistent store for the objects that make up the Environment, with
+# dirty-tracking and write-behind so that saving the world never stalls the
+# tick loop.
+#
+# Objects are identified by their #muesid (or an explicit id). Storing an
+# object, or marking one that's already stored as dirty, serializes it with
+# Marshal right then, on the calling thread, so each record holds the object
+# as it was at that moment rather than part-way through a later tick's
+# changes. A background writer thread appends the serialized records to a
+# MUES::ObjectLog in batches, either every :objectstore_flush_interval seconds
+# or as soon as :objectstore_batch_size objects are waiting, whichever comes
+# first. #sync writes everything that's dirty right away.
+#
+# Objects that have been stored or retrieved stay resident, so retrieving one
+# again returns the same object, until there are more resident objects than
+# :objectstore_resident_limit. Then the store's MUES::MemoryManager (chosen
+# with :memory_manager) picks cold objects to evict; they're loaded again from
+# the log the next time they're retrieved. Dirty objects and objects that are
+# pinned with #pin are never evicted. Since an evicted object comes back as a
+# new copy, code that keeps objects around for a long time should keep their
+# ids instead.
+#
+# The store can also maintain secondary indexes on attributes of its objects
+# (declared with the :indexes config key), so that objects can be looked up by
+# attribute value, range, or prefix without deserializing every record. The
+# special 'class' index is on the name of the object's class. Indexes are
+# updated whenever an object is stored or marked dirty, and each record in the
+# log carries its indexed values ahead of the object itself so the indexes can
+# be rebuilt at startup without unmarshalling any objects.
+#
+# == Synopsis
+#
+#   store = MUES::ObjectStore.new( :objectstore_dir => 'world',
+#                                  :indexes => %w{class username} )
+#   store.start
+#
+#   store.store( door )
+#   door.open = true
+#   store.mark_dirty( door )
+#
+#   store.retrieve( door.muesid )   # => door
+#   store.lookup( :class => MUES::User, :username => 'ged' )
+#   store.close
+#
+class MUES::ObjectStore
+	include MUES::Constants,
+	        MUES::Loggable,
+	        MUES::TimeUtilities
+
+
+	### Create a new ObjectStore with the given +config+, which may contain the
+	### :objectstore_dir, :objectstore_segment_size, :objectstore_flush_interval,
+	### :objectstore_batch_size, :objectstore_resident_limit, :memory_manager,
+	### and :indexes keys.
+	def initialize( config={} )
+		@directory      = config[:objectstore_dir] || DEFAULT_OBJECTSTORE_DIR
+		@flush_interval = Float( config[:objectstore_flush_interval] || DEFAULT_OBJECTSTORE_FLUSH_INTERVAL )
+		@batch_size     = Integer( config[:objectstore_batch_size] || DEFAULT_OBJECTSTORE_BATCH_SIZE )
+		@object_log     = MUES::ObjectLog.new( @directory,
+			config[:objectstore_segment_size] || DEFAULT_OBJECTSTORE_SEGMENT_SIZE )
+
+		@resident       = {}
+		@dirty          = {}
+		@dirty_serial   = 0
+		@clean          = {}
+		@deleted        = {}
+		@resident_limit = Integer( config[:objectstore_resident_limit] || DEFAULT_OBJECTSTORE_RESIDENT_LIMIT )
+		@memmgr         = MUES::MemoryManager.create( config[:memory_manager] || DEFAULT_MEMORY_MANAGER )
+		@mutex          = Mutex.new
+		@write_mutex    = Mutex.new
+		@dirty_cond     = ConditionVariable.new
+
+		@writer         = nil
+		@running        = false
+		@stats          = Hash.new( 0 )
+
+		# Secondary indexes: attribute => MUES::SortedIndex, and the indexed
+		# values of each object so they can be taken out again
+		@indexes        = {}
+		@index_values   = {}
+		( config[:indexes] || [] ).each {|attr| @indexes[attr.to_sym] = MUES::SortedIndex.new }
+		self.rebuild_indexes unless @indexes.empty?
+	end
+
+
+	######
+	public
+	######
+
+	# The directory the store's log segments are kept in
+	attr_reader :directory
+
+	# The MUES::ObjectLog the objects are written to
+	attr_reader :object_log
+
+	# The longest an object stays dirty before the writer thread saves it, in
+	# seconds
+	attr_reader :flush_interval
+
+	# The number of dirty objects that wakes up the writer thread early
+	attr_reader :batch_size
+
+	# The number of objects the store keeps resident before it starts evicting
+	attr_reader :resident_limit
+
+	# The MUES::MemoryManager that chooses which objects to evict
+	attr_reader :memmgr
+
+	### Return the names of the attributes the store maintains indexes for.
+	def indexes
+		return @indexes.keys
+	end
+
+
+	### Start the background writer thread, adding it to the specified
+	### +threadgroup+ if one is given.
+	def start( threadgroup=nil )
+		@running = true
+		@writer = Thread.new { self.write_behind }
+		threadgroup.add( @writer ) if threadgroup
+		return @writer
+	end
+
+
+	### Returns +true+ if the background writer thread is running.
+	def running?
+		return @running
+	end
+
+
+	### Store the given +object+ under the specified +id+ (or its #muesid), and
+	### mark it dirty so it'll be written as it is now. Returns the id.
+	def store( object, id=nil )
+		id ||= self.id_of( object )
+		@mutex.synchronize do
+			@deleted.delete( id )
+			self.mark_dirty_unlocked( id, object )
+			self.make_resident( id, object )
+			self.update_indexes( id, object )
+		end
+
+		return id
+	end
+
+
+	### Mark the specified +object+ (or object id) as having changed, so that it
+	### will be written as it is now the next time the store flushes. If the
+	### object has been evicted since it was retrieved, it becomes resident
+	### again.
+	def mark_dirty( object_or_id )
+		@mutex.synchronize do
+			if @resident.key?( object_or_id ) || !object_or_id.respond_to?( :muesid )
+				id, object = object_or_id, nil
+			else
+				id, object = object_or_id.muesid, object_or_id
+			end
+
+			if @resident.key?( id )
+				self.mark_dirty_unlocked( id, @resident[id] )
+			else
+				raise ArgumentError, "%p isn't in the store" % [ id ] unless
+					object && !@deleted.key?( id ) && @object_log.include?( self.key_for(id) )
+				self.mark_dirty_unlocked( id, object )
+				self.make_resident( id, object )
+			end
+
+			self.update_indexes( id, @resident[id] )
+		end
+	end
+	alias_method :touch, :mark_dirty
+
+
+	### Returns +true+ if the object with the given +id+ has changes that haven't
+	### been written yet.
+	def dirty?( id )
+		return @mutex.synchronize { @dirty.key?(id) }
+	end
+
+
+	### Return the number of objects with unwritten changes.
+	def dirty_count
+		return @mutex.synchronize { @dirty.size }
+	end
+
+
+	### Retrieve the object with the specified +id+, loading it from the log if it
+	### isn't resident. Returns +nil+ if there's no such object.
+	def retrieve( id )
+		object = @mutex.synchronize do
+			return nil if @deleted.key?( id )
+			@memmgr.touched( id ) if @resident.key?( id )
+			@resident[ id ]
+		end
+		return object if object
+
+		data = @object_log.read( self.key_for(id) ) or return nil
+		object = Marshal.load( self.unpack_payload(data).last )
+
+		@mutex.synchronize do
+			# Another thread may have loaded, stored, or deleted it in the meantime
+			return nil if @deleted.key?( id )
+			return @resident[ id ] if @resident.key?( id )
+			@stats[ :swapped_in ] += 1
+			self.make_resident( id, object )
+			return object
+		end
+	end
+	alias_method :[], :retrieve
+
+
+	### Returns +true+ if there's an object with the specified +id+ in the store.
+	def include?( id )
+		@mutex.synchronize do
+			return false if @deleted.key?( id )
+			return true if @resident.key?( id )
+		end
+		return @object_log.include?( self.key_for(id) )
+	end
+
+
+	### Remove the object with the specified +id+ from the store. Until its
+	### tombstone has been written, the deletion is remembered so that the
+	### object isn't read back from the log.
+	def delete( id )
+		@mutex.synchronize do
+			@deleted[ id ] = true
+			@resident.delete( id )
+			@clean.delete( id )
+			@memmgr.removed( id )
+			self.update_indexes( id, nil )
+			self.mark_dirty_unlocked( id )
+		end
+	end
+
+
+	### Keep the object with the specified +id+ resident until it's unpinned
+	### (e.g., because it's in an area that players are in).
+	def pin( id )
+		@mutex.synchronize { @memmgr.pin(id) }
+	end
+
+
+	### Undo one #pin of the object with the specified +id+.
+	def unpin( id )
+		@mutex.synchronize { @memmgr.unpin(id) }
+	end
+
+
+	### Returns +true+ if the object with the specified +id+ is resident.
+	def resident?( id )
+		return @mutex.synchronize { @resident.key?(id) }
+	end
+
+
+	### Return the ids of the objects whose indexed attributes match all of the
+	### given +criteria+, a Hash of attribute names and either values or Ranges
+	### of values.
+	def lookup_ids( criteria )
+		@mutex.synchronize do
+			sets = criteria.collect do |attr, value|
+				index = @indexes[ attr.to_sym ] or
+					raise ArgumentError, "no index on %p" % [ attr ]
+				value = self.index_value( value )
+
+				if value.is_a?( Range )
+					index.range( value.first, value.last, value.exclude_end? )
+				else
+					index.find( value )
+				end
+			end
+
+			return sets.inject {|ids, set| ids & set } || []
+		end
+	end
+
+
+	### Return the objects whose indexed attributes match all of the given
+	### +criteria+ (see #lookup_ids).
+	def lookup( criteria )
+		return self.lookup_ids( criteria ).collect {|id| self.retrieve(id) }.compact
+	end
+
+
+	### Return the ids of the objects whose value of the indexed +attr+ starts
+	### with +prefix+.
+	def lookup_prefix_ids( attr, prefix )
+		@mutex.synchronize do
+			index = @indexes[ attr.to_sym ] or
+				raise ArgumentError, "no index on %p" % [ attr ]
+			return index.prefix( prefix )
+		end
+	end
+
+
+	### Return the objects whose value of the indexed +attr+ starts with +prefix+.
+	def lookup_prefix( attr, prefix )
+		return self.lookup_prefix_ids( attr, prefix ).collect {|id| self.retrieve(id) }.compact
+	end
+
+
+	### Return the ids of all of the objects in the store.
+	def ids
+		ids = @object_log.keys.collect {|key| Marshal.load(key) }
+		@mutex.synchronize do
+			ids |= @resident.keys
+			ids.reject! {|id| @deleted.key?(id) }
+		end
+
+		return ids
+	end
+
+
+	### Write all of the dirty objects to the log right away. Returns the number
+	### of objects written.
+	def sync
+		return self.write_dirty
+	end
+	alias_method :flush, :sync
+
+
+	### Stop the writer thread, write any dirty objects, and close the log.
+	def close
+		@mutex.synchronize do
+			@running = false
+			@dirty_cond.signal
+		end
+		@writer.join if @writer && @writer != Thread.current
+		@writer = nil
+
+		self.write_dirty
+		@object_log.close
+	end
+
+
+	### Return a copy of the store's counters: the number of objects and batches
+	### written, the bytes written, and the time spent writing the last batch.
+	def stats
+		stats = @mutex.synchronize { @stats.dup }
+		return {
+			:resident          => @resident.size,
+			:dirty             => @dirty.size,
+			:swapped_in        => stats[ :swapped_in ],
+			:evicted           => stats[ :evicted ],
+			:objects_written   => stats[ :objects_written ],
+			:batches_written   => stats[ :batches_written ],
+			:bytes_written     => stats[ :bytes_written ],
+			:last_batch_time   => stats[ :last_batch_time ],
+		}
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the id of the given +object+.
+	def id_of( object )
+		raise ArgumentError, "%p doesn't have a muesid" % [ object ] unless
+			object.respond_to?( :muesid )
+		return object.muesid
+	end
+
+
+	### Return the key the object with the specified +id+ is stored under in the
+	### log.
+	def key_for( id )
+		return Marshal.dump( id )
+	end
+
+
+	### Return the log record payload for the given +object+: the object's
+	### indexed values, followed by the object itself.
+	def pack_payload( object )
+		values = Marshal.dump( self.index_values_of(object) )
+		return [ values.length ].pack( 'N' ) << values << Marshal.dump( object )
+	end
+
+
+	### Split the given log record payload into the Hash of indexed values and the
+	### marshalled object.
+	def unpack_payload( data )
+		length = data.unpack( 'N' ).first
+		return Marshal.load( data[4, length] ), data[ 4 + length .. -1 ]
+	end
+
+
+	### Return the value that's stored in an index for the given attribute
+	### +value+.
+	def index_value( value )
+		case value
+		when Class, Module
+			return value.name
+		when Range
+			return Range.new( self.index_value(value.first), self.index_value(value.last),
+				value.exclude_end? )
+		else
+			return value
+		end
+	end
+
+
+	### Return a Hash of the values of the given +object+'s indexed attributes.
+	def index_values_of( object )
+		values = {}
+		@indexes.each_key do |attr|
+			if attr == :class
+				values[ attr ] = object.class.name
+			elsif object.respond_to?( attr )
+				values[ attr ] = self.index_value( object.send(attr) )
+			end
+		end
+
+		return values
+	end
+
+
+	### Update the indexes for the object with the specified +id+, which is now
+	### +object+ (or +nil+ if it's been deleted). Must be called with the mutex
+	### held.
+	def update_indexes( id, object )
+		return if @indexes.empty?
+
+		new_values = object.nil? ? {} : self.index_values_of( object )
+		self.set_index_values( id, new_values )
+	end
+
+
+	### Replace the index entries for the object with the specified +id+ with the
+	### given +values+.
+	def set_index_values( id, values )
+		old_values = @index_values[ id ] || {}
+		return if old_values == values
+
+		old_values.each {|attr, value| @indexes[attr].delete(value, id) if @indexes[attr] }
+		values.each {|attr, value| @indexes[attr].insert(value, id) if @indexes[attr] }
+
+		if values.empty?
+			@index_values.delete( id )
+		else
+			@index_values[ id ] = values
+		end
+	end
+
+
+	### Rebuild the secondary indexes from the indexed values stored with each
+	### record in the log.
+	def rebuild_indexes
+		started = monotonic_time()
+		@object_log.keys.each do |key|
+			data = @object_log.read( key ) or next
+			values = self.unpack_payload( data ).first
+			values = values.reject {|attr, _| !@indexes.key?(attr) }
+			self.set_index_values( Marshal.load(key), values )
+		end
+
+		self.log.info "Rebuilt %d indexes for %d objects in %0.3fs" %
+			[ @indexes.length, @index_values.length, monotonic_time() - started ]
+	end
+
+
+	### Add the given +object+ to the resident set under the specified +id+,
+	### evicting cold objects if that puts the store over its limit. Must be
+	### called with the mutex held.
+	def make_resident( id, object )
+		@memmgr.added( id ) unless @resident.key?( id )
+		@resident[ id ] = object
+		@clean[ id ] = true unless @dirty.key?( id )
+		self.evict_unlocked if @resident.size > @resident_limit
+	end
+
+
+	### Evict objects chosen by the memory manager until the resident set is back
+	### within its limit (or nothing else can be evicted). Dirty objects, which
+	### include those that are being written, stay resident, and so do pinned
+	### ones. The memory manager isn't asked at all when every resident object
+	### is one of those, so a store full of dirty objects doesn't pay for a
+	### sweep on every #store. Must be called with the mutex held.
+	def evict_unlocked
+		excess = @resident.size - @resident_limit
+		return if excess < 1
+
+		evictable = @clean.size - @memmgr.pinned_ids.count {|id| @clean.key?(id) }
+		return if evictable < 1
+
+		victims = @memmgr.victims( [excess, evictable].min ) {|id| @clean.key?(id) }
+		victims.each do |id|
+			@resident.delete( id )
+			@clean.delete( id )
+		end
+		@stats[ :evicted ] += victims.length
+	end
+
+
+	### Mark the object with the specified +id+ dirty, serializing +object+ (or
+	### writing a tombstone if it's +nil+), and wake the writer if enough objects
+	### are waiting. Each marking gets a new serial number, so the writer can
+	### tell whether an object changed again while it was being written. Must be
+	### called with the mutex held.
+	def mark_dirty_unlocked( id, object=nil )
+		payload = object.nil? ? nil : self.snapshot( id, object )
+		@dirty[ id ] = [ (@dirty_serial += 1), payload ]
+		@clean.delete( id )
+		@dirty_cond.signal if @dirty.size >= @batch_size
+	end
+
+
+	### Return the log record payload for the given +object+, or +false+ if it
+	### can't be serialized. An object that can't be serialized stays dirty, but
+	### isn't written until it's marked dirty again.
+	def snapshot( id, object )
+		return self.pack_payload( object )
+	rescue => err
+		self.log.error "Couldn't serialize %p: %s: %s" % [ id, err.class.name, err.message ]
+		return false
+	end
+
+
+	### The writer thread's loop: write the dirty objects in batches until the
+	### store is closed.
+	def write_behind
+		written = nil
+		while @running
+			# Objects that can't be serialized stay dirty, so don't spin on them
+			@mutex.synchronize do
+				@dirty_cond.wait( @mutex, @flush_interval ) if
+					@running && ( @dirty.size < @batch_size || written == 0 )
+			end
+
+			begin
+				written = self.write_dirty
+			rescue => err
+				self.log.error "Write-behind failed: %s: %s" % [ err.class.name, err.message ]
+				self.log.debug { err.backtrace.join($/) }
+			end
+		end
+	end
+
+
+	### Write the record of each dirty object (or a tombstone for a deleted one)
+	### to the log. The records were serialized when the objects were marked
+	### dirty, so this only does the I/O. Objects stay dirty until their records
+	### have been appended, so a batch that fails to write is tried again next
+	### time. Returns the number of records written.
+	def write_dirty
+		@write_mutex.synchronize do
+			batch = @mutex.synchronize do
+				@dirty.collect do |id, (serial, payload)|
+					[ id, serial, payload ] unless payload == false
+				end.compact
+			end
+			return 0 if batch.empty?
+
+			started = monotonic_time()
+			records = batch.collect {|id, serial, payload| [self.key_for(id), payload] }
+			written = batch.collect {|id, serial, payload| [id, serial] }
+
+			bytes = @object_log.append_batch( records )
+
+			@mutex.synchronize do
+				# Objects that were marked dirty again while they were being
+				# written still need another write
+				written.each do |id, serial|
+					next unless @dirty[ id ] && @dirty[ id ].first == serial
+					@dirty.delete( id )
+					@deleted.delete( id )
+
+					# Now that it's on disk, it can be evicted
+					@clean[ id ] = true if @resident.key?( id )
+				end
+				self.evict_unlocked
+
+				@stats[ :objects_written ] += records.length
+				@stats[ :batches_written ] += 1
+				@stats[ :bytes_written ]   += bytes
+				@stats[ :last_batch_time ]  = monotonic_time() - started
+			end
+
+			return records.length
+		end
+	end
+
+end # class MUES::ObjectStore
+
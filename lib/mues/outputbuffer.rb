@@ -0,0 +1,155 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/wireformat'
+require 'mues/metrics'
+
+
+# A buffer that coalesces the output events sent to a player's client over the
+# course of an Environment tick into a single AMQP message.
+#
+# Each event is encoded as a MUES::WireFormat frame and appended to the buffer;
+# the buffered frames are published together when the buffer is flushed (which
+# the Engine does at the end of every tick), or as soon as they'd exceed the
+# buffer's size limit. Clients split the message back into frames with
+# MUES::WireFormat.decode_all.
+#
+# == Synopsis
+#
+#   buffer = MUES::OutputBuffer.new( player.exchange )
+#   buffer.append( :output, "Bob says: hello." )
+#   buffer.append( :movement, :who => 'bob', :to => 'bar' )
+#
+#   # ...at the end of the tick
+#   buffer.flush
+#
+class MUES::OutputBuffer
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# The default routing key batched output is published with
+	ROUTING_KEY = 'output'
+
+	# The number of messages all output buffers have published
+	PUBLISHES = MUES::Metrics.counter( :publishes, "output messages published" )
+
+	# The number of output events all output buffers have thrown away because
+	# they couldn't be published
+	DROPPED = MUES::Metrics.counter( :output_dropped, "output events dropped by failed publishes" )
+
+
+	### Create a new OutputBuffer that will publish to the given +exchange+ with
+	### the specified +routing_key+ once it's flushed or holds more than +max_size+
+	### bytes.
+	def initialize( exchange, max_size=DEFAULT_OUTPUT_BUFFER_SIZE, routing_key=ROUTING_KEY )
+		@exchange = exchange
+		@max_size = Integer( max_size )
+		@routing_key = routing_key
+		@buffer   = MUES::WireFormat.binary( '' )
+		@frames   = 0
+		@sequence = 0
+		@mutex    = Mutex.new
+		@stats    = { :events => 0, :publishes => 0, :early_flushes => 0, :dropped => 0 }
+	end
+
+
+	######
+	public
+	######
+
+	# The exchange the buffered output is published to
+	attr_reader :exchange
+
+	# The number of bytes the buffer holds before it's flushed early
+	attr_reader :max_size
+
+	# The routing key the buffered output is published with
+	attr_reader :routing_key
+
+	# The sequence number of the last event appended to the buffer
+	attr_reader :sequence
+
+
+	### Append an output event of the given message +type+ and +body+ to the
+	### buffer, publishing the buffered events first if it won't fit.
+	def append( type, body )
+		@mutex.synchronize do
+			@sequence += 1
+			frame = MUES::WireFormat.encode( type, @sequence, body )
+
+			if !@buffer.empty? && @buffer.length + frame.length > @max_size
+				@stats[ :early_flushes ] += 1
+				self.publish_buffer
+			end
+
+			@buffer << frame
+			@frames += 1
+			@stats[ :events ] += 1
+		end
+	end
+	alias_method :<<, :append
+
+
+	### Publish any buffered events. Returns the number of events that were
+	### published.
+	def flush
+		@mutex.synchronize { self.publish_buffer }
+	end
+
+
+	### Returns +true+ if there are no buffered events.
+	def empty?
+		return @frames.zero?
+	end
+
+
+	### Return the number of buffered events.
+	def size
+		return @frames
+	end
+
+
+	### Return a copy of the buffer's counters: the number of events appended,
+	### the number of messages published, how many of those were published
+	### early because the buffer was full, and the number of events dropped
+	### because publishing them failed.
+	def stats
+		return @mutex.synchronize { @stats.dup }
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Publish the buffered frames as one message and empty the buffer. If the
+	### publish fails, the frames are counted as dropped and 0 is returned.
+	### Must be called with the mutex held.
+	def publish_buffer
+		return 0 if @frames.zero?
+
+		count = @frames
+		begin
+			self.exchange.publish( @buffer, :key => self.routing_key )
+		rescue => err
+			@stats[ :dropped ] += count
+			DROPPED.increment( count )
+			self.log.error "Dropped %d output events: publishing failed: %s: %s" %
+				[ count, err.class.name, err.message ]
+			return 0
+		end
+		@stats[ :publishes ] += 1
+		PUBLISHES.increment
+
+		return count
+	ensure
+		@buffer = MUES::WireFormat.binary( '' )
+		@frames = 0
+	end
+
+end # class MUES::OutputBuffer
+
@@ -3,11 +3,23 @@
 require 'mues'
 require 'mues/mixins'
 require 'mues/constants'
+require 'mues/wireformat'
+require 'mues/outputbuffer'
+require 'mues/metrics'
+require 'mues/commandreactor'
 
 # The main server object class.
 class MUES::Player
     include MUES::Constants,
-	        MUES::Loggable
+	        MUES::Loggable,
+	        MUES::HtmlInspectableObject
+
+	# The number of commands players have sent
+	COMMANDS = MUES::Metrics.counter( :commands, "commands handled" )
+
+	# How long handling each command took
+	COMMAND_LATENCY = MUES::Metrics.histogram( :command_latency, "microseconds to handle a command" )
+
 
 	### Create a player from the information in the specified +event+ and
 	### connect it to the given +playersbus+.
@@ -30,7 +42,11 @@ class MUES::Player
 
 		@exchange = nil
 		@queue    = nil
-		@thread   = nil
+		@reactor  = nil
+		@output   = nil
+
+		@connected     = false
+		@on_disconnect = nil
 	end
 
 
@@ -50,68 +66,109 @@ class MUES::Player
 	# The Bunny::Exchange object that is connected to the players bus
 	attr_accessor :exchange
 
-	# The Bunny::Queue object that is bound to the exchange, and accumulates
-	# command events from the player's client
+	# The shared Bunny::Queue that is bound to the exchange, and accumulates
+	# command events from the player's client (and those of the other players
+	# assigned to the same consumer)
 	attr_accessor :queue
 
+	# The MUES::CommandReactor that dispatches the player's command events
+	attr_reader :reactor
+
+	# The MUES::OutputBuffer that coalesces output to the player's client
+	attr_reader :output
+
+
+	### Register a block to be called with the player when they disconnect.
+	def on_disconnect( &block )
+		@on_disconnect = block
+	end
+
+
+	### Returns +true+ if the player is connected to the players bus.
+	def connected?
+		return @connected
+	end
+
 
-	### Connect the player to the specified +playerbus+.
-	def connect_to_bus( playersbus )
+	### Connect the player to the specified +playerbus+, binding its exchange to
+	### the shared command queue the given +reactor+ assigns it to. Output to the
+	### player's client is buffered until the end of each tick, or until there's
+	### more than +output_buffer_size+ bytes of it.
+	def connect_to_bus( playersbus, reactor, output_buffer_size=DEFAULT_OUTPUT_BUFFER_SIZE )
 		name = self.name
 		self.log.info "Trying to connect to the exchange for #{name}."
 
+		@reactor = reactor
 		self.exchange = playersbus.exchange( name, :passive => true )
-		self.queue = playersbus.queue( "#{name}_commands",
-			:durable => true, :exclusive => true, :auto_delete => true )
+		self.queue = playersbus.queue( reactor.queue_name_for(name), MUES::CommandReactor::QUEUE_OPTIONS )
 		self.queue.bind( self.exchange, :key => 'command.#' )
+		@output = MUES::OutputBuffer.new( self.exchange, output_buffer_size )
+		@connected = true
 	end
 
 
 	### Start handling events.
 	def start
-		@thread = Thread.new do
-			Thread.current.abort_on_exception = true
-			self.queue.subscribe(
-				:header       => true,
-				:consumer_tag => self.name,
-				:exclusive    => true,
-				:no_ack       => false,
-				&self.method(:handle_command_event)
-			  )
-		end
+		self.reactor.register( self )
 	end
 
 
-	### Stop handling events and destroy the queue and exchange associated with the
-	### player.
+	### Stop handling events, unbind the player's exchange from the shared command
+	### queue, destroy the exchange, and call the #on_disconnect block. Does
+	### nothing if the player isn't connected.
 	def disconnect
-		queue = self.queue
+		return unless @connected
+		@connected = false
+
+		begin
+			self.reactor.unregister( self )
+			self.flush_output
+			self.queue.unbind( self.exchange, :key => 'command.#' )
+			self.exchange.delete
+		ensure
+			@on_disconnect.call( self ) if @on_disconnect
+		end
+	end
 
-		queue.unsubscribe( :consumer_tag => self.name )
-		queue.unbind( self.exchange )
-		queue.delete
 
-		self.exchange.delete
+	### Queue an output event of the given message +type+ with the specified +body+
+	### for the player's client. It'll be sent along with the rest of the tick's
+	### output when the output buffer is flushed.
+	def send_output( type, body )
+		self.output.append( type, body )
 	end
 
 
-	#########
-	protected
-	#########
+	### Publish any output that's been buffered for the player's client.
+	def flush_output
+		self.output.flush if self.output
+	end
+
 
 	### Command event-handler: parse an incoming command, then create and propagate any
 	### resulting events.
 	def handle_command_event( event )
-		self.log.debug "<%s>: command event: %p" % [ self.name, event ]
-		header, details, payload = event.values_at( :header, :delivery_details, :payload )
-		command = payload.strip
-
-		if command =~ /^(quit|logout)\b/i
-			self.log.info "Temporary logout command invoked by '%s'." % [ self.name ]
-			self.disconnect
+		COMMANDS.increment
+		COMMAND_LATENCY.time do
+			self.log.debug { "<%s>: command event: %p" % [self.name, event] }
+			header, details, payload = event.values_at( :header, :delivery_details, :payload )
+
+			# Clients that speak the binary wire format send framed commands; older
+			# ones just send the text
+			if MUES::WireFormat.frame?( payload )
+				frame = MUES::WireFormat.decode( payload )
+				command = frame.body.to_s.strip
+			else
+				command = payload.strip
+			end
+
+			if command =~ /^(quit|logout)\b/i
+				self.log.info "Temporary logout command invoked by '%s'." % [ self.name ]
+				self.disconnect
+			end
+
+			self.log.debug { "Would have run a command: %p" % [command] }
 		end
-
-		self.log.debug "Would have run a command: %p" % [ command ]
 	end
 
 
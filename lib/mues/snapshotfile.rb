@@ -0,0 +1,286 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+
+
+# A snapshot of the live records of a MUES::ObjectLog, laid out so that it can
+# be opened without reading more than its header and trailer:
+#
+#   offset  size  field
+#        0     9  header: magic ('MUSS'), format version, last segment covered
+#        9        the records, in the same format as a log segment
+#        T        the key table (see below)
+#                 trailer: magic ('MUSE'), number of records, offset T
+#
+# The key table lets a record be found by key with a binary search. It starts
+# with a 4-byte position for each entry (relative to the end of the positions),
+# followed by the entries themselves in key order, each of which is the
+# record's offset and length and its key:
+#
+#   offset  size  field
+#        0     8  offset of the record (two 32-bit halves)
+#        8     4  length of the record
+#       12     2  key length
+#       14        key
+#
+# All integers are unsigned and big-endian. The entries the first few steps of
+# a search visit are cached, so after a little warming up finding a key costs a
+# handful of reads no matter how big the snapshot is.
+#
+# == Synopsis
+#
+#   writer = MUES::SnapshotFile::Writer.new( 'world/00000012.snap.tmp', 12 )
+#   records.each {|key, record| writer.append(key, record) }
+#   writer.finish
+#
+#   snapshot = MUES::SnapshotFile.new( 'world/00000012.snap', 12 )
+#   offset, length = snapshot.find( key )
+#
+class MUES::SnapshotFile
+	include MUES::Loggable
+
+	# The magic bytes at the start of a snapshot
+	MAGIC = 'MUSS'
+
+	# The magic bytes at the start of a snapshot's trailer
+	TRAILER_MAGIC = 'MUSE'
+
+	# The version of the snapshot format that's written
+	VERSION = 2
+
+	# The pack() format of a snapshot header
+	HEADER_FORMAT = 'a4CN'
+
+	# The length of a snapshot header, in bytes
+	HEADER_LENGTH = 9
+
+	# The pack() format of a snapshot trailer
+	TRAILER_FORMAT = 'a4NNN'
+
+	# The length of a snapshot trailer, in bytes
+	TRAILER_LENGTH = 16
+
+	# The pack() format of the fixed part of a key table entry
+	ENTRY_FORMAT = 'NNNn'
+
+	# The length of the fixed part of a key table entry, in bytes
+	ENTRY_LENGTH = 14
+
+	# The most key table entries that are cached for searching
+	PROBE_CACHE_SIZE = 4096
+
+
+	# The error raised when a snapshot is incomplete or malformed
+	class FormatError < StandardError; end
+
+
+	#
+	# Writes a new snapshot.
+	#
+	class Writer
+
+		### Create a new snapshot of segment +number+ at +path+.
+		def initialize( path, number )
+			@path    = path
+			@number  = number
+			@io      = File.open( path, 'wb' )
+			@entries = []
+
+			@io.write( [MAGIC, VERSION, number].pack(HEADER_FORMAT) )
+			@offset  = HEADER_LENGTH
+		end
+
+
+		######
+		public
+		######
+
+		# The path of the snapshot being written
+		attr_reader :path
+
+		# The number of records that have been appended
+		def count
+			return @entries.length
+		end
+
+
+		### Append the given +record+ for +key+, returning the offset it was
+		### written at.
+		def append( key, record )
+			offset = @offset
+			@io.write( record )
+			@entries << [ key, offset, record.length ]
+			@offset += record.length
+			return offset
+		end
+
+
+		### Write the key table and trailer, and fsync and close the file.
+		def finish
+			table_offset = @offset
+			@entries = @entries.sort_by {|key, _, _| key }
+
+			positions = []
+			entries = ''
+			entries.force_encoding( 'binary' ) if entries.respond_to?( :force_encoding )
+			@entries.each do |key, offset, length|
+				positions << entries.length
+				entries << [ offset >> 32, offset & 0xffffffff, length, key.length ].pack( ENTRY_FORMAT ) << key
+			end
+
+			@io.write( positions.pack('N*') )
+			@io.write( entries )
+			@io.write( [TRAILER_MAGIC, @entries.length, table_offset >> 32, table_offset & 0xffffffff].
+				pack(TRAILER_FORMAT) )
+			@io.flush
+			@io.fsync
+			@io.close
+		end
+
+
+		### Close the file without finishing it.
+		def abort
+			@io.close unless @io.closed?
+		end
+
+	end # class Writer
+
+
+	### Open the snapshot of segment +number+ at +path+, checking its header and
+	### trailer. Raises a FormatError if it's incomplete or malformed.
+	def initialize( path, number )
+		@path   = path
+		@number = number
+		@io     = File.open( path, 'rb' )
+		@mutex  = Mutex.new
+		@probe_cache = {}
+
+		begin
+			self.read_header_and_trailer
+		rescue
+			@io.close
+			raise
+		end
+	end
+
+
+	######
+	public
+	######
+
+	# The path of the snapshot file
+	attr_reader :path
+
+	# The number of the last segment the snapshot covers
+	attr_reader :number
+
+	# The snapshot format version
+	attr_reader :version
+
+	# The number of records in the snapshot
+	attr_reader :count
+
+
+	### Return the [ offset, length ] of the record for +key+, or +nil+ if the
+	### snapshot doesn't have one.
+	def find( key )
+		@mutex.synchronize do
+			low, high = 0, @count - 1
+			while low <= high
+				mid = ( low + high ) / 2
+				entry_key, offset, length = self.entry_at( mid )
+
+				case key <=> entry_key
+				when 0  then return offset, length
+				when -1 then high = mid - 1
+				else         low = mid + 1
+				end
+			end
+		end
+
+		return nil
+	end
+
+
+	### Call the block with the key, offset, and length of each record, in key
+	### order. Reads the key table through its own file handle so that searches
+	### aren't held up.
+	def each
+		File.open( @path, 'rb' ) do |io|
+			io.seek( @table_offset + @count * 4 )
+			@count.times do
+				hi, lo, length, key_length = io.read( ENTRY_LENGTH ).unpack( ENTRY_FORMAT )
+				yield( io.read(key_length), (hi << 32) | lo, length )
+			end
+		end
+	end
+
+
+	### Close the snapshot.
+	def close
+		@mutex.synchronize { @io.close unless @io.closed? }
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Read and check the snapshot's header and trailer.
+	def read_header_and_trailer
+		size = File.size( @path )
+		raise FormatError, "truncated snapshot" if size < HEADER_LENGTH + TRAILER_LENGTH
+
+		magic, @version, number = @io.read( HEADER_LENGTH ).unpack( HEADER_FORMAT )
+		raise FormatError, "bad snapshot magic %p" % [ magic ] unless magic == MAGIC
+		raise FormatError, "snapshot of segment %d misnamed" % [ number ] unless number == @number
+		self.check_version
+
+		@io.seek( -TRAILER_LENGTH, IO::SEEK_END )
+		magic, @count, hi, lo = @io.read( TRAILER_LENGTH ).unpack( TRAILER_FORMAT )
+		raise FormatError, "missing snapshot trailer" unless magic == TRAILER_MAGIC
+		@table_offset = ( hi << 32 ) | lo
+		raise FormatError, "bad key table offset %d" % [ @table_offset ] if
+			@table_offset < HEADER_LENGTH || @table_offset + @count * 4 > size - TRAILER_LENGTH
+	end
+
+
+	### Raise a FormatError unless the snapshot is in the format that's written.
+	### Version 1 snapshots were only written by development builds, so there's
+	### no reader for them.
+	def check_version
+		return if @version == VERSION
+
+		if @version < VERSION
+			raise FormatError, "%s is a version %d snapshot, which is no longer readable " \
+				"(only version %d is); remove it and replay the log instead" %
+				[ @path, @version, VERSION ]
+		else
+			raise FormatError, "%s is a version %d snapshot, which is newer than this " \
+				"server can read (only version %d)" % [ @path, @version, VERSION ]
+		end
+	end
+
+
+	### Return the key, record offset, and record length of the key table entry at
+	### +index+. Must be called with the mutex held.
+	def entry_at( index )
+		if entry = @probe_cache[ index ]
+			return entry
+		end
+
+		@io.seek( @table_offset + index * 4 )
+		position = @io.read( 4 ).unpack( 'N' ).first
+		@io.seek( @table_offset + @count * 4 + position )
+		hi, lo, length, key_length = @io.read( ENTRY_LENGTH ).unpack( ENTRY_FORMAT )
+		entry = [ @io.read(key_length), (hi << 32) | lo, length ]
+
+		@probe_cache[ index ] = entry if @probe_cache.size < PROBE_CACHE_SIZE
+		return entry
+	end
+
+end # class MUES::SnapshotFile
+
@@ -0,0 +1,239 @@
+#!/usr/bin/env ruby
+
+require 'mues'
+require 'mues/mixins'
+
+
+# An in-memory ordered index of ( value, id ) entries, for looking objects up
+# by an attribute's value (exactly, by range, or by prefix) without touching
+# the objects themselves.
+#
+# It's a two-level B+tree: the entries are kept in sorted leaf pages of at most
+# PAGE_SIZE entries, and a parallel array of each page's first entry is
+# binary-searched to find the page an entry belongs in. Inserting or deleting
+# an entry only shifts the entries in one page (splitting or dropping the page
+# when it gets too full or empty), and scans walk the pages in order.
+#
+# Values of different classes that can't be compared with each other are
+# ordered by class name.
+#
+# == Synopsis
+#
+#   index = MUES::SortedIndex.new
+#   index.insert( 'ged', 12 )
+#   index.insert( 'gedge', 31 )
+#
+#   index.find( 'ged' )              # => [ 12 ]
+#   index.prefix( 'ged' )            # => [ 12, 31 ]
+#   index.range( 'a', 'h' )          # => [ 12, 31 ]
+#
+class MUES::SortedIndex
+	include Enumerable
+
+	# The most entries a leaf page holds before it's split
+	PAGE_SIZE = 128
+
+
+	### Compare the values +a+ and +b+, falling back to comparing their class
+	### names if they aren't comparable. +nil+ sorts before everything else.
+	def self::compare( a, b )
+		return ( a.nil? ? 0 : 1 ) - ( b.nil? ? 0 : 1 ) if a.nil? || b.nil?
+		cmp = ( a <=> b ) rescue nil
+		return cmp unless cmp.nil?
+		return a.class.name <=> b.class.name
+	end
+
+
+	### Compare the entries +a+ and +b+ by value, then id.
+	def self::compare_entries( a, b )
+		cmp = self.compare( a[0], b[0] )
+		return cmp.zero? ? self.compare( a[1], b[1] ) : cmp
+	end
+
+
+	### Create a new, empty SortedIndex.
+	def initialize
+		@pages = []
+		@firsts = []
+		@size = 0
+	end
+
+
+	######
+	public
+	######
+
+	# The number of entries in the index
+	attr_reader :size
+	alias_method :length, :size
+
+
+	### Add an entry that maps +value+ to +id+. Returns +false+ if the entry was
+	### already there.
+	def insert( value, id )
+		entry = [ value, id ]
+
+		if @pages.empty?
+			@pages << [ entry ]
+			@firsts << entry
+			@size += 1
+			return true
+		end
+
+		pageno = self.page_for( entry )
+		page = @pages[ pageno ]
+		pos = self.position_in( page, entry )
+		return false if pos < page.length && self.class.compare_entries( page[pos], entry ).zero?
+
+		page.insert( pos, entry )
+		@firsts[ pageno ] = entry if pos.zero?
+		@size += 1
+
+		self.split_page( pageno ) if page.length > PAGE_SIZE
+		return true
+	end
+
+
+	### Remove the entry that maps +value+ to +id+. Returns +false+ if there
+	### wasn't one.
+	def delete( value, id )
+		return false if @pages.empty?
+
+		entry = [ value, id ]
+		pageno = self.page_for( entry )
+		page = @pages[ pageno ]
+		pos = self.position_in( page, entry )
+		return false unless pos < page.length &&
+			self.class.compare_entries( page[pos], entry ).zero?
+
+		page.delete_at( pos )
+		@size -= 1
+
+		if page.empty?
+			@pages.delete_at( pageno )
+			@firsts.delete_at( pageno )
+		elsif pos.zero?
+			@firsts[ pageno ] = page.first
+		end
+
+		return true
+	end
+
+
+	### Return the ids of the entries whose value is +value+.
+	def find( value )
+		ids = []
+		self.scan_from( value ) do |val, id|
+			break unless self.class.compare( val, value ).zero?
+			ids << id
+		end
+
+		return ids
+	end
+
+
+	### Return the ids of the entries whose values are between +low+ and +high+,
+	### including +high+ unless +exclusive+ is true.
+	def range( low, high, exclusive=false )
+		ids = []
+		self.scan_from( low ) do |val, id|
+			cmp = self.class.compare( val, high )
+			break if cmp > 0 || ( exclusive && cmp.zero? )
+			ids << id
+		end
+
+		return ids
+	end
+
+
+	### Return the ids of the entries whose (String) values start with +prefix+.
+	def prefix( prefix )
+		prefix = prefix.to_s
+		ids = []
+		self.scan_from( prefix ) do |val, id|
+			break unless val.is_a?( String ) && val[ 0, prefix.length ] == prefix
+			ids << id
+		end
+
+		return ids
+	end
+
+
+	### Yield each entry's value and id, in order.
+	def each
+		@pages.each do |page|
+			page.each {|value, id| yield(value, id) }
+		end
+	end
+
+
+	### Yield the value and id of each entry from the first one whose value is
+	### at least +value+ onward, until the block breaks.
+	def scan_from( value )
+		return if @pages.empty?
+
+		# An entry with the value and no id sorts before all of the real ones
+		start = [ value, nil ]
+		pageno = self.page_for( start )
+		pos = self.position_in( @pages[pageno], start )
+
+		while pageno < @pages.length
+			page = @pages[ pageno ]
+			while pos < page.length
+				yield( *page[pos] )
+				pos += 1
+			end
+			pageno += 1
+			pos = 0
+		end
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the index of the page the given +entry+ belongs in: the last one
+	### whose first entry isn't after it.
+	def page_for( entry )
+		low, high = 0, @firsts.length
+		while low < high
+			mid = ( low + high ) / 2
+			if self.class.compare_entries( @firsts[mid], entry ) <= 0
+				low = mid + 1
+			else
+				high = mid
+			end
+		end
+
+		return low.zero? ? 0 : low - 1
+	end
+
+
+	### Return the position of the first entry in +page+ that isn't before
+	### +entry+.
+	def position_in( page, entry )
+		low, high = 0, page.length
+		while low < high
+			mid = ( low + high ) / 2
+			if self.class.compare_entries( page[mid], entry ) < 0
+				low = mid + 1
+			else
+				high = mid
+			end
+		end
+
+		return low
+	end
+
+
+	### Split the page at +pageno+ in half.
+	def split_page( pageno )
+		page = @pages[ pageno ]
+		half = page.slice!( page.length / 2, page.length )
+		@pages.insert( pageno + 1, half )
+		@firsts.insert( pageno + 1, half.first )
+	end
+
+end # class MUES::SortedIndex
+
@@ -0,0 +1,272 @@
+#!/usr/bin/env ruby
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+
+
+# A uniform-grid spatial index of the objects in the environment, for answering
+# "what's near this point?" without looking at every object.
+#
+# Space is divided into cubic cells of a fixed size, and each object is filed
+# in the cell that contains its position. A radius or box query only visits the
+# cells that overlap the query volume, so its cost depends on how crowded that
+# part of the world is rather than on how big the world is. Moving an object
+# only touches the index when it crosses into a different cell.
+#
+# A query whose box covers more cells than are occupied walks the occupied
+# cells instead, so a wide query over a sparse world costs no more than looking
+# at every object.
+#
+# The cell size should be about the radius of the most common queries (e.g.,
+# how far a player can see or hear): much smaller and queries visit lots of
+# empty cells; much larger and they check lots of objects that are too far
+# away.
+#
+# == Synopsis
+#
+#   index = MUES::SpatialIndex.new( 10.0 )
+#   index.insert( node, 12.0, 0.0, -3.5 )
+#   index.move( node, 14.0, 0.0, -3.5 )
+#
+#   index.within( 10.0, 0.0, 0.0, 5.0 )    # => [ node ]
+#
+class MUES::SpatialIndex
+	include MUES::Constants,
+	        MUES::Loggable
+
+	# The number of bits of each cell coordinate that go into a cell's key
+	KEY_BITS = 21
+
+	# The mask for one coordinate of a cell key
+	KEY_MASK = ( 1 << KEY_BITS ) - 1
+
+	# The smallest and largest cell coordinates that can be packed into a key
+	MIN_CELL = -( 1 << (KEY_BITS - 1) )
+	MAX_CELL = ( 1 << (KEY_BITS - 1) ) - 1
+
+
+	### Create a new, empty SpatialIndex with cells +cell_size+ units on a side.
+	def initialize( cell_size=DEFAULT_SPATIAL_CELL_SIZE )
+		@cell_size = Float( cell_size )
+		raise ArgumentError, "cell size must be positive" unless @cell_size > 0
+
+		@cells     = {}
+		@entries   = {}
+	end
+
+
+	######
+	public
+	######
+
+	# The length of a side of each cell
+	attr_reader :cell_size
+
+
+	### Return the number of objects in the index.
+	def size
+		return @entries.size
+	end
+	alias_method :length, :size
+
+
+	### Return the number of cells that contain at least one object.
+	def cell_count
+		return @cells.size
+	end
+
+
+	### Returns +true+ if the specified +object+ is in the index.
+	def include?( object )
+		return @entries.key?( object )
+	end
+
+
+	### Return the [ x, y, z ] position of the specified +object+, or +nil+ if it
+	### isn't in the index.
+	def position_of( object )
+		entry = @entries[ object ] or return nil
+		return entry[ 0, 3 ]
+	end
+
+
+	### Add the specified +object+ to the index at the given position, or move it
+	### there if it's already in the index.
+	def insert( object, x, y, z )
+		return self.move( object, x, y, z ) if @entries.key?( object )
+
+		key = self.cell_key( x, y, z )
+		( @cells[key] ||= {} )[ object ] = true
+		@entries[ object ] = [ x, y, z, key ]
+
+		return object
+	end
+	alias_method :[]=, :insert
+
+
+	### Move the specified +object+ to the given position, adding it to the index
+	### if it isn't already there.
+	def move( object, x, y, z )
+		entry = @entries[ object ] or return self.insert( object, x, y, z )
+		key = self.cell_key( x, y, z )
+
+		if key != entry[ 3 ]
+			self.remove_from_cell( object, entry[3] )
+			( @cells[key] ||= {} )[ object ] = true
+			entry[ 3 ] = key
+		end
+
+		entry[ 0 ] = x
+		entry[ 1 ] = y
+		entry[ 2 ] = z
+
+		return object
+	end
+
+
+	### Remove the specified +object+ from the index. Returns the object, or +nil+
+	### if it wasn't in the index.
+	def remove( object )
+		entry = @entries.delete( object ) or return nil
+		self.remove_from_cell( object, entry[3] )
+		return object
+	end
+	alias_method :delete, :remove
+
+
+	### Return the objects that are within +radius+ of the given point.
+	def within( x, y, z, radius )
+		limit = radius * radius
+		found = []
+
+		self.each_in_box( x - radius, y - radius, z - radius,
+		                  x + radius, y + radius, z + radius ) do |object, entry|
+			dx = entry[0] - x
+			dy = entry[1] - y
+			dz = entry[2] - z
+			found << object if dx * dx + dy * dy + dz * dz <= limit
+		end
+
+		return found
+	end
+
+
+	### Return the objects within the axis-aligned box with the given minimum and
+	### maximum corners.
+	def in_box( min_x, min_y, min_z, max_x, max_y, max_z )
+		found = []
+		self.each_in_box( min_x, min_y, min_z, max_x, max_y, max_z ) do |object, entry|
+			found << object
+		end
+
+		return found
+	end
+
+
+	### Yield each object that is in a cell overlapped by the given box, along with
+	### its index entry, if it's inside the box.
+	def each_in_box( min_x, min_y, min_z, max_x, max_y, max_z )
+		x_range = ( self.cell_coord(min_x) .. self.cell_coord(max_x) )
+		y_range = ( self.cell_coord(min_y) .. self.cell_coord(max_y) )
+		z_range = ( self.cell_coord(min_z) .. self.cell_coord(max_z) )
+		return if x_range.first > x_range.last ||
+		          y_range.first > y_range.last ||
+		          z_range.first > z_range.last
+
+		volume = ( x_range.last - x_range.first + 1 ) *
+		         ( y_range.last - y_range.first + 1 ) *
+		         ( z_range.last - z_range.first + 1 )
+
+		if volume > @cells.size
+			@cells.each do |key, cell|
+				cx, cy, cz = self.unpack_key( key )
+				next unless x_range.include?( cx ) && y_range.include?( cy ) && z_range.include?( cz )
+				self.each_in_cell( cell, min_x, min_y, min_z, max_x, max_y, max_z ) do |object, entry|
+					yield( object, entry )
+				end
+			end
+		else
+			x_range.each do |cx|
+				y_range.each do |cy|
+					z_range.each do |cz|
+						cell = @cells[ self.pack_key(cx, cy, cz) ] or next
+						self.each_in_cell( cell, min_x, min_y, min_z, max_x, max_y, max_z ) do |object, entry|
+							yield( object, entry )
+						end
+					end
+				end
+			end
+		end
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the key of the cell that contains the given point. Raises a
+	### RangeError if the point is too far out to be indexed.
+	def cell_key( x, y, z )
+		size = @cell_size
+		return self.pack_key( (x / size).floor, (y / size).floor, (z / size).floor )
+	end
+
+
+	### Return the coordinate of the cell that contains +value+ along one axis,
+	### clamped to the coordinates that can be packed into a key. Nothing can be
+	### filed outside of them, so a query can stop at the edge.
+	def cell_coord( value )
+		coord = value / @cell_size
+		return MIN_CELL if coord < MIN_CELL
+		return MAX_CELL if coord > MAX_CELL
+		return coord.floor
+	end
+
+
+	### Pack the given cell coordinates into a single Integer key. Raises a
+	### RangeError if any of them won't fit.
+	def pack_key( cx, cy, cz )
+		[ cx, cy, cz ].each do |coord|
+			raise RangeError, "cell coordinate %d is out of range" % [ coord ] unless
+				coord >= MIN_CELL && coord <= MAX_CELL
+		end
+
+		return ( (cx & KEY_MASK) << (KEY_BITS * 2) ) |
+		       ( (cy & KEY_MASK) << KEY_BITS ) |
+		       ( cz & KEY_MASK )
+	end
+
+
+	### Unpack the given cell +key+ into its [ cx, cy, cz ] coordinates.
+	def unpack_key( key )
+		return [ key >> (KEY_BITS * 2), key >> KEY_BITS, key ].collect do |field|
+			coord = field & KEY_MASK
+			coord > MAX_CELL ? coord - (1 << KEY_BITS) : coord
+		end
+	end
+
+
+	### Yield each object in +cell+ that is inside the given box, along with its
+	### index entry.
+	def each_in_cell( cell, min_x, min_y, min_z, max_x, max_y, max_z )
+		cell.each_key do |object|
+			entry = @entries[ object ]
+			next unless entry[0] >= min_x && entry[0] <= max_x &&
+			            entry[1] >= min_y && entry[1] <= max_y &&
+			            entry[2] >= min_z && entry[2] <= max_z
+			yield( object, entry )
+		end
+	end
+
+
+	### Remove the specified +object+ from the cell with the given +key+, and drop
+	### the cell if it's now empty.
+	def remove_from_cell( object, key )
+		cell = @cells[ key ] or return
+		cell.delete( object )
+		@cells.delete( key ) if cell.empty?
+	end
+
+end # class MUES::SpatialIndex
+
@@ -0,0 +1,244 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+require 'logger'
+
+require 'mues'
+require 'mues/mixins'
+require 'mues/constants'
+require 'mues/wireformat'
+
+
+# A formatter for Logger instances that turns each log message into a record
+# with a fixed schema instead of a line of text, so that logs can be fed to
+# offline analysis without having to pick lines apart with regexps.
+#
+# Every record has the same fields:
+#
+#   ts      the time of the message, in microseconds since the epoch
+#   pid     the id of the process
+#   thread  'main' for the main thread, or the object id of the thread
+#   class   the name of the class that logged the message (the progname)
+#   level   the severity ('DEBUG', 'INFO', ...)
+#   fields  the message: a Hash logged as the message is used as-is, an
+#           exception becomes { 'error' => class, 'msg' => message }, and
+#           anything else becomes { 'msg' => message }
+#   sample  the rate the record's category was sampled at, so counts can be
+#           scaled back up
+#
+# Records are written either as one JSON object per line (the :json format),
+# or (the :binary format) as a varint length followed by an Array of the field
+# values in the order above, encoded with MUES::WireFormat.pack_value.
+#
+# DEBUG and INFO messages can be sampled: the +sampling+ Hash maps class or
+# namespace names to the fraction of their messages that are kept, so
+# command-level logging can stay on in production at, say, 1%. The rate for a
+# class is looked up the same way as its log level (see
+# MUES::Loggable.set_level): its own name first, then each enclosing namespace.
+# Messages that aren't kept are formatted as an empty String. Warnings and
+# worse are never sampled.
+#
+# == Synopsis
+#
+#   sampling = { 'MUES::Player' => 0.01 }
+#   MUES.logger.formatter = MUES::StructuredLogFormatter.new( MUES.logger, :json, sampling )
+#
+#   player.log.info( :command => 'look', :player => 'bargle' )
+#   # => {"ts":1192575600123456,"pid":3141,"thread":"main","class":"MUES::Player",
+#   #     "level":"INFO","fields":{"command":"look","player":"bargle"},"sample":0.01}
+#
+class MUES::StructuredLogFormatter < Logger::Formatter
+	include MUES::JSONUtilities
+
+	# The record formats that can be written
+	FORMATS = [ :json, :binary ]
+
+	# The names of the fields of a record, in the order they're written in
+	FIELDS = %w[ts pid thread class level fields sample]
+
+	# The severities whose messages can be sampled
+	SAMPLED_SEVERITIES = %w[DEBUG INFO]
+
+
+	### Create a formatter for the given +logger+ that writes records in the
+	### specified +format+, sampling the categories in the +sampling+ Hash at
+	### the given rates.
+	def initialize( logger, format=:json, sampling={} ) # :notnew:
+		@logger = logger
+		@format = format.to_sym
+		raise ArgumentError, "unknown log record format %p" % [ @format ] unless
+			FORMATS.include?( @format )
+
+		@mutex    = Mutex.new
+		@counters = Hash.new( 0 )
+		self.sampling = sampling
+
+		super()
+	end
+
+
+	######
+	public
+	######
+
+	# The Logger object associated with the formatter
+	attr_accessor :logger
+
+	# The format records are written in (:json or :binary)
+	attr_reader :format
+
+	# The sampling rates, keyed by class or namespace name
+	attr_reader :sampling
+
+
+	### Set the sampling rates to those in the given +sampling+ Hash, whose keys
+	### are class or namespace names (or the classes and modules themselves), and
+	### whose values are the fraction of messages to keep.
+	def sampling=( sampling )
+		rates = {}
+		sampling.each do |category, rate|
+			rate = Float( rate )
+			raise ArgumentError, "sampling rate %p isn't between 0 and 1" % [ rate ] unless
+				rate >= 0.0 && rate <= 1.0
+			rates[ category.is_a?(Module) ? category.name : category.to_s ] = rate
+		end
+
+		# The rates are looked up once per class name; both are replaced as a
+		# whole, so threads that are formatting can keep using the old ones.
+		@rate_cache = {}
+		@sampling = rates
+	end
+
+
+	### Return the rate messages logged by the class named +name+ are kept at.
+	def rate_for( name )
+		name = name.to_s
+		cache = @rate_cache
+		return cache[ name ] if cache.key?( name )
+
+		rate = 1.0
+		category = name
+		loop do
+			if @sampling.key?( category )
+				rate = @sampling[ category ]
+				break
+			end
+			break unless category.include?( '::' )
+			category = category.sub( /::[^:]*\z/, '' )
+		end
+
+		cache[ name ] = rate
+		return rate
+	end
+
+
+	### Return the record for the message as a String in the formatter's format,
+	### or an empty String if it was sampled away.
+	def call( severity, time, progname, msg )
+		rate = SAMPLED_SEVERITIES.include?( severity ) ? self.rate_for( progname ) : 1.0
+		if rate < 1.0 && rand >= rate
+			@mutex.synchronize { @counters[:skipped] += 1 }
+			return ''
+		end
+		@mutex.synchronize { @counters[:written] += 1 }
+
+		thread = Thread.current == Thread.main ? 'main' : Thread.current.object_id.to_s
+		record = [
+			time.to_i * 1_000_000 + time.usec,
+			Process.pid,
+			thread,
+			progname.to_s,
+			severity,
+			self.fields_for( msg ),
+			rate,
+		]
+
+		return @format == :json ? self.json_record( record ) : self.binary_record( record )
+	end
+
+
+	### Return a Hash of the number of records that were written and the number
+	### that were sampled away.
+	def stats
+		@mutex.synchronize do
+			return { :written => @counters[:written], :skipped => @counters[:skipped] }
+		end
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the Hash of fields for the given log message.
+	def fields_for( msg )
+		case msg
+		when Hash
+			fields = {}
+			msg.each {|key, val| fields[key.to_s] = self.plain_value(val) }
+			return fields
+		when Exception
+			return { 'error' => msg.class.name, 'msg' => msg.message }
+		else
+			return { 'msg' => msg.to_s }
+		end
+	end
+
+
+	### Return the given +value+ if it's one that can be written as-is, or a
+	### String version of it if it isn't.
+	def plain_value( value )
+		case value
+		when nil, true, false, Integer, Float, String
+			return value
+		when Symbol
+			return value.to_s
+		when Array
+			return value.collect {|item| self.plain_value(item) }
+		when Hash
+			plain = {}
+			value.each {|key, val| plain[key.to_s] = self.plain_value(val) }
+			return plain
+		else
+			return value.to_s
+		end
+	end
+
+
+	### Return the given +record+ as a line of JSON.
+	def json_record( record )
+		pairs = []
+		FIELDS.each_with_index do |name, i|
+			pairs << %{"#{name}":#{self.json_value(record[i])}}
+		end
+
+		return "{#{pairs.join(',')}}\n"
+	end
+
+
+	### Return the JSON representation of the given plain +value+.
+	def json_value( value )
+		case value
+		when nil    then return 'null'
+		when String then return json_string( value )
+		when Float
+			return value.finite? ? value.to_s : 'null'
+		when Array
+			return '[' + value.collect {|item| self.json_value(item) }.join( ',' ) + ']'
+		when Hash
+			pairs = value.collect {|key, val| json_string(key) + ':' + self.json_value(val) }
+			return '{' + pairs.join( ',' ) + '}'
+		else
+			return value.to_s
+		end
+	end
+
+
+	### Return the given +record+ as a length-prefixed binary record.
+	def binary_record( record )
+		body = MUES::WireFormat.pack_value( record )
+		return MUES::WireFormat.pack_varint( body.length ) << body
+	end
+
+end # class MUES::StructuredLogFormatter
+
@@ -0,0 +1,284 @@
+#!/usr/bin/env ruby
+
+require 'thread'
+
+require 'mues'
+require 'mues/mixins'
+
+
+# A hierarchical timer wheel for scheduling delayed and periodic events in terms
+# of simulation ticks.
+#
+# The wheel is made up of LEVELS levels of 2**bits slots each. Level 0 has one
+# slot per tick; each slot of level N covers a whole turn of level N-1. A timer
+# is filed in the lowest level whose range covers its delay, and each time a
+# lower level comes full circle the next slot of the level above is cascaded
+# down into it. Scheduling and cancelling a timer are O(1), and advancing the
+# wheel only touches the one slot that expires on that tick (plus the
+# occasional cascade), so the cost of a tick doesn't depend on how many timers
+# are pending.
+#
+# Timers can be scheduled and cancelled from any thread while another one
+# advances the wheel. Callbacks are called without the wheel's lock held, so
+# they can schedule and cancel timers too.
+#
+# == Synopsis
+#
+#   wheel = MUES::TimerWheel.new
+#   respawn = wheel.schedule( 300 ) { npc.respawn }
+#   regen = wheel.schedule_every( 10 ) { player.regenerate }
+#
+#   # ...then once per tick
+#   wheel.advance
+#
+#   # Changed your mind?
+#   respawn.cancel
+#
+class MUES::TimerWheel
+	include MUES::Loggable
+
+	# The default number of bits of the tick counter covered by each level; each
+	# level has 2**bits slots
+	DEFAULT_BITS = 8
+
+	# The number of levels in the wheel
+	LEVELS = 4
+
+
+	#
+	# A single scheduled callback.
+	#
+	class Timer
+
+		### Create a new Timer on the given +wheel+ that will call +block+ on the
+		### +expires+ tick, and then every +interval+ ticks after that if +interval+
+		### is non-nil.
+		def initialize( wheel, expires, interval, block )
+			@wheel     = wheel
+			@expires   = expires
+			@interval  = interval
+			@block     = block
+			@slot      = nil
+			@cancelled = false
+		end
+
+
+		######
+		public
+		######
+
+		# The tick the timer (next) expires on
+		attr_accessor :expires
+
+		# The number of ticks between firings of a periodic timer, or +nil+ for a
+		# one-shot timer
+		attr_reader :interval
+
+		# The wheel slot the timer is currently filed in, or +nil+ if it isn't
+		# pending
+		attr_accessor :slot
+
+
+		### Returns +true+ if the timer is waiting to fire.
+		def pending?
+			return !@slot.nil?
+		end
+
+
+		### Returns +true+ if the timer fires repeatedly.
+		def periodic?
+			return !@interval.nil?
+		end
+
+
+		### Returns +true+ if the timer has been cancelled.
+		def cancelled?
+			return @cancelled
+		end
+
+
+		### Cancel the timer.
+		def cancel
+			@cancelled = true
+			@wheel.cancel( self )
+		end
+
+
+		### Call the timer's callback.
+		def fire
+			@block.call( self )
+		end
+
+	end # class Timer
+
+
+	### Create a new TimerWheel whose levels each cover +bits+ bits of the tick
+	### counter.
+	def initialize( bits=DEFAULT_BITS )
+		@bits    = bits
+		@mask    = ( 1 << bits ) - 1
+		@max     = ( 1 << (bits * LEVELS) ) - 1
+		@levels  = Array.new( LEVELS ) { Array.new(1 << bits) { {} } }
+
+		@tick    = 0
+		@count   = 0
+		@mutex   = Mutex.new
+	end
+
+
+	######
+	public
+	######
+
+	# The number of ticks the wheel has advanced
+	attr_reader :tick
+
+	# The number of pending timers
+	attr_reader :count
+
+
+	### Schedule the given +block+ to be called +ticks+ ticks from now, returning
+	### the MUES::TimerWheel::Timer. Fractional delays are rounded up to the next
+	### whole tick. Raises an ArgumentError if the delay is longer than the wheel
+	### can hold.
+	def schedule( ticks, &block )
+		raise ArgumentError, "no block given" unless block
+		delay = self.whole_ticks( ticks )
+		@mutex.synchronize do
+			timer = Timer.new( self, @tick + delay, nil, block )
+			self.add( timer )
+			return timer
+		end
+	end
+
+
+	### Schedule the given +block+ to be called every +ticks+ ticks until the
+	### returned MUES::TimerWheel::Timer is cancelled. Raises an ArgumentError if
+	### the interval is longer than the wheel can hold.
+	def schedule_every( ticks, &block )
+		raise ArgumentError, "no block given" unless block
+		interval = self.whole_ticks( ticks )
+		@mutex.synchronize do
+			timer = Timer.new( self, @tick + interval, interval, block )
+			self.add( timer )
+			return timer
+		end
+	end
+
+
+	### Remove the specified +timer+ from the wheel. Returns +true+ if the timer was
+	### pending.
+	def cancel( timer )
+		@mutex.synchronize do
+			slot = timer.slot or return false
+			slot.delete( timer )
+			timer.slot = nil
+			@count -= 1
+			return true
+		end
+	end
+
+
+	### Advance the wheel by one tick, firing any timers that expire on it.
+	### Returns the number of timers that fired.
+	def advance
+		now, expired = @mutex.synchronize { self.expire_next_tick }
+		return 0 unless expired
+		fired = 0
+
+		# Timers cancelled by an earlier callback in the batch, or from another
+		# thread, are skipped
+		expired.each_key do |timer|
+			next if timer.cancelled?
+			fired += 1
+			begin
+				timer.fire
+			rescue => err
+				self.log.error "Timer %p raised %s: %s" % [ timer, err.class.name, err.message ]
+			end
+
+			# Periodic timers go back in unless they've been cancelled
+			next unless timer.periodic?
+			@mutex.synchronize do
+				unless timer.cancelled?
+					timer.expires = now + timer.interval
+					self.add( timer )
+				end
+			end
+		end
+
+		return fired
+	end
+
+
+	#########
+	protected
+	#########
+
+	### Return the given delay in +ticks+ as a whole number of ticks no smaller
+	### than one, raising an ArgumentError if it's too long for the wheel.
+	def whole_ticks( ticks )
+		ticks = ticks.ceil
+		raise ArgumentError, "delay of %d ticks is longer than the maximum of %d" %
+			[ ticks, @max ] if ticks > @max
+		return ticks < 1 ? 1 : ticks
+	end
+
+
+	### Advance the tick counter, cascading timers down as needed, and take the
+	### timers that expire on the new tick out of the wheel. Returns the new
+	### tick and a Hash of the expired timers, or +nil+ if there aren't any.
+	### Must be called with the mutex held.
+	def expire_next_tick
+		@tick += 1
+
+		# Cascade timers down from each level whose lower neighbour just came full
+		# circle
+		level = 0
+		while level < LEVELS - 1 && ( (@tick >> (@bits * level)) & @mask ).zero?
+			level += 1
+			self.cascade( level, (@tick >> (@bits * level)) & @mask )
+		end
+
+		slots = @levels[ 0 ]
+		index = @tick & @mask
+		return @tick, nil if slots[ index ].empty?
+
+		# Swap in a fresh slot so callbacks can schedule into this one safely
+		expired = slots[ index ]
+		slots[ index ] = {}
+		expired.each_key {|timer| timer.slot = nil }
+		@count -= expired.size
+
+		return @tick, expired
+	end
+
+
+	### File the given +timer+ in the slot that corresponds to its expiry tick.
+	### Must be called with the mutex held.
+	def add( timer )
+		delta = timer.expires - @tick
+
+		level = 0
+		level += 1 while delta >> ( @bits * (level + 1) ) > 0
+
+		slot = @levels[ level ][ (timer.expires >> (@bits * level)) & @mask ]
+		slot[ timer ] = true
+		timer.slot = slot
+		@count += 1
+	end
+
+
+	### Re-file all the timers in the slot at +index+ of the given +level+ into the
+	### levels below it. Must be called with the mutex held.
+	def cascade( level, index )
+		slot = @levels[ level ][ index ]
+		return if slot.empty?
+
+		@levels[ level ][ index ] = {}
+		@count -= slot.size
+		slot.each_key {|timer| self.add(timer) }
+	end
+
+end # class MUES::TimerWheel
+
@@ -1,6 +1,7 @@
 #!/usr/bin/ruby
 
 require 'readline'
+require 'thread'
 require 'pathname'
 require 'logger'
 require 'erb'
@@ -695,6 +696,13 @@ module MUES
 		# The format to output if debugging is turned on
 		DEFAULT_DEBUG_FORMAT = "[%1$s.%2$06d %3$d/%4$s] %5$5s {%6$s} -- %7$s\n"
 
+		# The strftime() format of the part of the timestamp that's cached
+		TIMESTAMP_FORMAT = '%Y-%m-%d %H:%M:%S'
+
+		# The padded severity labels used by the default formats
+		SEVERITY_LABELS = Hash.new {|hash, severity| hash[severity] = severity.to_s.rjust(5) }
+		%w[DEBUG INFO WARN ERROR FATAL ANY].each {|severity| SEVERITY_LABELS[severity] }
+
 
 		### Initialize the formatter with a reference to the logger so it can check for log level.
 		def initialize( logger, format=DEFAULT_FORMAT, debug=DEFAULT_DEBUG_FORMAT ) # :notnew:
@@ -702,6 +710,12 @@ module MUES
 			@format       = format
 			@debug_format = debug
 
+			# The timestamp is only formatted again when the second changes, and
+			# each thread's tag only once per process. The cached timestamp is
+			# replaced as a whole, so threads can share it without locking.
+			@timestamp    = [ nil, nil ]
+			@tag_key      = :"mues_log_tag_#{self.object_id}"
+
 			super()
 		end
 
@@ -720,24 +734,59 @@ module MUES
 
 
 		### Log using either the DEBUG_FORMAT if the associated logger is at ::DEBUG level or
-		### using FORMAT if it's anything less verbose.
+		### using FORMAT if it's anything less verbose. Lines in the default formats
+		### are put together directly from the cached parts rather than with
+		### String#%.
 		def call( severity, time, progname, msg )
-			args = [
-				time.strftime( '%Y-%m-%d %H:%M:%S' ),                         # %1$s
-				time.usec,                                                    # %2$d
-				Process.pid,                                                  # %3$d
-				Thread.current == Thread.main ? 'main' : Thread.object_id,    # %4$s
-				severity,                                                     # %5$s
-				progname,                                                     # %6$s
-				msg                                                           # %7$s
-			]
-
-			if @logger.level == Logger::DEBUG
-				return self.debug_format % args
+			format = @logger.level == Logger::DEBUG ? self.debug_format : self.format
+			timestamp, pid, thread_name, tag = self.cached_parts( time )
+
+			case format
+			when DEFAULT_FORMAT
+				return "[#{timestamp}.#{usec(time)} #{tag}] #{SEVERITY_LABELS[severity]} -- #{msg}\n"
+			when DEFAULT_DEBUG_FORMAT
+				return "[#{timestamp}.#{usec(time)} #{tag}] #{SEVERITY_LABELS[severity]} " +
+					"{#{progname}} -- #{msg}\n"
 			else
-				return self.format % args
+				return format % [ timestamp, time.usec, pid, thread_name, severity, progname, msg ]
 			end
 		end
+
+
+		#########
+		protected
+		#########
+
+		### Return the second-resolution timestamp of the given +time+, the pid, and
+		### the name and "pid/name" tag of the current thread, formatting them only
+		### if they've changed since they were last needed.
+		def cached_parts( time )
+			second, timestamp = @timestamp
+			unless second == time.to_i
+				timestamp = time.strftime( TIMESTAMP_FORMAT )
+				@timestamp = [ time.to_i, timestamp ]
+			end
+
+			# Tags are kept in a thread-local, and made again in a forked child
+			thread = Thread.current
+			pid = Process.pid
+			name, tag, tag_pid = thread[ @tag_key ]
+			unless tag_pid == pid
+				name = thread == Thread.main ? 'main' : thread.object_id.to_s
+				tag = "#{pid}/#{name}"
+				thread[ @tag_key ] = [ name, tag, pid ]
+			end
+
+			return timestamp, pid, name, tag
+		end
+
+
+		### Return the microseconds of the given +time+ as a zero-padded String.
+		def usec( time )
+			usec = time.usec.to_s
+			return usec.length < 6 ? usec.rjust( 6, '0' ) : usec
+		end
+
 	end # class LogFormatter
 
 
@@ -892,3 +941,10 @@ module MUES
 
 end # class MUES
 
+
+
+begin
+	require 'mues_ext'
+rescue LoadError
+	# Log lines are formatted in Ruby without the extension
+end
@@ -0,0 +1,372 @@
+#!/usr/bin/env ruby
+
+require 'mues'
+require 'mues/mixins'
+
+
+# The compact binary envelope that events between players' clients and the
+# engine are carried in.
+#
+# Each frame is a fixed 16-byte header followed by the body:
+#
+#   offset  size  field
+#        0     1  format version (VERSION)
+#        1     1  message type (see TYPES)
+#        2     2  flags
+#        4     4  sequence number
+#        8     4  timestamp (milliseconds, modulo 2**32)
+#       12     4  body length
+#
+# All integers are unsigned and big-endian. Several frames can be concatenated
+# into one AMQP message; #decode_all splits them apart again.
+#
+# Bodies are either raw strings (for message types whose body is text) or
+# structured values encoded with #pack_value, a tagged binary encoding of
+# nil, booleans, Integers, Floats, Strings, Symbols, Arrays and Hashes that
+# costs far less to parse than JSON and is a good deal smaller.
+#
+# The header is packed and unpacked with a single Array#pack / String#unpack
+# call each. Values are packed and unpacked by MUES::WireFormat::Native, from
+# the C extension in ext/, if it's been built, and in Ruby otherwise; the two
+# produce the same bytes and raise the same errors.
+#
+# == Synopsis
+#
+#   data = MUES::WireFormat.encode( :movement, 12, :from => 'lobby', :to => 'bar' )
+#   frame = MUES::WireFormat.decode( data )
+#   frame.type      # => :movement
+#   frame.body      # => { :from => 'lobby', :to => 'bar' }
+#
+module MUES::WireFormat
+
+	# The version of the wire format
+	VERSION = 1
+
+	# The pack() format of the frame header
+	HEADER_FORMAT = 'CCnNNN'
+
+	# The length of the frame header, in bytes
+	HEADER_LENGTH = 16
+
+	# Message type codes
+	TYPES = {
+		:command   => 1,
+		:output    => 2,
+		:movement  => 3,
+		:combat    => 4,
+		:room_diff => 5,
+		:node_diff => 6,
+	}
+
+	# Message type names, keyed by code
+	TYPE_NAMES = TYPES.invert
+
+	# The message types whose body is a raw (UTF-8) string rather than a
+	# structured value
+	TEXT_TYPES = [ :command, :output ]
+
+	# Flag: the body is a raw string
+	FLAG_TEXT = 0x0001
+
+
+	# Tags for #pack_value's encoding
+	TAG_NIL    = 0
+	TAG_TRUE   = 1
+	TAG_FALSE  = 2
+	TAG_INT    = 3   # zig-zag varint
+	TAG_FLOAT  = 4   # 64-bit big-endian double
+	TAG_STRING = 5   # varint length + bytes
+	TAG_SYMBOL = 6   # varint length + bytes
+	TAG_ARRAY  = 7   # varint count + values
+	TAG_HASH   = 8   # varint count + key/value pairs
+
+	# The deepest Arrays and Hashes can be nested in a value; a deeper one
+	# can't be packed, and a frame carrying one is malformed
+	MAX_DEPTH = 32
+
+
+	# Exception class for malformed frames
+	class FormatError < StandardError; end
+
+	# A decoded frame
+	Frame = Struct.new( :type, :sequence, :timestamp, :body, :flags )
+
+
+	###############
+	module_function
+	###############
+
+	### Return +true+ if the given +data+ looks like a wire-format frame rather
+	### than a plain-text message.
+	def frame?( data )
+		data = binary_view( data )
+		return data.length >= HEADER_LENGTH && data.unpack( 'C' ).first == VERSION
+	end
+
+
+	### Encode a frame of the given message +type+ with the specified +sequence+
+	### number and +body+, and return it as a binary String.
+	def encode( type, sequence, body, timestamp=nil )
+		code = TYPES[ type ] or raise ArgumentError, "unknown message type %p" % [ type ]
+		timestamp ||= ( Time.now.to_f * 1000 ).to_i
+
+		if TEXT_TYPES.include?( type )
+			flags = FLAG_TEXT
+			body = binary( body.to_s )
+		else
+			flags = 0
+			body = pack_value( body )
+		end
+
+		header = [
+			VERSION, code, flags,
+			sequence & 0xffffffff,
+			timestamp & 0xffffffff,
+			body.length
+		].pack( HEADER_FORMAT )
+
+		return header << body
+	end
+
+
+	### Decode the frame at the beginning of +data+ and return it as a
+	### MUES::WireFormat::Frame.
+	def decode( data )
+		data = binary_view( data )
+		frame, offset = decode_at( data, 0 )
+		raise FormatError, "%d trailing bytes after frame" % [ data.length - offset ] if
+			offset != data.length
+		return frame
+	end
+
+
+	### Decode all of the frames concatenated in +data+, returning them as an
+	### Array of MUES::WireFormat::Frames.
+	def decode_all( data )
+		data = binary_view( data )
+		frames = []
+		offset = 0
+
+		while offset < data.length
+			frame, offset = decode_at( data, offset )
+			frames << frame
+		end
+
+		return frames
+	end
+
+
+	### Decode the frame that starts at +offset+ in +data+. Returns the frame and
+	### the offset of the first byte after it.
+	def decode_at( data, offset )
+		raise FormatError, "truncated frame header" if data.length - offset < HEADER_LENGTH
+
+		version, code, flags, sequence, timestamp, length =
+			data[ offset, HEADER_LENGTH ].unpack( HEADER_FORMAT )
+		raise FormatError, "unsupported wire format version %d" % [ version ] unless
+			version == VERSION
+		type = TYPE_NAMES[ code ] or
+			raise FormatError, "unknown message type code %d" % [ code ]
+
+		offset += HEADER_LENGTH
+		raise FormatError, "truncated frame body" if data.length - offset < length
+
+		raw = data[ offset, length ]
+		if ( flags & FLAG_TEXT ).nonzero?
+			body = raw
+			body.force_encoding( 'utf-8' ) if body.respond_to?( :force_encoding )
+		else
+			body = unpack_value( raw )
+		end
+
+		return Frame.new( type, sequence, timestamp, body, flags ), offset + length
+	end
+
+
+	### Encode the given +value+ in the tagged binary format and return it.
+	def pack_value( value, buffer=binary('') )
+		return Native.pack_value( value, buffer ) if defined?( Native )
+		return pack_value_at( value, buffer, 0 )
+	end
+
+
+	### Append the given +value+, which is nested +depth+ Arrays or Hashes deep,
+	### to +buffer+ in the tagged binary format, and return the buffer.
+	def pack_value_at( value, buffer, depth )
+		case value
+		when nil
+			buffer << TAG_NIL.chr
+		when true
+			buffer << TAG_TRUE.chr
+		when false
+			buffer << TAG_FALSE.chr
+		when Integer
+			buffer << TAG_INT.chr << pack_varint( value < 0 ? (-value << 1) - 1 : value << 1 )
+		when Float
+			buffer << TAG_FLOAT.chr << [ value ].pack( 'G' )
+		when Symbol
+			str = binary( value.to_s )
+			buffer << TAG_SYMBOL.chr << pack_varint( str.length ) << str
+		when String
+			str = binary( value )
+			buffer << TAG_STRING.chr << pack_varint( str.length ) << str
+		when Array
+			check_depth( depth, ArgumentError )
+			buffer << TAG_ARRAY.chr << pack_varint( value.length )
+			value.each {|item| pack_value_at(item, buffer, depth + 1) }
+		when Hash
+			check_depth( depth, ArgumentError )
+			buffer << TAG_HASH.chr << pack_varint( value.length )
+			value.each do |key, val|
+				pack_value_at( key, buffer, depth + 1 )
+				pack_value_at( val, buffer, depth + 1 )
+			end
+		else
+			raise ArgumentError, "can't encode a %s" % [ value.class.name ]
+		end
+
+		return buffer
+	end
+
+
+	### Decode a value encoded with #pack_value from +data+.
+	def unpack_value( data )
+		data = binary_view( data )
+		return Native.unpack_value( data ) if defined?( Native )
+
+		value, offset = unpack_value_at( data, 0 )
+		raise FormatError, "trailing bytes after value" unless offset == data.length
+		return value
+	end
+
+
+	### Decode the value that starts at +offset+ of +data+ (which must be
+	### binary) and is nested +depth+ Arrays or Hashes deep, returning it and
+	### the offset of the first byte after it.
+	def unpack_value_at( data, offset, depth=0 )
+		raise FormatError, "truncated value" if offset >= data.length
+		tag = data[ offset, 1 ].unpack( 'C' ).first
+		offset += 1
+
+		case tag
+		when TAG_NIL   then return nil, offset
+		when TAG_TRUE  then return true, offset
+		when TAG_FALSE then return false, offset
+
+		when TAG_INT
+			zigzag, offset = unpack_varint( data, offset )
+			return ( zigzag & 1 ).zero? ? zigzag >> 1 : -( (zigzag + 1) >> 1 ), offset
+
+		when TAG_FLOAT
+			raise FormatError, "truncated float" if data.length - offset < 8
+			return data[ offset, 8 ].unpack( 'G' ).first, offset + 8
+
+		when TAG_STRING, TAG_SYMBOL
+			length, offset = unpack_varint( data, offset )
+			raise FormatError, "truncated string" if data.length - offset < length
+			str = data[ offset, length ]
+			str.force_encoding( 'utf-8' ) if str.respond_to?( :force_encoding )
+			return ( tag == TAG_SYMBOL ? str.to_sym : str ), offset + length
+
+		when TAG_ARRAY
+			check_depth( depth, FormatError )
+			count, offset = unpack_varint( data, offset )
+			check_count( count, 1, data, offset )
+			array = Array.new( count ) do
+				item, offset = unpack_value_at( data, offset, depth + 1 )
+				item
+			end
+			return array, offset
+
+		when TAG_HASH
+			check_depth( depth, FormatError )
+			count, offset = unpack_varint( data, offset )
+			check_count( count, 2, data, offset )
+			hash = {}
+			count.times do
+				key, offset = unpack_value_at( data, offset, depth + 1 )
+				val, offset = unpack_value_at( data, offset, depth + 1 )
+				hash[ key ] = val
+			end
+			return hash, offset
+
+		else
+			raise FormatError, "unknown value tag %d" % [ tag ]
+		end
+	end
+
+
+	### Return the given non-negative Integer encoded as a base-128 varint.
+	def pack_varint( int )
+		bytes = []
+		while int > 0x7f
+			bytes << ( (int & 0x7f) | 0x80 )
+			int >>= 7
+		end
+		bytes << int
+
+		return bytes.pack( 'C*' )
+	end
+
+
+	### Decode the varint starting at +offset+ of +data+, returning it and the
+	### offset of the first byte after it.
+	def unpack_varint( data, offset )
+		int = shift = 0
+
+		loop do
+			raise FormatError, "truncated varint" if offset >= data.length
+			byte = data[ offset, 1 ].unpack( 'C' ).first
+			offset += 1
+			int |= ( byte & 0x7f ) << shift
+			break if ( byte & 0x80 ).zero?
+			shift += 7
+		end
+
+		return int, offset
+	end
+
+
+	### Raise a FormatError if +count+ values of at least +size+ bytes each
+	### can't fit in what's left of +data+ after +offset+, so a corrupt or
+	### hostile count can't make the decoder allocate without limit.
+	def check_count( count, size, data, offset )
+		raise FormatError, "count %d exceeds the %d bytes left" % [ count, data.length - offset ] if
+			count * size > data.length - offset
+	end
+
+
+	### Raise an +error+ if an Array or Hash at +depth+ would be nested more than
+	### MAX_DEPTH deep, so a hostile frame can't exhaust the decoding thread's
+	### stack.
+	def check_depth( depth, error )
+		raise error, "values nested more than %d deep" % [ MAX_DEPTH ] if depth >= MAX_DEPTH
+	end
+
+
+	### Return +string+ itself if it's already binary, or a binary copy of it
+	### otherwise, so that lengths and offsets into it count bytes.
+	def binary_view( string )
+		return string unless string.respond_to?( :encoding )
+		return string if string.encoding == Encoding::BINARY
+		return binary( string )
+	end
+
+
+	### Return a copy of +string+ with its encoding set to binary (on Rubies that
+	### have encodings).
+	def binary( string )
+		string = string.dup
+		string.force_encoding( 'binary' ) if string.respond_to?( :force_encoding )
+		return string
+	end
+
+end # module MUES::WireFormat
+
+
+begin
+	require 'mues_ext'
+rescue LoadError
+	# Values are packed and unpacked in Ruby without the extension
+end
+
@@ -0,0 +1,233 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'socket'
+require 'stringio'
+require 'tmpdir'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues'
+require 'mues/adminconsole'
+
+
+# A stand-in for a player
+class TestConsolePlayer
+	include MUES::HtmlInspectableObject
+
+	def initialize( name )
+		@name = name
+		@inventory = { 'pocket' => %w[lint coin] }
+	end
+end
+
+# A stand-in for the engine the console is attached to
+class TestConsoleEngine
+	def initialize
+		@players = { 'bargle' => TestConsolePlayer.new('bargle') }
+	end
+
+	attr_reader :players
+
+	def stats
+		return { :players => @players.length, :event_queue => {:depth => 0, :handled => 12} }
+	end
+
+	def environment; nil; end
+	def env_thread; nil; end
+	def connect_thread; nil; end
+end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::AdminConsole do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@path = File.join( Dir.tmpdir, "mues-console-spec-#{Process.pid}.sock" )
+		@engine = TestConsoleEngine.new
+		@console = MUES::AdminConsole.new( @engine, :admin_socket => @path )
+	end
+
+	after( :each ) do
+		@console.shutdown
+		MUES::Loggable.reset_levels
+	end
+
+
+	### Serve the console until nothing's been ready for a little while.
+	def pump( console )
+		while ready = IO.select( console.readers, console.writers, nil, 0.1 )
+			readable, writable = ready
+			readable.each {|io| console.handle_readable(io) }
+			writable.each {|io| console.handle_writable(io) }
+		end
+	end
+
+
+	### Run the given +command+ and return its output.
+	def command_output( command )
+		out = StringIO.new
+		@console.run_command( command, out )
+		return out.string
+	end
+
+
+	it "describes its commands" do
+		command_output( 'help' ).should =~ /^inspect <target>/
+	end
+
+	it "writes the engine's stats, indenting nested ones" do
+		command_output( 'stats' ).should == "event_queue:\n  depth: 0\n  handled: 12\nplayers: 1\n"
+	end
+
+	it "writes the values of the engine's metrics" do
+		MUES::Metrics.counter( :spec_console_commands ).increment( 2 )
+		command_output( 'metrics' ).should include( "spec_console_commands: 2\n" )
+		MUES::Metrics.reset
+	end
+
+	it "lists the connected players" do
+		command_output( 'players' ).should == "bargle\n"
+	end
+
+	it "inspects a player, following a path into it" do
+		output = command_output( 'inspect bargle @inventory pocket format=json' )
+		output.should =~ /\{"class":"Array","id":\d+,"size":2,"items":\["lint","coin"\],"first":0\}/
+		output.should include( '(3 values described)' )
+	end
+
+	it "inspects a player as HTML by default" do
+		command_output( 'inspect bargle depth=1' ).should include( %{<span class="object-class">TestConsolePlayer</span>} )
+	end
+
+	it "says when there's no such player" do
+		command_output( 'inspect nobody' ).should == %{No player named "nobody".\n}
+	end
+
+	it "reports errors from commands instead of raising them" do
+		command_output( 'inspect bargle @nothing' ).should =~ /IndexError: .* has no @nothing/
+	end
+
+	it "sets and lists per-class log levels" do
+		command_output( 'level MUES::Player debug' ).should == "MUES::Player now logs at debug.\n"
+		MUES::Loggable.level_for( 'MUES::Player' ).should == Logger::DEBUG
+		command_output( 'levels' ).should == "MUES::Player: debug\n"
+
+		command_output( 'level MUES::Player default' )
+		command_output( 'levels' ).should == "No per-class levels are set.\n"
+	end
+
+	it "dumps its threads" do
+		command_output( 'threads' ).should =~ /\(main\) run/
+	end
+
+	it "doesn't know other commands" do
+		command_output( 'frobnicate' ).should =~ /unknown command "frobnicate"/i
+	end
+
+
+	describe "listening on its socket" do
+
+		before( :each ) do
+			@console.start
+			@client = UNIXSocket.new( @path )
+			pump( @console )
+		end
+
+		after( :each ) do
+			@client.close unless @client.closed?
+		end
+
+		it "greets new clients" do
+			@client.readpartial( 4096 ).should =~ /MUES admin console/
+			@console.client_count.should == 1
+		end
+
+		it "runs commands that clients send" do
+			@client.readpartial( 4096 )
+			@client.write( "players\nsta" )
+			pump( @console )
+			@client.readpartial( 4096 ).should == "bargle\n"
+
+			@client.write( "ts\n" )
+			pump( @console )
+			@client.readpartial( 4096 ).should include( "players: 1\n" )
+		end
+
+		it "closes the connection after 'quit'" do
+			@client.write( "quit\nplayers\n" )
+			pump( @console )
+			@client.read.should =~ /Bye\.\n\z/
+			@console.client_count.should == 0
+		end
+
+		it "forgets clients that hang up" do
+			@client.close
+			pump( @console )
+			@console.client_count.should == 0
+		end
+
+		it "removes its socket when it's shut down" do
+			@console.shutdown
+			File.exist?( @path ).should be_false
+		end
+
+		it "creates its socket usable only by its owner, whatever the umask" do
+			@console.shutdown
+			old_umask = File.umask( 0 )
+			begin
+				console = MUES::AdminConsole.new( @engine, :admin_socket => @path )
+				console.start
+				File.umask.should == 0
+			ensure
+				File.umask( old_umask )
+			end
+
+			( File.stat(@path).mode & 0777 ).should == 0600
+			console.shutdown
+		end
+
+		it "replaces a socket nothing is listening on" do
+			@console.shutdown
+			UNIXServer.new( @path ).close
+			File.socket?( @path ).should be_true
+
+			console = MUES::AdminConsole.new( @engine, :admin_socket => @path )
+			console.start
+			console.should be_running()
+			console.shutdown
+		end
+
+		it "refuses to start on a socket another console is listening on" do
+			lambda {
+				MUES::AdminConsole.new( @engine, :admin_socket => @path ).start
+			}.should raise_error( RuntimeError, /already listening/ )
+		end
+
+	end
+
+end
+
@@ -0,0 +1,132 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/areaexchange'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::AreaExchange do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	# Stand-ins for the Bunny objects the area exchange talks to
+	class FakeExchange
+		def initialize; @messages = []; end
+		attr_reader :messages
+		def publish( data, opts={} ); @messages << [ data.dup, opts[:key] ]; end
+	end
+
+	class FakeQueue
+		def initialize; @bindings = []; end
+		attr_reader :bindings
+		def bind( exchange, opts ); @bindings << opts[:key]; end
+		def unbind( exchange, opts ); @bindings.delete( opts[:key] ); end
+	end
+
+	class FakeBus
+		def initialize; @queues = Hash.new {|h,k| h[k] = FakeQueue.new }; @declarations = 0; end
+		attr_reader :queues, :exchange_opts, :declarations
+		def exchange( name, opts ); @exchange_opts = opts; @exchange = FakeExchange.new; end
+		def queue( name, opts={} ); @declarations += 1; @queues[ name ]; end
+	end
+
+	FakePlayer = Struct.new( :name )
+
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@bus = FakeBus.new
+		@areas = MUES::AreaExchange.new( @bus )
+		@areas.start
+		@ged = FakePlayer.new( 'ged' )
+		@bob = FakePlayer.new( 'bob' )
+	end
+
+
+	it "publishes through a topic exchange" do
+		@bus.exchange_opts[:type].should == :topic
+	end
+
+	it "binds a player's client queue to the area they move into" do
+		@areas.move( @ged, 'tavern' )
+		@bus.queues['ged'].bindings.should == [ 'area.tavern' ]
+		@areas.area_of( @ged ).should == 'tavern'
+	end
+
+	it "rebinds a player's client queue when they move" do
+		@areas.move( @ged, 'tavern' )
+		@areas.move( @ged, 'street' )
+		@bus.queues['ged'].bindings.should == [ 'area.street' ]
+		@areas.players_in( 'tavern' ).should be_empty
+		@areas.players_in( 'street' ).should == [ 'ged' ]
+	end
+
+	it "unbinds a player's client queue when they leave" do
+		@areas.move( @ged, 'tavern' )
+		@areas.leave( @ged )
+		@bus.queues['ged'].bindings.should be_empty
+		@areas.area_of( @ged ).should be_nil
+	end
+
+	it "declares a player's client queue only once while they move around" do
+		@areas.move( @ged, 'tavern' )
+		@areas.move( @ged, 'street' )
+		@areas.move( @ged, 'tavern' )
+		@areas.leave( @ged )
+		@bus.declarations.should == 1
+	end
+
+	it "drops an area's buffer once the area is empty and flushed" do
+		@areas.move( @ged, 'tavern' )
+		@areas.move( @bob, 'tavern' )
+		@areas.broadcast( 'tavern', :output, "Ged waves." )
+		@areas.flush
+		@areas.instance_variable_get( :@buffers ).keys.should == [ 'tavern' ]
+
+		@areas.move( @ged, 'street' )
+		@areas.leave( @bob )
+		@areas.broadcast( 'tavern', :output, "The fire crackles." )
+		@areas.flush.should == 1
+		@areas.instance_variable_get( :@buffers ).keys.should be_empty
+	end
+
+	it "publishes a tick's worth of broadcasts to an area as one message" do
+		@areas.move( @ged, 'tavern' )
+		@areas.move( @bob, 'tavern' )
+
+		@areas.broadcast( 'tavern', :output, "Bob says: hi." )
+		@areas.broadcast( 'tavern', :output, "Ged waves." )
+		@areas.broadcast( 'street', :output, "A cart rolls by." )
+		@areas.flush.should == 3
+
+		messages = @areas.exchange.messages
+		messages.length.should == 2
+		tavern = messages.find {|data, key| key == 'area.tavern' }
+		MUES::WireFormat.decode_all( tavern.first ).collect {|frame| frame.body }.
+			should == [ "Bob says: hi.", "Ged waves." ]
+	end
+
+end
+
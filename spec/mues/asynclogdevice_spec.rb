@@ -0,0 +1,159 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'thread'
+require 'timeout'
+require 'logger'
+require 'stringio'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/asynclogdevice'
+
+
+# An IO that blocks writes until it's opened, to simulate a stalled terminal
+class TestStalledIO < StringIO
+	def initialize
+		super()
+		@gate = Queue.new
+		@open = false
+	end
+
+	def open_gate
+		@open = true
+		@gate << true
+	end
+
+	def write( data )
+		@gate.pop unless @open
+		super
+	end
+end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::AsyncLogDevice do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it "writes messages from its own thread" do
+		io = StringIO.new
+		device = MUES::AsyncLogDevice.new( io )
+		device.write( "one\n" )
+		device.write( "two\n" )
+		device.flush
+
+		io.string.should == "one\ntwo\n"
+		device.stats[ :written ].should == 2
+		device.close
+	end
+
+	it "works as a Logger's device" do
+		io = StringIO.new
+		device = MUES::AsyncLogDevice.new( io )
+		logger = Logger.new( device )
+		logger.formatter = lambda {|severity, time, progname, msg| "#{severity}: #{msg}\n" }
+
+		logger.warn( "The lamp is getting dim." )
+		device.close
+
+		io.string.should == "WARN: The lamp is getting dim.\n"
+	end
+
+	it "doesn't make the logging thread wait while the IO is stalled" do
+		io = TestStalledIO.new
+		device = MUES::AsyncLogDevice.new( io, :log_buffer_size => 4 )
+
+		Timeout.timeout( 1 ) do
+			10.times {|i| device.write("message #{i}\n") }
+		end
+		io.open_gate
+		device.close
+
+		io.string.should include( "message 0\n" )
+	end
+
+	it "drops messages and notes how many when the buffer is full" do
+		io = TestStalledIO.new
+		device = MUES::AsyncLogDevice.new( io, :log_buffer_size => 2, :log_overflow_policy => :drop )
+
+		device.write( "first\n" )
+		Timeout.timeout( 5 ) { sleep 0.01 until device.stats[:buffered].zero? }
+		4.times {|i| device.write("message #{i}\n") }
+		io.open_gate
+		device.close
+
+		device.stats[ :dropped ].should == 2
+		io.string.should == "first\n" +
+			( MUES::AsyncLogDevice::DROPPED_NOTE % [2] ) +
+			"message 0\nmessage 1\n"
+	end
+
+	it "makes the logging thread wait for room if its policy is :block" do
+		io = TestStalledIO.new
+		device = MUES::AsyncLogDevice.new( io, :log_buffer_size => 2, :log_overflow_policy => :block )
+
+		writer = Thread.new { 5.times {|i| device.write("message #{i}\n") } }
+		Timeout.timeout( 5 ) { sleep 0.01 until device.stats[:blocked] > 0 }
+		io.open_gate
+		writer.join
+		device.close
+
+		device.stats[ :dropped ].should == 0
+		io.string.should == (0 ... 5).collect {|i| "message #{i}\n" }.join
+	end
+
+	it "stops making the logging thread wait if the writer thread dies" do
+		io = TestStalledIO.new
+		device = MUES::AsyncLogDevice.new( io, :log_buffer_size => 2, :log_overflow_policy => :block )
+
+		writer = Thread.new { 5.times {|i| device.write("message #{i}\n") } }
+		Timeout.timeout( 5 ) { sleep 0.01 until device.stats[:blocked] > 0 }
+		device.thread.kill
+		io.open_gate
+
+		Timeout.timeout( 5 ) { writer.join }
+		device.should_not be_running
+		io.string.should =~ /message 4\n\z/
+	end
+
+	it "writes directly once it's closed" do
+		io = StringIO.new
+		device = MUES::AsyncLogDevice.new( io )
+		device.close
+		device.write( "late\n" )
+
+		io.string.should == "late\n"
+		device.should_not be_running
+	end
+
+	it "refuses an unknown overflow policy" do
+		lambda {
+			MUES::AsyncLogDevice.new( StringIO.new, :log_overflow_policy => :panic )
+		}.should raise_error( ArgumentError, /overflow policy/ )
+	end
+
+end
+
@@ -0,0 +1,133 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'tmpdir'
+require 'timeout'
+require 'fileutils'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/objectstore'
+require 'mues/checkpointer'
+
+
+# A minimal persistent object for the checkpointer specs
+class TestCheckpointObject
+	def initialize( muesid, name ); @muesid = muesid; @name = name; end
+	attr_reader :muesid
+	attr_accessor :name
+end
+
+# A stand-in for the environment whose state is checkpointed
+class TestCheckpointEnvironment
+	def initialize( tick=0 ); @tick = tick; end
+	attr_reader :tick
+	def checkpoint_state; { :tick => @tick }; end
+	def restore_state( state ); @tick = state[:tick]; end
+end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::Checkpointer do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@dir = File.join( Dir.tmpdir, "mues-checkpointer-#{Process.pid}-#{rand(100000)}" )
+		@config = { :objectstore_dir => @dir, :objectstore_flush_interval => 60 }
+		@store = MUES::ObjectStore.new( @config )
+		@checkpointer = MUES::Checkpointer.new( @store, @config )
+	end
+
+	after( :each ) do
+		@checkpointer.shutdown
+		@store.close
+		FileUtils.rm_rf( @dir )
+	end
+
+
+	it "writes out dirty objects and snapshots the store" do
+		@store.store( TestCheckpointObject.new('door', 'oaken door') )
+		@store.store( TestCheckpointObject.new('lamp', 'brass lamp') )
+
+		upto = @checkpointer.checkpoint
+		@store.dirty_count.should == 0
+		@store.object_log.snapshot.should == upto
+		@store.object_log.snapshots.should == [ upto ]
+	end
+
+	it "saves and restores the environment's state" do
+		@checkpointer.checkpoint( TestCheckpointEnvironment.new(1138) )
+		@store.close
+
+		@store = MUES::ObjectStore.new( @config )
+		@checkpointer = MUES::Checkpointer.new( @store, @config )
+		environment = TestCheckpointEnvironment.new
+
+		@checkpointer.restore( environment ).should be_true
+		environment.tick.should == 1138
+	end
+
+	it "doesn't restore anything if there hasn't been a checkpoint" do
+		environment = TestCheckpointEnvironment.new( 12 )
+		@checkpointer.restore( environment ).should be_false
+		environment.tick.should == 12
+	end
+
+	it "restores the world from the latest snapshot" do
+		@store.store( TestCheckpointObject.new('door', 'oaken door') )
+		@checkpointer.checkpoint
+		door = @store.retrieve( 'door' )
+		door.name = 'open oaken door'
+		@store.mark_dirty( door )
+		@store.close
+
+		@store = MUES::ObjectStore.new( @config )
+		@store.object_log.snapshot.should == 1
+		@store.retrieve( 'door' ).name.should == 'open oaken door'
+	end
+
+	it "writes snapshots in the background once it's started" do
+		@checkpointer.start
+		@store.store( TestCheckpointObject.new('door', 'oaken door') )
+		upto = @checkpointer.checkpoint
+
+		Timeout.timeout( 5 ) do
+			sleep 0.01 until @checkpointer.stats[:snapshots] == 1
+		end
+		@store.object_log.snapshot.should == upto
+	end
+
+	it "keeps timing statistics" do
+		@checkpointer.checkpoint
+		stats = @checkpointer.stats
+
+		stats[ :checkpoints ].should == 1
+		stats[ :snapshots ].should == 1
+		stats[ :pause ][ :count ].should == 1
+		stats[ :compaction ][ :count ].should == 1
+	end
+
+end
+
@@ -0,0 +1,275 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'thread'
+require 'timeout'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/commandreactor'
+require 'mues/eventqueue'
+require 'mues/player'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::CommandReactor do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	# A minimal stand-in for MUES::Player that just records its events
+	class RecordingPlayer
+		def initialize( name ); @name = name; @events = []; end
+		attr_reader :name, :events
+		def handle_command_event( event ); @events << event; end
+	end
+
+
+	# A stand-in for the broker that keeps track of queues and their bindings,
+	# and deletes an auto-delete queue when its last subscription is cancelled
+	class FakeBroker
+		def initialize; @queues = {}; end
+		attr_reader :queues
+
+		def declare( name, options )
+			return @queues[ name ] ||= FakeBrokerQueue.new( self, name, options )
+		end
+	end
+
+	# A queue on a FakeBroker
+	class FakeBrokerQueue
+		def initialize( broker, name, options )
+			@broker, @name, @options = broker, name, options
+			@bindings = []
+			@subscribers = Queue.new
+		end
+		attr_reader :bindings
+
+		def bind( exchange, options ); @bindings << [ exchange, options[:key] ]; end
+		def unbind( exchange, options ); @bindings.delete( [exchange, options[:key]] ); end
+		def ack( options ); end
+
+		def subscribe( options )
+			@subscribers.pop
+		end
+
+		def unsubscribe( options )
+			@subscribers << :cancelled
+			@broker.queues.delete( @name ) if @options[:auto_delete]
+		end
+	end
+
+	# A stand-in for a Bunny client connected to a FakeBroker
+	class FakeBrokerClient
+		def initialize( broker ); @broker = broker; end
+		def start; end
+		def stop; end
+		def qos( options ); end
+		def exchange( name, options={} ); name; end
+		def queue( name, options={} ); @broker.declare( name, options ); end
+	end
+
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@reactor = MUES::CommandReactor.new( :command_consumers => 3 )
+	end
+
+
+	it "sizes its consumer pool from the config" do
+		@reactor.size.should == 3
+	end
+
+	it "refuses a prefetch window smaller than its ack batch" do
+		lambda {
+			MUES::CommandReactor.new( :command_prefetch => 8, :command_ack_batch => 16 )
+		}.should raise_error( ArgumentError, /prefetch/ )
+		MUES::CommandReactor.new( :command_prefetch => 0, :command_ack_batch => 16 ).size.should > 0
+	end
+
+	it "always assigns a given player to the same consumer" do
+		slot = @reactor.slot_for( 'ged' )
+		10.times { @reactor.slot_for('ged').should == slot }
+		@reactor.queue_name_for( 'ged' ).should == "engine_commands.#{slot}"
+	end
+
+	it "assigns players to consumers within the pool" do
+		%w[ged stillflame scotus bartleby].each do |name|
+			@reactor.slot_for( name ).should >= 0
+			@reactor.slot_for( name ).should < 3
+		end
+	end
+
+	it "dispatches command events to the player whose exchange they were published to" do
+		ged = RecordingPlayer.new( 'ged' )
+		bob = RecordingPlayer.new( 'bob' )
+		@reactor.register( ged )
+		@reactor.register( bob )
+
+		event = { :delivery_details => {:exchange => 'ged'}, :payload => 'look' }
+		@reactor.dispatch( event )
+
+		ged.events.should == [ event ]
+		bob.events.should be_empty
+	end
+
+	it "discards command events for unregistered players" do
+		ged = RecordingPlayer.new( 'ged' )
+		@reactor.register( ged )
+		@reactor.unregister( ged )
+
+		@reactor.dispatch( :delivery_details => {:exchange => 'ged'}, :payload => 'look' )
+
+		ged.events.should be_empty
+	end
+
+
+	it "dispatches submitted commands right away if it has no event queue" do
+		ged = RecordingPlayer.new( 'ged' )
+		@reactor.register( ged )
+		@reactor.submit( :delivery_details => {:exchange => 'ged'}, :payload => 'look' )
+		ged.events.length.should == 1
+	end
+
+	it "runs submitted commands on its event queue's workers, in order for each player" do
+		queue = MUES::EventQueue.new( :event_queue_workers => 4 )
+		reactor = MUES::CommandReactor.new( {:command_consumers => 3}, queue )
+		players = %w[ged bob].collect {|name| RecordingPlayer.new(name) }
+		players.each {|player| reactor.register(player) }
+
+		queue.start
+		50.times do |i|
+			players.each do |player|
+				reactor.submit( :delivery_details => {:exchange => player.name}, :payload => i )
+			end
+		end
+		queue.shutdown
+
+		players.each do |player|
+			player.events.collect {|event| event[:payload] }.should == ( 0 ... 50 ).to_a
+		end
+		queue.stats[ :player ].should > 0
+	end
+
+	it "dispatches submitted commands itself if its event queue isn't running" do
+		queue = MUES::EventQueue.new( :event_queue_workers => 1 )
+		reactor = MUES::CommandReactor.new( {:command_consumers => 3}, queue )
+		ged = RecordingPlayer.new( 'ged' )
+		reactor.register( ged )
+
+		queue.start
+		queue.shutdown
+		3.times {|i| reactor.submit(:delivery_details => {:exchange => 'ged'}, :payload => i) }
+
+		ged.events.collect {|event| event[:payload] }.should == [ 0, 1, 2 ]
+	end
+
+	it "replaces a consumer whose thread has exited" do
+		exited = Queue.new
+		@reactor.start {|thread| exited << thread }
+		dead = Timeout.timeout( 2 ) { exited.pop }
+		dead.join
+		index = @reactor.consumers.index {|consumer| consumer.thread == dead }
+
+		consumer = @reactor.restart_consumer( dead )
+		consumer.index.should == index
+		consumer.thread.should_not == dead
+		@reactor.consumers[ index ].should equal( consumer )
+		@reactor.consumers.length.should == 3
+
+		@reactor.restart_consumer( Thread.current ).should be_nil
+	end
+
+	it "keeps its players' bindings when it replaces a consumer" do
+		broker = FakeBroker.new
+		original_new = Bunny.method( :new )
+		Bunny.define_singleton_method( :new ) {|*args| FakeBrokerClient.new(broker) }
+
+		begin
+			@reactor.start
+			Timeout.timeout( 2 ) { sleep 0.01 until broker.queues.length == 3 }
+
+			ged = MUES::Player.new( 'ged', {}, {} )
+			ged.connect_to_bus( FakeBrokerClient.new(broker), @reactor )
+			queue_name = @reactor.queue_name_for( 'ged' )
+			consumer = @reactor.consumers[ @reactor.slot_for('ged') ]
+
+			@reactor.restart_consumer( consumer.thread )
+			Timeout.timeout( 2 ) { sleep 0.01 until broker.queues.length == 3 }
+			broker.queues[ queue_name ].bindings.should == [ ['ged', 'command.#'] ]
+		ensure
+			@reactor.stop
+			Bunny.define_singleton_method( :new, original_new )
+		end
+	end
+
+
+	describe MUES::CommandReactor::AckBatcher do
+
+		before( :each ) do
+			@acked_tags = []
+			@batcher = MUES::CommandReactor::AckBatcher.new( 4, 60 ) {|tag| @acked_tags << tag }
+		end
+
+
+		it "acknowledges deliveries in batches with the last delivery tag" do
+			(1..9).each {|tag| @batcher.delivered(tag) }
+
+			@acked_tags.should == [ 4, 8 ]
+			@batcher.pending.should == 1
+			@batcher.stats.should == { :deliveries => 9, :acks => 2, :acked => 8, :pending => 1 }
+		end
+
+		it "acknowledges any pending deliveries when flushed" do
+			(1..2).each {|tag| @batcher.delivered(tag) }
+			@batcher.flush
+			@batcher.flush
+
+			@acked_tags.should == [ 2 ]
+			@batcher.pending.should == 0
+		end
+
+		it "acknowledges a partial batch once the ack interval has passed" do
+			batcher = MUES::CommandReactor::AckBatcher.new( 100, 0 ) {|tag| @acked_tags << tag }
+			batcher.delivered( 1 )
+			batcher.delivered( 2 )
+
+			@acked_tags.should == [ 1, 2 ]
+		end
+
+		it "acknowledges a partial batch from its timer once the interval has passed" do
+			batcher = MUES::CommandReactor::AckBatcher.new( 100, 0.05 ) {|tag| @acked_tags << tag }
+			batcher.delivered( 1 )
+			batcher.delivered( 2 )
+			batcher.flush_if_due
+			@acked_tags.should be_empty
+
+			sleep 0.06
+			batcher.flush_if_due
+			@acked_tags.should == [ 2 ]
+			batcher.pending.should == 0
+		end
+
+	end
+
+end
+
@@ -0,0 +1,126 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/deltaencoder'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::DeltaEncoder do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :each ) do
+		@encoder = MUES::DeltaEncoder.new( :delta_keyframe_interval => 5, :delta_max_unacked => 3 )
+		@decoder = MUES::DeltaEncoder::Decoder.new
+		@state = { :x => 1, :y => 2, :name => 'door', :open => false }
+	end
+
+
+	it "sends a keyframe the first time a session gets a node's state" do
+		update = @encoder.encode( :ged, :door, @state )
+		update[:key].should be_true
+		update[:set].should == @state
+		@decoder.decode( update ).should == @state
+	end
+
+	it "sends nothing if the session already has the node's state" do
+		@encoder.encode( :ged, :door, @state )
+		@encoder.encode( :ged, :door, @state.dup ).should be_nil
+	end
+
+	it "sends only the changed fields once the session has acknowledged a baseline" do
+		first = @encoder.encode( :ged, :door, @state )
+		@decoder.decode( first )
+		@encoder.ack( :ged, first[:seq] )
+
+		state = @state.merge( :open => true )
+		state.delete( :name )
+		update = @encoder.encode( :ged, :door, state )
+
+		update[:key].should be_nil
+		update[:base].should == first[:seq]
+		update[:set].should == { :open => true }
+		update[:unset].should == [ :name ]
+		@decoder.decode( update ).should == state
+	end
+
+	it "encodes deltas against the acknowledged baseline, so lost updates don't matter" do
+		first = @encoder.encode( :ged, :door, @state )
+		@decoder.decode( first )
+		@encoder.ack( :ged, first[:seq] )
+
+		@encoder.encode( :ged, :door, @state.merge(:x => 5) )   # never arrives
+		update = @encoder.encode( :ged, :door, @state.merge(:x => 5, :y => 6) )
+
+		update[:set].should == { :x => 5, :y => 6 }
+		@decoder.decode( update ).should == @state.merge( :x => 5, :y => 6 )
+	end
+
+	it "sends a keyframe every so often" do
+		first = @encoder.encode( :ged, :door, @state )
+		@encoder.ack( :ged, first[:seq] )
+
+		updates = (1 .. 6).collect do |x|
+			update = @encoder.encode( :ged, :door, @state.merge(:x => x + 1) )
+			@encoder.ack( :ged, update[:seq] )
+			update
+		end
+
+		updates.collect {|update| update[:key] ? :key : :delta }.
+			should == [ :delta, :delta, :delta, :delta, :delta, :key ]
+	end
+
+	it "falls back to keyframes when too many updates go unacknowledged" do
+		first = @encoder.encode( :ged, :door, @state )
+		@encoder.ack( :ged, first[:seq] )
+
+		updates = (1 .. 5).collect {|x| @encoder.encode(:ged, :door, @state.merge(:x => x + 1)) }
+		updates.collect {|update| update[:key] ? :key : :delta }.
+			should == [ :delta, :delta, :delta, :key, :key ]
+
+		@encoder.ack( :ged, updates.last[:seq] )
+		@encoder.encode( :ged, :door, @state.merge(:x => 100) )[:key].should be_nil
+	end
+
+	it "keeps separate baselines for each session" do
+		first = @encoder.encode( :ged, :door, @state )
+		@encoder.ack( :ged, first[:seq] )
+
+		@encoder.encode( :bob, :door, @state )[:key].should be_true
+		@encoder.encode( :ged, :door, @state.merge(:x => 9) )[:key].should be_nil
+	end
+
+	it "starts over with a keyframe after forgetting a session's baseline" do
+		first = @encoder.encode( :ged, :door, @state )
+		@encoder.ack( :ged, first[:seq] )
+		@encoder.forget( :ged, :door )
+
+		@encoder.encode( :ged, :door, @state )[:key].should be_true
+	end
+
+	it "decodes a run of deltas and keyframes with the client acknowledging late" do
+		(1 .. 20).each do |x|
+			state = @state.merge( :x => x, :y => x / 3 )
+			update = @encoder.encode( :ged, :door, state ) or next
+			@decoder.decode( update ).should == state
+			@encoder.ack( :ged, update[:seq] - 2 ) if update[:seq] > 2
+		end
+	end
+
+end
+
@@ -0,0 +1,130 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/environment'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::Environment do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+
+	it "refuses to be created with an unknown overrun policy" do
+		lambda {
+			MUES::Environment.new( :overrun_policy => :panic )
+		}.should raise_error( ArgumentError, /overrun policy/i )
+	end
+
+	it "calls its tick hooks with the tick number on every tick" do
+		env = MUES::Environment.new
+		ticks = []
+		env.add_tick_hook {|e, tick| ticks << tick }
+
+		3.times { env.run_tick }
+
+		ticks.should == [ 1, 2, 3 ]
+		env.stats[:ticks].should == 3
+	end
+
+	it "fires scheduled events on the tick after their delay" do
+		env = MUES::Environment.new( :tick_length => 0.5 )
+		fired = []
+		env.schedule( 1.2 ) { fired << env.tick }
+
+		4.times { env.run_tick }
+
+		fired.should == [ 3 ]
+	end
+
+	it "counts ticks that overrun their budget" do
+		env = MUES::Environment.new( :tick_length => 0.001 )
+		env.add_tick_hook { sleep 0.005 }
+
+		env.run_tick
+
+		env.stats[:overruns].should == 1
+	end
+
+	it "runs its tick loop until stopped" do
+		env = MUES::Environment.new( :tick_length => 0.01 )
+		env.add_tick_hook {|e, tick| e.stop if tick == 3 }
+
+		thr = Thread.new { env.start }
+		thr.join( 2 ).should_not be_nil
+
+		env.tick.should == 3
+		env.should_not be_running
+	end
+
+	it "skips ticks it missed if its overrun policy is :skip" do
+		env = MUES::Environment.new( :tick_length => 0.01, :overrun_policy => :skip )
+		env.add_tick_hook do |e, tick|
+			sleep 0.05 if tick == 1
+			e.stop if tick == 2
+		end
+
+		Thread.new { env.start }.join( 2 )
+
+		env.stats[:skipped_ticks].should > 0
+	end
+
+	it "finds the nodes near a point" do
+		env = MUES::Environment.new( :spatial_cell_size => 10 )
+		env.track_node( :door, 1, 0, 0 )
+		env.track_node( :lamp, 30, 0, 0 )
+
+		env.nodes_near( 0, 0, 0, 5 ).should == [ :door ]
+
+		env.move_node( :lamp, 3, 0, 0 )
+		env.nodes_near( 0, 0, 0, 5 ).sort_by {|node| node.to_s }.should == [ :door, :lamp ]
+
+		env.untrack_node( :door )
+		env.nodes_near( 0, 0, 0, 5 ).should == [ :lamp ]
+	end
+
+	it "forgets a session's interests and node state when it's removed" do
+		env = MUES::Environment.new
+		env.interest.subscribe( :ged, :door )
+		env.send_node_state( :door, :open => true ) {|session, update| }
+
+		env.remove_session( :ged )
+		env.interest.interests_of( :ged ).should be_empty
+		env.delta_encoder.instance_variable_get( :@sessions ).should be_empty
+	end
+
+	it "restores its tick counter from a checkpoint" do
+		env = MUES::Environment.new
+		3.times { env.run_tick }
+		state = env.checkpoint_state
+
+		restored = MUES::Environment.new
+		restored.restore_state( state )
+		restored.tick.should == 3
+	end
+
+end
+
@@ -0,0 +1,122 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/event'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::Event do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	# A handler with a specific method for one kind of event and a fallback for
+	# the rest
+	class TestEventHandler
+		def initialize; @handled = []; end
+		attr_reader :handled
+
+		protected
+		def handle_test_chat_event( event ); @handled << [:chat, event]; end
+		def handle_player_event( event ); @handled << [:player, event]; end
+	end
+
+	class MUES::TestChatEvent < MUES::PlayerEvent; end
+	class MUES::TestMoveEvent < MUES::PlayerEvent; end
+	class MUES::TestShutdownEvent < MUES::SystemEvent; end
+
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@handler = TestEventHandler.new
+	end
+
+	after( :each ) do
+		[ MUES::Event, MUES::PlayerEvent, MUES::TestChatEvent ].each do |klass|
+			klass.unregister_handlers( klass.handlers.dup )
+		end
+	end
+
+
+	it "derives handler method names from the event class name" do
+		MUES::Event.handler_method_name.should == 'handle_event'
+		MUES::TestChatEvent.handler_method_name.should == 'handle_test_chat_event'
+	end
+
+	it "takes its priority from its class" do
+		MUES::TestChatEvent.new.priority.should == :player
+		MUES::TestShutdownEvent.new.priority.should == :system
+		MUES::EnvironmentEvent.new.priority.should == :environment
+	end
+
+	it "dispatches to the most specific handler method for the event's class" do
+		MUES::PlayerEvent.register_handlers( @handler )
+
+		chat = MUES::TestChatEvent.new
+		move = MUES::TestMoveEvent.new
+		chat.dispatch
+		move.dispatch
+
+		@handler.handled.should == [ [:chat, chat], [:player, move] ]
+	end
+
+	it "dispatches to handlers registered with the event's superclasses" do
+		events = []
+		MUES::Event.register_handlers( lambda {|ev| events << ev } )
+
+		shutdown = MUES::TestShutdownEvent.new
+		shutdown.dispatch
+
+		events.should == [ shutdown ]
+	end
+
+	it "calls a handler registered at several levels of the hierarchy only once" do
+		MUES::PlayerEvent.register_handlers( @handler )
+		MUES::TestChatEvent.register_handlers( @handler )
+
+		MUES::TestChatEvent.new.dispatch
+
+		@handler.handled.length.should == 1
+	end
+
+	it "rebuilds the dispatch tables of subclasses when a handler is registered" do
+		MUES::TestChatEvent.dispatch_table.should be_empty
+		MUES::Event.register_handlers( @handler )
+		MUES::TestChatEvent.dispatch_table.length.should == 1
+		MUES::Event.unregister_handlers( @handler )
+		MUES::TestChatEvent.dispatch_table.should be_empty
+	end
+
+	it "keeps dispatching after a handler raises" do
+		events = []
+		MUES::TestChatEvent.register_handlers( lambda {|ev| raise "oops" } )
+		MUES::PlayerEvent.register_handlers( lambda {|ev| events << ev } )
+
+		MUES::TestChatEvent.new.dispatch
+
+		events.length.should == 1
+	end
+
+end
+
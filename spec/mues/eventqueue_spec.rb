@@ -0,0 +1,152 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'thread'
+require 'timeout'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/eventqueue'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::EventQueue do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@handled = []
+		@gate = Queue.new
+		@config = {
+			:event_queue_capacity   => 10,
+			:event_queue_workers    => 1,
+			:event_queue_high_water => 0.8,
+			:event_queue_low_water  => 0.2,
+		}
+		@queue = MUES::EventQueue.new( @config ) do |event|
+			@gate.pop if event == :hold
+			@handled << event
+		end
+	end
+
+	after( :each ) do
+		@gate << true
+		@queue.shutdown
+	end
+
+
+	### Start the queue and tie up its worker with an event that isn't handled
+	### until the gate is opened, so events can pile up behind it.
+	def start_held
+		@queue.start
+		@queue.enqueue( :hold, :system )
+		Timeout.timeout( 5 ) { sleep 0.01 until @queue.depth.zero? }
+	end
+
+
+	it "handles events from higher-priority lanes first" do
+		self.start_held
+		@queue.enqueue( :chatter, :player )
+		@queue.enqueue( :weather, :environment )
+		@queue.enqueue( :shutdown, :system )
+		@queue.enqueue( :more_chatter, :player )
+
+		@gate << true
+		@queue.shutdown
+
+		@handled.should == [ :hold, :shutdown, :weather, :chatter, :more_chatter ]
+		@queue.stats[:handled].should == 5
+	end
+
+	it "rejects events with an unknown priority" do
+		lambda {
+			@queue.enqueue( :foo, :urgent )
+		}.should raise_error( ArgumentError, /unknown priority/i )
+	end
+
+	it "drops events when it's full if told not to wait" do
+		self.start_held
+		10.times {|i| @queue.enqueue(i).should be_true }
+		@queue.enqueue( :too_many, :player, false ).should be_false
+		@queue.stats[:dropped].should == 1
+	end
+
+	it "refuses events when it isn't running" do
+		@queue.enqueue( :too_soon ).should be_false
+		@queue.start
+		@queue.shutdown
+		@queue.enqueue( :too_late ).should be_false
+
+		@handled.should be_empty
+		@queue.depth.should == 0
+	end
+
+	it "signals backpressure at its high-water mark and releases it at its low-water mark" do
+		signals = []
+		@queue.on_backpressure {|congested| signals << congested }
+
+		self.start_held
+		8.times {|i| @queue.enqueue(i) }
+		@queue.should be_congested
+		signals.should == [ true ]
+
+		@gate << true
+		@queue.wait_while_congested
+		@queue.should_not be_congested
+		signals.should == [ true, false ]
+	end
+
+	it "keeps histograms of its depth and of event latency" do
+		self.start_held
+		3.times {|i| @queue.enqueue(i) }
+		@gate << true
+		@queue.shutdown
+
+		@queue.depth_histogram.count.should == 4
+		@queue.depth_histogram.max.should == 3
+		@queue.latency_histogram.count.should == 4
+	end
+
+	it "replaces a worker that died, and tells its supervisor" do
+		exited = Queue.new
+		queue = MUES::EventQueue.new( @config ) do |event|
+			raise NoMemoryError, "out of cheese" if event == :fatal
+			@handled << event
+		end
+		queue.start {|thread| exited << thread }
+
+		queue.enqueue( :fatal )
+		dead = Timeout.timeout( 5 ) { exited.pop }
+		replacement = queue.restart_worker( dead )
+		replacement.should be_alive
+		queue.workers.should == [ replacement ]
+
+		queue.enqueue( :after )
+		queue.shutdown
+		@handled.should == [ :after ]
+		queue.restart_worker( replacement ).should be_nil
+	end
+
+end
+
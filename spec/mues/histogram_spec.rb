@@ -0,0 +1,103 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/histogram'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::Histogram do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :each ) do
+		@histogram = MUES::Histogram.new
+	end
+
+
+	it "tracks the count, sum, minimum and maximum of the recorded values" do
+		[ 5, 100, 42 ].each {|val| @histogram.record(val) }
+
+		@histogram.count.should == 3
+		@histogram.sum.should == 147
+		@histogram.min.should == 5
+		@histogram.max.should == 100
+		@histogram.mean.should == 49.0
+	end
+
+	it "reports small values exactly" do
+		(0..15).each {|val| @histogram.record(val) }
+		@histogram.percentile( 50 ).should == 7
+		@histogram.percentile( 100 ).should == 15
+	end
+
+	it "reports percentiles within its relative error" do
+		(1..10_000).each {|val| @histogram.record(val) }
+
+		[ 50, 90, 99 ].each do |pct|
+			expected = 10_000 * pct / 100
+			@histogram.percentile( pct ).should be_close( expected, expected / 16.0 )
+		end
+	end
+
+	it "never reports a percentile larger than the largest recorded value" do
+		@histogram.record( 1250 )
+		@histogram.percentile( 99 ).should == 1250
+	end
+
+	it "clamps values that are too large to track into its last bucket" do
+		@histogram.record( 2 ** 60 )
+		@histogram.count.should == 1
+		@histogram.percentile( 50 ).should == 2 ** 60
+	end
+
+	it "can be cleared" do
+		@histogram.record( 12 )
+		@histogram.clear
+		@histogram.count.should == 0
+		@histogram.percentile( 50 ).should be_nil
+	end
+
+	it "merges the values recorded in another histogram" do
+		[ 5, 10 ].each {|val| @histogram.record(val) }
+		other = MUES::Histogram.new( false )
+		[ 1, 1000 ].each {|val| other.record(val) }
+
+		@histogram.merge( other ).should equal( @histogram )
+		@histogram.count.should == 4
+		@histogram.min.should == 1
+		@histogram.max.should == 1000
+		@histogram.sum.should == 1016
+		@histogram.percentile( 50 ).should == 5
+	end
+
+	it "records the same way when it isn't synchronized" do
+		unlocked = MUES::Histogram.new( false )
+		[ 5, 10, 1000 ].each {|val| @histogram.record(val); unlocked.record(val) }
+
+		unlocked.to_h.should == @histogram.to_h
+	end
+
+	it "merges an empty histogram without changing" do
+		@histogram.record( 12 )
+		@histogram.merge( MUES::Histogram.new )
+		@histogram.count.should == 1
+		@histogram.min.should == 12
+		@histogram.max.should == 12
+	end
+
+end
@@ -0,0 +1,136 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/interestmanager'
+require 'mues/spatialindex'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::InterestManager do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	# A stand-in for the Environment's node-position API
+	class FakeWorld
+		def initialize; @index = MUES::SpatialIndex.new( 10 ); end
+		def track_node( node, x, y, z ); @index.insert( node, x, y, z ); end
+		def position_of( node ); @index.position_of( node ); end
+		def nodes_near( x, y, z, radius ); @index.within( x, y, z, radius ); end
+	end
+
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@world = FakeWorld.new
+		@interest = MUES::InterestManager.new( @world,
+			:interest_radius => 10, :interest_hysteresis => 5 )
+		@changes = []
+		@interest.on_change {|session, node, interested| @changes << [session, node, interested] }
+
+		@world.track_node( :avatar, 0, 0, 0 )
+	end
+
+
+	it "makes sessions interested in the nodes near their avatars" do
+		@world.track_node( :door, 5, 0, 0 )
+		@world.track_node( :castle, 100, 0, 0 )
+		@interest.add_session( :ged, :avatar )
+
+		@interest.should be_interested( :ged, :door )
+		@interest.should_not be_interested( :ged, :castle )
+		@interest.interested_sessions( :door ).should == [ :ged ]
+		@changes.should include( [:ged, :door, true] )
+	end
+
+	it "doesn't drop interest in a node until it's past the hysteresis margin" do
+		@world.track_node( :bird, 9, 0, 0 )
+		@interest.add_session( :ged, :avatar )
+		@changes.clear
+
+		@world.track_node( :bird, 13, 0, 0 )
+		@interest.update( :ged )
+		@interest.should be_interested( :ged, :bird )
+
+		@world.track_node( :bird, 9.5, 0, 0 )
+		@interest.update( :ged )
+		@world.track_node( :bird, 14, 0, 0 )
+		@interest.update( :ged )
+		@changes.should be_empty
+
+		@world.track_node( :bird, 16, 0, 0 )
+		@interest.update( :ged )
+		@interest.should_not be_interested( :ged, :bird )
+		@changes.should == [ [:ged, :bird, false] ]
+	end
+
+	it "makes sessions interested in the nodes in their room, however far away" do
+		@world.track_node( :fireplace, 500, 0, 0 )
+		@interest.add_session( :ged, :avatar )
+		@interest.place_node( :fireplace, 'tavern' )
+		@interest.should_not be_interested( :ged, :fireplace )
+
+		@interest.enter_room( :ged, 'tavern' )
+		@interest.should be_interested( :ged, :fireplace )
+
+		@interest.enter_room( :ged, 'street' )
+		@interest.should_not be_interested( :ged, :fireplace )
+	end
+
+	it "keeps interest in a node as long as there's any reason for it" do
+		@world.track_node( :door, 5, 0, 0 )
+		@interest.add_session( :ged, :avatar )
+		@interest.subscribe( :ged, :door )
+
+		@world.track_node( :door, 50, 0, 0 )
+		@interest.update( :ged )
+		@interest.should be_interested( :ged, :door )
+
+		@interest.unsubscribe( :ged, :door )
+		@interest.should_not be_interested( :ged, :door )
+		@changes.select {|change| change[1] == :door }.length.should == 2
+	end
+
+	it "only forwards a node's changes to the sessions that are interested in it" do
+		@world.track_node( :other_avatar, 100, 0, 0 )
+		@world.track_node( :door, 5, 0, 0 )
+		@interest.add_session( :ged, :avatar )
+		@interest.add_session( :bob, :other_avatar )
+
+		recipients = []
+		@interest.forward( :door ) {|session| recipients << session }.should == 1
+		recipients.should == [ :ged ]
+	end
+
+	it "drops all of a session's interests when it's removed" do
+		@world.track_node( :door, 5, 0, 0 )
+		@interest.add_session( :ged, :avatar )
+		@interest.remove_session( :ged )
+
+		@interest.interested_sessions( :door ).should be_empty
+		@changes.should include( [:ged, :door, false] )
+	end
+
+end
+
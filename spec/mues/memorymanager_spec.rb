@@ -0,0 +1,87 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/memorymanager'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::MemoryManager do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	it "creates managers by name" do
+		MUES::MemoryManager.create( 'Null' ).class.should == MUES::MemoryManager
+		MUES::MemoryManager.create( 'clock' ).should be_a_kind_of( MUES::MemoryManager::Clock )
+	end
+
+	it "refuses to create managers that don't exist" do
+		lambda {
+			MUES::MemoryManager.create( 'String' )
+		}.should raise_error( ArgumentError, /no such memory manager/ )
+	end
+
+	it "never evicts anything by default" do
+		memmgr = MUES::MemoryManager.create( 'Null' )
+		memmgr.added( 1 )
+		memmgr.victims( 1 ).should be_empty
+	end
+
+	it "counts nested pins" do
+		memmgr = MUES::MemoryManager.create( 'Null' )
+		memmgr.pin( 1 )
+		memmgr.pin( 1 )
+		memmgr.unpin( 1 )
+		memmgr.should be_pinned( 1 )
+		memmgr.unpin( 1 )
+		memmgr.should_not be_pinned( 1 )
+	end
+
+
+	describe "Clock" do
+
+		before( :each ) do
+			@memmgr = MUES::MemoryManager.create( 'Clock' )
+			( 1 .. 4 ).each {|id| @memmgr.added(id) }
+		end
+
+		it "evicts objects that haven't been touched since the hand last passed" do
+			@memmgr.victims( 1 ).should == [ 1 ]
+			@memmgr.touched( 2 )
+			@memmgr.victims( 1 ).should == [ 3 ]
+		end
+
+		it "skips pinned objects and those the caller rejects" do
+			@memmgr.pin( 1 )
+			@memmgr.victims( 2 ) {|id| id != 2 }.should == [ 3, 4 ]
+		end
+
+		it "counts the slots its hand passes over" do
+			@memmgr.victims( 1 )
+			@memmgr.swept.should == 5
+		end
+
+		it "forgets objects once they've been chosen or removed" do
+			@memmgr.removed( 2 )
+			@memmgr.victims( 10 ).sort.should == [ 1, 3, 4 ]
+			@memmgr.size.should == 0
+		end
+
+	end
+
+end
+
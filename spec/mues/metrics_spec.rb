@@ -0,0 +1,174 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'thread'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/metrics'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::Metrics do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	after( :each ) do
+		MUES::Metrics.reset
+	end
+
+
+	it "registers each metric once by name" do
+		counter = MUES::Metrics.counter( :spec_things, "things" )
+		MUES::Metrics.counter( 'spec_things' ).should equal( counter )
+		MUES::Metrics[ :spec_things ].should equal( counter )
+		counter.description.should == "things"
+	end
+
+	it "refuses to register a name as a different kind of metric" do
+		MUES::Metrics.counter( :spec_conflict )
+		lambda {
+			MUES::Metrics.histogram( :spec_conflict )
+		}.should raise_error( ArgumentError, /already a MUES::Metrics::Counter/ )
+	end
+
+	it "includes every metric in its snapshot" do
+		MUES::Metrics.counter( :spec_snapshot_count ).increment( 3 )
+		MUES::Metrics.gauge( :spec_snapshot_gauge ).set( 12 )
+		MUES::Metrics.histogram( :spec_snapshot_times ).record( 100 )
+
+		snapshot = MUES::Metrics.snapshot
+		snapshot[ :spec_snapshot_count ].should == 3
+		snapshot[ :spec_snapshot_gauge ].should == 12
+		snapshot[ :spec_snapshot_times ][ :count ].should == 1
+		snapshot[ :spec_snapshot_times ][ :max ].should == 100
+	end
+
+	it "leaves out gauges that can't be read from its snapshot" do
+		MUES::Metrics.gauge( :spec_broken_gauge ) { raise "broken" }
+		MUES::Metrics.snapshot.should_not have_key( :spec_broken_gauge )
+		MUES::Metrics.gauge( :spec_broken_gauge ) { 1 }
+	end
+
+
+	describe "counters" do
+
+		before( :each ) do
+			@counter = MUES::Metrics.counter( :spec_counter )
+		end
+
+		it "add up what each thread counted" do
+			threads = (1..4).collect do
+				Thread.new { 1000.times { @counter.increment } }
+			end
+			threads.each {|thr| thr.join }
+			@counter.increment( 5 )
+
+			@counter.value.should == 4005
+		end
+
+		it "keep the counts of threads that have exited" do
+			Thread.new { @counter.increment(7) }.join
+			@counter.value.should == 7
+			Thread.new { @counter.increment(3) }.join
+			@counter.value.should == 10
+		end
+
+		it "keep one shard per thread, however many fibers it runs" do
+			before = @counter.value
+			shards = nil
+			Thread.new do
+				10.times { Fiber.new { @counter.increment }.resume }
+				shards = @counter.instance_variable_get( :@shards ).
+					select {|thread, _| thread == Thread.current }.length
+			end.join
+
+			shards.should == 1
+			@counter.value.should == before + 10
+		end
+
+		it "can be reset" do
+			@counter.increment( 2 )
+			Thread.new { @counter.increment }.join
+			@counter.value
+			@counter.reset
+			@counter.value.should == 0
+		end
+
+	end
+
+
+	describe "histograms" do
+
+		before( :each ) do
+			@histogram = MUES::Metrics.histogram( :spec_histogram )
+		end
+
+		it "merge the values each thread recorded" do
+			Thread.new { @histogram.record(10) }.join
+			@histogram.record( 1000 )
+
+			@histogram.histogram.count.should == 2
+			@histogram.value[ :min ].should == 10
+			@histogram.value[ :max ].should == 1000
+		end
+
+		it "time blocks in microseconds" do
+			@histogram.time { sleep 0.01; :result }.should == :result
+			@histogram.histogram.min.should >= 10_000
+		end
+
+		it "time blocks that raise" do
+			lambda { @histogram.time { raise "oops" } }.should raise_error( RuntimeError )
+			@histogram.histogram.count.should == 1
+		end
+
+		it "can be reset" do
+			@histogram << 12
+			@histogram.reset
+			@histogram.value[ :count ].should == 0
+		end
+
+	end
+
+
+	describe "gauges" do
+
+		it "report the value they were set to" do
+			gauge = MUES::Metrics.gauge( :spec_gauge )
+			gauge.set( 42 )
+			gauge.value.should == 42
+		end
+
+		it "read their value from a block if they have one" do
+			depth = 3
+			gauge = MUES::Metrics.gauge( :spec_block_gauge ) { depth }
+			depth = 5
+			gauge.value.should == 5
+		end
+
+	end
+
+end
+
@@ -0,0 +1,116 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'thread'
+require 'timeout'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/metricsexporter'
+
+
+# A stand-in for a Bunny exchange that remembers what was published to it
+class TestMetricsExchange
+	def initialize
+		@published = Queue.new
+	end
+
+	attr_reader :published
+
+	def publish( data, options )
+		@published << [ data, options ]
+	end
+end
+
+# A stand-in for a Bunny client
+class TestMetricsBus
+	def initialize
+		@stats_exchange = TestMetricsExchange.new
+		@declared = nil
+	end
+
+	attr_reader :declared
+
+	# The exchange that's handed out
+	attr_reader :stats_exchange
+
+	def exchange( name, options )
+		@declared = [ name, options ]
+		return @stats_exchange
+	end
+end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::MetricsExporter do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@bus = TestMetricsBus.new
+		@counter = MUES::Metrics.counter( :spec_exported )
+		@exporter = MUES::MetricsExporter.new( @bus, :metrics_interval => 0.05 )
+	end
+
+	after( :each ) do
+		@exporter.shutdown
+		MUES::Metrics.reset
+	end
+
+
+	it "declares the stats topic exchange when it starts" do
+		@exporter.start
+		@bus.declared.should == [ 'stats', {:type => :topic, :auto_delete => true} ]
+	end
+
+	it "publishes a snapshot of the metrics every interval" do
+		@counter.increment( 3 )
+		@exporter.start
+
+		data, options = Timeout.timeout( 2 ) { @bus.stats_exchange.published.pop }
+		options.should == { :key => 'stats.engine' }
+
+		message = MUES::WireFormat.unpack_value( data )
+		message[ :pid ].should == Process.pid
+		message[ :metrics ][ :spec_exported ].should == 3
+	end
+
+	it "reports how fast counters went up since the previous snapshot" do
+		@exporter.make_message[ :rates ].should_not have_key( :spec_exported )
+		@counter.increment( 10 )
+		sleep 0.1
+
+		message = @exporter.make_message
+		message[ :interval ].should be_close( 0.1, 0.09 )
+		message[ :rates ][ :spec_exported ].should > 0
+	end
+
+	it "refuses an interval that isn't positive" do
+		lambda {
+			MUES::MetricsExporter.new( @bus, :metrics_interval => 0 )
+		}.should raise_error( ArgumentError, /must be positive/ )
+	end
+
+end
+
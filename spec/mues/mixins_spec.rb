@@ -13,9 +13,24 @@ require 'spec'
 require 'spec/lib/helpers'
 require 'spec/lib/constants'
 
+require 'stringio'
 require 'mues/mixins'
 
 
+# Classes for testing per-class log levels
+class TestLoggableThing
+	include MUES::Loggable
+	public :log, :log_debug
+end
+
+module TestLogNamespace
+	class Widget
+		include MUES::Loggable
+		public :log
+	end
+end
+
+
 include MUES::TestConstants
 
 
@@ -111,6 +126,97 @@ describe MUES, "mixins" do
 			testclass.new.should respond_to( :log )
 		end
 
+		describe "with per-class levels" do
+
+			before( :each ) do
+				@output = StringIO.new
+				logger = Logger.new( @output )
+				logger.level = Logger::WARN
+				logger.formatter = lambda {|severity, time, progname, msg| "#{severity} #{progname}: #{msg}\n" }
+				MUES.logger = logger
+			end
+
+			after( :each ) do
+				MUES::Loggable.reset_levels
+				reset_logging()
+			end
+
+			it "follows the global logger's level by default" do
+				TestLoggableThing.new.log.info( "ignored" )
+				TestLoggableThing.new.log.warn( "logged" )
+
+				@output.string.should == "WARN TestLoggableThing: logged\n"
+				TestLoggableThing.new.log.should_not be_info
+			end
+
+			it "logs messages below the global level for a class with a lower level" do
+				MUES::Loggable.set_level( TestLoggableThing, :debug )
+				TestLoggableThing.new.log.debug( "logged" )
+				TestLogNamespace::Widget.new.log.debug( "ignored" )
+
+				@output.string.should == "DEBUG TestLoggableThing: logged\n"
+				TestLoggableThing.new.log.should be_debug
+			end
+
+			it "applies a namespace's level to the classes in it" do
+				MUES::Loggable.set_level( 'TestLogNamespace', :info )
+				TestLogNamespace::Widget.new.log.info( "logged" )
+
+				@output.string.should == "INFO TestLogNamespace::Widget: logged\n"
+				MUES::Loggable.level_for( TestLogNamespace::Widget ).should == Logger::INFO
+			end
+
+			it "silences messages below a class's level" do
+				MUES::Loggable.set_level( TestLoggableThing, :error )
+				TestLoggableThing.new.log.warn( "ignored" )
+
+				@output.string.should == ''
+			end
+
+			it "only calls message blocks for enabled levels" do
+				MUES::Loggable.set_level( TestLoggableThing, :info )
+				called = []
+				TestLoggableThing.new.log.debug { called << :debug; "ignored" }
+				TestLoggableThing.new.log.info { called << :info; "logged" }
+
+				called.should == [ :info ]
+				@output.string.should == "INFO TestLoggableThing: logged\n"
+			end
+
+			it "changes the level of existing proxies" do
+				thing = TestLoggableThing.new
+				thing.log.debug( "ignored" )
+				MUES::Loggable.set_level( TestLoggableThing, :debug )
+				thing.log.debug( "logged" )
+				MUES::Loggable.set_level( TestLoggableThing, nil )
+				thing.log.debug( "ignored again" )
+
+				@output.string.should == "DEBUG TestLoggableThing: logged\n"
+			end
+
+			it "logs the class name as the message if a class with a lower level logs nothing" do
+				MUES::Loggable.set_level( TestLoggableThing, :debug )
+				TestLoggableThing.new.log.debug
+
+				@output.string.should == "DEBUG : TestLoggableThing\n"
+				MUES.logger.level.should == Logger::WARN
+			end
+
+			it "logs everything from the debug proxy at debug level" do
+				MUES::Loggable.set_level( TestLoggableThing, :debug )
+				TestLoggableThing.new.log_debug.error( "logged" )
+
+				@output.string.should == "DEBUG TestLoggableThing: logged\n"
+			end
+
+			it "rejects unknown levels" do
+				lambda {
+					MUES::Loggable.set_level( TestLoggableThing, :chatty )
+				}.should raise_error( ArgumentError, /unknown log level/ )
+			end
+
+		end
+
 	end
 
 
@@ -0,0 +1,190 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'stringio'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues'
+require 'mues/objectinspector'
+
+
+# A small object graph to inspect
+class TestInspectedThing
+	include MUES::HtmlInspectableObject
+
+	def initialize( name, parent=nil )
+		@name = name
+		@parent = parent
+		@children = []
+		parent.children << self if parent
+	end
+
+	attr_reader :children
+end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::ObjectInspector do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@root  = TestInspectedThing.new( 'root' )
+		@child = TestInspectedThing.new( 'child', @root )
+	end
+
+
+	it "refuses unknown formats" do
+		lambda {
+			MUES::ObjectInspector.new( StringIO.new, :format => :yaml )
+		}.should raise_error( ArgumentError, /unknown inspection format/i )
+	end
+
+	it "writes to its IO as it goes rather than all at once" do
+		io = StringIO.new
+		class << io
+			attr_accessor :writes
+			def write( data )
+				@writes = ( @writes || 0 ) + 1
+				super
+			end
+		end
+
+		MUES::ObjectInspector.new( io ).render( @root )
+		io.writes.should > 10
+	end
+
+	it "links to objects it has already described" do
+		html = MUES::ObjectInspector.render( @root )
+		html.scan( /<div id="object-#{@root.object_id}"/ ).length.should == 1
+		html.should include( %{<a href="#object-#{@root.object_id}" class="cache-link"} )
+	end
+
+	it "only remembers the objects it has seen for one rendering" do
+		first = @root.html_inspect
+		@root.html_inspect.should == first
+		Thread.current.keys.should_not include( :__to_html_cache__ ) if
+			Thread.current.respond_to?( :keys )
+	end
+
+	it "stops following instance variables at the maximum depth" do
+		json = MUES::ObjectInspector.render( @root, :format => :json, :max_depth => 2 )
+		json.should include( %{"@name":"root"} )
+		json.should =~ /"class":"TestInspectedThing","id":\d+,"ivars":3,"elided":true/
+	end
+
+	it "stops following collections at the maximum depth" do
+		json = MUES::ObjectInspector.render( [[[1, 2]]], :format => :json, :max_depth => 1 )
+		json.should =~ /"items":\[\{"class":"Array","id":\d+,"size":1,"elided":true\}\]/
+	end
+
+	it "refers back to Arrays that contain themselves" do
+		array = [ 1 ]
+		array << array
+
+		json = MUES::ObjectInspector.render( array, :format => :json, :max_depth => 10 )
+		id = array.object_id
+		json.should == '{"class":"Array","id":' + id.to_s + ',"size":2,"items":' +
+			'[1,{"class":"Array","id":' + id.to_s + ',"ref":true}],"first":0}' + "\n"
+
+		html = MUES::ObjectInspector.render( array )
+		html.should include( %{<ol id="object-#{array.object_id}" class="array-members">} )
+		html.should include( %{<a href="#object-#{array.object_id}" class="cache-link"} )
+	end
+
+	it "refers back to Hashes that contain themselves" do
+		hash = {}
+		hash[ :self ] = hash
+
+		json = MUES::ObjectInspector.render( hash, :format => :json )
+		json.should include( %{{"class":"Hash","id":#{hash.object_id},"ref":true}} )
+		MUES::ObjectInspector.render( hash ).should include( %{&rarr; Hash ##{hash.object_id}} )
+	end
+
+	it "stops describing values after the maximum number" do
+		inspector = MUES::ObjectInspector.new( io = StringIO.new, :max_objects => 5 )
+		inspector.render( (1..100).to_a ).should == 5
+		inspector.should be_truncated()
+		io.string.should include( 'elided' )
+	end
+
+	it "shortens long strings" do
+		json = MUES::ObjectInspector.render( 'x' * 100, :format => :json, :max_string => 10 )
+		json.should == %{"xxxxxxxxxx"\n}
+	end
+
+
+	describe "paging through collections" do
+
+		before( :each ) do
+			@array = (0 ... 100).to_a
+			@hash = {}
+			@array.each {|i| @hash[i] = i.to_s }
+		end
+
+		it "describes the requested page of an Array" do
+			json = MUES::ObjectInspector.render( @array, :format => :json, :page_size => 10, :page => 2 )
+			json.should == %{{"class":"Array","id":#{@array.object_id},"size":100,"items":[20,21,22,23,24,25,26,27,28,29],"first":20}\n}
+		end
+
+		it "describes the requested page of a Hash" do
+			json = MUES::ObjectInspector.render( @hash, :format => :json, :page_size => 2, :page => 1 )
+			json.should == %{{"class":"Hash","id":#{@hash.object_id},"size":100,"pairs":[[2,"2"],[3,"3"]],"first":2}\n}
+		end
+
+		it "describes only the first page of nested collections" do
+			html = MUES::ObjectInspector.render( [@array], :page_size => 5, :page => 0 )
+			html.scan( /<li>/ ).length.should == 6
+			html.should include( 'members 1 to 5 of 100' )
+		end
+
+		it "describes an empty page past the end" do
+			json = MUES::ObjectInspector.render( @array, :format => :json, :page_size => 10, :page => 20 )
+			json.should include( %{"items":[]} )
+		end
+
+	end
+
+
+	describe "resolving paths" do
+
+		it "follows instance variables, Array indexes and Hash keys" do
+			@root.instance_variable_set( :@table, {:kids => [@child]} )
+			MUES::ObjectInspector.resolve( @root, %w[@table kids 0 @name] ).should == 'child'
+		end
+
+		it "raises an IndexError for a step it can't follow" do
+			lambda {
+				MUES::ObjectInspector.resolve( @root, %w[@children 3] )
+			}.should raise_error( IndexError, /no element 3/ )
+			lambda {
+				MUES::ObjectInspector.resolve( @root, %w[@nothing] )
+			}.should raise_error( IndexError, /has no @nothing/ )
+		end
+
+	end
+
+end
+
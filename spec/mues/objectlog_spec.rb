@@ -0,0 +1,234 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'tmpdir'
+require 'fileutils'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/objectlog'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::ObjectLog do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@dir = File.join( Dir.tmpdir, "mues-objectlog-#{Process.pid}-#{rand(100000)}" )
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+	end
+
+	after( :each ) do
+		@log.close
+		FileUtils.rm_rf( @dir )
+	end
+
+
+	it "reads back the newest data written for each key" do
+		@log.append_batch( [['door', 'closed'], ['lamp', 'lit']] )
+		@log.append_batch( [['door', 'open']] )
+
+		@log.read( 'door' ).should == 'open'
+		@log.read( 'lamp' ).should == 'lit'
+		@log.read( 'troll' ).should be_nil
+		@log.keys.sort.should == [ 'door', 'lamp' ]
+	end
+
+	it "forgets deleted keys" do
+		@log.append_batch( [['door', 'closed']] )
+		@log.append_batch( [['door', nil]] )
+
+		@log.should_not include( 'door' )
+		@log.read( 'door' ).should be_nil
+	end
+
+	it "rebuilds its index when it's reopened" do
+		@log.append_batch( [['door', 'closed'], ['lamp', 'lit']] )
+		@log.append_batch( [['door', 'open'], ['lamp', nil]] )
+		@log.close
+
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+		@log.read( 'door' ).should == 'open'
+		@log.should_not include( 'lamp' )
+	end
+
+	it "rolls over to a new segment once the current one is full" do
+		5.times {|i| @log.append_batch([ ["obj#{i}", 'x' * 400] ]) }
+
+		@log.segments.length.should > 1
+		5.times {|i| @log.read("obj#{i}").should == 'x' * 400 }
+	end
+
+	it "truncates a torn record off the end of the log when it's reopened" do
+		@log.append_batch( [['door', 'closed']] )
+		@log.close
+
+		path = File.join( @dir, MUES::ObjectLog::SEGMENT_NAME_FORMAT % [@log.segment] )
+		good_size = File.size( path )
+		record = MUES::ObjectLog.pack_record( 'lamp', 'lit' )
+		File.open( path, 'ab' ) {|io| io.write(record[0, record.length - 2]) }
+
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+		@log.read( 'door' ).should == 'closed'
+		@log.should_not include( 'lamp' )
+		File.size( path ).should == good_size
+
+		@log.append_batch( [['lamp', 'lit']] )
+		@log.read( 'lamp' ).should == 'lit'
+	end
+
+	it "compacts closed segments into a snapshot" do
+		@log.append_batch( [['door', 'closed'], ['lamp', 'lit']] )
+		@log.append_batch( [['door', 'open'], ['troll', 'angry']] )
+		@log.append_batch( [['troll', nil]] )
+		upto = @log.roll
+
+		@log.write_snapshot( upto ).should == 2
+		@log.snapshot.should == upto
+		@log.snapshots.should == [ upto ]
+		@log.segments.should == [ @log.segment ]
+
+		@log.read( 'door' ).should == 'open'
+		@log.read( 'lamp' ).should == 'lit'
+		@log.should_not include( 'troll' )
+	end
+
+	it "loads the newest snapshot and the segments after it when it's reopened" do
+		@log.append_batch( [['door', 'closed'], ['lamp', 'lit']] )
+		@log.write_snapshot( @log.roll )
+		@log.append_batch( [['door', 'open'], ['lamp', nil]] )
+		@log.close
+
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+		@log.snapshot.should == 1
+		@log.read( 'door' ).should == 'open'
+		@log.should_not include( 'lamp' )
+
+		@log.append_batch( [['troll', 'angry']] )
+		@log.write_snapshot( @log.roll )
+		@log.snapshots.should == [ 2 ]
+		@log.read( 'door' ).should == 'open'
+		@log.read( 'troll' ).should == 'angry'
+	end
+
+	it "deletes records that are in a snapshot" do
+		@log.append_batch( [['door', 'closed'], ['lamp', 'lit']] )
+		@log.write_snapshot( @log.roll )
+		@log.append_batch( [['lamp', nil]] )
+
+		@log.should_not include( 'lamp' )
+		@log.keys.should == [ 'door' ]
+		@log.close
+
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+		@log.should_not include( 'lamp' )
+		@log.write_snapshot( @log.roll )
+		@log.keys.should == [ 'door' ]
+		@log.size.should == 1
+	end
+
+	it "keeps the specified number of older snapshots" do
+		3.times do |i|
+			@log.append_batch( [["obj#{i}", 'x']] )
+			@log.write_snapshot( @log.roll, 2 )
+		end
+
+		@log.snapshots.length.should == 2
+		3.times {|i| @log.read("obj#{i}").should == 'x' }
+	end
+
+	it "falls back to an older snapshot it's keeping if the newest is unreadable" do
+		@log.append_batch( [['door', 'closed']] )
+		@log.write_snapshot( @log.roll, 2 )
+		@log.append_batch( [['lamp', 'lit']] )
+		newest = @log.roll
+		@log.write_snapshot( newest, 2 )
+		@log.append_batch( [['troll', 'angry']] )
+		@log.close
+
+		File.open( File.join(@dir, MUES::ObjectLog::SNAPSHOT_NAME_FORMAT % [newest]), 'wb' ) {|io| io.write('junk') }
+
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+		@log.snapshot.should < newest
+		@log.read( 'door' ).should == 'closed'
+		@log.read( 'lamp' ).should == 'lit'
+		@log.read( 'troll' ).should == 'angry'
+	end
+
+	it "refuses to open if the segments after the snapshot it can read are gone" do
+		@log.append_batch( [['door', 'closed']] )
+		@log.write_snapshot( @log.roll )
+		@log.append_batch( [['lamp', 'lit']] )
+		newest = @log.roll
+		@log.write_snapshot( newest )
+		@log.close
+
+		File.open( File.join(@dir, MUES::ObjectLog::SNAPSHOT_NAME_FORMAT % [newest]), 'wb' ) {|io| io.write('junk') }
+
+		lambda {
+			MUES::ObjectLog.new( @dir, 1024 )
+		}.should raise_error( MUES::ObjectLog::CorruptRecord, /missing/ )
+	end
+
+	it "doesn't lose records that change while a snapshot is being written" do
+		@log.append_batch( [['door', 'closed']] )
+		upto = @log.roll
+		@log.append_batch( [['door', 'open']] )
+
+		@log.write_snapshot( upto )
+		@log.read( 'door' ).should == 'open'
+	end
+
+	it "refuses to snapshot the segment that's being written" do
+		lambda {
+			@log.write_snapshot( @log.segment )
+		}.should raise_error( ArgumentError, /being written/ )
+	end
+
+	it "ignores an incomplete snapshot when it's reopened" do
+		@log.append_batch( [['door', 'closed']] )
+		@log.close
+
+		path = File.join( @dir, MUES::ObjectLog::SNAPSHOT_NAME_FORMAT % [1] )
+		File.open( path, 'wb' ) do |io|
+			io.write( ['MUSS', MUES::SnapshotFile::VERSION, 1].pack('a4CN') )
+		end
+
+		@log = MUES::ObjectLog.new( @dir, 1024 )
+		@log.snapshot.should be_nil
+		@log.read( 'door' ).should == 'closed'
+	end
+
+	it "rejects records that fail their checksum" do
+		record = MUES::ObjectLog.pack_record( 'door', 'closed' )
+		record[ -1, 1 ] = 'X'
+
+		lambda {
+			MUES::ObjectLog.unpack_record( record )
+		}.should raise_error( MUES::ObjectLog::CorruptRecord, /checksum/ )
+	end
+
+end
+
@@ -0,0 +1,294 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'tmpdir'
+require 'timeout'
+require 'fileutils'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/objectstore'
+
+
+# A minimal persistent object for the object store specs
+class TestWorldObject
+	def initialize( muesid, name ); @muesid = muesid; @name = name; end
+	attr_reader :muesid
+	attr_accessor :name
+end
+
+class TestWorldUser < TestWorldObject; end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::ObjectStore do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@dir = File.join( Dir.tmpdir, "mues-objectstore-#{Process.pid}-#{rand(100000)}" )
+		@config = {
+			:objectstore_dir            => @dir,
+			:objectstore_flush_interval => 0.05,
+			:objectstore_batch_size     => 10,
+		}
+		@store = MUES::ObjectStore.new( @config )
+	end
+
+	after( :each ) do
+		@store.close
+		FileUtils.rm_rf( @dir )
+	end
+
+
+	it "keeps stored objects resident" do
+		door = TestWorldObject.new( 'door', 'oaken door' )
+		@store.store( door ).should == 'door'
+		@store.retrieve( 'door' ).should equal( door )
+	end
+
+	it "doesn't write stored objects until it's synced" do
+		@store.store( TestWorldObject.new('door', 'oaken door') )
+
+		@store.should be_dirty( 'door' )
+		@store.object_log.size.should == 0
+
+		@store.sync.should == 1
+		@store.should_not be_dirty( 'door' )
+		@store.object_log.size.should == 1
+	end
+
+	it "writes dirty objects in the background once it's started" do
+		@store.start
+		@store.store( TestWorldObject.new('door', 'oaken door') )
+
+		Timeout.timeout( 2 ) { sleep 0.01 while @store.stats[:objects_written].zero? }
+		@store.should_not be_dirty( 'door' )
+		@store.object_log.size.should == 1
+	end
+
+	it "persists objects and their changes across restarts" do
+		door = TestWorldObject.new( 'door', 'oaken door' )
+		@store.store( door )
+		@store.store( TestWorldObject.new(12, 'lamp') )
+		@store.sync
+
+		door.name = 'broken door'
+		@store.mark_dirty( door )
+		@store.close
+
+		@store = MUES::ObjectStore.new( @config )
+		@store.retrieve( 'door' ).name.should == 'broken door'
+		@store.retrieve( 12 ).name.should == 'lamp'
+		@store.ids.sort_by {|id| id.to_s }.should == [ 12, 'door' ]
+	end
+
+	it "forgets deleted objects" do
+		@store.store( TestWorldObject.new('door', 'oaken door') )
+		@store.sync
+		@store.delete( 'door' )
+		@store.close
+
+		@store = MUES::ObjectStore.new( @config )
+		@store.retrieve( 'door' ).should be_nil
+		@store.should_not include( 'door' )
+	end
+
+	it "doesn't bring deleted objects back from the log before it flushes" do
+		@store.store( TestWorldObject.new('door', 'oaken door') )
+		@store.sync
+		@store.delete( 'door' )
+
+		@store.retrieve( 'door' ).should be_nil
+		@store.should_not include( 'door' )
+		@store.ids.should_not include( 'door' )
+		@store.close
+
+		@store = MUES::ObjectStore.new( @config )
+		@store.retrieve( 'door' ).should be_nil
+	end
+
+	it "keeps objects that couldn't be serialized dirty" do
+		door = TestWorldObject.new( 'door', 'oaken door' )
+		@store.store( door )
+		door.name = lambda { 'unmarshallable' }
+		@store.mark_dirty( door )
+
+		@store.sync.should == 0
+		@store.should be_dirty( 'door' )
+
+		door.name = 'oaken door'
+		@store.mark_dirty( door )
+		@store.sync.should == 1
+		@store.should_not be_dirty( 'door' )
+	end
+
+	it "writes objects as they were when they were marked dirty" do
+		door = TestWorldObject.new( 'door', 'oaken door' )
+		@store.store( door )
+		door.name = 'half-painted door'
+		@store.sync
+		@store.close
+
+		@store = MUES::ObjectStore.new( @config )
+		@store.retrieve( 'door' ).name.should == 'oaken door'
+	end
+
+	describe "with secondary indexes" do
+
+		before( :each ) do
+			@store.close
+			@config[:indexes] = %w[ class name ]
+			@store = MUES::ObjectStore.new( @config )
+
+			@store.store( TestWorldObject.new(1, 'door') )
+			@store.store( TestWorldObject.new(2, 'ged') )
+			@store.store( TestWorldUser.new(3, 'ged') )
+			@store.store( TestWorldUser.new(4, 'gedge') )
+		end
+
+		it "looks objects up by the values of their indexed attributes" do
+			@store.lookup_ids( :class => TestWorldUser, :name => 'ged' ).should == [ 3 ]
+			@store.lookup_ids( :name => 'ged' ).sort.should == [ 2, 3 ]
+			@store.lookup( :class => TestWorldObject ).collect {|obj| obj.name }.sort.
+				should == %w[ door ged ]
+		end
+
+		it "looks objects up by ranges and prefixes of indexed values" do
+			@store.lookup_ids( :name => 'a' .. 'e' ).should == [ 1 ]
+			@store.lookup_prefix_ids( :name, 'ged' ).sort.should == [ 2, 3, 4 ]
+		end
+
+		it "updates the indexes when objects change" do
+			user = @store.retrieve( 3 )
+			user.name = 'bob'
+			@store.mark_dirty( user )
+			@store.delete( 4 )
+
+			@store.lookup_ids( :class => TestWorldUser ).should == [ 3 ]
+			@store.lookup_ids( :name => 'bob' ).should == [ 3 ]
+		end
+
+		it "rebuilds its indexes when it's reopened" do
+			@store.close
+			@store = MUES::ObjectStore.new( @config )
+
+			@store.lookup_ids( :class => TestWorldUser, :name => 'ged' ).should == [ 3 ]
+			@store.lookup_prefix_ids( :name, 'ged' ).sort.should == [ 2, 3, 4 ]
+		end
+
+		it "refuses to look objects up by attributes that aren't indexed" do
+			lambda {
+				@store.lookup( :color => 'red' )
+			}.should raise_error( ArgumentError, /no index/ )
+		end
+
+	end
+
+	describe "with a Clock memory manager" do
+
+		before( :each ) do
+			@store.close
+			@config[:memory_manager] = 'Clock'
+			@config[:objectstore_resident_limit] = 5
+			@store = MUES::ObjectStore.new( @config )
+
+			10.times {|i| @store.store(TestWorldObject.new(i, "obj#{i}")) }
+		end
+
+		it "keeps dirty objects resident even when it's over its limit" do
+			10.times {|i| @store.should be_resident(i) }
+		end
+
+		it "evicts objects down to its limit once they've been written" do
+			@store.sync
+			( 0 ... 10 ).select {|i| @store.resident?(i) }.length.should == 5
+			@store.stats[:evicted].should == 5
+		end
+
+		it "evicts the objects that haven't been used recently" do
+			@store.sync
+			hot = ( 0 ... 10 ).select {|i| @store.resident?(i) }
+			hot.each {|i| @store.retrieve(i) }
+
+			cold = ( 0 ... 10 ).to_a - hot
+			@store.retrieve( cold.first ).name.should == "obj#{cold.first}"
+			@store.stats[:swapped_in].should == 1
+			@store.should be_resident( cold.first )
+		end
+
+		it "never evicts pinned objects" do
+			@store.pin( 0 )
+			@store.pin( 1 )
+			@store.sync
+			20.times {|i| @store.retrieve(i % 10) }
+
+			@store.should be_resident( 0 )
+			@store.should be_resident( 1 )
+		end
+
+		it "takes an evicted object back when it's marked dirty" do
+			@store.sync
+			cold = ( 0 ... 10 ).find {|i| !@store.resident?(i) }
+			obj = TestWorldObject.new( cold, 'changed' )
+			@store.mark_dirty( obj )
+
+			@store.retrieve( cold ).should equal( obj )
+			@store.should be_dirty( cold )
+		end
+
+		it "doesn't sweep for victims while everything resident is dirty" do
+			swept = @store.memmgr.swept
+			100.times {|i| @store.store(TestWorldObject.new(i + 10, "more#{i}")) }
+			@store.memmgr.swept.should == swept
+		end
+
+		it "sweeps in proportion to the objects stored, not their square" do
+			sweeps = [ 100, 400 ].collect do |limit|
+				store = MUES::ObjectStore.new( @config.merge(
+					:objectstore_dir            => "#{@dir}-#{limit}",
+					:objectstore_resident_limit => limit,
+					:objectstore_batch_size     => 1_000_000) )
+				limit.times {|i| store.store(TestWorldObject.new(i, "old#{i}")) }
+				store.sync
+				( limit * 2 ).times {|i| store.store(TestWorldObject.new("new#{i}", "new")) }
+				store.close
+				FileUtils.rm_rf( "#{@dir}-#{limit}" )
+
+				store.memmgr.swept
+			end
+
+			sweeps.last.should < sweeps.first * 8
+		end
+
+	end
+
+	it "refuses to mark objects it doesn't know about as dirty" do
+		lambda {
+			@store.mark_dirty( TestWorldObject.new('ghost', 'ghost') )
+		}.should raise_error( ArgumentError, /isn't in the store/ )
+	end
+
+end
+
@@ -0,0 +1,101 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/outputbuffer'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::OutputBuffer do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	# A stand-in for a Bunny::Exchange that records what's published to it
+	class RecordingExchange
+		def initialize; @messages = []; end
+		attr_reader :messages
+		def publish( data, opts={} ); @messages << [ data.dup, opts ]; end
+	end
+
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@exchange = RecordingExchange.new
+		@buffer = MUES::OutputBuffer.new( @exchange, 256 )
+	end
+
+
+	it "doesn't publish anything until it's flushed" do
+		@buffer.append( :output, "Bob says: hi." )
+		@buffer.append( :movement, :who => 'bob', :to => 'bar' )
+
+		@exchange.messages.should be_empty
+		@buffer.size.should == 2
+	end
+
+	it "publishes all of the buffered events as one message when flushed" do
+		@buffer.append( :output, "Bob says: hi." )
+		@buffer.append( :movement, :who => 'bob', :to => 'bar' )
+		@buffer.flush.should == 2
+
+		@exchange.messages.length.should == 1
+		data, opts = @exchange.messages.first
+		opts[:key].should == MUES::OutputBuffer::ROUTING_KEY
+
+		frames = MUES::WireFormat.decode_all( data )
+		frames.collect {|frame| frame.sequence }.should == [ 1, 2 ]
+		frames.first.body.should == "Bob says: hi."
+		frames.last.body.should == { :who => 'bob', :to => 'bar' }
+		@buffer.should be_empty
+	end
+
+	it "doesn't publish empty messages" do
+		@buffer.flush.should == 0
+		@exchange.messages.should be_empty
+	end
+
+	it "publishes early if the buffered output would exceed its size limit" do
+		10.times {|i| @buffer.append(:output, "x" * 50) }
+
+		@exchange.messages.length.should == 3
+		@exchange.messages.each {|data, _| data.length.should <= 256 }
+		@buffer.stats[:early_flushes].should == 3
+
+		@buffer.flush
+		frames = @exchange.messages.collect {|data, _| MUES::WireFormat.decode_all(data) }.flatten
+		frames.collect {|frame| frame.sequence }.should == ( 1..10 ).to_a
+	end
+
+	it "counts the events it drops when publishing fails" do
+		def @exchange.publish( data, opts={} ); raise "connection lost"; end
+		@buffer.append( :output, "Bob says: hi." )
+		@buffer.append( :output, "Bob waves." )
+
+		@buffer.flush.should == 0
+		@buffer.should be_empty
+		@buffer.stats[ :dropped ].should == 2
+	end
+
+end
+
@@ -0,0 +1,131 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'tmpdir'
+require 'fileutils'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/objectlog'
+require 'mues/snapshotfile'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::SnapshotFile do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@dir = File.join( Dir.tmpdir, "mues-snapshotfile-#{Process.pid}-#{rand(100000)}" )
+		FileUtils.mkdir_p( @dir )
+		@path = File.join( @dir, '00000007.snap' )
+	end
+
+	after( :each ) do
+		FileUtils.rm_rf( @dir )
+	end
+
+
+	### Write a snapshot of the given [ key, data ] +pairs+ and return the
+	### offset of each key's record.
+	def write_snapshot( pairs )
+		writer = MUES::SnapshotFile::Writer.new( @path, 7 )
+		offsets = {}
+		pairs.each do |key, data|
+			offsets[ key ] = writer.append( key, MUES::ObjectLog.pack_record(key, data) )
+		end
+		writer.finish
+
+		return offsets
+	end
+
+
+	it "finds records by key" do
+		pairs = (0 ... 500).collect {|i| ["obj%03d" % [i], "data #{i}"] }.sort_by { rand }
+		offsets = write_snapshot( pairs )
+
+		snapshot = MUES::SnapshotFile.new( @path, 7 )
+		snapshot.count.should == 500
+
+		pairs.each do |key, data|
+			offset, length = snapshot.find( key )
+			offset.should == offsets[ key ]
+			record = File.open( @path, 'rb' ) {|io| io.seek(offset); io.read(length) }
+			MUES::ObjectLog.unpack_record( record )[1].should == data
+		end
+		snapshot.find( 'troll' ).should be_nil
+		snapshot.close
+	end
+
+	it "iterates over its records in key order" do
+		write_snapshot( [['lamp', 'lit'], ['door', 'open']] )
+
+		snapshot = MUES::SnapshotFile.new( @path, 7 )
+		keys = []
+		snapshot.each {|key, offset, length| keys << key }
+		keys.should == [ 'door', 'lamp' ]
+		snapshot.close
+	end
+
+	it "handles an empty snapshot" do
+		write_snapshot( [] )
+
+		snapshot = MUES::SnapshotFile.new( @path, 7 )
+		snapshot.count.should == 0
+		snapshot.find( 'door' ).should be_nil
+		snapshot.close
+	end
+
+	it "refuses to open a snapshot without a trailer" do
+		writer = MUES::SnapshotFile::Writer.new( @path, 7 )
+		writer.append( 'door', MUES::ObjectLog.pack_record('door', 'open') )
+		writer.abort
+
+		lambda {
+			MUES::SnapshotFile.new( @path, 7 )
+		}.should raise_error( MUES::SnapshotFile::FormatError, /trailer/ )
+	end
+
+	it "refuses to open a snapshot of a different segment" do
+		write_snapshot( [['door', 'open']] )
+
+		lambda {
+			MUES::SnapshotFile.new( @path, 8 )
+		}.should raise_error( MUES::SnapshotFile::FormatError, /misnamed/ )
+	end
+
+	it "refuses to open a snapshot in a format version it can't read" do
+		write_snapshot( [['door', 'open']] )
+		File.open( @path, 'r+b' ) do |io|
+			io.seek( MUES::SnapshotFile::MAGIC.length )
+			io.write( [1].pack('C') )
+		end
+
+		lambda {
+			MUES::SnapshotFile.new( @path, 7 )
+		}.should raise_error( MUES::SnapshotFile::FormatError, /version 1 snapshot.*only version 2/ )
+	end
+
+end
+
@@ -0,0 +1,92 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/sortedindex'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::SortedIndex do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :each ) do
+		@index = MUES::SortedIndex.new
+	end
+
+
+	it "finds the ids of entries with a given value" do
+		@index.insert( 'ged', 1 )
+		@index.insert( 'bob', 2 )
+		@index.insert( 'ged', 3 )
+
+		@index.find( 'ged' ).should == [ 1, 3 ]
+		@index.find( 'nobody' ).should be_empty
+	end
+
+	it "ignores duplicate entries" do
+		@index.insert( 'ged', 1 ).should be_true
+		@index.insert( 'ged', 1 ).should be_false
+		@index.size.should == 1
+	end
+
+	it "removes entries" do
+		@index.insert( 'ged', 1 )
+		@index.insert( 'ged', 2 )
+
+		@index.delete( 'ged', 1 ).should be_true
+		@index.delete( 'ged', 1 ).should be_false
+		@index.find( 'ged' ).should == [ 2 ]
+	end
+
+	it "scans ranges of values" do
+		[ 5, 1, 9, 3, 7 ].each {|val| @index.insert(val, "obj#{val}") }
+
+		@index.range( 3, 7 ).should == %w[ obj3 obj5 obj7 ]
+		@index.range( 3, 7, true ).should == %w[ obj3 obj5 ]
+	end
+
+	it "scans for string prefixes" do
+		%w[ gedge ged bob gecko gedankenexperiment ].each_with_index do |name, i|
+			@index.insert( name, i )
+		end
+
+		@index.prefix( 'ged' ).should == [ 1, 4, 0 ]
+	end
+
+	it "orders values of different classes by class name" do
+		@index.insert( 'ged', 1 )
+		@index.insert( 12, 2 )
+		@index.insert( :sym, 3 )
+
+		@index.collect {|value, id| id }.should == [ 2, 1, 3 ]
+		@index.find( 12 ).should == [ 2 ]
+	end
+
+	it "stays sorted as it splits into many pages" do
+		values = ( 1 .. 2000 ).to_a.sort_by { rand }
+		values.each {|val| @index.insert(val, val) }
+		values[ 0, 1000 ].each {|val| @index.delete(val, val) }
+
+		remaining = values[ 1000 .. -1 ].sort
+		@index.collect {|value, id| value }.should == remaining
+		@index.range( 500, 600 ).should == remaining.select {|val| val >= 500 && val <= 600 }
+		@index.size.should == 1000
+	end
+
+end
+
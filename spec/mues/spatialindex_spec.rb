@@ -0,0 +1,136 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/spatialindex'
+
+
+### A SpatialIndex that counts the cell keys it packs.
+class CountingSpatialIndex < MUES::SpatialIndex
+	attr_accessor :packed
+
+	def pack_key( *coords )
+		@packed = ( @packed || 0 ) + 1
+		super
+	end
+end
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::SpatialIndex do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :each ) do
+		@index = MUES::SpatialIndex.new( 10 )
+	end
+
+
+	it "finds objects within a radius of a point" do
+		@index.insert( :near, 3, 4, 0 )
+		@index.insert( :edge, 0, 0, 5 )
+		@index.insert( :far, 4, 4, 4 )
+
+		@index.within( 0, 0, 0, 5 ).sort_by {|obj| obj.to_s }.should == [ :edge, :near ]
+	end
+
+	it "finds objects in neighbouring cells, including ones with negative coordinates" do
+		@index.insert( :west, -2, 0, 0 )
+		@index.insert( :east, 2, 0, 0 )
+		@index.insert( :below, 0, 0, -11 )
+
+		@index.within( 0, 0, 0, 3 ).sort_by {|obj| obj.to_s }.should == [ :east, :west ]
+		@index.within( 0, 0, -10, 3 ).should == [ :below ]
+	end
+
+	it "finds objects within a box" do
+		@index.insert( :inside, 5, 15, 25 )
+		@index.insert( :outside, 5, 15, 35 )
+
+		@index.in_box( 0, 10, 20, 10, 20, 30 ).should == [ :inside ]
+	end
+
+	it "keeps track of objects as they move between cells" do
+		@index.insert( :cart, 1, 1, 1 )
+		@index.move( :cart, 101, 1, 1 )
+
+		@index.within( 0, 0, 0, 5 ).should be_empty
+		@index.within( 100, 0, 0, 5 ).should == [ :cart ]
+		@index.position_of( :cart ).should == [ 101, 1, 1 ]
+		@index.cell_count.should == 1
+	end
+
+	it "updates an object's position when it moves within a cell" do
+		@index.insert( :cart, 1, 1, 1 )
+		@index.move( :cart, 8, 1, 1 )
+
+		@index.within( 0, 0, 0, 5 ).should be_empty
+		@index.position_of( :cart ).should == [ 8, 1, 1 ]
+	end
+
+	it "forgets objects that are removed" do
+		@index.insert( :cart, 1, 1, 1 )
+		@index.remove( :cart ).should == :cart
+
+		@index.should_not include( :cart )
+		@index.within( 0, 0, 0, 5 ).should be_empty
+		@index.cell_count.should == 0
+		@index.remove( :cart ).should be_nil
+	end
+
+	it "doesn't count an object twice if it's inserted again" do
+		@index.insert( :cart, 1, 1, 1 )
+		@index.insert( :cart, 50, 1, 1 )
+
+		@index.size.should == 1
+		@index.within( 50, 0, 0, 5 ).should == [ :cart ]
+	end
+
+	it "answers wide queries over a sparse world by looking at the occupied cells" do
+		index = CountingSpatialIndex.new( 10 )
+		index.insert( :hut, 5, 5, 5 )
+		index.insert( :tower, -95_000, 40_000, 12 )
+		index.packed = 0
+
+		index.in_box( -100_000, -100_000, -100_000, 100_000, 100_000, 100_000 ).
+			sort_by {|obj| obj.to_s }.should == [ :hut, :tower ]
+		index.within( 0, 0, 0, 1e300 ).length.should == 2
+		index.packed.should == 0
+	end
+
+	it "doesn't mistake a distant cell for a near one" do
+		far = 10 * ( 1 << MUES::SpatialIndex::KEY_BITS )
+		@index.insert( :near, 5, 5, 5 )
+
+		lambda {
+			@index.insert( :far, far + 5, 5, 5 )
+		}.should raise_error( RangeError )
+
+		@index.in_box( far, 0, 0, far + 10, 10, 10 ).should be_empty
+		@index.within( 5, 5, 5, 1 ).should == [ :near ]
+	end
+
+	it "finds objects at the far corners of the index" do
+		edge = MUES::SpatialIndex::MIN_CELL * 10
+		@index.insert( :corner, edge, edge, edge )
+
+		@index.within( edge, edge, edge, 1 ).should == [ :corner ]
+		@index.in_box( edge - 1_000_000, edge, edge, edge, edge, edge ).should == [ :corner ]
+	end
+
+end
+
@@ -0,0 +1,179 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'logger'
+require 'stringio'
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/structuredlogformatter'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::StructuredLogFormatter do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :all ) do
+		setup_logging( :fatal )
+	end
+
+	after( :all ) do
+		reset_logging()
+	end
+
+	before( :each ) do
+		@output = StringIO.new
+		@logger = Logger.new( @output )
+		@time   = Time.at( 1192575600, 123456 )
+	end
+
+
+	it "refuses to write records in an unknown format" do
+		lambda {
+			MUES::StructuredLogFormatter.new( @logger, :xml )
+		}.should raise_error( ArgumentError, /unknown log record format/i )
+	end
+
+	it "refuses sampling rates that aren't fractions" do
+		lambda {
+			MUES::StructuredLogFormatter.new( @logger, :json, 'MUES' => 2 )
+		}.should raise_error( ArgumentError, /between 0 and 1/i )
+	end
+
+
+	describe "writing JSON" do
+
+		before( :each ) do
+			@formatter = MUES::StructuredLogFormatter.new( @logger, :json )
+		end
+
+		it "writes a message as a line of JSON with the fixed fields" do
+			line = @formatter.call( 'INFO', @time, 'MUES::Player', 'Logged in' )
+			line.should == '{"ts":1192575600123456,"pid":' + Process.pid.to_s + ',"thread":"main",' +
+				'"class":"MUES::Player","level":"INFO","fields":{"msg":"Logged in"},"sample":1.0}' + "\n"
+		end
+
+		it "uses a Hash message as the record's fields" do
+			line = @formatter.call( 'DEBUG', @time, 'MUES::Player',
+				:command => :look, :args => [1, nil, true], :at => @time )
+			line.should include( %{"command":"look"} )
+			line.should include( %{"args":[1,null,true]} )
+			line.should include( %{"at":"#{@time}"} )
+		end
+
+		it "writes the class and message of an exception" do
+			line = @formatter.call( 'ERROR', @time, 'MUES::Engine', RuntimeError.new('oops') )
+			line.should include( %{"fields":{"error":"RuntimeError","msg":"oops"}} )
+		end
+
+		it "escapes strings" do
+			line = @formatter.call( 'INFO', @time, 'MUES', %{say "hi"\\\n\001} )
+			line.should include( %{"msg":"say \\"hi\\"\\\\\\n\\u0001"} )
+			line.count( "\n" ).should == 1
+		end
+
+		it "replaces bytes that aren't valid UTF-8" do
+			bad = "caf\xc3 \xff".force_encoding( 'utf-8' )
+			line = @formatter.call( 'INFO', @time, 'MUES', bad )
+			line.should be_valid_encoding()
+			line.should include( %{"msg":"caf\xef\xbf\xbd \xef\xbf\xbd"}.force_encoding('utf-8') )
+
+			line = @formatter.call( 'INFO', @time, 'MUES', [0xe9, 0x80].pack('C*') )
+			line.encoding.should == Encoding::UTF_8
+			line.should be_valid_encoding()
+		end
+
+	end
+
+
+	describe "writing binary records" do
+
+		before( :each ) do
+			@formatter = MUES::StructuredLogFormatter.new( @logger, :binary )
+		end
+
+		it "writes a length-prefixed Array of the fields" do
+			record = @formatter.call( 'WARN', @time, 'MUES::Engine', 'Overrun' )
+			length, offset = MUES::WireFormat.unpack_varint( record, 0 )
+			length.should == record.length - offset
+
+			MUES::WireFormat.unpack_value( record[offset..-1] ).should == [
+				1192575600123456, Process.pid, 'main', 'MUES::Engine', 'WARN',
+				{ 'msg' => 'Overrun' }, 1.0
+			]
+		end
+
+	end
+
+
+	describe "with sampling rates" do
+
+		before( :each ) do
+			@formatter = MUES::StructuredLogFormatter.new( @logger, :json,
+				'MUES::Player' => 0.0, MUES::CommandReactor => 1, 'MUES' => 0.5 )
+		end
+
+		it "uses the rate of the class or its nearest namespace" do
+			@formatter.rate_for( 'MUES::Player' ).should == 0.0
+			@formatter.rate_for( 'MUES::CommandReactor::Consumer' ).should == 1.0
+			@formatter.rate_for( 'MUES::Engine' ).should == 0.5
+			@formatter.rate_for( 'Object' ).should == 1.0
+		end
+
+		it "skips debug and info messages that aren't sampled" do
+			@formatter.call( 'DEBUG', @time, 'MUES::Player', 'one' ).should == ''
+			@formatter.call( 'INFO', @time, 'MUES::Player', 'two' ).should == ''
+			@formatter.call( 'INFO', @time, 'MUES::CommandReactor', 'three' ).should_not be_empty
+			@formatter.stats.should == { :written => 1, :skipped => 2 }
+		end
+
+		it "never skips warnings or errors" do
+			@formatter.call( 'WARN', @time, 'MUES::Player', 'one' ).should include( '"sample":1.0' )
+			@formatter.call( 'ERROR', @time, 'MUES::Player', 'two' ).should_not be_empty
+			@formatter.stats.should == { :written => 2, :skipped => 0 }
+		end
+
+		it "records the rate a message was sampled at" do
+			srand( 1 )
+			lines = (1..200).collect { @formatter.call('INFO', @time, 'MUES::Engine', 'tick') }
+			written = lines.reject {|line| line.empty? }
+
+			written.length.should be_between( 50, 150 )
+			written.first.should include( '"sample":0.5' )
+		end
+
+		it "can have its rates changed" do
+			@formatter.rate_for( 'MUES::Player' ).should == 0.0
+			@formatter.sampling = { 'MUES::Player' => 1.0 }
+			@formatter.rate_for( 'MUES::Player' ).should == 1.0
+			@formatter.rate_for( 'MUES::Engine' ).should == 1.0
+		end
+
+	end
+
+
+	it "works as a Logger's formatter" do
+		@logger.formatter = MUES::StructuredLogFormatter.new( @logger, :json, 'Quiet' => 0.0 )
+		@logger.info( 'Loud' ) { 'Heard' }
+		@logger.info( 'Quiet' ) { 'Unheard' }
+
+		@output.string.split( "\n" ).length.should == 1
+		@output.string.should include( '"class":"Loud"' )
+	end
+
+end
+
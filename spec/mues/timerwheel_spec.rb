@@ -0,0 +1,125 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'timeout'
+require 'thread'
+
+require 'mues/timerwheel'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::TimerWheel do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	before( :each ) do
+		# Three levels of 8 slots each
+		@wheel = MUES::TimerWheel.new( 3 )
+		@fired = []
+	end
+
+
+	it "fires a timer on the tick it expires on" do
+		@wheel.schedule( 3 ) { @fired << @wheel.tick }
+		5.times { @wheel.advance }
+		@fired.should == [ 3 ]
+		@wheel.count.should == 0
+	end
+
+	it "fires timers that are further away than one turn of the wheel" do
+		@wheel.schedule( 8 ) { @fired << @wheel.tick }
+		@wheel.schedule( 19 ) { @fired << @wheel.tick }
+		@wheel.schedule( 200 ) { @fired << @wheel.tick }
+		@wheel.schedule( 1000 ) { @fired << @wheel.tick }
+		1000.times { @wheel.advance }
+		@fired.should == [ 8, 19, 200, 1000 ]
+	end
+
+	it "fires timers scheduled partway through a turn of the wheel on time" do
+		5.times { @wheel.advance }
+		@wheel.schedule( 70 ) { @fired << @wheel.tick }
+		100.times { @wheel.advance }
+		@fired.should == [ 75 ]
+	end
+
+	it "rounds delays of less than a tick up to the next tick" do
+		@wheel.schedule( 0.2 ) { @fired << @wheel.tick }
+		@wheel.advance
+		@fired.should == [ 1 ]
+	end
+
+	it "doesn't fire cancelled timers" do
+		timer = @wheel.schedule( 2 ) { @fired << @wheel.tick }
+		@wheel.schedule( 300 ) { @fired << @wheel.tick }.cancel
+		@wheel.count.should == 1
+
+		timer.cancel
+		timer.should_not be_pending
+		@wheel.count.should == 0
+
+		400.times { @wheel.advance }
+		@fired.should be_empty
+	end
+
+	it "fires periodic timers until they're cancelled" do
+		timer = @wheel.schedule_every( 5 ) do |t|
+			@fired << @wheel.tick
+			t.cancel if @fired.length == 3
+		end
+		30.times { @wheel.advance }
+		@fired.should == [ 5, 10, 15 ]
+		timer.should_not be_pending
+	end
+
+	it "allows timers to reschedule themselves from their callback" do
+		@wheel.schedule( 8 ) do
+			@fired << @wheel.tick
+			@wheel.schedule( 8 ) { @fired << @wheel.tick }
+		end
+		16.times { @wheel.advance }
+		@fired.should == [ 8, 16 ]
+	end
+
+	it "refuses delays longer than the wheel can hold" do
+		lambda {
+			@wheel.schedule( 2 ** 12 ) { @fired << @wheel.tick }
+		}.should raise_error( ArgumentError, /longer than the maximum/ )
+		lambda {
+			@wheel.schedule_every( 2 ** 12 ) { @fired << @wheel.tick }
+		}.should raise_error( ArgumentError, /longer than the maximum/ )
+		@wheel.count.should == 0
+	end
+
+	it "fires timers scheduled from other threads while it's advancing" do
+		fired = Queue.new
+		scheduler = Thread.new do
+			500.times {|i| @wheel.schedule( i % 50 + 1 ) { fired << i } }
+		end
+
+		Timeout.timeout( 5 ) do
+			until !scheduler.alive? && @wheel.count.zero?
+				@wheel.advance
+				Thread.pass
+			end
+		end
+
+		fired.size.should == 500
+	end
+
+end
+
@@ -5,8 +5,10 @@ BEGIN {
 	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
 
 	libdir = basedir + "lib"
+	extdir = basedir + "ext"
 
 	$LOAD_PATH.unshift( libdir ) unless $LOAD_PATH.include?( libdir )
+	$LOAD_PATH.unshift( extdir.to_s ) unless $LOAD_PATH.include?( extdir.to_s )
 }
 
 require 'spec'
@@ -15,6 +17,7 @@ require 'spec/lib/helpers'
 
 require 'mues'
 require 'mues/utils'
+require 'stringio'
 
 
 include MUES::TestConstants
@@ -35,6 +38,49 @@ describe MUES, "utilities" do
 		reset_logging()
 	end
 
+
+	describe MUES::LogFormatter do
+
+		before( :each ) do
+			@logger = Logger.new( StringIO.new )
+			@logger.level = Logger::INFO
+			@formatter = MUES::LogFormatter.new( @logger )
+			@time = Time.local( 2010, 3, 14, 15, 9, 26, 5358 )
+		end
+
+		it "formats lines the same way as the default format string" do
+			expected = MUES::LogFormatter::DEFAULT_FORMAT %
+				[ '2010-03-14 15:09:26', 5358, Process.pid, 'main', 'INFO', 'Engine', 'Started.' ]
+			@formatter.call( 'INFO', @time, 'Engine', 'Started.' ).should == expected
+		end
+
+		it "includes the progname in debug mode" do
+			@logger.level = Logger::DEBUG
+			expected = MUES::LogFormatter::DEFAULT_DEBUG_FORMAT %
+				[ '2010-03-14 15:09:26', 5358, Process.pid, 'main', 'DEBUG', 'Engine', 'Tick.' ]
+			@formatter.call( 'DEBUG', @time, 'Engine', 'Tick.' ).should == expected
+		end
+
+		it "formats lines with a custom format string" do
+			@formatter.format = "%5$s %4$s %7$s\n"
+			@formatter.call( 'WARN', @time, 'Engine', 'Hmm.' ).should == "WARN main Hmm.\n"
+		end
+
+		it "tags lines from other threads with the thread's id" do
+			line = nil
+			thread = Thread.new { line = @formatter.call('INFO', @time, 'Engine', 'Hi.') }
+			thread.join
+
+			line.should include( "#{Process.pid}/#{thread.object_id}]" )
+		end
+
+		it "notices when the second changes" do
+			@formatter.call( 'INFO', @time, 'Engine', 'One.' )
+			@formatter.call( 'INFO', @time + 1, 'Engine', 'Two.' ).should include( '15:09:27' )
+		end
+
+	end
+
 end
 
 
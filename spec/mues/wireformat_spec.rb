@@ -0,0 +1,190 @@
+#!/usr/bin/env ruby
+
+BEGIN {
+	require 'pathname'
+	basedir = Pathname.new( __FILE__ ).dirname.parent.parent
+
+	libdir = basedir + "lib"
+	extdir = basedir + "ext"
+
+	$LOAD_PATH.unshift( libdir.to_s ) unless $LOAD_PATH.include?( libdir.to_s )
+	$LOAD_PATH.unshift( extdir.to_s ) unless $LOAD_PATH.include?( extdir.to_s )
+}
+
+require 'spec'
+require 'spec/lib/helpers'
+require 'spec/lib/constants'
+
+require 'mues/wireformat'
+
+
+#####################################################################
+###	C O N T E X T S
+#####################################################################
+
+describe MUES::WireFormat do
+	include MUES::SpecHelpers,
+	        MUES::TestConstants
+
+	it "round-trips text messages" do
+		data = MUES::WireFormat.encode( :command, 17, "say hello", 123456 )
+		data.length.should == MUES::WireFormat::HEADER_LENGTH + 9
+
+		frame = MUES::WireFormat.decode( data )
+		frame.type.should == :command
+		frame.sequence.should == 17
+		frame.timestamp.should == 123456
+		frame.body.should == "say hello"
+	end
+
+	it "round-trips structured messages" do
+		body = {
+			:actor   => 'ged',
+			:damage  => -12,
+			:crit    => true,
+			:misses  => nil,
+			:ratio   => 0.25,
+			:targets => [ 1, 300, 2 ** 40, 'orc' ],
+		}
+		data = MUES::WireFormat.encode( :combat, 2 ** 32 + 5, body )
+
+		frame = MUES::WireFormat.decode( data )
+		frame.type.should == :combat
+		frame.sequence.should == 5
+		frame.body.should == body
+	end
+
+	it "decodes several concatenated frames" do
+		data = MUES::WireFormat.encode( :output, 1, "You see a door." ) +
+			MUES::WireFormat.encode( :movement, 2, :to => 'bar' )
+
+		frames = MUES::WireFormat.decode_all( data )
+		frames.collect {|frame| frame.type }.should == [ :output, :movement ]
+		frames.last.body.should == { :to => 'bar' }
+	end
+
+	it "can tell frames from plain-text messages" do
+		MUES::WireFormat.frame?( MUES::WireFormat.encode(:command, 1, "look") ).should be_true
+		MUES::WireFormat.frame?( "look at the sixteen-byte message" ).should be_false
+	end
+
+	it "rejects truncated frames" do
+		data = MUES::WireFormat.encode( :output, 1, "You see a door." )
+		lambda {
+			MUES::WireFormat.decode( data[0, data.length - 1] )
+		}.should raise_error( MUES::WireFormat::FormatError, /truncated/ )
+	end
+
+	it "rejects counts larger than the data that's left" do
+		body = [ 7, 0xff, 0xff, 0xff, 0xff, 0x0f ].pack( 'C*' )
+		data = [ 1, 3, 0, 1, 0, body.length ].pack( 'CCnNNN' ) + body
+		lambda {
+			MUES::WireFormat.decode( data )
+		}.should raise_error( MUES::WireFormat::FormatError, /exceeds/ )
+
+		lambda {
+			MUES::WireFormat.unpack_value( [8, 2, 0, 0].pack('C*') )
+		}.should raise_error( MUES::WireFormat::FormatError, /exceeds/ )
+	end
+
+	it "rejects values nested too deeply instead of exhausting the stack" do
+		body = ( [7, 1] * 5000 + [0] ).pack( 'C*' )
+		data = [ 1, 3, 0, 1, 0, body.length ].pack( 'CCnNNN' ) + body
+		lambda {
+			MUES::WireFormat.decode( data )
+		}.should raise_error( MUES::WireFormat::FormatError, /nested/ )
+
+		deepest = ( 1 ... MUES::WireFormat::MAX_DEPTH ).inject( [1] ) {|value, _| [value] }
+		MUES::WireFormat.unpack_value( MUES::WireFormat.pack_value(deepest) ).should == deepest
+		lambda {
+			MUES::WireFormat.pack_value( [deepest] )
+		}.should raise_error( ArgumentError, /nested/ )
+	end
+
+	it "counts bytes rather than characters in text it's given" do
+		data = MUES::WireFormat.encode( :output, 1, "caf\xc3\xa9" )
+		data.force_encoding( 'utf-8' )
+		frame = MUES::WireFormat.decode( data )
+		frame.body.should == "caf\xc3\xa9".force_encoding( 'utf-8' )
+	end
+
+	it "rejects unknown message types" do
+		lambda {
+			MUES::WireFormat.encode( :telepathy, 1, "..." )
+		}.should raise_error( ArgumentError, /unknown message type/ )
+	end
+
+	it "is much more compact than JSON for structured messages" do
+		body = { :x => 1024, :y => -7, :z => 3, :node => 118 }
+		MUES::WireFormat.pack_value( body ).length.should < 30
+	end
+
+
+	if defined?( MUES::WireFormat::Native )
+
+		describe "native codec" do
+
+			VALUES = [
+				nil, true, false, 0, 1, -1, 63, -64, 2 ** 62, -( 2 ** 62 ), 2 ** 63, -( 2 ** 63 ) - 1,
+				2 ** 100, -( 2 ** 100 ), 0.25, -1.0e300, "", "caf\xc3\xa9", :orc, [],
+				{ :actor => 'ged', :targets => [ 1, [ 2, { 'x' => nil } ] ] },
+			]
+
+			### Pack +value+ with the pure-Ruby codec.
+			def ruby_pack( value )
+				return MUES::WireFormat.pack_value_at( value, MUES::WireFormat.binary(''), 0 )
+			end
+
+			### Unpack +data+ with the pure-Ruby codec.
+			def ruby_unpack( data )
+				value, offset = MUES::WireFormat.unpack_value_at( data, 0 )
+				raise MUES::WireFormat::FormatError, "trailing bytes after value" unless
+					offset == data.length
+				return value
+			end
+
+			### Return the class and message of the error the block raises.
+			def error_from
+				yield
+				return nil
+			rescue => err
+				return [ err.class, err.message ]
+			end
+
+
+			it "packs values into the same bytes as the Ruby codec" do
+				VALUES.each do |value|
+					MUES::WireFormat::Native.pack_value( value, MUES::WireFormat.binary('') ).
+						should == ruby_pack( value )
+				end
+			end
+
+			it "unpacks what the Ruby codec packed" do
+				VALUES.each do |value|
+					MUES::WireFormat::Native.unpack_value( ruby_pack(value) ).should == value
+				end
+			end
+
+			it "raises the same errors as the Ruby codec" do
+				malformed = [
+					[], [9], [3, 0x80], [4, 0, 0], [5, 3, 0x61], [7, 2, 0], [8, 2, 0, 0],
+					[7, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f], [0, 0],
+					[7, 1] * 100 + [0],
+				].collect {|bytes| bytes.pack('C*') }
+
+				malformed.each do |data|
+					native = error_from { MUES::WireFormat::Native.unpack_value(data) }
+					native.should_not be_nil
+					native.should == error_from { ruby_unpack(data) }
+				end
+
+				error_from { MUES::WireFormat::Native.pack_value(Object.new, '') }.
+					should == error_from { ruby_pack(Object.new) }
+			end
+
+		end
+
+	end
+
+end
+